@@ -5,6 +5,8 @@ This file handles the wxWidgets initialization.
 ***************************************************************/
 
 #include "app.h"
+#include "romcache.h"
+#include "capture.h"
 #include <wx/stdpaths.h>
 #include <wx/config.h>
 #include <wx/fileconf.h>
@@ -54,6 +56,7 @@ App::~App()
 bool App::OnInit()
 {
     wxString cfgpath;
+    wxString capturepath;
     wxFileConfig* cfgfile;
     const wxString cfgname = "config.cfg";
 
@@ -76,6 +79,14 @@ bool App::OnInit()
     cfgfile = new wxFileConfig(wxEmptyString, wxEmptyString, cfgpath + cfgname);
     wxConfigBase::Set(cfgfile);
 
+    // Load the hashes of ROMs we've seen before
+    ROMCache::Load((cfgpath + "romcache.txt").ToStdString());
+
+    // Record all traffic, if the user asked for it
+    capturepath = wxConfigBase::Get()->Read("CaptureFile", wxEmptyString);
+    if (capturepath != wxEmptyString)
+        PacketCapture::Start(capturepath.ToStdString());
+
     // Create icons
     icon_refresh = wxBITMAP_PNG_FROM_DATA(icon_refresh);
     wxBitmap temp = wxBITMAP_PNG_FROM_DATA(icon_program);
@@ -87,4 +98,17 @@ bool App::OnInit()
     this->m_Frame->Show();
     SetTopWindow(this->m_Frame);
     return true;
+}
+
+
+/*==============================
+    App::OnExit
+    Called when the application is closing
+    @return The exit code
+==============================*/
+
+int App::OnExit()
+{
+    PacketCapture::Stop();
+    return wxApp::OnExit();
 }
\ No newline at end of file
@@ -21,4 +21,5 @@ class App : public wxApp
 		App();
 		~App();
 		virtual bool OnInit();
+		virtual int OnExit();
 };
\ No newline at end of file
@@ -0,0 +1,1069 @@
+/***************************************************************
+                            bench.cpp
+
+Microbenchmarks and self checks for the parts of the client
+that don't need wxWidgets: packet encoding and decoding, the
+UDP handler's sequence and ack tracking, loopback round trips,
+USB bundling, SHA-256, the server list, the thread rings, and
+server discovery. Results are printed as JSON so that they can
+be tracked over time, and the exit code is non-zero if any of
+the checks failed.
+***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "packets.h"
+#include "discovery.h"
+#include "serverlist.h"
+#include "ringbuffer.h"
+#include "sha256.h"
+#include "devicestub.h"
+#include "Include/device.h"
+
+
+/******************************
+             Macros
+******************************/
+
+#define PROGRAM_NAME   "netlib-bench"
+#define BENCH_VERSION  1
+
+#define DATATYPE_NETPACKET        0x27
+#define DATATYPE_NETPACKETBUNDLE  0x28
+
+// The largest USB transfer of bundled NetLib packets, same as the client and relay
+#define BENCH_USBBUNDLESIZE  (64*1024)
+
+// The cost of a USB round trip before bundling, used to model the throughput on real hardware
+#define BENCH_USBTRANSFERTIME  1000 // Microseconds
+
+// The sizes of the payloads used in the packet benchmarks
+static const uint16_t bench_payloadsizes[] = {0, 64, 256, 1024, 4000};
+
+
+/******************************
+             Types
+******************************/
+
+typedef struct {
+    std::string name;
+    std::vector<std::pair<std::string, std::string>> values; // Already formatted as JSON
+} BenchResult;
+
+typedef struct {
+    std::string name;
+    bool passed;
+    std::string detail;
+} BenchCheck;
+
+typedef std::chrono::steady_clock::time_point BenchTime;
+
+
+/******************************
+            Globals
+******************************/
+
+static std::atomic<uint64_t> global_bench_allocs(0);
+static std::vector<BenchResult> global_bench_results;
+static std::vector<BenchCheck> global_bench_checks;
+static std::string global_bench_filter = "";
+static bool global_bench_quick = false;
+static volatile uint64_t global_bench_sink = 0;
+
+
+/*=============================================================
+                     Allocation Counting
+=============================================================*/
+
+// Every heap allocation in the program goes through these, so the benchmarks can count them.
+// Each form of new has its matching delete, and they're kept out of line so GCC doesn't inline
+// the free next to a pointer that came from operator new and report the pair as mismatched
+#ifdef __GNUC__
+    #define BENCH_NOINLINE __attribute__((noinline))
+#else
+    #define BENCH_NOINLINE
+#endif
+
+BENCH_NOINLINE void* operator new(size_t size)
+{
+    void* ptr;
+    global_bench_allocs.fetch_add(1, std::memory_order_relaxed);
+    ptr = malloc(size > 0 ? size : 1);
+    if (ptr == NULL)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+BENCH_NOINLINE void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+BENCH_NOINLINE void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    global_bench_allocs.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size > 0 ? size : 1);
+}
+
+BENCH_NOINLINE void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+
+BENCH_NOINLINE void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+BENCH_NOINLINE void operator delete[](void* ptr) noexcept
+{
+    free(ptr);
+}
+
+BENCH_NOINLINE void operator delete(void* ptr, size_t size) noexcept
+{
+    (void)size;
+    free(ptr);
+}
+
+BENCH_NOINLINE void operator delete[](void* ptr, size_t size) noexcept
+{
+    (void)size;
+    free(ptr);
+}
+
+BENCH_NOINLINE void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+    free(ptr);
+}
+
+BENCH_NOINLINE void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+    free(ptr);
+}
+
+
+/*=============================================================
+                       Helper Functions
+=============================================================*/
+
+/*==============================
+    bench_elapsed
+    Gets the time since a point, in nanoseconds
+    @param  The starting point
+    @return The nanoseconds since the starting point
+==============================*/
+
+static double bench_elapsed(BenchTime start)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+/*==============================
+    bench_iterations
+    Scales an iteration count down in quick mode
+    @param  The full iteration count
+    @return The iteration count to use
+==============================*/
+
+static size_t bench_iterations(size_t count)
+{
+    if (!global_bench_quick)
+        return count;
+    return std::max(count/20, (size_t)1);
+}
+
+
+/*==============================
+    bench_enabled
+    Checks if a group of benchmarks should run
+    @param  The name of the group
+    @return Whether the group matches the filter
+==============================*/
+
+static bool bench_enabled(const char* group)
+{
+    return global_bench_filter == "" || strstr(group, global_bench_filter.c_str()) != NULL;
+}
+
+
+/*==============================
+    bench_escape
+    Turns a string into a JSON string
+    @param  The string to escape
+    @return The quoted and escaped string
+==============================*/
+
+static std::string bench_escape(const std::string& str)
+{
+    std::string out = "\"";
+    for (char c : str)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            char hex[8];
+            snprintf(hex, sizeof(hex), "\\u%04x", c);
+            out += hex;
+        }
+        else
+            out += c;
+    }
+    return out + "\"";
+}
+
+
+/*==============================
+    bench_result
+    Adds a new benchmark result
+    @param  The name of the benchmark
+    @return The result, for adding values to
+==============================*/
+
+static BenchResult* bench_result(std::string name)
+{
+    BenchResult result;
+    result.name = name;
+    global_bench_results.push_back(result);
+    return &global_bench_results.back();
+}
+
+
+/*==============================
+    bench_number
+    Adds a number to a benchmark result
+    @param The result
+    @param The name of the value
+    @param The value
+==============================*/
+
+static void bench_number(BenchResult* result, std::string key, double value)
+{
+    char str[64];
+    snprintf(str, sizeof(str), "%.6g", value);
+    result->values.push_back(std::make_pair(key, std::string(str)));
+}
+
+
+/*==============================
+    bench_string
+    Adds a string to a benchmark result
+    @param The result
+    @param The name of the value
+    @param The value
+==============================*/
+
+static void bench_string(BenchResult* result, std::string key, std::string value)
+{
+    result->values.push_back(std::make_pair(key, bench_escape(value)));
+}
+
+
+/*==============================
+    bench_check
+    Records the outcome of a self check
+    @param The name of the check
+    @param Whether the check passed
+    @param (Optional) What went wrong
+==============================*/
+
+static void bench_check(std::string name, bool passed, std::string detail = "")
+{
+    BenchCheck check;
+    check.name = name;
+    check.passed = passed;
+    check.detail = detail;
+    global_bench_checks.push_back(check);
+}
+
+
+/*==============================
+    bench_netlibpacket
+    Serializes a NetLib packet with the given header values
+    @param  The buffer to write into
+    @param  The packet's flags
+    @param  The packet's sequence number
+    @param  The packet's ack number
+    @param  The packet's ack bitfield
+    @return The size of the serialized packet
+==============================*/
+
+static uint16_t bench_netlibpacket(uint8_t* buff, uint8_t flags, uint16_t seqnum, uint16_t ack, uint16_t ackbitfield)
+{
+    uint8_t payload[32] = {0};
+    NetLibPacket pkt(1, sizeof(payload), payload, flags);
+    pkt.SetSequenceNumber(seqnum);
+    pkt.SetAck(ack);
+    pkt.SetAckBitfield(ackbitfield);
+    return pkt.WriteAsBytes(buff, MAX_PACKETSIZE);
+}
+
+
+/*=============================================================
+                          Benchmarks
+=============================================================*/
+
+/*==============================
+    bench_packets
+    Times encoding and decoding S64 and NetLib packets of
+    different sizes, and counts the heap allocations each one
+    needs once the packet pool is warmed up
+==============================*/
+
+static void bench_packets()
+{
+    uint8_t payload[MAX_PACKETSIZE];
+    uint8_t buff[MAX_PACKETSIZE];
+    size_t iterations = bench_iterations(1000000);
+    for (size_t i=0; i<sizeof(payload); i++)
+        payload[i] = i & 0xFF;
+
+    for (uint16_t size : bench_payloadsizes)
+    {
+        for (int kind=0; kind<2; kind++)
+        {
+            std::string prefix = (kind == 0) ? "netlib" : "s64";
+            AbstractPacket* pkt = (kind == 0) ? (AbstractPacket*)new NetLibPacket(1, size, payload, 0) : (AbstractPacket*)new S64Packet("BENCH", size, payload, 0);
+            uint16_t encoded = pkt->WriteAsBytes(buff, sizeof(buff));
+            if (encoded == 0)
+            {
+                delete pkt;
+                continue;
+            }
+
+            // Encoding into a caller provided buffer
+            uint64_t allocs = global_bench_allocs.load();
+            BenchTime start = std::chrono::steady_clock::now();
+            for (size_t i=0; i<iterations; i++)
+                global_bench_sink += pkt->WriteAsBytes(buff, sizeof(buff));
+            double ns = bench_elapsed(start);
+            BenchResult* result = bench_result(prefix + "_encode");
+            bench_number(result, "payload", size);
+            bench_number(result, "ns_per_packet", ns/iterations);
+            bench_number(result, "allocs_per_packet", (double)(global_bench_allocs.load() - allocs)/iterations);
+            delete pkt;
+
+            // Parsing in place with a view
+            allocs = global_bench_allocs.load();
+            start = std::chrono::steady_clock::now();
+            for (size_t i=0; i<iterations; i++)
+            {
+                if (kind == 0)
+                {
+                    NetLibPacketView view;
+                    global_bench_sink += view.Parse(buff, encoded) ? view.GetSize() : 0;
+                }
+                else
+                {
+                    S64PacketView view;
+                    global_bench_sink += view.Parse(buff, encoded) ? view.GetSize() : 0;
+                }
+            }
+            ns = bench_elapsed(start);
+            result = bench_result(prefix + "_parse_view");
+            bench_number(result, "payload", size);
+            bench_number(result, "ns_per_packet", ns/iterations);
+            bench_number(result, "allocs_per_packet", (double)(global_bench_allocs.load() - allocs)/iterations);
+
+            // Parsing into a pooled packet
+            delete ((kind == 0) ? (AbstractPacket*)NetLibPacket::FromBytes(buff, encoded) : (AbstractPacket*)S64Packet::FromBytes(buff, encoded));
+            allocs = global_bench_allocs.load();
+            start = std::chrono::steady_clock::now();
+            for (size_t i=0; i<iterations; i++)
+            {
+                AbstractPacket* decoded = (kind == 0) ? (AbstractPacket*)NetLibPacket::FromBytes(buff, encoded) : (AbstractPacket*)S64Packet::FromBytes(buff, encoded);
+                global_bench_sink += decoded->GetSize();
+                delete decoded;
+            }
+            ns = bench_elapsed(start);
+            result = bench_result(prefix + "_decode");
+            bench_number(result, "payload", size);
+            bench_number(result, "ns_per_packet", ns/iterations);
+            bench_number(result, "allocs_per_packet", (double)(global_bench_allocs.load() - allocs)/iterations);
+        }
+    }
+}
+
+
+/*==============================
+    bench_acks
+    Times how long it takes the UDP handler to process acks
+    while different amounts of reliable packets are in flight.
+    Enough packets are sent to wrap the local sequence number
+    around, which would run the TX window out of slots if the
+    acks weren't applied properly.
+==============================*/
+
+static void bench_acks()
+{
+    const size_t inflight[] = {16, 128, 512, 1000};
+    const size_t total = global_bench_quick ? 0x10100 : 0x10000*2;
+    uint8_t payload[32] = {0};
+    std::vector<std::vector<uint8_t>> acks;
+    ASIOSocket sink("127.0.0.1", 0);
+    for (size_t count : inflight)
+    {
+        ASIOSocket socket("127.0.0.1", 0);
+        UDPHandler handler(&socket, "127.0.0.1", sink.GetLocalEndpoint().port());
+        uint16_t localseq = 0, remoteseq = 0;
+        size_t sent = 0;
+        double ns = 0;
+        bool passed = true;
+        acks.resize(count);
+        for (std::vector<uint8_t>& ack : acks)
+            ack.resize(MAX_PACKETSIZE);
+        try
+        {
+            while (sent < total)
+            {
+                // Fill the window
+                for (size_t i=0; i<count; i++)
+                    handler.SendPacket(new NetLibPacket(1, sizeof(payload), payload, 0));
+
+                // Ack each packet, with the bitfield covering the ones before it like a real peer would
+                for (size_t i=0; i<count; i++)
+                {
+                    uint16_t acknum = (uint16_t)(localseq + i);
+                    uint16_t bitfield = (uint16_t)((i >= 16) ? 0xFFFF : ((1 << i) - 1));
+                    bench_netlibpacket(acks[i].data(), FLAG_UNRELIABLE, remoteseq++, acknum, bitfield);
+                }
+                BenchTime start = std::chrono::steady_clock::now();
+                for (size_t i=0; i<count; i++)
+                    delete handler.ReadNetLibPacket(acks[i].data(), acks[i].size());
+                ns += bench_elapsed(start);
+                localseq = (uint16_t)(localseq + count);
+                sent += count;
+            }
+        }
+        catch (ClientTimeoutException& e)
+        {
+            (void)e;
+            passed = false;
+        }
+        BenchResult* result = bench_result("ack_processing");
+        bench_number(result, "inflight", count);
+        bench_number(result, "ns_per_ack", ns/sent);
+        bench_check("acks_clear_tx_window_" + std::to_string(count), passed, "The TX window filled up, so the acks weren't applied");
+    }
+}
+
+
+/*==============================
+    bench_wraparound
+    Feeds the UDP handler reliable packets whose sequence
+    numbers wrap around, and checks that every new packet is
+    accepted and every repeated one is rejected
+==============================*/
+
+static void bench_wraparound()
+{
+    const size_t count = bench_iterations(200000);
+    const uint16_t first = 0xFFFF - 1000;
+    std::vector<uint8_t> buff(MAX_PACKETSIZE);
+    ASIOSocket socket("127.0.0.1", 0);
+    UDPHandler handler(&socket, "127.0.0.1", 9);
+    size_t accepted = 0, rejected = 0;
+    double ns = 0;
+
+    // New packets, crossing the wraparound point several times
+    for (size_t i=0; i<count; i++)
+    {
+        uint16_t size = bench_netlibpacket(buff.data(), 0, (uint16_t)(first + i), 0, 0);
+        BenchTime start = std::chrono::steady_clock::now();
+        NetLibPacket* pkt = handler.ReadNetLibPacket(buff.data(), size);
+        ns += bench_elapsed(start);
+        if (pkt != NULL)
+            accepted++;
+        delete pkt;
+    }
+
+    // Repeats of the most recent packets
+    for (size_t i=1; i<=SEQWINDOW_RX/2; i++)
+    {
+        uint16_t size = bench_netlibpacket(buff.data(), 0, (uint16_t)(first + count - i), 0, 0);
+        NetLibPacket* pkt = handler.ReadNetLibPacket(buff.data(), size);
+        if (pkt == NULL)
+            rejected++;
+        delete pkt;
+    }
+
+    BenchResult* result = bench_result("sequence_wraparound");
+    bench_number(result, "packets", count);
+    bench_number(result, "ns_per_packet", ns/count);
+    bench_check("wraparound_accepts_new", accepted == count, std::to_string(count - accepted) + " new packets were rejected");
+    bench_check("wraparound_rejects_duplicates", rejected == SEQWINDOW_RX/2, std::to_string(SEQWINDOW_RX/2 - rejected) + " duplicates were accepted");
+}
+
+
+/*==============================
+    bench_loopback
+    Times round trips between two UDP handlers over loopback,
+    and how many packets a handler can send per second with and
+    without a connected socket or batching
+==============================*/
+
+static void bench_loopback()
+{
+    const size_t roundtrips = bench_iterations(20000);
+    const size_t sends = bench_iterations(200000);
+    uint8_t payload[64] = {0};
+    std::vector<uint8_t> slab(MAX_BATCHCOUNT*MAX_PACKETSIZE);
+    size_t sizes[MAX_BATCHCOUNT];
+    std::vector<double> times;
+    ASIOSocket a("127.0.0.1", 0), b("127.0.0.1", 0);
+    UDPHandler ha(&a, "127.0.0.1", b.GetLocalEndpoint().port());
+    UDPHandler hb(&b, "127.0.0.1", a.GetLocalEndpoint().port());
+    size_t lost = 0;
+
+    // Ping pong, counting the time spent in both handlers as well as the kernel
+    for (size_t i=0; i<roundtrips; i++)
+    {
+        bool returned = false;
+        BenchTime start = std::chrono::steady_clock::now();
+        ha.SendPacket(new NetLibPacket(1, sizeof(payload), payload, FLAG_UNRELIABLE));
+        for (int side=0; side<2; side++)
+        {
+            ASIOSocket* socket = (side == 0) ? &b : &a;
+            UDPHandler* handler = (side == 0) ? &hb : &ha;
+            size_t count;
+            if (!socket->WaitRead(1000))
+                break;
+            count = socket->ReadBatch(slab.data(), MAX_PACKETSIZE, sizes, MAX_BATCHCOUNT);
+            for (size_t j=0; j<count; j++)
+            {
+                NetLibPacket* pkt = handler->ReadNetLibPacket(&slab[j*MAX_PACKETSIZE], sizes[j]);
+                if (pkt == NULL)
+                    continue;
+                if (side == 0)
+                    hb.SendPacket(new NetLibPacket(1, sizeof(payload), payload, FLAG_UNRELIABLE));
+                else
+                    returned = true;
+                delete pkt;
+            }
+        }
+        if (!returned)
+        {
+            lost++;
+            continue;
+        }
+        times.push_back(bench_elapsed(start)/1000.0);
+    }
+    if (!times.empty())
+    {
+        double sum = 0;
+        for (double t : times)
+            sum += t;
+        std::sort(times.begin(), times.end());
+        BenchResult* result = bench_result("loopback_roundtrip");
+        bench_number(result, "roundtrips", times.size());
+        bench_number(result, "mean_us", sum/times.size());
+        bench_number(result, "p50_us", times[times.size()/2]);
+        bench_number(result, "p99_us", times[(times.size()*99)/100]);
+    }
+    bench_check("loopback_roundtrips", lost == 0, std::to_string(lost) + " round trips were lost");
+
+    // Send rates, to a socket that is never read from
+    for (int mode=0; mode<3; mode++)
+    {
+        ASIOSocket sink("127.0.0.1", 0);
+        ASIOSocket socket("127.0.0.1", 0);
+        UDPHandler handler(&socket, "127.0.0.1", sink.GetLocalEndpoint().port());
+        const char* modes[] = {"unconnected", "connected", "batched"};
+        if (mode > 0)
+            handler.ConnectSocket();
+        BenchTime start = std::chrono::steady_clock::now();
+        if (mode == 2)
+            handler.BeginBatch();
+        for (size_t i=0; i<sends; i++)
+            handler.SendPacket(new NetLibPacket(1, sizeof(payload), payload, FLAG_UNRELIABLE));
+        if (mode == 2)
+            handler.EndBatch();
+        double ns = bench_elapsed(start);
+        BenchResult* result = bench_result("loopback_send");
+        bench_string(result, "mode", modes[mode]);
+        bench_number(result, "packets_per_second", sends/(ns/1e9));
+    }
+}
+
+
+/*==============================
+    bench_usb
+    Sends NetLib packets to the simulated flashcart one per USB
+    transfer, and bundled into as few transfers as possible.
+    Since the simulated flashcart has no transfer cost, the
+    throughput on real hardware is modelled from the number of
+    transfers.
+==============================*/
+
+static void bench_usb()
+{
+    const size_t count = bench_iterations(100000);
+    uint8_t payload[64] = {0};
+    std::vector<uint8_t> bundle(BENCH_USBBUNDLESIZE);
+    NetLibPacket pkt(1, sizeof(payload), payload, FLAG_UNRELIABLE);
+    size_t echoed[2] = {0, 0};
+    device_initialize();
+    device_find();
+    device_open();
+
+    for (int bundled=0; bundled<2; bundled++)
+    {
+        uint32_t dataheader;
+        byte* buff;
+        size_t used = 0;
+        DeviceStubStats before = devicestub_getstats();
+        BenchTime start = std::chrono::steady_clock::now();
+        for (size_t i=0; i<count; i++)
+        {
+            uint16_t size = pkt.WriteAsBytes(bundle.data() + used, bundle.size() - used);
+            if (size == 0)
+            {
+                device_senddata((USBDataType)DATATYPE_NETPACKETBUNDLE, bundle.data(), used);
+                used = 0;
+                size = pkt.WriteAsBytes(bundle.data(), bundle.size());
+            }
+            used += size;
+            if (!bundled)
+            {
+                device_senddata((USBDataType)DATATYPE_NETPACKET, bundle.data(), used);
+                used = 0;
+            }
+        }
+        if (used > 0)
+            device_senddata((USBDataType)DATATYPE_NETPACKETBUNDLE, bundle.data(), used);
+        double ns = bench_elapsed(start);
+        DeviceStubStats after = devicestub_getstats();
+        uint64_t transfers = after.transfers_in - before.transfers_in;
+        echoed[bundled] = after.packets_in - before.packets_in;
+
+        // Throw away the packets the simulated N64 sent back
+        while (device_receivedata(&dataheader, &buff) == DEVICEERR_OK && buff != NULL)
+            free(buff);
+
+        BenchResult* result = bench_result("usb_send");
+        bench_string(result, "mode", bundled ? "bundled" : "single");
+        bench_number(result, "packets", count);
+        bench_number(result, "transfers", transfers);
+        bench_number(result, "ns_per_packet", ns/count);
+        bench_number(result, "modelled_packets_per_second", count/((transfers*BENCH_USBTRANSFERTIME + ns/1000.0)/1e6));
+    }
+    bench_check("usb_bundles_deliver_all", echoed[0] == count && echoed[1] == count, "The simulated N64 received " + std::to_string(echoed[0]) + " and " + std::to_string(echoed[1]) + " packets");
+    device_close();
+}
+
+
+/*==============================
+    bench_sha256
+    Checks every SHA-256 kernel the CPU supports against known
+    answers, and times how fast each one hashes
+==============================*/
+
+static void bench_sha256()
+{
+    const SHA256Kernel kernels[] = {SHA256_KERNEL_GENERIC, SHA256_KERNEL_SHANI, SHA256_KERNEL_ARMV8};
+    const char* messages[] = {"", "abc", "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", NULL};
+    const char* answers[] = {
+        "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+        "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+        "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+        "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0", // One million 'a's
+    };
+    const size_t size = global_bench_quick ? 8*1024*1024 : 64*1024*1024;
+    std::vector<uint8_t> data(size);
+    SHA256Kernel original = sha256_getkernel();
+    for (size_t i=0; i<size; i++)
+        data[i] = (uint8_t)(i*2654435761u >> 24);
+
+    for (SHA256Kernel kernel : kernels)
+    {
+        std::string name = sha256_kernelname(kernel);
+        bool passed = true;
+        if (!sha256_setkernel(kernel))
+            continue;
+
+        // Known answers, with the million 'a's fed in uneven chunks to test the buffering
+        for (int i=0; i<4; i++)
+        {
+            SHA256_CTX ctx;
+            uint8_t digest[SHA256_BLOCK_SIZE];
+            char hex[SHA256_BLOCK_SIZE*2 + 1];
+            sha256_init(&ctx);
+            if (messages[i] != NULL)
+                sha256_update(&ctx, (const uint8_t*)messages[i], strlen(messages[i]));
+            else
+            {
+                std::vector<uint8_t> a(1000000, 'a');
+                for (size_t offset = 0, chunk = 1; offset < a.size(); offset += chunk, chunk = (chunk*7 + 3) % 4099)
+                    sha256_update(&ctx, a.data() + offset, std::min(chunk, a.size() - offset));
+            }
+            sha256_final(&ctx, digest);
+            for (int j=0; j<SHA256_BLOCK_SIZE; j++)
+                snprintf(hex + j*2, 3, "%02x", digest[j]);
+            if (strcmp(hex, answers[i]) != 0)
+                passed = false;
+        }
+        bench_check("sha256_known_answers_" + name, passed);
+
+        // Throughput
+        SHA256_CTX ctx;
+        uint8_t digest[SHA256_BLOCK_SIZE];
+        BenchTime start = std::chrono::steady_clock::now();
+        sha256_init(&ctx);
+        sha256_update(&ctx, data.data(), data.size());
+        sha256_final(&ctx, digest);
+        double ns = bench_elapsed(start);
+        global_bench_sink += digest[0];
+        BenchResult* result = bench_result("sha256");
+        bench_string(result, "kernel", name);
+        bench_number(result, "bytes", size);
+        bench_number(result, "mb_per_second", (size/(1024.0*1024.0))/(ns/1e9));
+    }
+    sha256_setkernel(original);
+}
+
+
+/*==============================
+    bench_serverlist
+    Loads 10,000 servers into a sorted server list in batches,
+    like the server finder does, and then updates their pings
+==============================*/
+
+static void bench_serverlist()
+{
+    const size_t count = 10000;
+    const size_t batchsize = 100;
+    ServerList list;
+    std::unordered_map<std::string, int64_t> pings;
+    bool sorted = true;
+    uint32_t random = 12345;
+    list.Sort(SERVERCOLUMN_PING, true);
+
+    // Add the servers
+    BenchTime start = std::chrono::steady_clock::now();
+    for (size_t i=0; i<count; i+=batchsize)
+    {
+        std::vector<ServerListEntry> batch(batchsize);
+        for (size_t j=0; j<batchsize; j++)
+        {
+            random = random*1103515245 + 12345;
+            batch[j].fulladdress = "10.0." + std::to_string((i + j)/256) + "." + std::to_string((i + j)%256) + ":6460";
+            batch[j].name = "Server " + std::to_string(i + j);
+            batch[j].playercount = random % 8;
+            batch[j].maxplayers = 8;
+            batch[j].ping = (random >> 8) % 500;
+            batch[j].romname = "game.z64";
+            batch[j].romdownloadable = false;
+            batch[j].romstatus = ROMSTATUS_UNAVAILABLE;
+        }
+        list.Append(batch);
+    }
+    double addns = bench_elapsed(start);
+    for (size_t i=1; i<list.Count(); i++)
+        if (list.Get(i-1)->ping > list.Get(i)->ping)
+            sorted = false;
+
+    // Change every server's ping
+    for (size_t i=0; i<list.Count(); i++)
+    {
+        random = random*1103515245 + 12345;
+        pings[list.Get(i)->fulladdress] = (random >> 8) % 500;
+    }
+    start = std::chrono::steady_clock::now();
+    list.UpdatePings(pings);
+    double pingns = bench_elapsed(start);
+    for (size_t i=1; i<list.Count(); i++)
+        if (list.Get(i-1)->ping > list.Get(i)->ping)
+            sorted = false;
+
+    BenchResult* result = bench_result("serverlist_load");
+    bench_number(result, "servers", count);
+    bench_number(result, "batch", batchsize);
+    bench_number(result, "append_ms", addns/1e6);
+    bench_number(result, "update_pings_ms", pingns/1e6);
+    bench_check("serverlist_sorted", sorted && list.Count() == count);
+}
+
+
+/*==============================
+    bench_rings
+    Streams data between two threads through the packet ring
+    and the console's byte ring, checking that it arrives
+    intact and in order
+==============================*/
+
+static void bench_rings()
+{
+    const size_t items = bench_iterations(20000000);
+    const size_t bytes = global_bench_quick ? 32*1024*1024 : 512*1024*1024;
+    static SPSCRing<uint64_t, 1024> ring;
+    static SPSCByteRing<1024*1024> bytering;
+    bool inorder = true;
+
+    // Packet ring
+    BenchTime start = std::chrono::steady_clock::now();
+    std::thread producer([&]() {
+        for (uint64_t i=0; i<items; i++)
+        {
+            uint64_t item = i;
+            while (!ring.Push(std::move(item)))
+                std::this_thread::yield();
+        }
+    });
+    for (uint64_t i=0; i<items; i++)
+    {
+        uint64_t item;
+        while (!ring.Pop(item))
+            std::this_thread::yield();
+        if (item != i)
+            inorder = false;
+    }
+    producer.join();
+    double ns = bench_elapsed(start);
+    BenchResult* result = bench_result("spsc_ring");
+    bench_number(result, "items", items);
+    bench_number(result, "ns_per_item", ns/items);
+    bench_check("spsc_ring_in_order", inorder);
+
+    // Byte ring, with writes of varying sizes like console prints
+    inorder = true;
+    start = std::chrono::steady_clock::now();
+    std::thread writer([&]() {
+        uint8_t chunk[4096];
+        size_t written = 0, length = 1;
+        while (written < bytes)
+        {
+            length = std::min((length*13 + 7) % sizeof(chunk) + 1, bytes - written);
+            for (size_t i=0; i<length; i++)
+                chunk[i] = (uint8_t)((written + i) % 251);
+            while (!bytering.Write(chunk, length))
+                std::this_thread::yield();
+            written += length;
+        }
+    });
+    {
+        std::vector<uint8_t> buff(64*1024);
+        size_t received = 0;
+        while (received < bytes)
+        {
+            size_t count = bytering.Read(buff.data(), buff.size());
+            if (count == 0)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            for (size_t i=0; i<count; i++)
+                if (buff[i] != (uint8_t)((received + i) % 251))
+                    inorder = false;
+            received += count;
+        }
+    }
+    writer.join();
+    ns = bench_elapsed(start);
+    result = bench_result("spsc_byte_ring");
+    bench_number(result, "bytes", bytes);
+    bench_number(result, "mb_per_second", (bytes/(1024.0*1024.0))/(ns/1e9));
+    bench_check("spsc_byte_ring_in_order", inorder);
+}
+
+
+/*==============================
+    bench_discovery
+    Probes a set of fake servers on loopback with the discovery
+    engine, and times how long it takes to ping all of them
+==============================*/
+
+static void bench_discovery()
+{
+    const size_t count = global_bench_quick ? 50 : 250;
+    const double rate = 5000;
+    std::vector<ASIOSocket*> servers;
+    std::atomic<bool> stop(false);
+    ASIOSocket socket("127.0.0.1", 0);
+    ServerDiscovery discovery(&socket, rate);
+    std::vector<uint8_t> slab(MAX_BATCHCOUNT*MAX_PACKETSIZE);
+    size_t sizes[MAX_BATCHCOUNT];
+    udp::endpoint senders[MAX_BATCHCOUNT];
+    size_t found = 0, pinged = 0, timedout = 0;
+    for (size_t i=0; i<count; i++)
+        servers.push_back(new ASIOSocket("127.0.0.1", 0));
+
+    // The fake servers reply to each probe with the probe's sequence number as the ack
+    std::thread responder([&]() {
+        std::vector<uint8_t> rxslab(MAX_BATCHCOUNT*MAX_PACKETSIZE);
+        size_t rxsizes[MAX_BATCHCOUNT];
+        udp::endpoint rxsenders[MAX_BATCHCOUNT];
+        uint8_t reply[MAX_PACKETSIZE];
+        while (!stop.load())
+        {
+            bool idle = true;
+            for (ASIOSocket* server : servers)
+            {
+                size_t received = server->ReadBatch(rxslab.data(), MAX_PACKETSIZE, rxsizes, MAX_BATCHCOUNT, rxsenders);
+                for (size_t i=0; i<received; i++)
+                {
+                    S64PacketView view;
+                    if (!view.Parse(&rxslab[i*MAX_PACKETSIZE], rxsizes[i]))
+                        continue;
+                    S64Packet pkt("DISCOVER", 0, NULL, FLAG_UNRELIABLE);
+                    pkt.SetAck(view.GetSequenceNumber());
+                    server->Send(rxsenders[i], reply, pkt.WriteAsBytes(reply, sizeof(reply)));
+                    idle = false;
+                }
+            }
+            if (idle)
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+
+    // Probe them all
+    BenchTime start = std::chrono::steady_clock::now();
+    for (ASIOSocket* server : servers)
+        discovery.Add("127.0.0.1:" + std::to_string(server->GetLocalEndpoint().port()));
+    while (pinged + timedout < count && discovery.IsBusy())
+    {
+        std::vector<DiscoveryEvent>* events;
+        socket.WaitRead(discovery.GetWaitTime(10));
+        size_t received = socket.ReadBatch(slab.data(), MAX_PACKETSIZE, sizes, MAX_BATCHCOUNT, senders);
+        for (size_t i=0; i<received; i++)
+            discovery.HandleDatagram(senders[i], &slab[i*MAX_PACKETSIZE], sizes[i]);
+        discovery.Update();
+        events = discovery.GetEvents();
+        for (DiscoveryEvent& evt : *events)
+        {
+            if (evt.type == DISCOVERYEVENT_FOUND)
+                found++;
+            else if (evt.type == DISCOVERYEVENT_PINGED)
+                pinged++;
+            else
+                timedout++;
+        }
+        events->clear();
+    }
+    double ns = bench_elapsed(start);
+    discovery.Clear();
+    stop.store(true);
+    responder.join();
+    for (ASIOSocket* server : servers)
+        delete server;
+
+    BenchResult* result = bench_result("discovery");
+    bench_number(result, "servers", count);
+    bench_number(result, "rate", rate);
+    bench_number(result, "ms_to_ping_all", ns/1e6);
+    bench_number(result, "ideal_ms", (count*DISCOVERY_SAMPLES/rate)*1000);
+    bench_check("discovery_pings_all", found == count && pinged == count && timedout == 0, std::to_string(pinged) + " of " + std::to_string(count) + " servers pinged, " + std::to_string(timedout) + " timed out");
+}
+
+
+/*=============================================================
+                         Entrypoint
+=============================================================*/
+
+/*==============================
+    bench_usage
+    Prints the command line usage
+==============================*/
+
+static void bench_usage()
+{
+    printf("Usage: %s [-quick] [-filter <Name>] [-output <File>]\n", PROGRAM_NAME);
+    printf("    -quick\t\tRun fewer iterations, for checking that nothing broke\n");
+    printf("    -filter <Name>\tOnly run the benchmark groups whose name contains this\n");
+    printf("    -output <File>\tWrite the JSON results to a file instead of stdout\n");
+    printf("Groups: packets, acks, wraparound, loopback, usb, sha256, serverlist, rings, discovery\n");
+}
+
+
+/*==============================
+    main
+    Program entrypoint
+    @param  The number of arguments
+    @param  The list of arguments
+    @return The exit code, 0 if all the checks passed
+==============================*/
+
+int main(int argc, char* argv[])
+{
+    std::string outpath = "";
+    FILE* fp = stdout;
+    bool passed = true;
+
+    // Parse the command line
+    for (int i=1; i<argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.length() > 1 && arg[0] == '-' && arg[1] == '-')
+            arg = arg.substr(1);
+        if (arg == "-quick" || arg == "-q")
+            global_bench_quick = true;
+        else if ((arg == "-filter" || arg == "-f") && i+1 < argc)
+            global_bench_filter = argv[++i];
+        else if ((arg == "-output" || arg == "-o") && i+1 < argc)
+            outpath = argv[++i];
+        else
+        {
+            bench_usage();
+            return (arg == "-help" || arg == "-h") ? 0 : 1;
+        }
+    }
+
+    // Run the benchmarks
+    ASIOSocket::InitASIO();
+    if (bench_enabled("packets"))    bench_packets();
+    if (bench_enabled("acks"))       bench_acks();
+    if (bench_enabled("wraparound")) bench_wraparound();
+    if (bench_enabled("loopback"))   bench_loopback();
+    if (bench_enabled("usb"))        bench_usb();
+    if (bench_enabled("sha256"))     bench_sha256();
+    if (bench_enabled("serverlist")) bench_serverlist();
+    if (bench_enabled("rings"))      bench_rings();
+    if (bench_enabled("discovery"))  bench_discovery();
+
+    // Print the results
+    if (outpath != "")
+    {
+        fp = fopen(outpath.c_str(), "w");
+        if (fp == NULL)
+        {
+            printf("Unable to open '%s' for writing.\n", outpath.c_str());
+            return 1;
+        }
+    }
+    fprintf(fp, "{\n  \"program\": \"%s\",\n  \"version\": %d,\n  \"quick\": %s,\n  \"sha256_kernel\": %s,\n", PROGRAM_NAME, BENCH_VERSION, global_bench_quick ? "true" : "false", bench_escape(sha256_kernelname(sha256_getkernel())).c_str());
+    fprintf(fp, "  \"results\": [");
+    for (size_t i=0; i<global_bench_results.size(); i++)
+    {
+        fprintf(fp, "%s\n    {\"name\": %s", (i > 0) ? "," : "", bench_escape(global_bench_results[i].name).c_str());
+        for (std::pair<std::string, std::string>& value : global_bench_results[i].values)
+            fprintf(fp, ", %s: %s", bench_escape(value.first).c_str(), value.second.c_str());
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n  ],\n  \"checks\": [");
+    for (size_t i=0; i<global_bench_checks.size(); i++)
+    {
+        BenchCheck& check = global_bench_checks[i];
+        fprintf(fp, "%s\n    {\"name\": %s, \"passed\": %s", (i > 0) ? "," : "", bench_escape(check.name).c_str(), check.passed ? "true" : "false");
+        if (!check.passed && check.detail != "")
+            fprintf(fp, ", \"detail\": %s", bench_escape(check.detail).c_str());
+        fprintf(fp, "}");
+        passed = passed && check.passed;
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    if (fp != stdout)
+        fclose(fp);
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,638 @@
+/***************************************************************
+                           capture.cpp
+
+Records the traffic going through the client (both UDP and USB)
+to a pcapng file, and reads it back for replaying. Captures can
+be opened in Wireshark, which decodes the UDP datagrams.
+***************************************************************/
+
+#include <string.h>
+#include <mutex>
+#include <chrono>
+#include "capture.h"
+
+
+/******************************
+            Macros
+******************************/
+
+#define PCAPNG_BLOCK_SHB  0x0A0D0D0A
+#define PCAPNG_BLOCK_IDB  0x00000001
+#define PCAPNG_BLOCK_EPB  0x00000006
+#define PCAPNG_BYTEORDER  0x1A2B3C4D
+
+#define PCAPNG_OPT_END      0
+#define PCAPNG_OPT_COMMENT  1
+#define PCAPNG_OPT_IFNAME   2
+#define PCAPNG_OPT_EPBFLAGS 2
+#define PCAPNG_OPT_USERAPPL 4
+
+// The largest block we're willing to read, anything bigger is treated as a corrupt file
+#define PCAPNG_MAXBLOCK  (32*1024*1024)
+
+#define IPV4_HEADERSIZE  20
+#define UDP_HEADERSIZE   8
+
+
+/******************************
+            Globals
+******************************/
+
+std::atomic<bool> global_capture_active(false);
+
+static std::mutex global_capture_mutex;
+static FILE* global_capture_file = NULL;
+static std::vector<uint8_t> global_capture_block;
+
+
+/*=============================================================
+                       Helper Functions
+=============================================================*/
+
+/*==============================
+    capture_put
+    Appends bytes to the block being built
+    @param The bytes to append
+    @param The number of bytes
+==============================*/
+
+static void capture_put(const void* data, size_t size)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    global_capture_block.insert(global_capture_block.end(), bytes, bytes + size);
+}
+
+
+/*==============================
+    capture_put16
+    Appends a 16-bit value, in our byte order, to the block
+    being built
+    @param The value to append
+==============================*/
+
+static void capture_put16(uint16_t val)
+{
+    capture_put(&val, sizeof(val));
+}
+
+
+/*==============================
+    capture_put32
+    Appends a 32-bit value, in our byte order, to the block
+    being built
+    @param The value to append
+==============================*/
+
+static void capture_put32(uint32_t val)
+{
+    capture_put(&val, sizeof(val));
+}
+
+
+/*==============================
+    capture_pad
+    Pads the block being built to a multiple of 4 bytes
+==============================*/
+
+static void capture_pad()
+{
+    while (global_capture_block.size() % 4 != 0)
+        global_capture_block.push_back(0);
+}
+
+
+/*==============================
+    capture_putoption
+    Appends an option to the block being built
+    @param The option code
+    @param The option's value
+    @param The size of the option's value
+==============================*/
+
+static void capture_putoption(uint16_t code, const void* value, uint16_t size)
+{
+    capture_put16(code);
+    capture_put16(size);
+    capture_put(value, size);
+    capture_pad();
+}
+
+
+/*==============================
+    capture_beginblock
+    Starts building a new block
+    @param The type of block
+==============================*/
+
+static void capture_beginblock(uint32_t type)
+{
+    global_capture_block.clear();
+    capture_put32(type);
+    capture_put32(0); // Filled in by capture_endblock
+}
+
+
+/*==============================
+    capture_endblock
+    Finishes the block being built, and writes it to the file
+==============================*/
+
+static void capture_endblock()
+{
+    uint32_t length = global_capture_block.size() + 4;
+    capture_put32(length);
+    memcpy(&global_capture_block[4], &length, 4);
+    fwrite(global_capture_block.data(), 1, global_capture_block.size(), global_capture_file);
+}
+
+
+/*==============================
+    capture_writeinterface
+    Writes an interface description block
+    @param The link type of the interface
+    @param The name of the interface
+==============================*/
+
+static void capture_writeinterface(uint16_t linktype, const char* name)
+{
+    capture_beginblock(PCAPNG_BLOCK_IDB);
+    capture_put16(linktype);
+    capture_put16(0);
+    capture_put32(0); // No snapshot length limit
+    capture_putoption(PCAPNG_OPT_IFNAME, name, strlen(name));
+    capture_put32(PCAPNG_OPT_END);
+    capture_endblock();
+}
+
+
+/*==============================
+    capture_beginpacket
+    Starts building an enhanced packet block
+    @param The interface the packet went through
+    @param The size of the packet, including any headers
+==============================*/
+
+static void capture_beginpacket(CaptureSource source, size_t size)
+{
+    uint64_t timestamp = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    capture_beginblock(PCAPNG_BLOCK_EPB);
+    capture_put32(source);
+    capture_put32((uint32_t)(timestamp >> 32));
+    capture_put32((uint32_t)timestamp);
+    capture_put32(size);
+    capture_put32(size);
+}
+
+
+/*==============================
+    capture_endpacket
+    Finishes the enhanced packet block being built, and writes
+    it to the file
+    @param The direction the packet went in
+==============================*/
+
+static void capture_endpacket(CaptureDirection direction)
+{
+    uint32_t flags = direction;
+    capture_pad();
+    capture_putoption(PCAPNG_OPT_EPBFLAGS, &flags, sizeof(flags));
+    capture_put32(PCAPNG_OPT_END);
+    capture_endblock();
+}
+
+
+/*==============================
+    capture_swap16
+    Swaps the byte order of a 16-bit value
+    @param  The value to swap
+    @return The swapped value
+==============================*/
+
+static inline uint16_t capture_swap16(uint16_t val)
+{
+    return (val >> 8) | (val << 8);
+}
+
+
+/*==============================
+    capture_swap32
+    Swaps the byte order of a 32-bit value
+    @param  The value to swap
+    @return The swapped value
+==============================*/
+
+static inline uint32_t capture_swap32(uint32_t val)
+{
+    return (val >> 24) | ((val >> 8) & 0xFF00) | ((val << 8) & 0xFF0000) | (val << 24);
+}
+
+
+/*==============================
+    capture_ipv4
+    Gets an endpoint's IPv4 address as an integer
+    @param  The endpoint
+    @return The address, or 0 if the endpoint isn't IPv4
+==============================*/
+
+static uint32_t capture_ipv4(const udp::endpoint& endpoint)
+{
+    if (!endpoint.address().is_v4())
+        return 0;
+    return endpoint.address().to_v4().to_uint();
+}
+
+
+/*=============================================================
+                          Capture
+=============================================================*/
+
+/*==============================
+    PacketCapture::Start
+    Starts capturing traffic to a file
+    @param  The path of the file to write to, which is replaced
+    @return Whether the capture started
+==============================*/
+
+bool PacketCapture::Start(std::string path)
+{
+    const char* appname = "N64 NetLib";
+    const char* comment = "Timestamps are from a monotonic clock, not the time of day";
+    std::lock_guard<std::mutex> lock(global_capture_mutex);
+    if (global_capture_file != NULL)
+        return false;
+    global_capture_file = fopen(path.c_str(), "wb");
+    if (global_capture_file == NULL)
+        return false;
+    setvbuf(global_capture_file, NULL, _IOFBF, CAPTURE_BUFFERSIZE);
+
+    // Section header, in our native byte order
+    capture_beginblock(PCAPNG_BLOCK_SHB);
+    capture_put32(PCAPNG_BYTEORDER);
+    capture_put16(1);
+    capture_put16(0);
+    capture_put32(0xFFFFFFFF); // Unknown section length
+    capture_put32(0xFFFFFFFF);
+    capture_putoption(PCAPNG_OPT_USERAPPL, appname, strlen(appname));
+    capture_putoption(PCAPNG_OPT_COMMENT, comment, strlen(comment));
+    capture_put32(PCAPNG_OPT_END);
+    capture_endblock();
+
+    // One interface for each CaptureSource, in order
+    capture_writeinterface(CAPTURE_LINKTYPE_IPV4, "udp");
+    capture_writeinterface(CAPTURE_LINKTYPE_USB, "usb");
+    global_capture_active.store(true);
+    return true;
+}
+
+
+/*==============================
+    PacketCapture::Stop
+    Stops capturing traffic, and closes the file
+==============================*/
+
+void PacketCapture::Stop()
+{
+    std::lock_guard<std::mutex> lock(global_capture_mutex);
+    global_capture_active.store(false);
+    if (global_capture_file == NULL)
+        return;
+    fclose(global_capture_file);
+    global_capture_file = NULL;
+    global_capture_block.clear();
+    global_capture_block.shrink_to_fit();
+}
+
+
+/*==============================
+    PacketCapture::Datagram
+    Records a UDP datagram
+    @param The direction the datagram went in
+    @param The endpoint of our socket
+    @param The endpoint on the other side
+    @param The datagram
+    @param The size of the datagram
+==============================*/
+
+void PacketCapture::Datagram(CaptureDirection direction, const udp::endpoint& local, const udp::endpoint& remote, const uint8_t* data, size_t size)
+{
+    uint8_t header[IPV4_HEADERSIZE + UDP_HEADERSIZE];
+    const udp::endpoint& src = (direction == CAPTURE_IN) ? remote : local;
+    const udp::endpoint& dst = (direction == CAPTURE_IN) ? local : remote;
+    uint32_t srcaddr = capture_ipv4(src);
+    uint32_t dstaddr = capture_ipv4(dst);
+    uint32_t checksum = 0;
+    size_t total = sizeof(header) + size;
+    if (total > 0xFFFF)
+        return;
+
+    // IPv4 header, with the addresses of the endpoints
+    memset(header, 0, sizeof(header));
+    header[0] = 0x45;
+    header[2] = (total >> 8) & 0xFF;
+    header[3] = total & 0xFF;
+    header[6] = 0x40; // Don't fragment
+    header[8] = 64;
+    header[9] = 17;   // UDP
+    for (int i=0; i<4; i++)
+    {
+        header[12 + i] = (srcaddr >> (24 - i*8)) & 0xFF;
+        header[16 + i] = (dstaddr >> (24 - i*8)) & 0xFF;
+    }
+    for (int i=0; i<IPV4_HEADERSIZE; i+=2)
+        checksum += (header[i] << 8) | header[i+1];
+    while (checksum > 0xFFFF)
+        checksum = (checksum & 0xFFFF) + (checksum >> 16);
+    checksum = ~checksum & 0xFFFF;
+    header[10] = (checksum >> 8) & 0xFF;
+    header[11] = checksum & 0xFF;
+
+    // UDP header, without a checksum
+    header[20] = (src.port() >> 8) & 0xFF;
+    header[21] = src.port() & 0xFF;
+    header[22] = (dst.port() >> 8) & 0xFF;
+    header[23] = dst.port() & 0xFF;
+    header[24] = ((UDP_HEADERSIZE + size) >> 8) & 0xFF;
+    header[25] = (UDP_HEADERSIZE + size) & 0xFF;
+
+    // Write the packet
+    std::lock_guard<std::mutex> lock(global_capture_mutex);
+    if (global_capture_file == NULL)
+        return;
+    capture_beginpacket(CAPTURE_UDP, total);
+    capture_put(header, sizeof(header));
+    capture_put(data, size);
+    capture_endpacket(direction);
+}
+
+
+/*==============================
+    PacketCapture::USB
+    Records a USB transfer
+    @param The direction the transfer went in
+    @param The USB data type
+    @param The data that was transferred
+    @param The size of the data
+==============================*/
+
+void PacketCapture::USB(CaptureDirection direction, uint8_t type, const uint8_t* data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(global_capture_mutex);
+    if (global_capture_file == NULL)
+        return;
+    capture_beginpacket(CAPTURE_USB, size + 1);
+    capture_put(&type, 1);
+    capture_put(data, size);
+    capture_endpacket(direction);
+}
+
+
+/*=============================================================
+                        Capture Reader
+=============================================================*/
+
+/*==============================
+    CaptureReader (Constructor)
+    Initializes the class
+==============================*/
+
+CaptureReader::CaptureReader()
+{
+    this->m_File = NULL;
+    this->m_Swapped = false;
+}
+
+
+/*==============================
+    CaptureReader (Destructor)
+    Cleans up the class before deletion
+==============================*/
+
+CaptureReader::~CaptureReader()
+{
+    this->Close();
+}
+
+
+/*==============================
+    CaptureReader::Open
+    Opens a capture file for reading
+    @param  The path of the capture file
+    @return Whether the file is a pcapng file
+==============================*/
+
+bool CaptureReader::Open(std::string path)
+{
+    uint8_t header[12];
+    uint32_t type, byteorder;
+    this->Close();
+    this->m_File = fopen(path.c_str(), "rb");
+    if (this->m_File == NULL)
+        return false;
+
+    // Make sure the file starts with a section header
+    if (fread(header, 1, sizeof(header), this->m_File) != sizeof(header))
+    {
+        this->Close();
+        return false;
+    }
+    memcpy(&type, header, 4);
+    memcpy(&byteorder, header + 8, 4);
+    if (type != PCAPNG_BLOCK_SHB || (byteorder != PCAPNG_BYTEORDER && byteorder != capture_swap32(PCAPNG_BYTEORDER)))
+    {
+        this->Close();
+        return false;
+    }
+    fseek(this->m_File, 0, SEEK_SET);
+    return true;
+}
+
+
+/*==============================
+    CaptureReader::Close
+    Closes the capture file
+==============================*/
+
+void CaptureReader::Close()
+{
+    if (this->m_File != NULL)
+        fclose(this->m_File);
+    this->m_File = NULL;
+    this->m_LinkTypes.clear();
+}
+
+
+/*==============================
+    CaptureReader::Get16
+    Reads a 16-bit value in the section's byte order
+    @param  The buffer to read from
+    @return The value
+==============================*/
+
+uint16_t CaptureReader::Get16(const uint8_t* buff)
+{
+    uint16_t val;
+    memcpy(&val, buff, sizeof(val));
+    return this->m_Swapped ? capture_swap16(val) : val;
+}
+
+
+/*==============================
+    CaptureReader::Get32
+    Reads a 32-bit value in the section's byte order
+    @param  The buffer to read from
+    @return The value
+==============================*/
+
+uint32_t CaptureReader::Get32(const uint8_t* buff)
+{
+    uint32_t val;
+    memcpy(&val, buff, sizeof(val));
+    return this->m_Swapped ? capture_swap32(val) : val;
+}
+
+
+/*==============================
+    CaptureReader::ReadSectionHeader
+    Reads the rest of a section header block, which sets the
+    byte order of the blocks that follow it
+    @param  The block length, as stored in the file
+    @return Whether the section header is valid
+==============================*/
+
+bool CaptureReader::ReadSectionHeader(uint32_t length)
+{
+    uint8_t byteorder[4];
+    if (fread(byteorder, 1, 4, this->m_File) != 4)
+        return false;
+    this->m_Swapped = false;
+    if (this->Get32(byteorder) != PCAPNG_BYTEORDER)
+        this->m_Swapped = true;
+    length = this->Get32((uint8_t*)&length);
+    if (length < 28 || length > PCAPNG_MAXBLOCK || length % 4 != 0)
+        return false;
+    this->m_LinkTypes.clear();
+    return fseek(this->m_File, length - 12, SEEK_CUR) == 0;
+}
+
+
+/*==============================
+    CaptureReader::ParsePacket
+    Turns the enhanced packet block that was just read into a
+    record
+    @param  The record to fill in
+    @return Whether the packet came from an interface we know
+==============================*/
+
+bool CaptureReader::ParsePacket(CaptureRecord* record)
+{
+    const uint8_t* body = this->m_Block.data();
+    size_t bodysize = this->m_Block.size() - 4;
+    uint32_t ifid, caplen, flags = 0;
+    const uint8_t* data;
+    size_t optoffset;
+    if (bodysize < 20)
+        return false;
+    ifid = this->Get32(body);
+    caplen = this->Get32(body + 12);
+    if (ifid >= this->m_LinkTypes.size() || 20 + (size_t)caplen > bodysize)
+        return false;
+    data = body + 20;
+    record->timestamp = (((uint64_t)this->Get32(body + 4)) << 32) | this->Get32(body + 8);
+
+    // Find the direction in the options
+    optoffset = 20 + ((caplen + 3) & ~3);
+    while (optoffset + 4 <= bodysize)
+    {
+        uint16_t code = this->Get16(body + optoffset);
+        uint16_t length = this->Get16(body + optoffset + 2);
+        if (code == PCAPNG_OPT_END || optoffset + 4 + length > bodysize)
+            break;
+        if (code == PCAPNG_OPT_EPBFLAGS && length == 4)
+            flags = this->Get32(body + optoffset + 4);
+        optoffset += 4 + ((length + 3) & ~3);
+    }
+    record->direction = ((flags & 0x03) == CAPTURE_OUT) ? CAPTURE_OUT : CAPTURE_IN;
+
+    // Strip the headers we added when capturing
+    switch (this->m_LinkTypes[ifid])
+    {
+        case CAPTURE_LINKTYPE_IPV4:
+            {
+                size_t ihl, udplen;
+                udp::endpoint src, dst;
+                if (caplen < IPV4_HEADERSIZE + UDP_HEADERSIZE || (data[0] >> 4) != 4 || data[9] != 17)
+                    return false;
+                ihl = (data[0] & 0x0F)*4;
+                if (ihl < IPV4_HEADERSIZE || ihl + UDP_HEADERSIZE > caplen)
+                    return false;
+                udplen = (data[ihl + 4] << 8) | data[ihl + 5];
+                if (udplen < UDP_HEADERSIZE || ihl + udplen > caplen)
+                    return false;
+                src = udp::endpoint(asio::ip::address_v4((data[12] << 24) | (data[13] << 16) | (data[14] << 8) | data[15]), (data[ihl] << 8) | data[ihl + 1]);
+                dst = udp::endpoint(asio::ip::address_v4((data[16] << 24) | (data[17] << 16) | (data[18] << 8) | data[19]), (data[ihl + 2] << 8) | data[ihl + 3]);
+                record->source = CAPTURE_UDP;
+                record->local = (record->direction == CAPTURE_IN) ? dst : src;
+                record->remote = (record->direction == CAPTURE_IN) ? src : dst;
+                record->usbtype = 0;
+                record->data.assign(data + ihl + UDP_HEADERSIZE, data + ihl + udplen);
+            }
+            return true;
+        case CAPTURE_LINKTYPE_USB:
+            if (caplen < 1)
+                return false;
+            record->source = CAPTURE_USB;
+            record->local = udp::endpoint();
+            record->remote = udp::endpoint();
+            record->usbtype = data[0];
+            record->data.assign(data + 1, data + caplen);
+            return true;
+        default:
+            return false;
+    }
+}
+
+
+/*==============================
+    CaptureReader::Next
+    Reads the next record from the capture file. Blocks other
+    than packets, and packets from interfaces that we don't
+    know, are skipped.
+    @param  The record to fill in
+    @return Whether a record was read, false at the end of
+            the file or if the file is corrupt
+==============================*/
+
+bool CaptureReader::Next(CaptureRecord* record)
+{
+    uint8_t header[8];
+    if (this->m_File == NULL)
+        return false;
+    while (fread(header, 1, sizeof(header), this->m_File) == sizeof(header))
+    {
+        uint32_t type, length;
+        memcpy(&type, header, 4);
+        if (type == PCAPNG_BLOCK_SHB)
+        {
+            memcpy(&length, header + 4, 4);
+            if (!this->ReadSectionHeader(length))
+                return false;
+            continue;
+        }
+
+        // Read the rest of the block
+        type = this->Get32(header);
+        length = this->Get32(header + 4);
+        if (length < 12 || length > PCAPNG_MAXBLOCK || length % 4 != 0)
+            return false;
+        this->m_Block.resize(length - 8);
+        if (fread(this->m_Block.data(), 1, this->m_Block.size(), this->m_File) != this->m_Block.size())
+            return false;
+
+        // Handle it
+        if (type == PCAPNG_BLOCK_IDB && this->m_Block.size() >= 12)
+            this->m_LinkTypes.push_back(this->Get16(this->m_Block.data()));
+        else if (type == PCAPNG_BLOCK_EPB && this->ParsePacket(record))
+            return true;
+    }
+    return false;
+}
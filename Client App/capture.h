@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include "Include/asio.hpp"
+
+using asio::ip::udp;
+
+
+/******************************
+             Macros
+******************************/
+
+// pcapng link types for the two capture interfaces
+#define CAPTURE_LINKTYPE_IPV4  228 // Raw IPv4, so Wireshark can decode the UDP datagrams
+#define CAPTURE_LINKTYPE_USB   147 // LINKTYPE_USER0, a USB data type byte followed by the data
+
+// How much of the capture file to buffer in memory before writing it out
+#define CAPTURE_BUFFERSIZE  (1024*1024)
+
+
+/******************************
+             Types
+******************************/
+
+typedef enum {
+    CAPTURE_UDP = 0, // A UDP datagram
+    CAPTURE_USB = 1, // A USB transfer to or from the flashcart
+} CaptureSource;
+
+typedef enum {
+    CAPTURE_IN  = 1, // Received by us
+    CAPTURE_OUT = 2, // Sent by us
+} CaptureDirection;
+
+typedef struct {
+    CaptureSource    source;
+    CaptureDirection direction;
+    uint64_t timestamp;        // In microseconds, from a monotonic clock
+    udp::endpoint local;       // Only set for UDP datagrams
+    udp::endpoint remote;      // Only set for UDP datagrams
+    uint8_t  usbtype;          // Only set for USB transfers
+    std::vector<uint8_t> data; // The datagram or USB transfer, without any headers
+} CaptureRecord;
+
+
+/******************************
+            Globals
+******************************/
+
+extern std::atomic<bool> global_capture_active;
+
+
+/*********************************
+             Classes
+*********************************/
+
+// Opt-in recorder of every datagram and USB transfer, for building reproducible workloads.
+// Records are written to a pcapng file, with the datagrams wrapped in IPv4 + UDP headers.
+// Safe to use from multiple threads.
+class PacketCapture
+{
+    public:
+        static bool Start(std::string path);
+        static void Stop();
+        static bool IsActive() {return global_capture_active.load(std::memory_order_relaxed);};
+        static void Datagram(CaptureDirection direction, const udp::endpoint& local, const udp::endpoint& remote, const uint8_t* data, size_t size);
+        static void USB(CaptureDirection direction, uint8_t type, const uint8_t* data, size_t size);
+};
+
+// Reads back the records of a capture file written by PacketCapture
+class CaptureReader
+{
+    private:
+        FILE* m_File;
+        bool  m_Swapped;
+        std::vector<uint16_t> m_LinkTypes;
+        std::vector<uint8_t>  m_Block;
+
+        uint16_t Get16(const uint8_t* buff);
+        uint32_t Get32(const uint8_t* buff);
+        bool ReadSectionHeader(uint32_t length);
+        bool ParsePacket(CaptureRecord* record);
+
+    protected:
+
+    public:
+        CaptureReader();
+        ~CaptureReader();
+        bool Open(std::string path);
+        void Close();
+        bool Next(CaptureRecord* record);
+};
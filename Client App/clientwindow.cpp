@@ -6,7 +6,9 @@ The client window that handles USB and server communication
 
 #include <wx/event.h>
 #include <wx/msgqueue.h>
+#include <wx/config.h>
 #include "clientwindow.h"
+#include "capture.h"
 #include "Include/device.h"
 
 
@@ -18,17 +20,37 @@ The client window that handles USB and server communication
 #define USBPROTOCOL_VERSION PROTOCOL_VERSION2
 #define HEARTBEAT_VERSION   1
 
-#define DATATYPE_NETPACKET  0x27
+#define DATATYPE_NETPACKET        0x27
+#define DATATYPE_NETPACKETBUNDLE  0x28
+
+// The largest USB transfer of bundled NetLib packets we'll send to the N64
+#define MAX_USBBUNDLESIZE  (64*1024)
 
 #define STOPONERROR  0
 
+#define TIME_IDLECHECK    1000
+#define TIME_THREADCHECK  100
+
+// How often (in milliseconds) text from the N64 is moved into the console
+#define CONSOLE_FLUSHTIME  16
+
+// The most bytes of text moved into the console per refresh
+#define CONSOLE_FLUSHSIZE  (256*1024)
+
+// The most lines the console keeps before it starts dropping the oldest ones, and how many it trims down to when it does
+// Trimming a batch at a time keeps the expensive removal from the start of the text control from happening on every line
+#define CONSOLE_MAXLINES   10000
+#define CONSOLE_TRIMLINES  (CONSOLE_MAXLINES - CONSOLE_MAXLINES/10)
+
+// How often (in milliseconds) the status bar is updated, and the stats are logged
+#define STATS_REFRESHTIME  1000
+
 
 /******************************
              Types
 ******************************/
 
 typedef enum {
-    TEVENT_CLEARCONSOLE,
     TEVENT_WRITECONSOLE,
     TEVENT_WRITECONSOLEERROR,
     TEVENT_SETSTATUS,
@@ -50,10 +72,18 @@ typedef struct {
             Globals
 ******************************/
 
-static wxMessageQueue<NetLibPacket*> global_msgqueue_usbthread_pkt;
-static wxMessageQueue<NetLibPacket*> global_msgqueue_serverthread_pkt;
+static PacketRing global_ring_usbthread_pkt;    // Server thread -> USB thread
+static PacketRing global_ring_serverthread_pkt; // USB thread -> Server thread
+static std::deque<NetLibPacketPtr> global_overflow_serverthread_pkt; // USB thread only, packets waiting for room in the ring above
+static ConsoleRing global_ring_console;          // USB thread -> Main thread
+static std::atomic<bool> global_console_clear(false);
+static TransportStats global_stats_server;       // Updated by the server thread
+static TransportStats global_stats_usb;          // Updated by the USB thread
 static wxMessageQueue<InputMessage*> global_msgqueue_usbthread_input;
 
+static wxMutex global_serverthread_mutex;
+static std::atomic<ServerConnectionThread*> global_serverthread(NULL);
+
 
 /*=============================================================
                          Client Window
@@ -72,8 +102,16 @@ static wxMessageQueue<InputMessage*> global_msgqueue_usbthread_input;
 
 ClientWindow::ClientWindow(wxWindow* parent, wxWindowID id, const wxString& title, const wxPoint& pos, const wxSize& size, long style) : wxFrame(parent, id, title, pos, size, style)
 {
+    wxString logpath;
     this->m_ServerThread = NULL;
     this->m_DeviceThread = NULL;
+    this->m_ConsoleLineLength = 0;
+    this->m_ConsoleDropped = global_ring_console.Dropped();
+    this->m_ConsoleLog = NULL;
+    this->m_StatsLog = NULL;
+    this->m_ConsoleBuffer.resize(CONSOLE_FLUSHSIZE);
+    this->m_LastStats_USB = global_stats_usb.Snapshot();
+    this->m_LastStatsTime = std::chrono::steady_clock::now();
     this->SetSizeHints(wxDefaultSize, wxDefaultSize);
 
     // Initialize the main window sizer
@@ -87,8 +125,19 @@ ClientWindow::ClientWindow(wxWindow* parent, wxWindowID id, const wxString& titl
     // Rich console for text output
     this->m_RichText_Console = new wxRichTextCtrl(this, wxID_ANY, wxEmptyString, wxDefaultPosition, wxDefaultSize, wxTE_READONLY|wxVSCROLL|wxHSCROLL|wxNO_BORDER|wxWANTS_CHARS);
     m_Sizer_Main->Add(this->m_RichText_Console, 1, wxEXPAND | wxALL, 5);
+    this->m_RichText_Console->BeginSuppressUndo(); // Otherwise every write is kept in the undo history forever
     this->m_RichText_Console->Clear();
 
+    // Mirror the console to a log file, if the user asked for it
+    logpath = wxConfigBase::Get()->Read("ConsoleLogFile", wxEmptyString);
+    if (logpath != wxEmptyString)
+        this->m_ConsoleLog = fopen(logpath.mb_str(), "ab");
+
+    // Log the connection stats as JSON lines, if the user asked for it
+    logpath = wxConfigBase::Get()->Read("StatsLogFile", wxEmptyString);
+    if (logpath != wxEmptyString)
+        this->m_StatsLog = fopen(logpath.mb_str(), "ab");
+
     // Sizer for the bottom items
     this->m_Sizer_Input = new wxGridBagSizer(0, 0);
     this->m_Sizer_Input->SetFlexibleDirection(wxBOTH);
@@ -118,8 +167,10 @@ ClientWindow::ClientWindow(wxWindow* parent, wxWindowID id, const wxString& titl
     this->SetSizer(m_Sizer_Main);
     this->Layout();
 
-    // Status bar (currently unused, would be nice to display statistics)
-    //m_StatusBar_ClientStatus = this->CreateStatusBar(1, wxSTB_SIZEGRIP, wxID_ANY);
+    // Status bar with the connection statistics
+    const int statuswidths[] = {-3, -2, -2};
+    this->m_StatusBar_ClientStatus = this->CreateStatusBar(3, wxSTB_SIZEGRIP, wxID_ANY);
+    this->m_StatusBar_ClientStatus->SetStatusWidths(3, statuswidths);
 
     // Finalize positioning
     this->Centre(wxBOTH);
@@ -128,6 +179,16 @@ ClientWindow::ClientWindow(wxWindow* parent, wxWindowID id, const wxString& titl
     // Connect events
     this->m_TextCtrl_Input->Connect(wxEVT_COMMAND_TEXT_UPDATED, wxCommandEventHandler(ClientWindow::m_TextCtrl_Input_OnText), NULL, this);
     this->m_Button_Send->Connect(wxEVT_COMMAND_BUTTON_CLICKED, wxCommandEventHandler(ClientWindow::m_Button_Send_OnButtonClick), NULL, this);
+
+    // Timer for moving text from the N64 into the console
+    this->m_Timer_Console = new wxTimer(this, wxID_ANY);
+    this->Connect(this->m_Timer_Console->GetId(), wxEVT_TIMER, wxTimerEventHandler(ClientWindow::m_Timer_Console_OnTimer), NULL, this);
+    this->m_Timer_Console->Start(CONSOLE_FLUSHTIME);
+
+    // Timer for refreshing the statistics in the status bar
+    this->m_Timer_Stats = new wxTimer(this, wxID_ANY);
+    this->Connect(this->m_Timer_Stats->GetId(), wxEVT_TIMER, wxTimerEventHandler(ClientWindow::m_Timer_Stats_OnTimer), NULL, this);
+    this->m_Timer_Stats->Start(STATS_REFRESHTIME);
 }
 
 
@@ -142,6 +203,20 @@ ClientWindow::~ClientWindow()
     this->StopThread_Server(); // Kill server thread first otherwise USB will keep receiving messages and sending them
     this->StopThread_Device();
 
+    // Stop the console timer
+    this->m_Timer_Console->Stop();
+    this->Disconnect(this->m_Timer_Console->GetId(), wxEVT_TIMER, wxTimerEventHandler(ClientWindow::m_Timer_Console_OnTimer), NULL, this);
+    delete this->m_Timer_Console;
+    if (this->m_ConsoleLog != NULL)
+        fclose(this->m_ConsoleLog);
+
+    // Stop the stats timer
+    this->m_Timer_Stats->Stop();
+    this->Disconnect(this->m_Timer_Stats->GetId(), wxEVT_TIMER, wxTimerEventHandler(ClientWindow::m_Timer_Stats_OnTimer), NULL, this);
+    delete this->m_Timer_Stats;
+    if (this->m_StatsLog != NULL)
+        fclose(this->m_StatsLog);
+
     // Disconnect events
     this->m_Button_Send->Disconnect(wxEVT_COMMAND_BUTTON_CLICKED, wxCommandEventHandler(ClientWindow::m_Button_Send_OnButtonClick), NULL, this);
     this->m_TextCtrl_Input->Disconnect(wxEVT_COMMAND_TEXT_UPDATED, wxCommandEventHandler(ClientWindow::m_TextCtrl_Input_OnText), NULL, this);
@@ -394,18 +469,13 @@ void ClientWindow::ThreadEvent(wxThreadEvent& event)
 {
     switch ((ThreadEventType)event.GetInt())
     {
-        case TEVENT_CLEARCONSOLE:
-            this->m_RichText_Console->Clear();
-            break;
         case TEVENT_WRITECONSOLE:
-            this->m_RichText_Console->WriteText(event.GetString());
-            this->m_RichText_Console->ShowPosition(this->m_RichText_Console->GetLastPosition());
+            this->FlushConsole(); // Keep the order of the text the USB thread wrote before this
+            this->AppendConsole(event.GetString(), false);
             break;
         case TEVENT_WRITECONSOLEERROR:
-            this->m_RichText_Console->BeginTextColour(wxColour(255, 0, 0));
-            this->m_RichText_Console->WriteText(event.GetString());
-            this->m_RichText_Console->EndTextColour();
-            this->m_RichText_Console->ShowPosition(this->m_RichText_Console->GetLastPosition());
+            this->FlushConsole();
+            this->AppendConsole(event.GetString(), true);
             break;
         case TEVENT_SETSTATUS:
             this->SetClientDeviceStatus((ClientDeviceStatus)event.GetExtraLong());
@@ -422,6 +492,212 @@ void ClientWindow::ThreadEvent(wxThreadEvent& event)
 }
 
 
+/*==============================
+    ClientWindow::m_Timer_Console_OnTimer
+    Moves text from the N64 into the console
+    @param The timer event
+==============================*/
+
+void ClientWindow::m_Timer_Console_OnTimer(wxTimerEvent& event)
+{
+    this->FlushConsole();
+    (void)event;
+}
+
+
+/*==============================
+    ClientWindow::m_Timer_Stats_OnTimer
+    Refreshes the connection statistics
+    @param The timer event
+==============================*/
+
+void ClientWindow::m_Timer_Stats_OnTimer(wxTimerEvent& event)
+{
+    this->UpdateStats();
+    (void)event;
+}
+
+
+/*==============================
+    ClientWindow::UpdateStats
+    Shows the connection statistics in the status bar, and
+    writes them to the stats log if there is one
+==============================*/
+
+void ClientWindow::UpdateStats()
+{
+    TransportStatsSnapshot server = global_stats_server.Snapshot();
+    TransportStatsSnapshot usb = global_stats_usb.Snapshot();
+    PacketQueueStats toserver = this->GetQueueStats_ToServer();
+    PacketQueueStats todevice = this->GetQueueStats_ToDevice();
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - this->m_LastStatsTime).count();
+    uint64_t transfers, bytes;
+    if (seconds <= 0)
+        return;
+
+    // The counters start over with each new connection, so don't let the rates go negative
+    if (usb.packets_in + usb.packets_out < this->m_LastStats_USB.packets_in + this->m_LastStats_USB.packets_out)
+        memset(&this->m_LastStats_USB, 0, sizeof(TransportStatsSnapshot));
+    transfers = (usb.packets_in + usb.packets_out) - (this->m_LastStats_USB.packets_in + this->m_LastStats_USB.packets_out);
+    bytes = (usb.bytes_in + usb.bytes_out) - (this->m_LastStats_USB.bytes_in + this->m_LastStats_USB.bytes_out);
+
+    // Show the stats
+    this->m_StatusBar_ClientStatus->SetStatusText(wxString::Format("RTT %.1f ms (%.1f jitter), Resent %llu (%.1f%%), Unacked %llu",
+        server.srtt, server.rttvar, (unsigned long long)server.resends,
+        (server.packets_out > 0) ? (100.0*server.resends)/server.packets_out : 0.0, (unsigned long long)server.outstanding
+    ), 0);
+    this->m_StatusBar_ClientStatus->SetStatusText(wxString::Format("USB %.0f transfers/s, %.1f KB/s", transfers/seconds, bytes/seconds/1024.0), 1);
+    this->m_StatusBar_ClientStatus->SetStatusText(wxString::Format("Queued: %lu to N64, %lu to server, %llu dropped", (unsigned long)todevice.depth, (unsigned long)toserver.depth, (unsigned long long)(server.dropped + usb.dropped)), 2);
+
+    // Log them as a JSON line
+    if (this->m_StatsLog != NULL)
+    {
+        fprintf(this->m_StatsLog, "{\"time_ms\":%lld,\"server\":%s,\"usb\":%s,\"queues\":{\"to_server\":{\"depth\":%lu,\"highwater\":%lu},\"to_device\":{\"depth\":%lu,\"highwater\":%lu}},\"console_dropped\":%lu}\n",
+            (long long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count(),
+            TransportStats::ToJSON(&server).c_str(), TransportStats::ToJSON(&usb).c_str(),
+            (unsigned long)toserver.depth, (unsigned long)toserver.highwater, (unsigned long)todevice.depth, (unsigned long)todevice.highwater,
+            (unsigned long)this->GetConsoleDropped()
+        );
+        fflush(this->m_StatsLog);
+    }
+    this->m_LastStats_USB = usb;
+    this->m_LastStatsTime = now;
+}
+
+
+/*==============================
+    ClientWindow::FlushConsole
+    Takes the text that the USB thread has queued up and adds
+    it to the console in one go, so that a ROM that prints a lot
+    doesn't flood the UI with events
+==============================*/
+
+void ClientWindow::FlushConsole()
+{
+    size_t dropped;
+    size_t readcount = global_ring_console.Read(this->m_ConsoleBuffer.data(), this->m_ConsoleBuffer.size());
+
+    // The clear request comes before any text written after it, so it must be checked after reading
+    if (global_console_clear.exchange(false))
+        this->ClearConsole();
+    if (readcount > 0)
+        this->AppendConsole(wxString((const char*)this->m_ConsoleBuffer.data(), readcount), false);
+
+    // Let the user know if the N64 printed faster than we could keep up with
+    dropped = global_ring_console.Dropped();
+    if (dropped != this->m_ConsoleDropped)
+    {
+        this->AppendConsole(wxString::Format("\n[%lu bytes of output were dropped]\n", (unsigned long)(dropped - this->m_ConsoleDropped)), true);
+        this->m_ConsoleDropped = dropped;
+    }
+}
+
+
+/*==============================
+    ClientWindow::ClearConsole
+    Clears the console
+==============================*/
+
+void ClientWindow::ClearConsole()
+{
+    this->m_RichText_Console->Clear();
+    this->m_ConsoleLines.clear();
+    this->m_ConsoleLineLength = 0;
+}
+
+
+/*==============================
+    ClientWindow::AppendConsole
+    Adds text to the end of the console, dropping the oldest
+    lines if there are too many
+    @param The text to add
+    @param Whether the text is an error
+==============================*/
+
+void ClientWindow::AppendConsole(wxString text, bool error)
+{
+    size_t start = 0, newline;
+    if (text.IsEmpty())
+        return;
+
+    // Mirror the text to the log file
+    if (this->m_ConsoleLog != NULL)
+    {
+        wxScopedCharBuffer utf8 = text.utf8_str();
+        fwrite(utf8.data(), 1, utf8.length(), this->m_ConsoleLog);
+        fflush(this->m_ConsoleLog);
+    }
+
+    // Write the text
+    this->m_RichText_Console->Freeze();
+    this->m_RichText_Console->SetInsertionPointEnd();
+    if (error)
+        this->m_RichText_Console->BeginTextColour(wxColour(255, 0, 0));
+    this->m_RichText_Console->WriteText(text);
+    if (error)
+        this->m_RichText_Console->EndTextColour();
+
+    // Keep track of how long each line is, so the oldest ones can be removed without searching for them
+    while ((newline = text.find('\n', start)) != wxString::npos)
+    {
+        this->m_ConsoleLines.push_back(this->m_ConsoleLineLength + (long)(newline - start) + 1);
+        this->m_ConsoleLineLength = 0;
+        start = newline + 1;
+    }
+    this->m_ConsoleLineLength += (long)(text.length() - start);
+    if (this->m_ConsoleLines.size() > CONSOLE_MAXLINES)
+    {
+        long removed = 0;
+        while (this->m_ConsoleLines.size() > CONSOLE_TRIMLINES)
+        {
+            removed += this->m_ConsoleLines.front();
+            this->m_ConsoleLines.pop_front();
+        }
+        this->m_RichText_Console->Remove(0, removed);
+    }
+    this->m_RichText_Console->ShowPosition(this->m_RichText_Console->GetLastPosition());
+    this->m_RichText_Console->Thaw();
+}
+
+
+/*==============================
+    ClientWindow::GetConsoleDropped
+    Gets how many bytes of N64 text didn't fit in the console's
+    queue and were dropped
+    @return The number of dropped bytes
+==============================*/
+
+size_t ClientWindow::GetConsoleDropped()
+{
+    return global_ring_console.Dropped();
+}
+
+
+/*==============================
+    ClientWindow::GetStats_Server
+    Retrieves the traffic stats of the connection to the server
+    @return A snapshot of the server connection's stats
+==============================*/
+
+TransportStatsSnapshot ClientWindow::GetStats_Server()
+{
+    return global_stats_server.Snapshot();
+}
+
+
+/*==============================
+    ClientWindow::GetStats_USB
+    Retrieves the traffic stats of the USB connection to the N64
+    @return A snapshot of the USB connection's stats
+==============================*/
+
+TransportStatsSnapshot ClientWindow::GetStats_USB()
+{
+    return global_stats_usb.Snapshot();
+}
+
+
 /*==============================
     ClientWindow::SetROM
     Sets the path to the ROM to upload
@@ -482,6 +758,34 @@ int ClientWindow::GetPort()
 }
 
 
+/*==============================
+    ClientWindow::GetQueueStats_ToServer
+    Retreives the state of the queue of packets 
+    going from the USB thread to the server thread
+    @return The queue's depth and high-water mark
+==============================*/
+
+PacketQueueStats ClientWindow::GetQueueStats_ToServer()
+{
+    PacketQueueStats stats = {global_ring_serverthread_pkt.Depth(), global_ring_serverthread_pkt.HighWater()};
+    return stats;
+}
+
+
+/*==============================
+    ClientWindow::GetQueueStats_ToDevice
+    Retreives the state of the queue of packets 
+    going from the server thread to the USB thread
+    @return The queue's depth and high-water mark
+==============================*/
+
+PacketQueueStats ClientWindow::GetQueueStats_ToDevice()
+{
+    PacketQueueStats stats = {global_ring_usbthread_pkt.Depth(), global_ring_usbthread_pkt.HighWater()};
+    return stats;
+}
+
+
 /*=============================================================
                       USB Handler Thread
 =============================================================*/
@@ -497,7 +801,8 @@ DeviceThread::DeviceThread(ClientWindow* win) : wxThread(wxTHREAD_JOINABLE)
     this->m_Window = win;
     this->m_UploadThread = NULL;
     this->m_FirstPrint = true;
-    global_msgqueue_usbthread_pkt.Clear();
+    this->m_BundleSize = 0;
+    this->m_BundleBuffer = (uint8_t*)malloc(MAX_USBBUNDLESIZE);
     device_initialize();
     this->SetClientDeviceStatus(CLSTATUS_IDLE);
 }
@@ -510,6 +815,7 @@ DeviceThread::DeviceThread(ClientWindow* win) : wxThread(wxTHREAD_JOINABLE)
 
 DeviceThread::~DeviceThread()
 {
+    free(this->m_BundleBuffer);
     if (device_isopen())
         device_close();
 }
@@ -524,8 +830,14 @@ DeviceThread::~DeviceThread()
 void* DeviceThread::Entry()
 {
     wxString rompath = "";
+    NetLibPacketPtr stale;
     DeviceError deverr = device_find();
 
+    // Throw away packets meant for a previous USB thread
+    while (global_ring_usbthread_pkt.Pop(stale))
+        stale.reset();
+    global_stats_usb.Reset();
+
     // Search for a cart
     this->WriteConsole("Searching for a valid flashcart\n");
     if (deverr != DEVICEERR_OK)
@@ -588,6 +900,7 @@ void* DeviceThread::Entry()
         {
             this->WriteConsole("Loading '" + rompath + "' via USB\n");
             this->SetClientDeviceStatus(CLSTATUS_UPLOADING);
+            this->m_BundleSize = 0; // The new ROM will tell us if it supports bundles
 
             // Create upload thread and update the status bar as it's uploading
             this->UploadROM(rompath);
@@ -656,12 +969,16 @@ void* DeviceThread::Entry()
         {
             uint32_t size = dataheader & 0xFFFFFF;
             uint8_t command = ((dataheader >> 24) & 0xFF);
+            global_stats_usb.CountIn(size);
+            if (PacketCapture::IsActive())
+                PacketCapture::USB(CAPTURE_IN, command, outbuff, size);
 
             // Decide what to do with the data based off the command type
             switch (command)
             {
                 case DATATYPE_TEXT:      this->ParseUSB_TextPacket(outbuff, size); break;
-                case DATATYPE_NETPACKET: this->ParseUSB_NetLibPacket(outbuff); break;
+                case DATATYPE_NETPACKET: this->ParseUSB_NetLibPacket(outbuff, size); break;
+                case DATATYPE_NETPACKETBUNDLE: this->ParseUSB_NetLibBundlePacket(outbuff, size); break;
                 case DATATYPE_HEARTBEAT: this->ParseUSB_HeartbeatPacket(outbuff, size); break;
                 default:
                     this->WriteConsoleError(wxString::Format("\nError: Received unknown datatype '%02X' from the flashcart.\n", command));
@@ -674,19 +991,13 @@ void* DeviceThread::Entry()
         }
         else // No incoming USB data, that means we can send a data packet to the N64 safely
         {
-            bool workdone = false;
-            NetLibPacket* pkt;
-            if (global_msgqueue_usbthread_pkt.ReceiveTimeout(0, pkt) == wxMSGQUEUE_NO_ERROR)
-            {
-                uint8_t* pktasbytes = pkt->GetAsBytes();
-                device_senddata((USBDataType)DATATYPE_NETPACKET, (byte*)pktasbytes, (uint32_t)pkt->GetAsBytes_Size());
-                workdone = true;
-                free(pktasbytes);
-            }
+            bool workdone;
+            ServerConnectionThread::RetryPosted();
+            workdone = this->UploadPackets();
             
-            // Rest if there was nothing done
+            // Rest if there was nothing done, unless the server thread gives us something
             if (!workdone)
-                wxMilliSleep(1);
+                global_ring_usbthread_pkt.WaitFor(1);
         }
 
         // Check for messages from the main thread
@@ -700,6 +1011,103 @@ void* DeviceThread::Entry()
 }
 
 
+/*==============================
+    DeviceThread::UploadPackets
+    Uploads everything the server thread has queued so far
+    to the N64. If the ROM supports it, packets are bundled
+    so that many of them go in a single USB transfer,
+    otherwise only one packet is sent per call.
+    @return Whether any packets were uploaded
+==============================*/
+
+bool DeviceThread::UploadPackets()
+{
+    NetLibPacketPtr pkt;
+    size_t count = global_ring_usbthread_pkt.Depth();
+    uint32_t bundleused = 0;
+    int bundlecount = 0;
+    if (count == 0)
+        return false;
+
+    // If the ROM can't handle bundles, send a single packet and let the thread poll the N64 again before the next one
+    if (this->m_BundleSize == 0)
+    {
+        while (count-- > 0 && global_ring_usbthread_pkt.Pop(pkt))
+        {
+            uint16_t pktsize = pkt->WriteAsBytes(this->m_BundleBuffer, MAX_PACKETSIZE);
+            if (pktsize == 0)
+            {
+                global_stats_usb.CountDrop();
+                this->WriteConsoleError("\nPacket from the server is too large for the N64, dropped it.\n");
+                continue;
+            }
+            this->SendData(DATATYPE_NETPACKET, this->m_BundleBuffer, pktsize);
+            break;
+        }
+        return true;
+    }
+
+    // Pack as many packets as will fit into each transfer
+    while (count-- > 0 && global_ring_usbthread_pkt.Pop(pkt))
+    {
+        uint16_t pktsize = pkt->WriteAsBytes(this->m_BundleBuffer + bundleused, this->m_BundleSize - bundleused);
+        if (pktsize == 0 && bundlecount > 0)
+        {
+            this->SendBundle(bundleused, bundlecount);
+            bundleused = 0;
+            bundlecount = 0;
+            pktsize = pkt->WriteAsBytes(this->m_BundleBuffer, this->m_BundleSize);
+        }
+        if (pktsize > 0)
+        {
+            bundleused += pktsize;
+            bundlecount++;
+        }
+        else
+        {
+            global_stats_usb.CountDrop();
+            this->WriteConsoleError("\nPacket from the server is too large for the N64, dropped it.\n");
+        }
+    }
+    if (bundlecount > 0)
+        this->SendBundle(bundleused, bundlecount);
+    return true;
+}
+
+
+/*==============================
+    DeviceThread::SendBundle
+    Sends the packets in the bundle buffer to the N64
+    @param The number of bytes in the bundle buffer
+    @param The number of packets in the bundle buffer
+==============================*/
+
+void DeviceThread::SendBundle(uint32_t size, int count)
+{
+    this->SendData((count > 1) ? DATATYPE_NETPACKETBUNDLE : DATATYPE_NETPACKET, this->m_BundleBuffer, size);
+}
+
+
+/*==============================
+    DeviceThread::SendData
+    Sends a USB transfer to the N64, timing how long it takes
+    @param The USB datatype of the transfer
+    @param The data to send
+    @param The size of the data
+==============================*/
+
+void DeviceThread::SendData(uint8_t type, uint8_t* data, uint32_t size)
+{
+    std::chrono::steady_clock::time_point start;
+    if (PacketCapture::IsActive())
+        PacketCapture::USB(CAPTURE_OUT, type, data, size);
+    start = std::chrono::steady_clock::now();
+    device_senddata((USBDataType)type, (byte*)data, size);
+    global_stats_usb.CountOut(size);
+    global_stats_usb.AddLatency(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+}
+
+
 /*==============================
     DeviceThread::HandleMainInput
     Handle input from the main thread
@@ -743,18 +1151,10 @@ bool DeviceThread::HandleMainInput(wxString* rompath)
 
 void DeviceThread::ParseUSB_TextPacket(uint8_t* buff, uint32_t size)
 {
-    char* text = (char*)calloc(size+1, sizeof(char));
-
-    // Ensure malloc succeeded
-    if (text == NULL)
-    {
-        this->WriteConsoleError("\nError: Unable to allocate memory for incoming string.\n");
-        return;
-    }
-
-    // Copy the string over
-    memset(text, 0, size+1);
-    strncpy(text, (char*)buff, size);
+    // Only print up to the string terminator, if there is one
+    uint8_t* end = (uint8_t*)memchr(buff, '\0', size);
+    if (end != NULL)
+        size = end - buff;
 
     // If this was the first print of this thread, clear the console of status text 
     if (this->m_FirstPrint)
@@ -763,9 +1163,8 @@ void DeviceThread::ParseUSB_TextPacket(uint8_t* buff, uint32_t size)
         this->ClearConsole();
     }
 
-    // Send the text packet to the main thread for displaying, and cleanup
-    this->WriteConsole(wxString(text));
-    free(text);
+    // Queue the text for the main thread, which adds it to the console on its next refresh
+    global_ring_console.Write(buff, size);
 }
 
 
@@ -773,12 +1172,20 @@ void DeviceThread::ParseUSB_TextPacket(uint8_t* buff, uint32_t size)
     DeviceThread::ParseUSB_NetLibPacket
     Parses a NetLib packet and sends it to the main thread (so it can be relayed to the server)
     @param The raw buffer with NetLib packet data
+    @param The size of the data
 ==============================*/
 
-void DeviceThread::ParseUSB_NetLibPacket(uint8_t* buff)
+void DeviceThread::ParseUSB_NetLibPacket(uint8_t* buff, uint32_t size)
 {
-    wxThreadEvent evt = wxThreadEvent(wxEVT_THREAD, wxID_ANY);
-    NetLibPacket* pkt = NetLibPacket::FromBytes((uint8_t*)buff);
+    NetLibPacket* pkt = NULL;
+    try
+    {
+        pkt = NetLibPacket::FromBytes(buff, size);
+    }
+    catch (BadPacketVersionException& e)
+    {
+        (void)e;
+    }
 
     // Ensure we had a valid packet
     if (pkt == NULL)
@@ -788,7 +1195,37 @@ void DeviceThread::ParseUSB_NetLibPacket(uint8_t* buff)
     }
 
     // Send the packet to the networking thread
-    global_msgqueue_serverthread_pkt.Post(pkt);
+    if (!ServerConnectionThread::PostPacket(NetLibPacketPtr(pkt)))
+    {
+        global_stats_usb.CountDrop();
+        this->WriteConsoleError("\nServer queue is full, dropped a packet from the N64.\n");
+    }
+}
+
+
+/*==============================
+    DeviceThread::ParseUSB_NetLibBundlePacket
+    Parses the N64 telling us that it can receive bundles 
+    of NetLib packets in a single USB transfer
+    @param The raw buffer with the bundle announcement
+    @param The size of the data
+==============================*/
+
+void DeviceThread::ParseUSB_NetLibBundlePacket(uint8_t* buff, uint32_t size)
+{
+    uint32_t maxsize;
+    if (size < 4)
+    {
+        this->WriteConsoleError("\nError: Malformed bundle announcement received.\n");
+        return;
+    }
+
+    // Bundles must be able to fit at least the largest packet
+    maxsize = (buff[0] << 24) | (buff[1] << 16) | (buff[2] << 8) | buff[3];
+    if (maxsize < MAX_PACKETSIZE)
+        this->m_BundleSize = 0;
+    else
+        this->m_BundleSize = (maxsize < MAX_USBBUNDLESIZE) ? maxsize : MAX_USBBUNDLESIZE;
 }
 
 
@@ -838,14 +1275,13 @@ void DeviceThread::ParseUSB_HeartbeatPacket(uint8_t* buff, uint32_t size)
 
 /*==============================
     DeviceThread::ClearConsole
-    Send a text console clear request to the main thread
+    Asks the main thread to clear the console before it adds
+    any text that is queued after this call
 ==============================*/
 
 void DeviceThread::ClearConsole()
 {
-    wxThreadEvent evt = wxThreadEvent(wxEVT_THREAD, wxID_ANY);
-    evt.SetInt(TEVENT_CLEARCONSOLE);
-    wxQueueEvent(this->m_Window, evt.Clone());
+    global_console_clear.store(true);
 }
 
 
@@ -1050,7 +1486,12 @@ void UploadThread::WriteConsoleError(wxString str)
 ServerConnectionThread::ServerConnectionThread(ClientWindow* win) : wxThread(wxTHREAD_JOINABLE)
 {
     this->m_Window = win;
-    global_msgqueue_serverthread_pkt.Clear(); // TODO: Manually empty the queue to prevent leaks?
+    this->m_Socket = NULL;
+    this->m_Handler = NULL;
+    this->m_Timer = NULL;
+    this->m_RecvSlab = NULL;
+    this->m_Stopping = false;
+    this->m_TimerFast = false;
 }
 
 
@@ -1067,67 +1508,335 @@ ServerConnectionThread::~ServerConnectionThread()
 
 /*==============================
     ServerConnectionThread::Entry
-    The entry function for the thread
+    The entry function for the thread.
+    Runs global_asiocontext, so that the thread sleeps until
+    there's a packet to relay or a timer to service.
     @return The exit code
 ==============================*/
 
 void* ServerConnectionThread::Entry()
 {
-    uint8_t* buff = (uint8_t*)malloc(4096);
-    ASIOSocket* socket = new ASIOSocket(this->m_Window->GetAddress(), this->m_Window->GetPort());
-    UDPHandler* handler = new UDPHandler(socket, this->m_Window->GetAddress(), this->m_Window->GetPort());
+    asio::executor_work_guard<asio::io_context::executor_type> work = asio::make_work_guard(*global_asiocontext);
+    NetLibPacketPtr stale;
+    this->m_Socket = new ASIOSocket(this->m_Window->GetAddress().ToStdString(), this->m_Window->GetPort());
+    this->m_Handler = new UDPHandler(this->m_Socket, this->m_Window->GetAddress().ToStdString(), this->m_Window->GetPort());
+    this->m_Timer = new asio::steady_timer(*global_asiocontext);
+    global_stats_server.Reset();
+    this->m_Handler->SetStats(&global_stats_server);
+    this->m_RecvSlab = (uint8_t*)malloc(MAX_BATCHCOUNT*MAX_PACKETSIZE);
+    this->m_Stopping = false;
+
+    // The server is the only peer of this socket, so connect to it to speed up sends
+    try
+    {
+        this->m_Handler->ConnectSocket();
+    }
+    catch (asio::system_error& e)
+    {
+        this->WriteConsoleError(wxString::Format("\nUnable to resolve server address: %s\n", e.what()));
+        this->m_Stopping = true;
+    }
+
+    // Start listening for packets from the server, and let the USB thread know where to send its packets
+    if (!this->m_Stopping)
+    {
+        this->WriteConsole("Establishing connection to server once ROM is ready.\n");
+        this->StartRead();
+        this->StartTimer();
+
+        // Throw away packets meant for a previous server thread, then pick up anything sent after
+        global_ring_serverthread_pkt.Idle();
+        while (global_ring_serverthread_pkt.Pop(stale))
+            stale.reset();
+        global_serverthread_mutex.Lock();
+        global_serverthread = this;
+        global_serverthread_mutex.Unlock();
+        asio::post(*global_asiocontext, [this]() {
+            this->DrainOutgoing();
+        });
+    }
+
+    // Handle I/O until the main thread wants to kill us
+    global_asiocontext->restart();
+    while (!TestDestroy() && !this->m_Stopping)
+        global_asiocontext->run_for(std::chrono::milliseconds(TIME_THREADCHECK));
+
+    // Stop receiving packets from the USB thread
+    global_serverthread_mutex.Lock();
+    global_serverthread = NULL;
+    global_serverthread_mutex.Unlock();
+
+    // Cancel all pending operations and let their handlers finish
+    this->m_Stopping = true;
+    this->m_Timer->cancel();
+    this->m_Socket->Cancel();
+    work.reset();
+    global_asiocontext->restart();
+    global_asiocontext->run();
+
+    // Cleanup
+    free(this->m_RecvSlab);
+    delete this->m_Timer;
+    delete this->m_Handler;
+    delete this->m_Socket;
+    return NULL;
+}
+
+
+/*==============================
+    ServerConnectionThread::PostPacket
+    Hands a packet over to the server thread to be sent.
+    If the ring is full, or there's no server thread yet,
+    the packet waits in an overflow list until RetryPosted
+    finds room for it.
+    Must only be called from the USB thread.
+    @param  The packet to send, which the server thread takes ownership of
+    @return False if the overflow list was also full, and
+            the packet had to be dropped
+==============================*/
+
+bool ServerConnectionThread::PostPacket(NetLibPacketPtr pkt)
+{
+    // Packets already waiting for room go first, so that they're sent in order
+    // The ring is emptied when a server thread starts, so nothing goes in it until one is there to receive it
+    ServerConnectionThread::RetryPosted();
+    if (global_serverthread.load() == NULL || !global_overflow_serverthread_pkt.empty() || !global_ring_serverthread_pkt.Push(std::move(pkt)))
+    {
+        if (global_overflow_serverthread_pkt.size() >= RING_PACKETS)
+            return false;
+        global_overflow_serverthread_pkt.push_back(std::move(pkt));
+        return true;
+    }
+    ServerConnectionThread::WakeServer();
+    return true;
+}
+
+
+/*==============================
+    ServerConnectionThread::RetryPosted
+    Moves the packets waiting in the overflow list into the
+    ring, for as long as there's room for them. If there's
+    no server thread, they keep waiting until one starts.
+    Must only be called from the USB thread.
+==============================*/
+
+void ServerConnectionThread::RetryPosted()
+{
+    bool moved = false;
+    if (global_overflow_serverthread_pkt.empty() || global_serverthread.load() == NULL)
+        return;
+    while (!global_overflow_serverthread_pkt.empty() && global_ring_serverthread_pkt.Push(std::move(global_overflow_serverthread_pkt.front())))
+    {
+        global_overflow_serverthread_pkt.pop_front();
+        moved = true;
+    }
+    if (moved)
+        ServerConnectionThread::WakeServer();
+}
+
 
-    // Handle packets coming from the server
-    this->WriteConsole("Establishing connection to server once ROM is ready.\n");
-    while (!TestDestroy())
+/*==============================
+    ServerConnectionThread::WakeServer
+    Lets the server thread know there are packets in the
+    ring for it to send.
+    Must only be called from the USB thread.
+==============================*/
+
+void ServerConnectionThread::WakeServer()
+{
+    // Only bother the server thread if it's not already draining the queue
+    if (global_ring_serverthread_pkt.WakeConsumer())
     {
-        try
+        wxMutexLocker lock(global_serverthread_mutex);
+        ServerConnectionThread* thread = global_serverthread.load();
+        if (thread != NULL)
         {
-            bool workdone = false;
-            NetLibPacket* pkt = NULL;
+            asio::post(*global_asiocontext, [thread]() {
+                thread->DrainOutgoing();
+            });
+        }
+    }
+}
+
+
+/*==============================
+    ServerConnectionThread::DrainOutgoing
+    Sends every packet the USB thread has queued up,
+    batching them into as few syscalls as possible
+==============================*/
+
+void ServerConnectionThread::DrainOutgoing()
+{
+    NetLibPacketPtr pkt;
+    if (this->m_Stopping)
+        return;
+
+    // Mark ourselves idle first, so that anything queued after we finish wakes us again
+    global_ring_serverthread_pkt.Idle();
+    this->m_Handler->BeginBatch();
+    while (global_ring_serverthread_pkt.Pop(pkt))
+        this->SendToServer(pkt.release());
+    if (!this->m_Stopping)
+        this->m_Handler->EndBatch();
+
+    // If the packets need to be acked, make sure the retransmission timer is ticking
+    if (!this->m_Stopping && !this->m_TimerFast && this->m_Handler->HasPendingResends())
+        this->StartTimer();
+}
+
+
+/*==============================
+    ServerConnectionThread::SendToServer
+    Sends a packet from the USB thread to the server
+    @param The packet to send
+==============================*/
+
+void ServerConnectionThread::SendToServer(NetLibPacket* pkt)
+{
+    if (this->m_Stopping)
+    {
+        delete pkt;
+        return;
+    }
+    try
+    {
+        this->m_Handler->SendPacket(pkt);
+    }
+    catch (ClientTimeoutException& e)
+    {
+        (void)e;
+        this->Disconnect("\nServer timed out. Disconnected.\n");
+    }
+}
+
+
+/*==============================
+    ServerConnectionThread::StartRead
+    Waits asynchronously for packets from the server
+==============================*/
 
-            // Check for messages from the USB thread to send to the server
-            while (global_msgqueue_serverthread_pkt.ReceiveTimeout(0, pkt) == wxMSGQUEUE_NO_ERROR)
-                handler->SendPacket(pkt);
+void ServerConnectionThread::StartRead()
+{
+    this->m_Socket->AsyncWait([this](const asio::error_code& error) {
+        this->OnRead(error);
+    });
+}
 
-            // Check for packets from the server and upload it to USB
-            socket->Read(buff, 4096);
-            while (socket->LastReadCount() > 0)
+
+/*==============================
+    ServerConnectionThread::OnRead
+    Drains all the packets the server sent us, in batches, 
+    and uploads them to USB
+    @param The error code of the wait operation
+==============================*/
+
+void ServerConnectionThread::OnRead(const asio::error_code& error)
+{
+    size_t count = MAX_BATCHCOUNT;
+    if (error == asio::error::operation_aborted || this->m_Stopping)
+        return;
+
+    // Parse the packets and pass them to the USB thread, batching any acks we need to send back
+    this->m_Handler->BeginBatch();
+    while (!error && count == MAX_BATCHCOUNT)
+    {
+        count = this->m_Socket->ReadBatch(this->m_RecvSlab, MAX_PACKETSIZE, this->m_RecvSizes, MAX_BATCHCOUNT);
+        for (size_t i=0; i<count; i++)
+        {
+            try
             {
-                pkt = handler->ReadNetLibPacket(buff);
+                NetLibPacket* pkt = this->m_Handler->ReadNetLibPacket(this->m_RecvSlab + i*MAX_PACKETSIZE, this->m_RecvSizes[i]);
                 if (pkt != NULL)
-                    this->TransferPacket(pkt);
-                socket->Read(buff, 4096);
-                workdone = true;
+                    this->TransferPacket(NetLibPacketPtr(pkt));
+            }
+            catch (BadPacketVersionException& e)
+            {
+                this->WriteConsoleError(wxString::Format("\nGot unsupported packet version %d from the server.\n", e.GetVersion()));
+            }
+            catch (ClientTimeoutException& e)
+            {
+                (void)e;
+                this->Disconnect("\nServer timed out. Disconnected.\n");
+                return;
             }
-            if (!workdone)
-                wxMilliSleep(1);
-        }
-        catch (ClientTimeoutException& e)
-        {
-            (void)e;
-            this->WriteConsoleError("\nServer timed out. Disconnected.\n");
-            break;
         }
     }
+    this->m_Handler->EndBatch();
 
-    // Cleanup
-    delete handler;
-    free(buff);
-    delete socket;
-    return NULL;
+    // Wait for more
+    this->StartRead();
+}
+
+
+/*==============================
+    ServerConnectionThread::StartTimer
+    Schedules the next retransmission check. The timer ticks
+    with the handler's timer wheel while packets are waiting
+    for an ack, and rarely otherwise.
+==============================*/
+
+void ServerConnectionThread::StartTimer()
+{
+    this->m_TimerFast = this->m_Handler->HasPendingResends();
+    this->m_Timer->expires_after(std::chrono::milliseconds(this->m_TimerFast ? TIMERWHEEL_TICK : TIME_IDLECHECK));
+    this->m_Timer->async_wait([this](const asio::error_code& error) {
+        this->OnTimer(error);
+    });
+}
+
+
+/*==============================
+    ServerConnectionThread::OnTimer
+    Resends reliable packets that were not acknowledged in time
+    @param The error code of the timer
+==============================*/
+
+void ServerConnectionThread::OnTimer(const asio::error_code& error)
+{
+    if (error == asio::error::operation_aborted || this->m_Stopping)
+        return;
+    try
+    {
+        this->m_Handler->ResendMissingPackets();
+    }
+    catch (ClientTimeoutException& e)
+    {
+        (void)e;
+        this->Disconnect("\nServer timed out. Disconnected.\n");
+        return;
+    }
+    this->StartTimer();
+}
+
+
+/*==============================
+    ServerConnectionThread::Disconnect
+    Stops the connection to the server
+    @param The reason to print to the console
+==============================*/
+
+void ServerConnectionThread::Disconnect(wxString reason)
+{
+    this->WriteConsoleError(reason);
+    this->m_Stopping = true;
 }
 
 
 /*==============================
     ServerConnectionThread::TransferPacket
     Transfers a packet from the server to the USB thread
-    @param The packet to transfer
+    @param The packet to transfer, which the USB thread takes ownership of
 ==============================*/
 
-void ServerConnectionThread::TransferPacket(NetLibPacket* pkt)
+void ServerConnectionThread::TransferPacket(NetLibPacketPtr pkt)
 {
-    global_msgqueue_usbthread_pkt.Post(NetLibPacket::FromBytes(pkt->GetAsBytes()));
+    if (!global_ring_usbthread_pkt.Push(std::move(pkt)))
+    {
+        global_stats_server.CountDrop();
+        this->WriteConsoleError("\nUSB queue is full, dropped a packet from the server.\n");
+        return;
+    }
+    global_ring_usbthread_pkt.WakeConsumer();
 }
 
 
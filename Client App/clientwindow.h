@@ -20,8 +20,27 @@ typedef struct IUnknown IUnknown;
 #include <wx/sizer.h>
 #include <wx/statusbr.h>
 #include <wx/frame.h>
+#include <wx/thread.h>
+#include <wx/timer.h>
+#include <stdio.h>
 #include <stdint.h>
+#include <memory>
+#include <deque>
+#include <vector>
 #include "packets.h"
+#include "ringbuffer.h"
+#include "stats.h"
+
+
+/******************************
+             Macros
+******************************/
+
+// The max number of packets waiting to cross between the USB and server threads, must be a power of two
+#define RING_PACKETS  1024
+
+// The max number of bytes of N64 text waiting to be added to the console, must be a power of two
+#define RING_CONSOLE  (1024*1024)
 
 
 /******************************
@@ -34,6 +53,14 @@ typedef enum {
     CLSTATUS_DEAD,
 } ClientDeviceStatus;
 
+typedef SPSCRing<NetLibPacketPtr, RING_PACKETS> PacketRing;
+typedef SPSCByteRing<RING_CONSOLE> ConsoleRing;
+
+typedef struct {
+    size_t depth;
+    size_t highwater;
+} PacketQueueStats;
+
 
 /*********************************
              Classes
@@ -61,8 +88,24 @@ class ClientWindow : public wxFrame
         DeviceThread* m_DeviceThread;
         ClientDeviceStatus m_DeviceStatus;
         ServerConnectionThread* m_ServerThread;
+        wxTimer* m_Timer_Console;
+        wxTimer* m_Timer_Stats;
+        std::vector<uint8_t> m_ConsoleBuffer;
+        std::deque<long> m_ConsoleLines;
+        long m_ConsoleLineLength;
+        size_t m_ConsoleDropped;
+        FILE* m_ConsoleLog;
+        FILE* m_StatsLog;
+        TransportStatsSnapshot m_LastStats_USB;
+        std::chrono::steady_clock::time_point m_LastStatsTime;
 
         void ThreadEvent(wxThreadEvent& event);
+        void m_Timer_Console_OnTimer(wxTimerEvent& event);
+        void m_Timer_Stats_OnTimer(wxTimerEvent& event);
+        void UpdateStats();
+        void FlushConsole();
+        void ClearConsole();
+        void AppendConsole(wxString text, bool error);
         void StartThread_Device();
         void StartThread_Server();
         void StopThread_Device();
@@ -85,6 +128,11 @@ class ClientWindow : public wxFrame
         void SetPortNumber(int port);
         wxString GetAddress();
         int GetPort();
+        PacketQueueStats GetQueueStats_ToServer();
+        PacketQueueStats GetQueueStats_ToDevice();
+        size_t GetConsoleDropped();
+        TransportStatsSnapshot GetStats_Server();
+        TransportStatsSnapshot GetStats_USB();
 };
 
 // Thread for handling USB communication
@@ -94,10 +142,16 @@ class DeviceThread : public wxThread
         ClientWindow* m_Window;
         UploadThread* m_UploadThread;
         bool m_FirstPrint;
+        uint32_t m_BundleSize;
+        uint8_t* m_BundleBuffer;
 
         bool HandleMainInput(wxString* rompath);
+        bool UploadPackets();
+        void SendBundle(uint32_t size, int count);
+        void SendData(uint8_t type, uint8_t* data, uint32_t size);
         void ParseUSB_TextPacket(uint8_t* buff, uint32_t size);
-        void ParseUSB_NetLibPacket(uint8_t* buff);
+        void ParseUSB_NetLibPacket(uint8_t* buff, uint32_t size);
+        void ParseUSB_NetLibBundlePacket(uint8_t* buff, uint32_t size);
         void ParseUSB_HeartbeatPacket(uint8_t* buff, uint32_t size);
         void ClearConsole();
         void WriteConsole(wxString str);
@@ -138,13 +192,26 @@ class UploadThread : public wxThread
 class ServerConnectionThread : public wxThread
 {
     private:
-        udp::socket* m_Socket;
+        ASIOSocket* m_Socket;
+        UDPHandler* m_Handler;
+        asio::steady_timer* m_Timer;
         ClientWindow* m_Window;
-
-        void HandleMainInput();
-        void TransferPacket(NetLibPacket* pkt);
+        uint8_t* m_RecvSlab;
+        size_t m_RecvSizes[MAX_BATCHCOUNT];
+        bool m_Stopping;
+        bool m_TimerFast;
+
+        void StartRead();
+        void StartTimer();
+        void OnRead(const asio::error_code& error);
+        void OnTimer(const asio::error_code& error);
+        void DrainOutgoing();
+        void SendToServer(NetLibPacket* pkt);
+        void Disconnect(wxString reason);
+        void TransferPacket(NetLibPacketPtr pkt);
         void WriteConsole(wxString str);
         void WriteConsoleError(wxString str);
+        static void WakeServer();
 
     protected:
 
@@ -152,5 +219,7 @@ class ServerConnectionThread : public wxThread
         ServerConnectionThread(ClientWindow* win);
         ~ServerConnectionThread();
 
+        static bool PostPacket(NetLibPacketPtr pkt);
+        static void RetryPosted();
         virtual void* Entry() wxOVERRIDE;
 };
\ No newline at end of file
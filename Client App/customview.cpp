@@ -1,16 +1,22 @@
 /***************************************************************
                          customview.cpp
 
-A custom wxDataViewListCtrl that supports markup in text entries
+A custom wxDataViewCtrl that supports markup in text entries,
+and the virtual model that feeds it the server list
 ***************************************************************/
 
 #include "customview.h"
 
 
+/*=============================================================
+                        Custom Data View
+=============================================================*/
+
 /*==============================
     CustomDataView::AppendCustomTextColumn
-    Initializes the class
+    Appends a text column that supports markup
     @param  The label to add
+    @param  The model column to display
     @param  The cell mode
     @param  The width of the column
     @param  The alignment of the text
@@ -18,12 +24,191 @@ A custom wxDataViewListCtrl that supports markup in text entries
     @return The column that text was added to
 ==============================*/
 
-wxDataViewColumn* CustomDataView::AppendCustomTextColumn(const wxString &label, wxDataViewCellMode mode, int width, wxAlignment align, int flags)
+wxDataViewColumn* CustomDataView::AppendCustomTextColumn(const wxString &label, unsigned int model_column, wxDataViewCellMode mode, int width, wxAlignment align, int flags)
 {
     wxDataViewTextRenderer* renderer = new wxDataViewTextRenderer(wxT("string"), mode);
     renderer->EnableMarkup();
-    GetStore()->AppendColumn(wxT("string"));
-    wxDataViewColumn *ret = new wxDataViewColumn(label, renderer, GetColumnCount(), width, align, flags);
+    wxDataViewColumn *ret = new wxDataViewColumn(label, renderer, model_column, width, align, flags);
     wxDataViewCtrl::AppendColumn(ret);
     return ret;
-}
\ No newline at end of file
+}
+
+
+/*=============================================================
+                       Server List Model
+=============================================================*/
+
+/*==============================
+    ServerListModel::GetColumnCount
+    Gets the number of columns in the model
+    @return The number of columns
+==============================*/
+
+unsigned int ServerListModel::GetColumnCount() const
+{
+    return SERVERCOLUMN_COUNT;
+}
+
+
+/*==============================
+    ServerListModel::GetColumnType
+    Gets the type of a column in the model
+    @param  The column
+    @return The column's variant type
+==============================*/
+
+wxString ServerListModel::GetColumnType(unsigned int col) const
+{
+    (void)col;
+    return wxT("string");
+}
+
+
+/*==============================
+    ServerListModel::GetValueByRow
+    Gets the text to show in a cell
+    @param The variant to store the text in
+    @param The row of the cell
+    @param The column of the cell
+==============================*/
+
+void ServerListModel::GetValueByRow(wxVariant &variant, unsigned int row, unsigned int col) const
+{
+    ServerListEntry* server = const_cast<ServerList*>(&this->m_List)->Get(row);
+    if (server == NULL)
+    {
+        variant = wxString("");
+        return;
+    }
+    switch (col)
+    {
+        case SERVERCOLUMN_PING:
+            variant = wxString::Format("%lld", (long long)server->ping);
+            break;
+        case SERVERCOLUMN_PLAYERS:
+            variant = wxString::Format("%d/%d", server->playercount, server->maxplayers);
+            break;
+        case SERVERCOLUMN_ADDRESS:
+            variant = wxString::FromUTF8(server->fulladdress.c_str());
+            break;
+        case SERVERCOLUMN_ROM:
+        {
+            wxString romname = wxString::FromUTF8(server->romname.c_str());
+            switch (server->romstatus)
+            {
+                case ROMSTATUS_MATCHES:     variant = wxString::Format("<span color=\"#008000\">%s</span>", romname); break;
+                case ROMSTATUS_DIFFERS:     variant = wxString::Format("<span color=\"#FF8000\">%s</span>", romname); break;
+                case ROMSTATUS_UNAVAILABLE: variant = wxString::Format("<span color=\"#800000\">%s</span>", romname); break;
+                default:                    variant = romname; break;
+            }
+            break;
+        }
+        case SERVERCOLUMN_NAME:
+            variant = wxString::FromUTF8(server->name.c_str());
+            break;
+        default:
+            variant = wxString("");
+            break;
+    }
+}
+
+
+/*==============================
+    ServerListModel::SetValueByRow
+    Changes the value of a cell. The list is read only.
+    @param  The new value
+    @param  The row of the cell
+    @param  The column of the cell
+    @return Whether the value was changed
+==============================*/
+
+bool ServerListModel::SetValueByRow(const wxVariant &variant, unsigned int row, unsigned int col)
+{
+    (void)variant;
+    (void)row;
+    (void)col;
+    return false;
+}
+
+
+/*==============================
+    ServerListModel::GetList
+    Gets the server list the model shows
+    @return The server list
+==============================*/
+
+ServerList* ServerListModel::GetList()
+{
+    return &this->m_List;
+}
+
+
+/*==============================
+    ServerListModel::GetServer
+    Gets the server for a given item
+    @param  The item
+    @return The server, or NULL if the item isn't valid
+==============================*/
+
+ServerListEntry* ServerListModel::GetServer(const wxDataViewItem &item)
+{
+    if (!item.IsOk())
+        return NULL;
+    return this->m_List.Get(this->GetRow(item));
+}
+
+
+/*==============================
+    ServerListModel::AppendServers
+    Adds a batch of servers, notifying the view once
+    for the whole batch
+    @param The servers to add, which are moved out of the vector
+==============================*/
+
+void ServerListModel::AppendServers(std::vector<ServerListEntry>& batch)
+{
+    if (batch.empty())
+        return;
+    this->m_List.Append(batch);
+    this->Reset(this->m_List.Count());
+}
+
+
+/*==============================
+    ServerListModel::UpdatePings
+    Changes the ping of a batch of servers, notifying the view
+    once for the whole batch
+    @param The new pings, keyed by server address:port
+==============================*/
+
+void ServerListModel::UpdatePings(const std::unordered_map<std::string, int64_t>& pings)
+{
+    if (this->m_List.UpdatePings(pings))
+        this->Reset(this->m_List.Count());
+}
+
+
+/*==============================
+    ServerListModel::ClearServers
+    Removes all the servers
+==============================*/
+
+void ServerListModel::ClearServers()
+{
+    this->m_List.Clear();
+    this->Reset(0);
+}
+
+
+/*==============================
+    ServerListModel::SortServers
+    Sorts the servers in place
+    @param The column to sort by
+    @param Whether to sort in ascending order
+==============================*/
+
+void ServerListModel::SortServers(int column, bool ascending)
+{
+    this->m_List.Sort(column, ascending);
+    this->Reset(this->m_List.Count());
+}
@@ -3,15 +3,37 @@
 typedef struct IUnknown IUnknown;
 
 #include <wx/dataview.h>
+#include "serverlist.h"
 
 
 /*********************************
              Classes
 *********************************/
 
-class CustomDataView : public wxDataViewListCtrl
+class CustomDataView : public wxDataViewCtrl
 {
     public:
-        CustomDataView(wxWindow *parent, wxWindowID id, const wxPoint &pos=wxDefaultPosition, const wxSize &size=wxDefaultSize, long style=wxDV_ROW_LINES, const wxValidator &validator=wxDefaultValidator) : wxDataViewListCtrl(parent, id, pos, size, style, validator) {};
-        wxDataViewColumn* AppendCustomTextColumn(const wxString &label, wxDataViewCellMode mode, int width, wxAlignment align, int flags);
-};
\ No newline at end of file
+        CustomDataView(wxWindow *parent, wxWindowID id, const wxPoint &pos=wxDefaultPosition, const wxSize &size=wxDefaultSize, long style=wxDV_ROW_LINES, const wxValidator &validator=wxDefaultValidator) : wxDataViewCtrl(parent, id, pos, size, style, validator) {};
+        wxDataViewColumn* AppendCustomTextColumn(const wxString &label, unsigned int model_column, wxDataViewCellMode mode, int width, wxAlignment align, int flags);
+};
+
+// Virtual model that shows a ServerList, so only the visible rows are ever turned into text
+class ServerListModel : public wxDataViewVirtualListModel
+{
+    private:
+        ServerList m_List;
+
+    public:
+        ServerListModel() : wxDataViewVirtualListModel(0) {};
+        virtual unsigned int GetColumnCount() const wxOVERRIDE;
+        virtual wxString GetColumnType(unsigned int col) const wxOVERRIDE;
+        virtual void GetValueByRow(wxVariant &variant, unsigned int row, unsigned int col) const wxOVERRIDE;
+        virtual bool SetValueByRow(const wxVariant &variant, unsigned int row, unsigned int col) wxOVERRIDE;
+
+        ServerList* GetList();
+        ServerListEntry* GetServer(const wxDataViewItem &item);
+        void AppendServers(std::vector<ServerListEntry>& batch);
+        void UpdatePings(const std::unordered_map<std::string, int64_t>& pings);
+        void ClearServers();
+        void SortServers(int column, bool ascending);
+};
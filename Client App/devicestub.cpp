@@ -0,0 +1,470 @@
+/***************************************************************
+                          devicestub.cpp
+
+A fake flashcart that implements the device.h API, for running
+the relay without any hardware. The simulated N64 boots when a
+ROM is uploaded, announces that it can receive bundles, says
+hello to the server, and then sends every NetLib packet it
+receives back to the host.
+If NETLIB_USBSOCKET is set to a path, the stub instead listens
+on a Unix socket there, and passes USB transfers to and from a
+host build of the N64 library (see N64 Library/Host), which
+connects to it when the ROM is uploaded.
+***************************************************************/
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include "Include/device.h"
+#include "devicestub.h"
+
+
+/******************************
+             Macros
+******************************/
+
+#define DATATYPE_NETPACKET        0x27
+#define DATATYPE_NETPACKETBUNDLE  0x28
+
+#define STUB_HEADERSIZE  18
+#define STUB_BUNDLESIZE  (8*1024*1024)
+
+#define STUB_BOOTTEXT "NetLib stub device booted\n"
+
+
+/******************************
+             Types
+******************************/
+
+typedef struct {
+    uint32_t header;
+    std::vector<uint8_t> data;
+} StubTransfer;
+
+
+/******************************
+            Globals
+******************************/
+
+static bool        global_stub_open = false;
+static CartType    global_stub_cart = CART_NONE;
+static CICType     global_stub_cic = CIC_NONE;
+static SaveType    global_stub_save = SAVE_NONE;
+static ProtocolVer global_stub_protocol = PROTOCOL_VERSION1;
+static char*       global_stub_rom = NULL;
+static float       global_stub_progress = 0;
+static bool        global_stub_cancelled = false;
+
+static std::deque<StubTransfer> global_stub_outgoing;
+static DeviceStubStats global_stub_stats = {0, 0, 0, 0};
+
+// Simulated flashcart socket, for when the N64 side is a host build of the N64 library
+static std::string          global_stub_sockpath = "";
+static int                  global_stub_listener = -1;
+static int                  global_stub_socket = -1;
+static std::vector<uint8_t> global_stub_received;
+
+
+/*=============================================================
+                       Simulated N64
+=============================================================*/
+
+/*==============================
+    stub_write
+    Queues a USB transfer from the simulated N64 to the host
+    @param The data type
+    @param The data to send
+    @param The size of the data
+==============================*/
+
+static void stub_write(int type, const uint8_t* data, uint32_t size)
+{
+    StubTransfer transfer;
+    transfer.header = ((type & 0xFF) << 24) | (size & 0xFFFFFF);
+    transfer.data.assign(data, data + size);
+    global_stub_outgoing.push_back(transfer);
+}
+
+
+/*==============================
+    stub_boot
+    Simulates the N64 booting a NetLib ROM
+==============================*/
+
+static void stub_boot()
+{
+    uint8_t heartbeat[4] = {0x00, (uint8_t)USBPROTOCOL_LATEST, 0x00, 0x01};
+    uint8_t bundlesize[4] = {
+        (STUB_BUNDLESIZE >> 24) & 0xFF, (STUB_BUNDLESIZE >> 16) & 0xFF,
+        (STUB_BUNDLESIZE >> 8) & 0xFF, STUB_BUNDLESIZE & 0xFF
+    };
+    uint8_t hello[STUB_HEADERSIZE] = {'N', 'L', 'P', 1};
+    global_stub_outgoing.clear();
+    stub_write(DATATYPE_HEARTBEAT, heartbeat, sizeof(heartbeat));
+    stub_write(DATATYPE_NETPACKETBUNDLE, bundlesize, sizeof(bundlesize));
+    stub_write(DATATYPE_TEXT, (const uint8_t*)STUB_BOOTTEXT, sizeof(STUB_BOOTTEXT)-1);
+
+    // Send an empty packet so the server learns about us
+    stub_write(DATATYPE_NETPACKET, hello, sizeof(hello));
+    global_stub_stats.packets_out++;
+}
+
+
+/*==============================
+    stub_handlepackets
+    Simulates the N64 handling the NetLib packets in a transfer,
+    by sending each one back to the host
+    @param The packet data
+    @param The size of the data
+==============================*/
+
+static void stub_handlepackets(const uint8_t* data, uint32_t size)
+{
+    while (size >= STUB_HEADERSIZE && memcmp(data, "NLP", 3) == 0)
+    {
+        uint32_t pktsize = STUB_HEADERSIZE + ((data[16] << 8) | data[17]);
+        if (pktsize > size)
+            break;
+        global_stub_stats.packets_in++;
+        global_stub_stats.packets_out++;
+        stub_write(DATATYPE_NETPACKET, data, pktsize);
+        data += pktsize;
+        size -= pktsize;
+    }
+}
+
+
+/*==============================
+    stub_socketsend
+    Sends a USB transfer to the host build of the N64 library.
+    Each transfer is a big endian USB header followed by the data
+    @param  The data type
+    @param  The data to send
+    @param  The size of the data
+    @return Whether the transfer was sent
+==============================*/
+
+static bool stub_socketsend(int type, const uint8_t* data, uint32_t size)
+{
+    uint32_t header = ((type & 0xFF) << 24) | (size & 0xFFFFFF);
+    uint8_t headerbytes[4] = {(uint8_t)(header >> 24), (uint8_t)(header >> 16), (uint8_t)(header >> 8), (uint8_t)header};
+    std::vector<uint8_t> transfer(headerbytes, headerbytes + 4);
+    transfer.insert(transfer.end(), data, data + size);
+    for (size_t sent = 0; sent < transfer.size();)
+    {
+        ssize_t done = send(global_stub_socket, transfer.data() + sent, transfer.size() - sent, MSG_NOSIGNAL);
+        if (done <= 0)
+            return false;
+        sent += done;
+    }
+    return true;
+}
+
+
+/*==============================
+    stub_socketreceive
+    Reads whatever the host build of the N64 library has sent,
+    without blocking, and hands back the oldest full transfer
+    @param  A pointer to store the USB header in
+    @param  A pointer to store the data in, which the caller frees
+    @return DEVICEERR_OK, even if there was nothing to receive,
+            or an error if the socket failed
+==============================*/
+
+static DeviceError stub_socketreceive(uint32_t* dataheader, byte** buff)
+{
+    uint8_t chunk[4096];
+    ssize_t done;
+    uint32_t size;
+
+    // Grab everything that's waiting on the socket
+    while ((done = recv(global_stub_socket, chunk, sizeof(chunk), MSG_DONTWAIT)) > 0)
+        global_stub_received.insert(global_stub_received.end(), chunk, chunk + done);
+    if (done == 0) // The N64 program closed, treat it like the USB being unplugged
+    {
+        global_stub_open = false;
+        return DEVICEERR_OK;
+    }
+    if (done < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        return DEVICEERR_READFAIL;
+
+    // Check we have a whole transfer
+    if (global_stub_received.size() < 4)
+        return DEVICEERR_OK;
+    size = (global_stub_received[1] << 16) | (global_stub_received[2] << 8) | global_stub_received[3];
+    if (global_stub_received.size() < 4 + size)
+        return DEVICEERR_OK;
+
+    // Hand it over
+    *buff = (byte*)malloc(size > 0 ? size : 1);
+    if (*buff == NULL)
+        return DEVICEERR_MALLOCFAIL;
+    memcpy(*buff, global_stub_received.data() + 4, size);
+    *dataheader = (global_stub_received[0] << 24) | size;
+    global_stub_received.erase(global_stub_received.begin(), global_stub_received.begin() + 4 + size);
+    global_stub_stats.transfers_out++;
+    return DEVICEERR_OK;
+}
+
+
+/*==============================
+    devicestub_getstats
+    Gets how much traffic the simulated N64 has seen
+    @return The stub statistics
+==============================*/
+
+DeviceStubStats devicestub_getstats()
+{
+    return global_stub_stats;
+}
+
+
+/*=============================================================
+                        Device API
+=============================================================*/
+
+void device_initialize()
+{
+    global_stub_open = false;
+    global_stub_cart = CART_NONE;
+    global_stub_protocol = PROTOCOL_VERSION1;
+    global_stub_outgoing.clear();
+}
+
+DeviceError device_find()
+{
+    global_stub_cart = CART_SC64;
+    return DEVICEERR_OK;
+}
+
+DeviceError device_open()
+{
+    const char* path = getenv("NETLIB_USBSOCKET");
+    if (path != NULL && path[0] != '\0')
+    {
+        struct sockaddr_un addr;
+        if (strlen(path) >= sizeof(addr.sun_path))
+            return DEVICEERR_CANTOPEN;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path);
+        unlink(path);
+        global_stub_listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (global_stub_listener < 0 || bind(global_stub_listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(global_stub_listener, 1) != 0)
+        {
+            device_close();
+            return DEVICEERR_CANTOPEN;
+        }
+        global_stub_sockpath = path;
+    }
+    global_stub_open = true;
+    return DEVICEERR_OK;
+}
+
+uint32_t device_getmaxromsize()
+{
+    return 64*1024*1024;
+}
+
+uint32_t device_rompadding(uint32_t romsize)
+{
+    return calc_padsize(romsize);
+}
+
+bool device_explicitcic()
+{
+    global_stub_cic = CIC_6102;
+    return true;
+}
+
+bool device_isopen()
+{
+    return global_stub_open;
+}
+
+DeviceError device_testdebug()
+{
+    return DEVICEERR_OK;
+}
+
+DeviceError device_sendrom(FILE* rom, uint32_t filesize)
+{
+    (void)rom;
+    (void)filesize;
+    global_stub_cancelled = false;
+    global_stub_progress = 100.0f;
+
+    // With a socket, "booting" means waiting for the host build of the N64 library to connect
+    if (global_stub_listener >= 0)
+    {
+        if (global_stub_socket >= 0)
+            close(global_stub_socket);
+        global_stub_received.clear();
+        global_stub_socket = accept(global_stub_listener, NULL, NULL);
+        return (global_stub_socket >= 0) ? DEVICEERR_OK : DEVICEERR_TIMEOUT;
+    }
+    stub_boot();
+    return DEVICEERR_OK;
+}
+
+DeviceError device_senddata(USBDataType datatype, byte* data, uint32_t size)
+{
+    if (!global_stub_open)
+        return DEVICEERR_WRITEFAIL;
+    global_stub_stats.transfers_in++;
+    if (global_stub_listener >= 0)
+    {
+        if (global_stub_socket >= 0 && !stub_socketsend((int)datatype, data, size))
+            return DEVICEERR_WRITEFAIL;
+        return DEVICEERR_OK;
+    }
+    if ((int)datatype == DATATYPE_NETPACKET || (int)datatype == DATATYPE_NETPACKETBUNDLE)
+        stub_handlepackets(data, size);
+    return DEVICEERR_OK;
+}
+
+DeviceError device_receivedata(uint32_t* dataheader, byte** buff)
+{
+    *dataheader = 0;
+    *buff = NULL;
+    if (global_stub_listener >= 0)
+        return (global_stub_socket >= 0) ? stub_socketreceive(dataheader, buff) : DEVICEERR_OK;
+    if (global_stub_outgoing.empty())
+        return DEVICEERR_OK;
+
+    // Hand the oldest transfer over, the caller frees the buffer
+    StubTransfer& transfer = global_stub_outgoing.front();
+    *buff = (byte*)malloc(transfer.data.size() > 0 ? transfer.data.size() : 1);
+    if (*buff == NULL)
+        return DEVICEERR_MALLOCFAIL;
+    memcpy(*buff, transfer.data.data(), transfer.data.size());
+    *dataheader = transfer.header;
+    global_stub_outgoing.pop_front();
+    global_stub_stats.transfers_out++;
+    return DEVICEERR_OK;
+}
+
+DeviceError device_close()
+{
+    global_stub_open = false;
+    global_stub_outgoing.clear();
+    if (global_stub_socket >= 0)
+        close(global_stub_socket);
+    if (global_stub_listener >= 0)
+        close(global_stub_listener);
+    if (global_stub_sockpath != "")
+        unlink(global_stub_sockpath.c_str());
+    global_stub_socket = -1;
+    global_stub_listener = -1;
+    global_stub_sockpath = "";
+    global_stub_received.clear();
+    return DEVICEERR_OK;
+}
+
+bool device_setrom(const char* path)
+{
+    free(global_stub_rom);
+    global_stub_rom = strdup(path);
+    return global_stub_rom != NULL;
+}
+
+void device_setcart(CartType cart)
+{
+    global_stub_cart = cart;
+}
+
+void device_setcic(CICType cic)
+{
+    global_stub_cic = cic;
+}
+
+void device_setsave(SaveType save)
+{
+    global_stub_save = save;
+}
+
+char* device_getrom()
+{
+    return global_stub_rom;
+}
+
+CartType device_getcart()
+{
+    return global_stub_cart;
+}
+
+CICType device_getcic()
+{
+    return global_stub_cic;
+}
+
+SaveType device_getsave()
+{
+    return global_stub_save;
+}
+
+void device_cancelupload()
+{
+    global_stub_cancelled = true;
+}
+
+bool device_uploadcancelled()
+{
+    return global_stub_cancelled;
+}
+
+void device_setuploadprogress(float progress)
+{
+    global_stub_progress = progress;
+}
+
+float device_getuploadprogress()
+{
+    return global_stub_progress;
+}
+
+void device_setprotocol(ProtocolVer version)
+{
+    global_stub_protocol = version;
+}
+
+ProtocolVer device_getprotocol()
+{
+    return global_stub_protocol;
+}
+
+uint32_t swap_endian(uint32_t val)
+{
+    return ((val << 24)) | ((val << 8) & 0x00FF0000) | ((val >> 8) & 0x0000FF00) | ((val >> 24));
+}
+
+uint32_t calc_padsize(uint32_t size)
+{
+    size--;
+    size |= size >> 1;
+    size |= size >> 2;
+    size |= size >> 4;
+    size |= size >> 8;
+    size |= size >> 16;
+    return size + 1;
+}
+
+uint32_t romhash(byte* buff, uint32_t len)
+{
+    uint32_t hash = 0;
+    for (uint32_t i=0; i<len; i++)
+        hash += buff[i];
+    return hash;
+}
+
+CICType cic_from_bootcode(byte* bootcode)
+{
+    (void)bootcode;
+    return CIC_6102;
+}
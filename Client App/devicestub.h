@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+
+/******************************
+             Types
+******************************/
+
+typedef struct {
+    uint64_t transfers_in;   // USB transfers from the host to the simulated N64
+    uint64_t transfers_out;  // USB transfers from the simulated N64 to the host
+    uint64_t packets_in;     // NetLib packets the simulated N64 received
+    uint64_t packets_out;    // NetLib packets the simulated N64 sent
+} DeviceStubStats;
+
+
+/*********************************
+       Function Prototypes
+*********************************/
+
+DeviceStubStats devicestub_getstats();
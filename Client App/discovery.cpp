@@ -0,0 +1,439 @@
+/***************************************************************
+                          discovery.cpp
+
+Finds out which of the servers that the master server listed
+are actually reachable, and how long it takes to reach them.
+Probes are sent to every server at a steady rate instead of one
+at a time, and each server gets several probes so that a single
+slow reply doesn't decide its ping.
+***************************************************************/
+
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "discovery.h"
+#include "helper.h"
+
+
+/******************************
+             Macros
+******************************/
+
+// The highest sequence number used for probes. Servers start counting from zero, so
+// staying in the lower half of the sequence space makes sure they ack what we send
+#define DISCOVERY_MAXSEQNUM  0x7FFF
+
+
+/*==============================
+    ServerDiscovery (Constructor)
+    Initializes the class
+    @param The socket to send probes through
+    @param The max number of probes to send per second
+==============================*/
+
+ServerDiscovery::ServerDiscovery(ASIOSocket* socket, double rate)
+{
+    this->m_Socket = socket;
+    this->m_Rate = (rate > 0) ? rate : DISCOVERY_DEFAULTRATE;
+    this->m_Tokens = 1;
+    this->m_LastRefill = std::chrono::steady_clock::now();
+    this->m_SeqNum = 0;
+}
+
+
+/*==============================
+    ServerDiscovery (Destructor)
+    Cleans up the class before deletion
+==============================*/
+
+ServerDiscovery::~ServerDiscovery()
+{
+    // Nothing here
+}
+
+
+/*==============================
+    ServerDiscovery::Add
+    Queues a server to be probed. Addresses that aren't plain
+    IPs are resolved in the background.
+    @param The server's address:port
+==============================*/
+
+void ServerDiscovery::Add(std::string fulladdress)
+{
+    std::string address;
+    int port;
+    asio::error_code error;
+    asio::ip::address ip;
+    address_split(fulladdress, &address, &port);
+
+    // Avoid a DNS lookup if we can
+    ip = asio::ip::make_address(address, error);
+    if (!error)
+    {
+        this->AddEndpoint(fulladdress, udp::endpoint(ip, port));
+        return;
+    }
+    this->m_Resolving.push_back(std::make_pair(fulladdress, std::async(std::launch::async, &ASIOSocket::Resolve, address, port)));
+}
+
+
+/*==============================
+    ServerDiscovery::AddEndpoint
+    Queues a resolved server to be probed
+    @param The server's address:port
+    @param The server's endpoint
+==============================*/
+
+void ServerDiscovery::AddEndpoint(std::string fulladdress, const udp::endpoint& endpoint)
+{
+    Probe probe;
+
+    // Ignore servers that are listed twice
+    if (this->m_Probes.find(endpoint) != this->m_Probes.end())
+        return;
+    probe.fulladdress = fulladdress;
+    probe.found = false;
+    probe.done = false;
+    probe.sample = 0;
+    probe.attempts = 0;
+    probe.queued = false;
+    this->m_Probes[endpoint] = probe;
+    this->QueueProbe(endpoint, &this->m_Probes[endpoint]);
+}
+
+
+/*==============================
+    ServerDiscovery::QueueProbe
+    Queues a probe to be sent once the rate limit allows it
+    @param The server's endpoint
+    @param The server's probe data
+==============================*/
+
+void ServerDiscovery::QueueProbe(const udp::endpoint& endpoint, Probe* probe)
+{
+    if (probe->queued)
+        return;
+    probe->queued = true;
+    this->m_SendQueue.push_back(endpoint);
+}
+
+
+/*==============================
+    ServerDiscovery::SendProbe
+    Sends a discovery packet to a server
+    @param The server's endpoint
+    @param The server's probe data
+    @param The current time
+==============================*/
+
+void ServerDiscovery::SendProbe(const udp::endpoint& endpoint, Probe* probe, TimePoint now)
+{
+    ProbeDeadline deadline;
+    uint16_t size;
+
+    // Pick a sequence number so that the reply can be matched to this attempt
+    this->m_SeqNum = (this->m_SeqNum % DISCOVERY_MAXSEQNUM) + 1;
+    S64Packet pkt("DISCOVER", probe->fulladdress.length(), (uint8_t*)probe->fulladdress.data(), FLAG_UNRELIABLE);
+    pkt.SetSequenceNumber(this->m_SeqNum);
+    size = pkt.WriteAsBytes(this->m_SendBuffer, sizeof(this->m_SendBuffer));
+    this->m_Socket->Send(endpoint, this->m_SendBuffer, size);
+
+    // Remember when it was sent
+    probe->seqnums[probe->attempts] = this->m_SeqNum;
+    probe->sendtimes[probe->attempts] = now;
+    probe->attempts++;
+    deadline.deadline = now + std::chrono::milliseconds(DISCOVERY_TIMEOUT);
+    deadline.endpoint = endpoint;
+    deadline.seqnum = this->m_SeqNum;
+    this->m_Deadlines.push_back(deadline);
+}
+
+
+/*==============================
+    ServerDiscovery::FinishSample
+    Moves on to the next sample for a server, or reports the
+    median ping if all the samples were taken
+    @param The server's endpoint
+    @param The server's probe data
+==============================*/
+
+void ServerDiscovery::FinishSample(const udp::endpoint& endpoint, Probe* probe)
+{
+    DiscoveryEvent evt;
+    probe->sample++;
+    probe->attempts = 0;
+    if (probe->sample < DISCOVERY_SAMPLES)
+    {
+        this->QueueProbe(endpoint, probe);
+        return;
+    }
+
+    // All done, report the median
+    probe->done = true;
+    std::sort(probe->pings.begin(), probe->pings.end());
+    evt.type = DISCOVERYEVENT_PINGED;
+    evt.fulladdress = probe->fulladdress;
+    evt.ping = probe->pings[probe->pings.size()/2];
+    this->m_Events.push_back(evt);
+}
+
+
+/*==============================
+    ServerDiscovery::HandleDatagram
+    Checks if a datagram is a reply to one of our probes
+    @param  Who sent the datagram
+    @param  The datagram
+    @param  The size of the datagram
+    @return Whether the datagram came from a server being
+            probed, in which case it was consumed
+==============================*/
+
+bool ServerDiscovery::HandleDatagram(const udp::endpoint& sender, const uint8_t* data, size_t size)
+{
+    TimePoint now = std::chrono::steady_clock::now();
+    S64PacketView view;
+    TimePoint sendtime;
+    double ping;
+    int i;
+    std::unordered_map<udp::endpoint, Probe>::iterator it = this->m_Probes.find(sender);
+    if (it == this->m_Probes.end())
+        return false;
+    Probe* probe = &it->second;
+
+    // Ignore anything that isn't a reply to a probe which is still waiting for one
+    try
+    {
+        if (!view.Parse(data, size))
+            return true;
+    }
+    catch (BadPacketVersionException& e)
+    {
+        (void)e;
+        return true;
+    }
+    if (probe->done || probe->attempts == 0 || view.GetTypeLength() != 8 || memcmp(view.GetTypeData(), "DISCOVER", 8) != 0)
+        return true;
+
+    // Time the reply against the attempt it acknowledges. Anything else is a late reply to an earlier sample, which would give a bogus ping
+    for (i=0; i<probe->attempts; i++)
+        if (probe->seqnums[i] == view.GetAck())
+            break;
+    if (i == probe->attempts)
+        return true;
+    sendtime = probe->sendtimes[i];
+    ping = std::chrono::duration<double, std::milli>(now - sendtime).count();
+    probe->pings.push_back(ping);
+
+    // Report the server as soon as it first replies, the ping gets refined as more samples come in
+    if (!probe->found)
+    {
+        DiscoveryEvent evt;
+        probe->found = true;
+        evt.type = DISCOVERYEVENT_FOUND;
+        evt.fulladdress = probe->fulladdress;
+        evt.ping = ping;
+        if (view.GetSize() > 0)
+            evt.data.assign(view.GetData(), view.GetData() + view.GetSize());
+        this->m_Events.push_back(evt);
+    }
+    this->FinishSample(sender, probe);
+    return true;
+}
+
+
+/*==============================
+    ServerDiscovery::CheckResolves
+    Collects the servers that finished resolving in the background
+==============================*/
+
+void ServerDiscovery::CheckResolves()
+{
+    for (size_t i=0; i<this->m_Resolving.size();)
+    {
+        std::pair<std::string, std::future<udp::endpoint>>& resolve = this->m_Resolving[i];
+        if (resolve.second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            i++;
+            continue;
+        }
+        try
+        {
+            this->AddEndpoint(resolve.first, resolve.second.get());
+        }
+        catch (asio::system_error& e)
+        {
+            DiscoveryEvent evt;
+            (void)e;
+            evt.type = DISCOVERYEVENT_TIMEOUT;
+            evt.fulladdress = resolve.first;
+            evt.ping = 0;
+            this->m_Events.push_back(evt);
+        }
+        this->m_Resolving.erase(this->m_Resolving.begin() + i);
+    }
+}
+
+
+/*==============================
+    ServerDiscovery::CheckDeadlines
+    Handles probes that didn't get a reply in time. The first
+    probe to a server is retried, later ones are just counted
+    as lost samples.
+    @param The current time
+==============================*/
+
+void ServerDiscovery::CheckDeadlines(TimePoint now)
+{
+    // Every probe has the same timeout, so the deadlines are already in order
+    while (!this->m_Deadlines.empty() && this->m_Deadlines.front().deadline <= now)
+    {
+        ProbeDeadline deadline = this->m_Deadlines.front();
+        std::unordered_map<udp::endpoint, Probe>::iterator it = this->m_Probes.find(deadline.endpoint);
+        this->m_Deadlines.pop_front();
+        if (it == this->m_Probes.end())
+            continue;
+        Probe* probe = &it->second;
+
+        // Skip deadlines of probes that were already answered, or which were retried since
+        if (probe->done || probe->attempts == 0 || probe->seqnums[probe->attempts-1] != deadline.seqnum)
+            continue;
+
+        // Retry if the server hasn't replied at all yet
+        if (!probe->found)
+        {
+            if (probe->attempts <= DISCOVERY_RETRIES)
+            {
+                this->QueueProbe(deadline.endpoint, probe);
+                continue;
+            }
+            DiscoveryEvent evt;
+            probe->done = true;
+            evt.type = DISCOVERYEVENT_TIMEOUT;
+            evt.fulladdress = probe->fulladdress;
+            evt.ping = 0;
+            this->m_Events.push_back(evt);
+            continue;
+        }
+        this->FinishSample(deadline.endpoint, probe);
+    }
+}
+
+
+/*==============================
+    ServerDiscovery::SendQueued
+    Sends as many queued probes as the rate limit allows
+    @param The current time
+==============================*/
+
+void ServerDiscovery::SendQueued(TimePoint now)
+{
+    double burst = std::max(1.0, this->m_Rate/100);
+
+    // Refill the send budget
+    this->m_Tokens += std::chrono::duration<double>(now - this->m_LastRefill).count()*this->m_Rate;
+    this->m_Tokens = std::min(this->m_Tokens, burst);
+    this->m_LastRefill = now;
+
+    // Send probes until we run out of budget
+    while (!this->m_SendQueue.empty() && this->m_Tokens >= 1)
+    {
+        udp::endpoint endpoint = this->m_SendQueue.front();
+        std::unordered_map<udp::endpoint, Probe>::iterator it = this->m_Probes.find(endpoint);
+        this->m_SendQueue.pop_front();
+        if (it == this->m_Probes.end() || it->second.done)
+            continue;
+        it->second.queued = false;
+        this->SendProbe(endpoint, &it->second, now);
+        this->m_Tokens -= 1;
+    }
+}
+
+
+/*==============================
+    ServerDiscovery::Update
+    Sends queued probes and handles lost ones. Should be
+    called often, ideally after waiting for at most
+    GetWaitTime milliseconds.
+==============================*/
+
+void ServerDiscovery::Update()
+{
+    TimePoint now = std::chrono::steady_clock::now();
+    if (!this->m_Resolving.empty())
+        this->CheckResolves();
+    this->CheckDeadlines(now);
+    this->SendQueued(now);
+}
+
+
+/*==============================
+    ServerDiscovery::GetWaitTime
+    Gets how long the caller can wait for replies before
+    Update needs to be called again
+    @param  The most the caller wants to wait, in milliseconds
+    @return The time to wait, in milliseconds
+==============================*/
+
+int ServerDiscovery::GetWaitTime(int maxwait)
+{
+    TimePoint now = std::chrono::steady_clock::now();
+    int wait = maxwait;
+
+    // Wait until we can afford to send the next probe
+    if (!this->m_SendQueue.empty())
+    {
+        double needed = (1 - this->m_Tokens)/this->m_Rate;
+        wait = std::min(wait, (int)ceil(needed*1000));
+    }
+
+    // Or until the next probe times out
+    if (!this->m_Deadlines.empty())
+    {
+        int64_t left = std::chrono::duration_cast<std::chrono::milliseconds>(this->m_Deadlines.front().deadline - now).count() + 1;
+        wait = (int)std::min((int64_t)wait, left);
+    }
+    return std::max(wait, 0);
+}
+
+
+/*==============================
+    ServerDiscovery::IsBusy
+    Checks if there are still servers being probed
+    @return Whether any probes are still queued or in flight
+==============================*/
+
+bool ServerDiscovery::IsBusy()
+{
+    return !this->m_SendQueue.empty() || !this->m_Deadlines.empty() || !this->m_Resolving.empty();
+}
+
+
+/*==============================
+    ServerDiscovery::Clear
+    Forgets about all the servers, so that a new list can be
+    probed. Blocks until any background resolves finish.
+==============================*/
+
+void ServerDiscovery::Clear()
+{
+    this->m_Probes.clear();
+    this->m_SendQueue.clear();
+    this->m_Deadlines.clear();
+    this->m_Events.clear();
+    this->m_Resolving.clear();
+}
+
+
+/*==============================
+    ServerDiscovery::GetEvents
+    Gets the things that happened since the last time the
+    events were cleared. The caller should clear the list
+    once it has handled them.
+    @return The list of discovery events
+==============================*/
+
+std::vector<DiscoveryEvent>* ServerDiscovery::GetEvents()
+{
+    return &this->m_Events;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <chrono>
+#include <future>
+#include "packets.h"
+
+
+/******************************
+             Macros
+******************************/
+
+// Default number of discovery probes to send per second
+#define DISCOVERY_DEFAULTRATE  500
+
+// How many round trips to time per server. The reported ping is the median of them
+#define DISCOVERY_SAMPLES  3
+
+// How long (in milliseconds) to wait for a reply before a probe is considered lost
+#define DISCOVERY_TIMEOUT  1000
+
+// How many times to resend the first probe before giving up on a server
+#define DISCOVERY_RETRIES  2
+
+
+/******************************
+             Types
+******************************/
+
+typedef enum {
+    DISCOVERYEVENT_FOUND,   // The server replied for the first time
+    DISCOVERYEVENT_PINGED,  // All the samples for a server were taken
+    DISCOVERYEVENT_TIMEOUT, // The server never replied
+} DiscoveryEventType;
+
+typedef struct {
+    DiscoveryEventType type;
+    std::string fulladdress;
+    double ping;               // In milliseconds. The first sample when found, the median once pinged
+    std::vector<uint8_t> data; // The data in the server's reply, only set when found
+} DiscoveryEvent;
+
+
+/*********************************
+             Classes
+*********************************/
+
+// Sends discovery probes to a list of servers at a fixed rate, and times their replies.
+// All probes go out through one socket, and replies are matched back to their server by endpoint.
+// Lost probes are handled with deadlines rather than exceptions.
+class ServerDiscovery
+{
+    private:
+        typedef std::chrono::steady_clock::time_point TimePoint;
+
+        typedef struct {
+            std::string fulladdress;
+            bool     found;
+            bool     done;
+            bool     queued;
+            int      sample;
+            int      attempts;
+            uint16_t seqnums[DISCOVERY_RETRIES+1];
+            TimePoint sendtimes[DISCOVERY_RETRIES+1];
+            std::vector<double> pings;
+        } Probe;
+
+        typedef struct {
+            TimePoint deadline;
+            udp::endpoint endpoint;
+            uint16_t seqnum;
+        } ProbeDeadline;
+
+        ASIOSocket* m_Socket;
+        double   m_Rate;
+        double   m_Tokens;
+        TimePoint m_LastRefill;
+        uint16_t m_SeqNum;
+        std::unordered_map<udp::endpoint, Probe> m_Probes;
+        std::deque<udp::endpoint> m_SendQueue;
+        std::deque<ProbeDeadline> m_Deadlines;
+        std::vector<std::pair<std::string, std::future<udp::endpoint>>> m_Resolving;
+        std::vector<DiscoveryEvent> m_Events;
+        uint8_t  m_SendBuffer[MAX_PACKETSIZE];
+
+        void AddEndpoint(std::string fulladdress, const udp::endpoint& endpoint);
+        void QueueProbe(const udp::endpoint& endpoint, Probe* probe);
+        void SendProbe(const udp::endpoint& endpoint, Probe* probe, TimePoint now);
+        void FinishSample(const udp::endpoint& endpoint, Probe* probe);
+        void CheckResolves();
+        void CheckDeadlines(TimePoint now);
+        void SendQueued(TimePoint now);
+
+    protected:
+
+    public:
+        ServerDiscovery(ASIOSocket* socket, double rate = DISCOVERY_DEFAULTRATE);
+        ~ServerDiscovery();
+        void   Add(std::string fulladdress);
+        bool   HandleDatagram(const udp::endpoint& sender, const uint8_t* data, size_t size);
+        void   Update();
+        int    GetWaitTime(int maxwait);
+        bool   IsBusy();
+        void   Clear();
+        std::vector<DiscoveryEvent>* GetEvents();
+};
@@ -4,6 +4,8 @@
 A collection of helper functions
 ***************************************************************/
 
+#include <stdio.h>
+#include <stdlib.h>
 #include "helper.h"
 
 
@@ -41,10 +43,30 @@ uint32_t swap_endian32(uint32_t val)
     @return The string representation
 ==============================*/
 
-wxString stringhash_frombytes(uint8_t* bytes, uint32_t size)
+std::string stringhash_frombytes(uint8_t* bytes, uint32_t size)
 {
-    wxString str = "";
+    std::string str = "";
+    char hex[3];
     for (uint32_t i=0; i<size; i++)
-        str += wxString::Format("%02X", bytes[i]);
+    {
+        snprintf(hex, sizeof(hex), "%02X", bytes[i]);
+        str += hex;
+    }
     return str;
+}
+
+
+/*==============================
+    address_split
+    Splits an address:port combination
+    @param The string in the address:port format
+    @param A pointer to the string to store the address in
+    @param A pointer to the int to store the port in
+==============================*/
+
+void address_split(std::string fulladdress, std::string* address, int* port)
+{
+    size_t colon = fulladdress.find(':');
+    *address = fulladdress.substr(0, colon);
+    *port = (colon != std::string::npos) ? atoi(fulladdress.c_str() + colon + 1) : 0;
 }
\ No newline at end of file
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <stdint.h> 
-#include <wx/string.h>
+#include <string>
 
 
 /*********************************
@@ -10,4 +10,5 @@
 
 uint16_t swap_endian16(uint16_t val);
 uint32_t swap_endian32(uint32_t val);
-wxString stringhash_frombytes(uint8_t* bytes, uint32_t size);
\ No newline at end of file
+std::string stringhash_frombytes(uint8_t* bytes, uint32_t size);
+void address_split(std::string fulladdress, std::string* address, int* port);
\ No newline at end of file
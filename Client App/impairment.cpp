@@ -0,0 +1,468 @@
+/***************************************************************
+                          impairment.cpp
+
+Simulates latency, jitter, loss, duplication, reordering, and
+limited bandwidth on the datagrams that ASIOSocket sends, so
+that the retransmission and ack logic can be tested under bad
+network conditions without needing a bad network.
+***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include "impairment.h"
+#include "capture.h"
+
+
+/*********************************
+             Classes
+*********************************/
+
+// Sends delayed datagrams once they are due, from a single thread
+class ImpairmentQueue
+{
+    private:
+        typedef std::chrono::steady_clock::time_point TimePoint;
+
+        typedef struct {
+            udp::socket* socket;
+            udp::endpoint local;
+            udp::endpoint remote;
+            std::vector<uint8_t> data;
+        } DelayedDatagram;
+
+        std::mutex m_Mutex;
+        std::condition_variable m_Condition;
+        std::map<std::pair<TimePoint, uint64_t>, DelayedDatagram> m_Queue;
+        uint64_t m_Order;
+        std::thread* m_Thread;
+        bool m_Stopping;
+
+        void Run();
+
+    protected:
+
+    public:
+        ImpairmentQueue();
+        ~ImpairmentQueue();
+        void Schedule(TimePoint when, udp::socket* socket, const udp::endpoint& local, const udp::endpoint& remote, const uint8_t* data, size_t size);
+        void Cancel(udp::socket* socket);
+};
+
+
+/******************************
+            Globals
+******************************/
+
+static ImpairmentConfig global_impairment_config = {0, 0, 0, 0, 0, 1, 0, 0, 0, IMPAIRMENT_DEFAULTGAP, 0, 0};
+static std::atomic<bool> global_impairment_enabled(false);
+static std::atomic<uint64_t> global_impairment_sockets(0);
+
+static std::atomic<uint64_t> global_impairment_sent(0);
+static std::atomic<uint64_t> global_impairment_dropped(0);
+static std::atomic<uint64_t> global_impairment_duplicated(0);
+static std::atomic<uint64_t> global_impairment_reordered(0);
+
+static ImpairmentQueue global_impairment_queue;
+
+
+/*=============================================================
+                       Helper Functions
+=============================================================*/
+
+/*==============================
+    impairment_send
+    Sends a datagram, ignoring any errors like a real network
+    would
+    @param The socket to send with
+    @param The socket's local endpoint
+    @param The endpoint to send to
+    @param The datagram
+    @param The size of the datagram
+==============================*/
+
+static void impairment_send(udp::socket* socket, const udp::endpoint& local, const udp::endpoint& remote, const uint8_t* data, size_t size)
+{
+    asio::error_code error;
+    socket->send_to(asio::buffer(data, size), remote, 0, error);
+    if (!error && PacketCapture::IsActive())
+        PacketCapture::Datagram(CAPTURE_OUT, local, remote, data, size);
+}
+
+
+/*==============================
+    impairment_parse
+    Parses a number from a setting
+    @param  The setting's value
+    @param  The smallest allowed value
+    @param  The largest allowed value
+    @param  Where to store the number
+    @return Whether the value is a number within range
+==============================*/
+
+static bool impairment_parse(const std::string& value, double min, double max, double* out)
+{
+    char* end;
+    double number = strtod(value.c_str(), &end);
+    if (value.empty() || *end != '\0' || number < min || number > max)
+        return false;
+    *out = number;
+    return true;
+}
+
+
+/*=============================================================
+                          Impairment
+=============================================================*/
+
+/*==============================
+    Impairment::Configure
+    Sets the impairment for all sockets created from now on.
+    The settings are a comma separated list of key=value pairs:
+        latency=<ms>     Delay added to every datagram
+        jitter=<ms>      Random extra delay of up to +/- this much
+        loss=<0-1>       Chance of dropping a datagram
+        ge_p=<0-1>       Gilbert-Elliott burst loss, chance of going from the good to the bad state
+        ge_r=<0-1>       Chance of going from the bad state back to the good one
+        ge_bad=<0-1>     Chance of dropping a datagram in the bad state (default 1)
+        ge_good=<0-1>    Chance of dropping a datagram in the good state (default 0)
+        dup=<0-1>        Chance of sending a datagram twice
+        reorder=<0-1>    Chance of holding a datagram back so later ones overtake it
+        gap=<ms>         How long reordered datagrams are held back (default 10)
+        rate=<bytes/s>   Bandwidth limit
+        seed=<number>    Seed for the random number generators
+    @param  The settings, or an empty string to disable it
+    @return Whether the settings were valid. If not, nothing
+            is changed
+==============================*/
+
+bool Impairment::Configure(std::string spec)
+{
+    ImpairmentConfig config = {0, 0, 0, 0, 0, 1, 0, 0, 0, IMPAIRMENT_DEFAULTGAP, 0, 0};
+    size_t start = 0;
+    while (start < spec.length())
+    {
+        size_t end = spec.find(',', start);
+        size_t split;
+        std::string key, value;
+        bool valid;
+        if (end == std::string::npos)
+            end = spec.length();
+        split = spec.find('=', start);
+        if (split == std::string::npos || split > end)
+            return false;
+        key = spec.substr(start, split - start);
+        value = spec.substr(split + 1, end - split - 1);
+        start = end + 1;
+
+        // Parse the setting
+        if (key == "latency")       valid = impairment_parse(value, 0, 60000, &config.latency);
+        else if (key == "jitter")   valid = impairment_parse(value, 0, 60000, &config.jitter);
+        else if (key == "loss")     valid = impairment_parse(value, 0, 1, &config.loss);
+        else if (key == "ge_p")     valid = impairment_parse(value, 0, 1, &config.ge_p);
+        else if (key == "ge_r")     valid = impairment_parse(value, 0, 1, &config.ge_r);
+        else if (key == "ge_bad")   valid = impairment_parse(value, 0, 1, &config.ge_bad);
+        else if (key == "ge_good")  valid = impairment_parse(value, 0, 1, &config.ge_good);
+        else if (key == "dup")      valid = impairment_parse(value, 0, 1, &config.duplicate);
+        else if (key == "reorder")  valid = impairment_parse(value, 0, 1, &config.reorder);
+        else if (key == "gap")      valid = impairment_parse(value, 0, 60000, &config.gap);
+        else if (key == "rate")     valid = impairment_parse(value, 0, 1e12, &config.rate);
+        else if (key == "seed")
+        {
+            char* numend;
+            config.seed = strtoull(value.c_str(), &numend, 0);
+            valid = !value.empty() && *numend == '\0';
+        }
+        else
+            valid = false;
+        if (!valid)
+            return false;
+    }
+
+    // Apply the settings
+    global_impairment_config = config;
+    global_impairment_enabled.store(config.latency > 0 || config.jitter > 0 || config.loss > 0 || config.ge_p > 0 || config.ge_good > 0 || config.duplicate > 0 || config.reorder > 0 || config.rate > 0);
+    return true;
+}
+
+
+/*==============================
+    Impairment::IsEnabled
+    Checks whether sockets should impair what they send
+    @return Whether impairment is enabled
+==============================*/
+
+bool Impairment::IsEnabled()
+{
+    return global_impairment_enabled.load();
+}
+
+
+/*==============================
+    Impairment::GetConfig
+    Gets the current impairment settings
+    @return The impairment settings
+==============================*/
+
+ImpairmentConfig Impairment::GetConfig()
+{
+    return global_impairment_config;
+}
+
+
+/*==============================
+    Impairment::GetStats
+    Gets what the impairment did to the datagrams of all
+    sockets so far
+    @return The impairment stats
+==============================*/
+
+ImpairmentStats Impairment::GetStats()
+{
+    ImpairmentStats stats;
+    stats.sent = global_impairment_sent.load();
+    stats.dropped = global_impairment_dropped.load();
+    stats.duplicated = global_impairment_duplicated.load();
+    stats.reordered = global_impairment_reordered.load();
+    return stats;
+}
+
+
+/*==============================
+    Impairment::Cancel
+    Throws away the delayed datagrams of a socket. Must be
+    called before the socket is closed.
+    @param The socket
+==============================*/
+
+void Impairment::Cancel(udp::socket* socket)
+{
+    global_impairment_queue.Cancel(socket);
+}
+
+
+/*==============================
+    Impairment (Constructor)
+    Initializes the class
+==============================*/
+
+Impairment::Impairment()
+{
+    uint64_t index = global_impairment_sockets.fetch_add(1);
+    this->m_Config = global_impairment_config;
+    this->m_Random.seed(this->m_Config.seed + index*0x9E3779B97F4A7C15ULL);
+    this->m_BadState = false;
+    this->m_LinkFree = std::chrono::steady_clock::now();
+}
+
+
+/*==============================
+    Impairment::Chance
+    Gets a random number for deciding what happens to a datagram
+    @return A random number from 0 (inclusive) to 1 (exclusive)
+==============================*/
+
+double Impairment::Chance()
+{
+    return (this->m_Random() >> 11) * (1.0/9007199254740992.0);
+}
+
+
+/*==============================
+    Impairment::Send
+    Sends a datagram through the impairment. The same amount of
+    random numbers is used for every datagram, so that changing
+    one setting doesn't change the fate of unrelated datagrams.
+    @param The socket to send with
+    @param The socket's local endpoint
+    @param The endpoint to send to
+    @param The datagram
+    @param The size of the datagram
+==============================*/
+
+void Impairment::Send(udp::socket* socket, const udp::endpoint& local, const udp::endpoint& remote, const uint8_t* data, size_t size)
+{
+    TimePoint now = std::chrono::steady_clock::now();
+    TimePoint departure = now;
+    double lossroll = this->Chance();
+    double stateroll = this->Chance();
+    double duproll = this->Chance();
+    double reorderroll = this->Chance();
+    double jitterroll = this->Chance();
+    double lossrate = this->m_Config.loss;
+    double delay;
+    int copies = 1;
+    global_impairment_sent++;
+
+    // Move between the good and bad Gilbert-Elliott states, and drop the datagram if we're unlucky
+    if (this->m_Config.ge_p > 0 || this->m_Config.ge_good > 0)
+    {
+        if (this->m_BadState && stateroll < this->m_Config.ge_r)
+            this->m_BadState = false;
+        else if (!this->m_BadState && stateroll < this->m_Config.ge_p)
+            this->m_BadState = true;
+        lossrate = 1 - (1 - lossrate)*(1 - (this->m_BadState ? this->m_Config.ge_bad : this->m_Config.ge_good));
+    }
+    if (lossroll < lossrate)
+    {
+        global_impairment_dropped++;
+        return;
+    }
+
+    // With a bandwidth limit, datagrams wait for the ones before them to finish sending
+    if (this->m_Config.rate > 0)
+    {
+        if (this->m_LinkFree < now)
+            this->m_LinkFree = now;
+        this->m_LinkFree += std::chrono::microseconds((int64_t)(size*1000000.0/this->m_Config.rate));
+        departure = this->m_LinkFree;
+    }
+
+    // Work out the delay
+    delay = this->m_Config.latency + (jitterroll*2 - 1)*this->m_Config.jitter;
+    if (reorderroll < this->m_Config.reorder)
+    {
+        delay += this->m_Config.gap;
+        global_impairment_reordered++;
+    }
+    if (delay > 0)
+        departure += std::chrono::microseconds((int64_t)(delay*1000));
+    if (duproll < this->m_Config.duplicate)
+    {
+        copies = 2;
+        global_impairment_duplicated++;
+    }
+
+    // Send the datagram, or leave it to the timer thread
+    for (int i=0; i<copies; i++)
+    {
+        if (departure <= now)
+            impairment_send(socket, local, remote, data, size);
+        else
+            global_impairment_queue.Schedule(departure, socket, local, remote, data, size);
+    }
+}
+
+
+/*=============================================================
+                       Impairment Queue
+=============================================================*/
+
+/*==============================
+    ImpairmentQueue (Constructor)
+    Initializes the class
+==============================*/
+
+ImpairmentQueue::ImpairmentQueue()
+{
+    this->m_Order = 0;
+    this->m_Thread = NULL;
+    this->m_Stopping = false;
+}
+
+
+/*==============================
+    ImpairmentQueue (Destructor)
+    Cleans up the class before deletion
+==============================*/
+
+ImpairmentQueue::~ImpairmentQueue()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->m_Mutex);
+        this->m_Stopping = true;
+    }
+    this->m_Condition.notify_one();
+    if (this->m_Thread != NULL)
+    {
+        this->m_Thread->join();
+        delete this->m_Thread;
+    }
+}
+
+
+/*==============================
+    ImpairmentQueue::Schedule
+    Queues a datagram to be sent later. The timer thread is
+    started the first time this is called.
+    @param When to send the datagram
+    @param The socket to send with
+    @param The socket's local endpoint
+    @param The endpoint to send to
+    @param The datagram
+    @param The size of the datagram
+==============================*/
+
+void ImpairmentQueue::Schedule(TimePoint when, udp::socket* socket, const udp::endpoint& local, const udp::endpoint& remote, const uint8_t* data, size_t size)
+{
+    bool first;
+    DelayedDatagram delayed;
+    delayed.socket = socket;
+    delayed.local = local;
+    delayed.remote = remote;
+    delayed.data.assign(data, data + size);
+    {
+        std::lock_guard<std::mutex> lock(this->m_Mutex);
+        if (this->m_Thread == NULL)
+            this->m_Thread = new std::thread(&ImpairmentQueue::Run, this);
+        first = this->m_Queue.emplace(std::make_pair(when, this->m_Order++), std::move(delayed)).first == this->m_Queue.begin();
+    }
+
+    // Wake the timer thread up if this datagram is due before the one it's waiting on
+    if (first)
+        this->m_Condition.notify_one();
+}
+
+
+/*==============================
+    ImpairmentQueue::Cancel
+    Throws away the delayed datagrams of a socket. Since the
+    timer thread sends while holding the lock, the socket is no
+    longer used once this returns.
+    @param The socket
+==============================*/
+
+void ImpairmentQueue::Cancel(udp::socket* socket)
+{
+    std::lock_guard<std::mutex> lock(this->m_Mutex);
+    for (std::map<std::pair<TimePoint, uint64_t>, DelayedDatagram>::iterator it = this->m_Queue.begin(); it != this->m_Queue.end();)
+    {
+        if (it->second.socket == socket)
+            it = this->m_Queue.erase(it);
+        else
+            ++it;
+    }
+}
+
+
+/*==============================
+    ImpairmentQueue::Run
+    The timer thread, which sends datagrams as they come due
+==============================*/
+
+void ImpairmentQueue::Run()
+{
+    std::unique_lock<std::mutex> lock(this->m_Mutex);
+    while (!this->m_Stopping)
+    {
+        std::map<std::pair<TimePoint, uint64_t>, DelayedDatagram>::iterator it = this->m_Queue.begin();
+        if (it == this->m_Queue.end())
+        {
+            this->m_Condition.wait(lock);
+            continue;
+        }
+        if (it->first.first > std::chrono::steady_clock::now())
+        {
+            this->m_Condition.wait_until(lock, it->first.first);
+            continue;
+        }
+        impairment_send(it->second.socket, it->second.local, it->second.remote, it->second.data.data(), it->second.data.size());
+        this->m_Queue.erase(it);
+    }
+}
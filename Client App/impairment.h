@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <random>
+#include <chrono>
+#include "Include/asio.hpp"
+
+using asio::ip::udp;
+
+
+/******************************
+             Macros
+******************************/
+
+// Environment variable that impairment settings are read from, in the same format as Impairment::Configure
+#define IMPAIRMENT_ENVVAR  "NETLIB_IMPAIR"
+
+// How far (in milliseconds) a reordered datagram is held back, if not configured
+#define IMPAIRMENT_DEFAULTGAP  10
+
+
+/******************************
+             Types
+******************************/
+
+typedef struct {
+    double   latency;   // Delay added to every datagram, in milliseconds
+    double   jitter;    // Random extra delay of up to +/- this many milliseconds
+    double   loss;      // Chance of dropping a datagram, from 0 to 1
+    double   ge_p;      // Gilbert-Elliott chance of going from the good to the bad state
+    double   ge_r;      // Gilbert-Elliott chance of going from the bad to the good state
+    double   ge_bad;    // Chance of dropping a datagram in the bad state
+    double   ge_good;   // Chance of dropping a datagram in the good state
+    double   duplicate; // Chance of sending a datagram twice
+    double   reorder;   // Chance of holding a datagram back so that later ones overtake it
+    double   gap;       // How long reordered datagrams are held back, in milliseconds
+    double   rate;      // Max bytes per second, or 0 for no limit
+    uint64_t seed;      // Seed for the random number generators
+} ImpairmentConfig;
+
+typedef struct {
+    uint64_t sent;       // Datagrams handed to the impairment stage
+    uint64_t dropped;    // Datagrams that were dropped
+    uint64_t duplicated; // Datagrams that were sent twice
+    uint64_t reordered;  // Datagrams that were held back
+} ImpairmentStats;
+
+
+/*********************************
+             Classes
+*********************************/
+
+// Simulates a bad network on the datagrams a socket sends.
+// Each socket gets its own instance, with a random number generator seeded from the configured
+// seed and the order the socket was created in, so runs with the same seed behave the same.
+// Delayed datagrams are sent by a single timer thread shared by all sockets.
+class Impairment
+{
+    private:
+        typedef std::chrono::steady_clock::time_point TimePoint;
+
+        ImpairmentConfig m_Config;
+        std::mt19937_64 m_Random;
+        bool      m_BadState;
+        TimePoint m_LinkFree;
+
+        double Chance();
+
+    protected:
+
+    public:
+        static bool Configure(std::string spec);
+        static bool IsEnabled();
+        static ImpairmentConfig GetConfig();
+        static ImpairmentStats GetStats();
+        static void Cancel(udp::socket* socket);
+
+        Impairment();
+        void Send(udp::socket* socket, const udp::endpoint& local, const udp::endpoint& remote, const uint8_t* data, size_t size);
+};
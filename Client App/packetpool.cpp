@@ -0,0 +1,194 @@
+/***************************************************************
+                         packetpool.cpp
+
+A fixed size block allocator for packets, so that creating and
+destroying packets does not touch the heap in steady state.
+***************************************************************/
+
+#include <stdlib.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "packetpool.h"
+
+
+/*********************************
+             Classes
+*********************************/
+
+// A thread's private cache of free blocks
+class PacketPoolCache
+{
+    public:
+        std::vector<void*> m_Blocks;
+
+        PacketPoolCache();
+        ~PacketPoolCache();
+};
+
+
+/******************************
+            Globals
+******************************/
+
+static std::mutex global_pooldepot_mutex;
+static std::vector<void*> global_pooldepot;
+
+static std::atomic<uint64_t> global_poolstat_hits(0);
+static std::atomic<uint64_t> global_poolstat_misses(0);
+static std::atomic<uint64_t> global_poolstat_frees(0);
+
+static thread_local PacketPoolCache global_poolcache;
+
+
+/*=============================================================
+                        Thread Cache
+=============================================================*/
+
+/*==============================
+    PacketPoolCache (Constructor)
+    Initializes the class
+==============================*/
+
+PacketPoolCache::PacketPoolCache()
+{
+    this->m_Blocks.reserve(2*PACKETPOOL_BATCH);
+}
+
+
+/*==============================
+    PacketPoolCache (Destructor)
+    Gives the thread's free blocks back to the depot
+    when the thread exits
+==============================*/
+
+PacketPoolCache::~PacketPoolCache()
+{
+    std::lock_guard<std::mutex> lock(global_pooldepot_mutex);
+    for (void* block : this->m_Blocks)
+    {
+        if (global_pooldepot.size() < PACKETPOOL_MAXDEPOT)
+        {
+            global_pooldepot.push_back(block);
+        }
+        else
+        {
+            free(block);
+            global_poolstat_frees.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    this->m_Blocks.clear();
+}
+
+
+/*=============================================================
+                         Packet Pool
+=============================================================*/
+
+/*==============================
+    PacketPool::Allocate
+    Takes a block from the pool, or from the heap if the
+    pool is empty
+    @param  The number of bytes needed
+    @return The allocated memory
+==============================*/
+
+void* PacketPool::Allocate(size_t size)
+{
+    std::vector<void*>& cache = global_poolcache.m_Blocks;
+    void* block;
+
+    // Blocks that don't fit in the pool come straight from the heap
+    if (size > PACKETPOOL_BLOCKSIZE)
+    {
+        global_poolstat_misses.fetch_add(1, std::memory_order_relaxed);
+        block = malloc(size);
+        if (block == NULL)
+            throw std::bad_alloc();
+        return block;
+    }
+
+    // If our cache is empty, refill it from the depot
+    if (cache.empty())
+    {
+        std::lock_guard<std::mutex> lock(global_pooldepot_mutex);
+        size_t count = (global_pooldepot.size() < PACKETPOOL_BATCH) ? global_pooldepot.size() : PACKETPOOL_BATCH;
+        cache.insert(cache.end(), global_pooldepot.end() - count, global_pooldepot.end());
+        global_pooldepot.resize(global_pooldepot.size() - count);
+    }
+
+    // Use a cached block if we have one
+    if (!cache.empty())
+    {
+        global_poolstat_hits.fetch_add(1, std::memory_order_relaxed);
+        block = cache.back();
+        cache.pop_back();
+        return block;
+    }
+
+    // Otherwise, the pool grows
+    global_poolstat_misses.fetch_add(1, std::memory_order_relaxed);
+    block = malloc(PACKETPOOL_BLOCKSIZE);
+    if (block == NULL)
+        throw std::bad_alloc();
+    return block;
+}
+
+
+/*==============================
+    PacketPool::Free
+    Returns a block to the pool
+    @param The memory to free
+    @param The number of bytes that were requested for it
+==============================*/
+
+void PacketPool::Free(void* ptr, size_t size)
+{
+    std::vector<void*>& cache = global_poolcache.m_Blocks;
+    if (ptr == NULL)
+        return;
+
+    // Blocks that didn't fit in the pool go straight back to the heap
+    if (size > PACKETPOOL_BLOCKSIZE)
+    {
+        global_poolstat_frees.fetch_add(1, std::memory_order_relaxed);
+        free(ptr);
+        return;
+    }
+
+    // If our cache is full, move a batch of blocks to the depot so other threads can use them
+    if (cache.size() >= 2*PACKETPOOL_BATCH)
+    {
+        std::lock_guard<std::mutex> lock(global_pooldepot_mutex);
+        for (int i=0; i<PACKETPOOL_BATCH; i++)
+        {
+            if (global_pooldepot.size() < PACKETPOOL_MAXDEPOT)
+            {
+                global_pooldepot.push_back(cache.back());
+            }
+            else
+            {
+                free(cache.back());
+                global_poolstat_frees.fetch_add(1, std::memory_order_relaxed);
+            }
+            cache.pop_back();
+        }
+    }
+    cache.push_back(ptr);
+}
+
+
+/*==============================
+    PacketPool::GetStats
+    Gets the pool's usage statistics
+    @return The pool statistics
+==============================*/
+
+PacketPoolStats PacketPool::GetStats()
+{
+    PacketPoolStats stats;
+    stats.hits = global_poolstat_hits.load(std::memory_order_relaxed);
+    stats.misses = global_poolstat_misses.load(std::memory_order_relaxed);
+    stats.frees = global_poolstat_frees.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/******************************
+             Macros
+******************************/
+
+// The size of each block in the pool. Must fit the largest packet class
+#define PACKETPOOL_BLOCKSIZE  (4096 + 512)
+
+// How many blocks move between a thread's cache and the shared depot at once
+#define PACKETPOOL_BATCH  32
+
+// The max number of free blocks kept in the shared depot, the rest are given back to the heap
+#define PACKETPOOL_MAXDEPOT  1024
+
+
+/******************************
+             Types
+******************************/
+
+typedef struct {
+    uint64_t hits;    // Allocations served by the pool
+    uint64_t misses;  // Allocations that had to go to the heap
+    uint64_t frees;   // Blocks given back to the heap
+} PacketPoolStats;
+
+
+/*********************************
+             Classes
+*********************************/
+
+// Fixed size block allocator for packets.
+// Each thread keeps its own cache of free blocks, and trades
+// them in batches with a shared depot, so that blocks allocated
+// in one thread and freed in another find their way back.
+class PacketPool
+{
+    public:
+        static void* Allocate(size_t size);
+        static void  Free(void* ptr, size_t size);
+        static PacketPoolStats GetStats();
+};
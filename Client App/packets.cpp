@@ -6,10 +6,19 @@ communication handler.
 ***************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
 #include "packets.h"
+#include "capture.h"
 #include "helper.h"
-#include <wx/buffer.h>
-#include <wx/tokenzr.h>
+#ifdef __linux__
+    #include <sys/socket.h>
+    #include <errno.h>
+#endif
+#ifndef _WIN32
+    #include <poll.h>
+#endif
 
 
 /******************************
@@ -18,13 +27,17 @@ communication handler.
 
 #define DEBUGPRINTS 0
 
-#define MAX_PACKETSIZE   4096
-#define MAX_RESENDCOUNT  5
 #define MAX_SEQUENCENUM  0xFFFF
 
 #define TIME_RESEND    1000
+#define TIME_RTO_MIN   100
+#define TIME_RTO_MAX   1000*60
+#define TIME_GIVEUP    1000*5 // How long a reliable packet can go unacked, the same as five resends a second apart
 #define TIME_TIMEOUT   1000*30
 #define TIME_ACKRETRY  1000*5
+#define TIME_RESOLVETTL  1000*60*5
+
+static_assert(sizeof(S64Packet) <= PACKETPOOL_BLOCKSIZE && sizeof(NetLibPacket) <= PACKETPOOL_BLOCKSIZE, "Packets must fit in a PacketPool block");
 
 
 /******************************
@@ -47,7 +60,30 @@ asio::io_context* global_asiocontext;
 
 void ASIOSocket::InitASIO()
 {
+    const char* impairment = getenv(IMPAIRMENT_ENVVAR);
     global_asiocontext = new asio::io_context();
+    if (impairment != NULL && !Impairment::Configure(impairment))
+        fprintf(stderr, "Ignoring invalid %s settings '%s'\n", IMPAIRMENT_ENVVAR, impairment);
+}
+
+
+/*==============================
+    ASIOSocket::Resolve
+    Resolves an address + port combination into an endpoint.
+    This blocks, and uses its own io_context so that it is safe
+    to call from any thread.
+    @param  The address to resolve
+    @param  The port to use
+    @return The first resolved IPv4 endpoint
+    @throws asio::system_error If the address could not be resolved
+==============================*/
+
+udp::endpoint ASIOSocket::Resolve(std::string address, int port)
+{
+    asio::io_context context;
+    udp::resolver resolver(context);
+    udp::resolver::results_type endp = resolver.resolve(udp::v4(), address, std::to_string(port));
+    return *(endp.begin());
 }
 
 
@@ -57,16 +93,15 @@ void ASIOSocket::InitASIO()
     @param A string with in the address:port format with the server to connect to
 ==============================*/
 
-ASIOSocket::ASIOSocket(wxString fulladdress)
+ASIOSocket::ASIOSocket(std::string fulladdress)
 {
-    wxStringTokenizer tokenizer(fulladdress, ":");
-    this->m_Address = tokenizer.GetNextToken();
-    if (tokenizer.HasMoreTokens())
-        tokenizer.GetNextToken().ToInt(&this->m_Port);
-    this->m_Resolver = new udp::resolver(*global_asiocontext);
+    address_split(fulladdress, &this->m_Address, &this->m_Port);
     this->m_Socket = new udp::socket(*global_asiocontext, udp::endpoint(udp::v4(), 0));
     this->m_Socket->non_blocking(true);
+    this->m_LocalEndpoint = this->m_Socket->local_endpoint();
     this->m_LastReadCount = 0;
+    this->m_Connected = false;
+    this->m_Impairment = Impairment::IsEnabled() ? new Impairment() : NULL;
 }
 
 
@@ -77,14 +112,16 @@ ASIOSocket::ASIOSocket(wxString fulladdress)
     @param The server port
 ==============================*/
 
-ASIOSocket::ASIOSocket(wxString address, int port)
+ASIOSocket::ASIOSocket(std::string address, int port)
 {
     this->m_Address = address;
     this->m_Port = port;
-    this->m_Resolver = new udp::resolver(*global_asiocontext);
     this->m_Socket = new udp::socket(*global_asiocontext, udp::endpoint(udp::v4(), 0));
     this->m_Socket->non_blocking(true);
+    this->m_LocalEndpoint = this->m_Socket->local_endpoint();
     this->m_LastReadCount = 0;
+    this->m_Connected = false;
+    this->m_Impairment = Impairment::IsEnabled() ? new Impairment() : NULL;
 }
 
 
@@ -95,9 +132,13 @@ ASIOSocket::ASIOSocket(wxString address, int port)
 
 ASIOSocket::~ASIOSocket()
 {
+    if (this->m_Impairment != NULL)
+    {
+        Impairment::Cancel(this->m_Socket);
+        delete this->m_Impairment;
+    }
     this->m_Socket->close();
     delete this->m_Socket;
-    delete this->m_Resolver;
 }
 
 
@@ -112,12 +153,137 @@ ASIOSocket::~ASIOSocket()
 void ASIOSocket::Read(uint8_t* buff, size_t size)
 {
     asio::error_code error;
-    udp::endpoint sendpoint;
-    this->m_LastReadCount = this->m_Socket->receive_from(asio::buffer(buff, size), sendpoint, 0, error);
+    this->m_LastReadCount = this->m_Socket->receive_from(asio::buffer(buff, size), this->m_ReadEndpoint, 0, error);
+    if (this->m_LastReadCount != 0 && PacketCapture::IsActive())
+        PacketCapture::Datagram(CAPTURE_IN, this->m_LocalEndpoint, this->m_ReadEndpoint, buff, this->m_LastReadCount);
     #if DEBUGPRINTS
         if (this->m_LastReadCount != 0)
-            printf("Read %ld bytes from %s:%d\n", this->m_LastReadCount, (const char*)this->m_Address.mb_str(), this->m_Port);
+            printf("Read %ld bytes from %s:%d\n", this->m_LastReadCount, this->m_Address.c_str(), this->m_Port);
+    #endif
+}
+
+
+/*==============================
+    ASIOSocket::ReadBatch
+    Reads as many datagrams as are available (up to a limit)
+    into a slab of equally sized slots. On Linux this is a 
+    single recvmmsg call. Does not block.
+    @param  The slab to read into, which must hold count slots
+    @param  The size of each slot in the slab
+    @param  An array to store the size of each datagram in
+    @param  The max number of datagrams to read (capped to MAX_BATCHCOUNT)
+    @param  (Optional) An array to store who sent each datagram in
+    @return The number of datagrams read
+==============================*/
+
+size_t ASIOSocket::ReadBatch(uint8_t* slab, size_t slotsize, size_t* sizes, size_t count, udp::endpoint* senders)
+{
+    size_t readcount = 0;
+    if (count > MAX_BATCHCOUNT)
+        count = MAX_BATCHCOUNT;
+    #ifdef __linux__
+        struct mmsghdr msgs[MAX_BATCHCOUNT];
+        struct iovec iovecs[MAX_BATCHCOUNT];
+        udp::endpoint capturesenders[MAX_BATCHCOUNT];
+        int ret;
+        if (senders == NULL && PacketCapture::IsActive())
+            senders = capturesenders; // The capture needs to know who sent each datagram
+        memset(msgs, 0, sizeof(struct mmsghdr)*count);
+        for (size_t i=0; i<count; i++)
+        {
+            iovecs[i].iov_base = slab + i*slotsize;
+            iovecs[i].iov_len = slotsize;
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            if (senders != NULL)
+            {
+                msgs[i].msg_hdr.msg_name = senders[i].data();
+                msgs[i].msg_hdr.msg_namelen = senders[i].capacity();
+            }
+        }
+        ret = recvmmsg(this->m_Socket->native_handle(), msgs, count, MSG_DONTWAIT, NULL);
+        if (ret > 0)
+        {
+            readcount = ret;
+            for (size_t i=0; i<readcount; i++)
+            {
+                sizes[i] = msgs[i].msg_len;
+                if (senders != NULL)
+                    senders[i].resize(msgs[i].msg_hdr.msg_namelen);
+                if (PacketCapture::IsActive())
+                    PacketCapture::Datagram(CAPTURE_IN, this->m_LocalEndpoint, senders[i], slab + i*slotsize, sizes[i]);
+            }
+        }
+    #else
+        while (readcount < count)
+        {
+            this->Read(slab + readcount*slotsize, slotsize);
+            if (this->m_LastReadCount == 0)
+                break;
+            if (senders != NULL)
+                senders[readcount] = this->m_ReadEndpoint;
+            sizes[readcount++] = this->m_LastReadCount;
+        }
     #endif
+    #if DEBUGPRINTS
+        if (readcount != 0)
+            printf("Read %ld datagrams from %s:%d\n", readcount, this->m_Address.c_str(), this->m_Port);
+    #endif
+    return readcount;
+}
+
+
+/*==============================
+    ASIOSocket::WaitRead
+    Blocks until the socket has data to read, or until the
+    timeout runs out
+    @param  The max time to wait, in milliseconds
+    @return Whether there is data to read
+==============================*/
+
+bool ASIOSocket::WaitRead(int timeout)
+{
+    #ifdef _WIN32
+        WSAPOLLFD pfd;
+        pfd.fd = this->m_Socket->native_handle();
+        pfd.events = POLLRDNORM;
+        pfd.revents = 0;
+        return WSAPoll(&pfd, 1, timeout) > 0;
+    #else
+        struct pollfd pfd;
+        pfd.fd = this->m_Socket->native_handle();
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        return poll(&pfd, 1, timeout) > 0;
+    #endif
+}
+
+
+/*==============================
+    ASIOSocket::AsyncWait
+    Waits asynchronously for the socket to have data to read.
+    The callback is executed by whichever thread is running 
+    global_asiocontext, and should drain the socket with
+    ReadBatch.
+    @param The function to call when the socket is readable
+==============================*/
+
+void ASIOSocket::AsyncWait(std::function<void(const asio::error_code&)> callback)
+{
+    this->m_Socket->async_wait(udp::socket::wait_read, callback);
+}
+
+
+/*==============================
+    ASIOSocket::Cancel
+    Cancels all pending asynchronous operations on the socket.
+    Their callbacks will execute with asio::error::operation_aborted.
+==============================*/
+
+void ASIOSocket::Cancel()
+{
+    asio::error_code error;
+    this->m_Socket->cancel(error);
 }
 
 
@@ -130,18 +296,158 @@ void ASIOSocket::Read(uint8_t* buff, size_t size)
     @param The size of the data
 ==============================*/
 
-void ASIOSocket::Send(wxString address, int port, uint8_t* buff, size_t size)
+void ASIOSocket::Send(std::string address, int port, uint8_t* buff, size_t size)
 {
-    udp::resolver::results_type endp = this->m_Resolver->resolve(udp::v4(), address.ToStdString(), wxString::Format(wxT("%d"), (int)port).ToStdString());
-    size_t sent = this->m_Socket->send_to(asio::buffer(buff, size), *(endp.begin()));
+    this->Send(ASIOSocket::Resolve(address, port), buff, size);
+}
+
+
+/*==============================
+    ASIOSocket::Send
+    Sends data to an already resolved endpoint.
+    If the socket is connected to this endpoint, the
+    kernel's per-send route lookup is skipped. If network
+    impairment is enabled, the datagram goes through it.
+    @param The destination endpoint
+    @param The data to send
+    @param The size of the data
+==============================*/
+
+void ASIOSocket::Send(const udp::endpoint& endpoint, uint8_t* buff, size_t size)
+{
+    size_t sent;
+    asio::error_code error;
+    if (this->m_Impairment != NULL)
+    {
+        this->m_Impairment->Send(this->m_Socket, this->m_LocalEndpoint, endpoint, buff, size);
+        return;
+    }
+    if (this->m_Connected && endpoint == this->m_ConnectedEndpoint)
+        sent = this->m_Socket->send(asio::buffer(buff, size), 0, error);
+    else
+        sent = this->m_Socket->send_to(asio::buffer(buff, size), endpoint, 0, error);
+
+    // A connected socket reports ICMP errors (like the server restarting) on the next send, treat it as a dropped datagram
+    if (error)
+    {
+        #if DEBUGPRINTS
+            printf("Failed to send %ld bytes to %s:%d (%s)\n", size, endpoint.address().to_string().c_str(), endpoint.port(), error.message().c_str());
+        #endif
+        return;
+    }
+    if (PacketCapture::IsActive())
+        PacketCapture::Datagram(CAPTURE_OUT, this->m_LocalEndpoint, endpoint, buff, sent);
     #if DEBUGPRINTS
-        printf("Sent %ld bytes to %s:%d\n", sent, (const char*)address.mb_str(), port);
+        printf("Sent %ld bytes to %s:%d\n", sent, endpoint.address().to_string().c_str(), endpoint.port());
     #else
         (void)sent;
     #endif
 }
 
 
+/*==============================
+    ASIOSocket::SendBatch
+    Sends a set of datagrams to an endpoint. On Linux this is 
+    a single sendmmsg call (per MAX_BATCHCOUNT datagrams).
+    @param The destination endpoint
+    @param The slab with the datagrams
+    @param The size of each slot in the slab
+    @param The size of each datagram
+    @param The number of datagrams
+==============================*/
+
+void ASIOSocket::SendBatch(const udp::endpoint& endpoint, uint8_t* slab, size_t slotsize, size_t* sizes, size_t count)
+{
+    #ifdef __linux__
+        struct mmsghdr msgs[MAX_BATCHCOUNT];
+        struct iovec iovecs[MAX_BATCHCOUNT];
+        bool connected = this->m_Connected && endpoint == this->m_ConnectedEndpoint;
+        size_t sent = 0;
+        if (this->m_Impairment != NULL)
+        {
+            for (size_t i=0; i<count; i++)
+                this->Send(endpoint, slab + i*slotsize, sizes[i]);
+            return;
+        }
+        while (sent < count)
+        {
+            int ret;
+            size_t batch = std::min(count - sent, (size_t)MAX_BATCHCOUNT);
+            memset(msgs, 0, sizeof(struct mmsghdr)*batch);
+            for (size_t i=0; i<batch; i++)
+            {
+                iovecs[i].iov_base = slab + (sent + i)*slotsize;
+                iovecs[i].iov_len = sizes[sent + i];
+                msgs[i].msg_hdr.msg_iov = &iovecs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+                if (!connected)
+                {
+                    msgs[i].msg_hdr.msg_name = (void*)endpoint.data();
+                    msgs[i].msg_hdr.msg_namelen = endpoint.size();
+                }
+            }
+            ret = sendmmsg(this->m_Socket->native_handle(), msgs, batch, 0);
+            if (ret <= 0)
+            {
+                if (ret < 0 && errno == EINTR)
+                    continue;
+                break; // Same as a dropped datagram
+            }
+            if (PacketCapture::IsActive())
+                for (int i=0; i<ret; i++)
+                    PacketCapture::Datagram(CAPTURE_OUT, this->m_LocalEndpoint, endpoint, slab + (sent + i)*slotsize, sizes[sent + i]);
+            sent += ret;
+        }
+        #if DEBUGPRINTS
+            printf("Sent %ld datagrams to %s:%d\n", sent, endpoint.address().to_string().c_str(), endpoint.port());
+        #endif
+    #else
+        for (size_t i=0; i<count; i++)
+            this->Send(endpoint, slab + i*slotsize, sizes[i]);
+    #endif
+}
+
+
+/*==============================
+    ASIOSocket::Connect
+    Connects the socket to an endpoint. Only do this if the
+    socket talks exclusively to this endpoint, as the kernel
+    will drop datagrams coming from anywhere else.
+    @param The endpoint to connect to
+==============================*/
+
+void ASIOSocket::Connect(const udp::endpoint& endpoint)
+{
+    this->m_Socket->connect(endpoint);
+    this->m_ConnectedEndpoint = endpoint;
+    this->m_Connected = true;
+}
+
+
+/*==============================
+    ASIOSocket::IsConnected
+    Checks whether the socket is connected to an endpoint
+    @return Whether the socket is connected
+==============================*/
+
+bool ASIOSocket::IsConnected()
+{
+    return this->m_Connected;
+}
+
+
+/*==============================
+    ASIOSocket::GetLocalEndpoint
+    Gets the endpoint that the socket is bound to
+    @return The socket's local endpoint
+==============================*/
+
+udp::endpoint ASIOSocket::GetLocalEndpoint()
+{
+    return this->m_LocalEndpoint;
+}
+
+
 /*==============================
     ASIOSocket::LastReadCount
     Returns the number of bytes that were read
@@ -210,22 +516,105 @@ static inline uint32_t sequence_increment(uint32_t seqnum)
     @return The string representation of the bits
 ==============================*/
 
-static wxString getbits(size_t size, void* num)
+static std::string getbits(size_t size, void* num)
 {
-    wxString ret = "";
+    std::string ret = "";
     uint8_t* bp = (uint8_t*) num;
     for (int i = size-1; i >= 0; i--)
     {
         for (int j = 7; j >= 0; j--)
         {
             uint8_t byte = (bp[i] >> j) & 1;
-            ret += wxString::Format("%u", byte);
+            ret += (char)('0' + byte);
         }
     }
     return ret;
 }
 
 
+/*==============================
+    getbytes
+    Gets a string representation of a set of bytes in hex
+    @param  The bytes to represent
+    @param  The number of bytes
+    @return The string representation of the bytes
+==============================*/
+
+static std::string getbytes(uint8_t* bytes, size_t size)
+{
+    std::string ret = "";
+    char hex[4];
+    for (size_t i=0; i<size; i++)
+    {
+        snprintf(hex, sizeof(hex), "%02x ", bytes[i]);
+        ret += hex;
+    }
+    return ret;
+}
+
+
+/*==============================
+    read_u16
+    Reads a big endian 16-bit number from a buffer
+    @param  The buffer to read from
+    @return The number in native endianness
+==============================*/
+
+static inline uint16_t read_u16(const uint8_t* buff)
+{
+    uint16_t val;
+    memcpy(&val, buff, sizeof(val));
+    return swap_endian16(val);
+}
+
+
+/*==============================
+    read_u32
+    Reads a big endian 32-bit number from a buffer
+    @param  The buffer to read from
+    @return The number in native endianness
+==============================*/
+
+static inline uint32_t read_u32(const uint8_t* buff)
+{
+    uint32_t val;
+    memcpy(&val, buff, sizeof(val));
+    return swap_endian32(val);
+}
+
+
+/*==============================
+    write_u16
+    Writes a 16-bit number to a buffer as big endian
+    @param  The buffer to write to
+    @param  The number to write
+    @return The number of bytes written
+==============================*/
+
+static inline uint32_t write_u16(uint8_t* buff, uint16_t val)
+{
+    val = swap_endian16(val);
+    memcpy(buff, &val, sizeof(val));
+    return sizeof(val);
+}
+
+
+/*==============================
+    write_u32
+    Writes a 32-bit number to a buffer as big endian
+    @param  The buffer to write to
+    @param  The number to write
+    @return The number of bytes written
+==============================*/
+
+static inline uint32_t write_u32(uint8_t* buff, uint32_t val)
+{
+    val = swap_endian32(val);
+    memcpy(buff, &val, sizeof(val));
+    return sizeof(val);
+}
+
+
 /*==============================
     MakeAck_S64Packet
     Creates an ack S64 Packet
@@ -262,16 +651,15 @@ static AbstractPacket* MakeAck_NetLibPacket()
     @param The port of the destination
 ==============================*/
 
-UDPHandler::UDPHandler(ASIOSocket* socket, wxString address, int port)
+UDPHandler::UDPHandler(ASIOSocket* socket, std::string address, int port)
 {
     this->m_Socket = socket;
     this->m_Address = address;
     this->m_Port = port;
-    this->m_LocalSeqNum = 0;
-    this->m_RemoteSeqNum = 0;
-    this->m_AckBitfield = 0;
-    this->m_AcksLeft_RX = std::deque<AbstractPacket*>();
-    this->m_AcksLeft_TX = std::deque<AbstractPacket*>();
+    this->m_HasEndpoint = false;
+    this->m_ConnectSocket = false;
+    this->m_Stats = NULL;
+    this->InitializeSequences();
     #if DEBUGPRINTS
         printf("Created UDP handler for %s:%d\n", static_cast<const char*>(address.c_str()), port);
     #endif
@@ -285,18 +673,14 @@ UDPHandler::UDPHandler(ASIOSocket* socket, wxString address, int port)
     @param The address and port combination for the handler to connect to
 ==============================*/
 
-UDPHandler::UDPHandler(ASIOSocket* socket, wxString fulladdress)
+UDPHandler::UDPHandler(ASIOSocket* socket, std::string fulladdress)
 {
-    wxStringTokenizer tokenizer(fulladdress, ":");
-    this->m_Address = tokenizer.GetNextToken();
-    if (tokenizer.HasMoreTokens())
-        tokenizer.GetNextToken().ToInt(&this->m_Port);
+    address_split(fulladdress, &this->m_Address, &this->m_Port);
     this->m_Socket = socket;
-    this->m_LocalSeqNum = 0;
-    this->m_RemoteSeqNum = 0;
-    this->m_AckBitfield = 0;
-    this->m_AcksLeft_RX = std::deque<AbstractPacket*>();
-    this->m_AcksLeft_TX = std::deque<AbstractPacket*>();
+    this->m_HasEndpoint = false;
+    this->m_ConnectSocket = false;
+    this->m_Stats = NULL;
+    this->InitializeSequences();
     #if DEBUGPRINTS
         printf("Created UDP handler for %s\n", static_cast<const char*>(fulladdress.c_str()));
     #endif
@@ -310,23 +694,50 @@ UDPHandler::UDPHandler(ASIOSocket* socket, wxString fulladdress)
 
 UDPHandler::~UDPHandler()
 {
-    for (AbstractPacket* pkt : this->m_AcksLeft_RX)
-        free(pkt);
-    for (AbstractPacket* pkt : this->m_AcksLeft_TX)
-        free(pkt);
     #if DEBUGPRINTS
         printf("Destroyed UDP handler for %s:%d\n", static_cast<const char*>(this->m_Address.c_str()), this->m_Port);
     #endif
 }
 
 
+/*==============================
+    UDPHandler::InitializeSequences
+    Resets the sequence numbers and the sliding windows
+==============================*/
+
+void UDPHandler::InitializeSequences()
+{
+    this->m_LocalSeqNum = 0;
+    this->m_RemoteSeqNum = 0;
+    this->m_AckBitfield = 0;
+    this->m_TXOldest = 0;
+    this->m_TXCount = 0;
+    this->m_BatchCount = 0;
+    this->m_Batching = false;
+    this->m_ResendWheelSlot = 0;
+    this->m_ResendWheelCount = 0;
+    this->m_ResendWheelTime = std::chrono::steady_clock::now();
+    this->m_SRTT = 0;
+    this->m_RTTVar = 0;
+    this->m_RTO = TIME_RESEND;
+    this->m_HasRTTSample = false;
+    for (int i=0; i<SEQWINDOW_RX; i++)
+    {
+        this->m_RXSeqNums[i] = 0;
+        this->m_RXReceived[i] = false;
+    }
+    for (int i=0; i<SEQWINDOW_TX; i++)
+        this->m_TXPackets[i].reset();
+}
+
+
 /*==============================
     UDPHandler::GetAddress
     Retrieves the server address of the destination
     @return The server address of the destination
 ==============================*/
 
-wxString UDPHandler::GetAddress()
+std::string UDPHandler::GetAddress()
 {
     return this->m_Address;
 }
@@ -357,42 +768,156 @@ ASIOSocket* UDPHandler::GetSocket()
 
 
 /*==============================
-    UDPHandler::GetSocket
+    UDPHandler::SetEndpoint
+    Stores a freshly resolved destination endpoint, reconnecting
+    the socket if it was connected to the old one
+    @param The resolved endpoint
+==============================*/
+
+void UDPHandler::SetEndpoint(const udp::endpoint& endpoint)
+{
+    bool changed = !this->m_HasEndpoint || endpoint != this->m_Endpoint;
+    this->m_Endpoint = endpoint;
+    this->m_HasEndpoint = true;
+    this->m_EndpointTime = std::chrono::steady_clock::now();
+    if (this->m_ConnectSocket && changed)
+        this->m_Socket->Connect(this->m_Endpoint);
+}
+
+
+/*==============================
+    UDPHandler::UpdateEndpoint
+    Makes sure we have a resolved destination endpoint.
+    The first resolve blocks, afterwards the endpoint is
+    re-resolved in the background once its TTL expires, and
+    the old one keeps being used until the new one is ready.
+    @throws asio::system_error If the first resolve fails
+==============================*/
+
+void UDPHandler::UpdateEndpoint()
+{
+    // First time, we have no choice but to block
+    if (!this->m_HasEndpoint)
+    {
+        this->SetEndpoint(ASIOSocket::Resolve(this->m_Address, this->m_Port));
+        return;
+    }
+
+    // Collect the result of a background resolve
+    if (this->m_EndpointResolve.valid())
+    {
+        if (this->m_EndpointResolve.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return;
+        try
+        {
+            this->SetEndpoint(this->m_EndpointResolve.get());
+        }
+        catch (asio::system_error& e)
+        {
+            // Keep using the old endpoint and try again after another TTL
+            (void)e;
+            this->m_EndpointTime = std::chrono::steady_clock::now();
+        }
+        return;
+    }
+
+    // If the TTL expired, start a background resolve
+    if (std::chrono::steady_clock::now() - this->m_EndpointTime > std::chrono::milliseconds(TIME_RESOLVETTL))
+        this->m_EndpointResolve = std::async(std::launch::async, &ASIOSocket::Resolve, this->m_Address, this->m_Port);
+}
+
+
+/*==============================
+    UDPHandler::ConnectSocket
+    Connects the handler's socket to the destination, so that
+    sends skip the kernel's route lookup. Only use this if the
+    socket is not shared with other handlers.
+    @throws asio::system_error If the address could not be resolved
+==============================*/
+
+void UDPHandler::ConnectSocket()
+{
+    this->m_ConnectSocket = true;
+    this->UpdateEndpoint();
+    if (!this->m_Socket->IsConnected())
+        this->m_Socket->Connect(this->m_Endpoint);
+}
+
+
+/*==============================
+    UDPHandler::SendPacket
     Sends a packet to the server
+    The handler takes ownership of the packet. Unreliable
+    packets are deleted once sent, reliable ones once acked.
     @param  The packet to send
-    @throws ClientTimeoutException If a packet fails to send after MAX_RESENDCOUNT attempts
+    @throws ClientTimeoutException If a packet went unacked for TIME_GIVEUP, 
+                                   or too many reliable packets are waiting for an ack
 ==============================*/
 
 void UDPHandler::SendPacket(AbstractPacket* pkt)
 {
     uint8_t* data;
-    uint16_t ackbitfield = 0;
+    uint16_t size;
+    bool reliable = (pkt->GetFlags() & FLAG_UNRELIABLE) == 0;
         
     // Check for timeouts
     pkt->UpdateSendAttempt();
-    if (pkt->GetSendAttempts() > MAX_RESENDCOUNT)
-        throw ClientTimeoutException(wxString::Format("%s:%d", this->m_Address, this->m_Port));
+    if (pkt->GetSendAttempts() > 1 && pkt->GetSendTimestamp() - pkt->GetFirstSendTimestamp() > std::chrono::milliseconds(TIME_GIVEUP))
+        throw ClientTimeoutException(this->m_Address + ":" + std::to_string(this->m_Port));
     
     // Set the sequence data
     if (pkt->GetSendAttempts() == 1)
     {
+        // If the TX window is full, the oldest packet went unacked for far too long
+        if (reliable && this->m_TXPackets[this->m_LocalSeqNum % SEQWINDOW_TX].get() != NULL)
+        {
+            delete pkt;
+            throw ClientTimeoutException(this->m_Address + ":" + std::to_string(this->m_Port));
+        }
         pkt->SetSequenceNumber(this->m_LocalSeqNum);
         pkt->SetAck(this->m_RemoteSeqNum);
-        for (AbstractPacket* pkt2ack : this->m_AcksLeft_RX)
-            if (sequence_greaterthan(this->m_RemoteSeqNum, pkt2ack->GetSequenceNumber()))
-                ackbitfield |= 1 << (sequence_delta(this->m_RemoteSeqNum, pkt2ack->GetSequenceNumber()) - 1);
-        pkt->SetAckBitfield(ackbitfield);
+        pkt->SetAckBitfield(this->m_AckBitfield);
+    }
+
+    // Make sure we know where to send the packet
+    this->UpdateEndpoint();
+
+    // Serialize the packet into the batch or our send buffer, only going to the heap if it doesn't fit
+    data = this->m_Batching ? &this->m_BatchSlab[this->m_BatchCount*MAX_PACKETSIZE] : this->m_SendBuffer;
+    size = pkt->WriteAsBytes(data, MAX_PACKETSIZE);
+    if (size == 0)
+    {
+        this->FlushBatch();
+        data = pkt->GetAsBytes();
+        size = pkt->GetAsBytes_Size();
     }
 
-    // Send the packet
-    data = pkt->GetAsBytes();
-    this->m_Socket->Send(this->m_Address, this->m_Port, data, pkt->GetAsBytes_Size());
+    // Send the packet, or queue it if we're batching
+    if (this->m_Batching && data != this->m_SendBuffer && size <= MAX_PACKETSIZE)
+    {
+        this->m_BatchSizes[this->m_BatchCount++] = size;
+        if (this->m_BatchCount == MAX_BATCHCOUNT)
+            this->FlushBatch();
+    }
+    else
+        this->m_Socket->Send(this->m_Endpoint, data, size);
     
-    // Add it to our list of packets that need an ack
-    if ((pkt->GetFlags() & FLAG_UNRELIABLE) == 0 && pkt->GetSendAttempts() == 1)
+    // Add it to our window of packets that need an ack, and schedule its retransmission
+    if (reliable && pkt->GetSendAttempts() == 1)
     {
-        this->m_AcksLeft_TX.push_back(pkt);
+        this->m_TXPackets[this->m_LocalSeqNum % SEQWINDOW_TX].reset(pkt);
+        this->ScheduleResend(this->m_LocalSeqNum, pkt->GetSendTimestamp() + std::chrono::microseconds((int64_t)(this->m_RTO*1000)));
         this->m_LocalSeqNum = sequence_increment(this->m_LocalSeqNum);
+        this->m_TXCount++;
+    }
+
+    // Update the stats
+    if (this->m_Stats != NULL)
+    {
+        this->m_Stats->CountOut(size);
+        if (pkt->GetSendAttempts() > 1)
+            this->m_Stats->CountResend();
+        this->m_Stats->SetOutstanding(this->m_TXCount);
     }
 
     // Debug prints for developers
@@ -406,7 +931,152 @@ void UDPHandler::SendPacket(AbstractPacket* pkt)
     #endif
 
     // Cleanup
-    free(data);
+    if (size > MAX_PACKETSIZE)
+        free(data);
+    if (!reliable)
+        delete pkt;
+}
+
+
+/*==============================
+    UDPHandler::BeginBatch
+    Starts collecting sent packets into a batch instead of
+    sending them right away. Call EndBatch to send them.
+==============================*/
+
+void UDPHandler::BeginBatch()
+{
+    if (this->m_BatchSlab.empty())
+        this->m_BatchSlab.resize(MAX_BATCHCOUNT*MAX_PACKETSIZE);
+    this->m_Batching = true;
+}
+
+
+/*==============================
+    UDPHandler::EndBatch
+    Sends all the packets collected since BeginBatch, and 
+    stops batching
+==============================*/
+
+void UDPHandler::EndBatch()
+{
+    this->FlushBatch();
+    this->m_Batching = false;
+}
+
+
+/*==============================
+    UDPHandler::FlushBatch
+    Sends all the packets collected in the batch so far with
+    as few syscalls as possible
+==============================*/
+
+void UDPHandler::FlushBatch()
+{
+    if (this->m_BatchCount > 0)
+        this->m_Socket->SendBatch(this->m_Endpoint, &this->m_BatchSlab[0], MAX_PACKETSIZE, this->m_BatchSizes, this->m_BatchCount);
+    this->m_BatchCount = 0;
+}
+
+
+/*==============================
+    UDPHandler::IsReceived
+    Checks if a reliable packet with the given sequence number
+    was received within the RX window
+    @param  The sequence number to check
+    @return Whether the packet was received
+==============================*/
+
+bool UDPHandler::IsReceived(uint16_t seqnum)
+{
+    uint16_t slot = seqnum % SEQWINDOW_RX;
+    return this->m_RXReceived[slot] && this->m_RXSeqNums[slot] == seqnum;
+}
+
+
+/*==============================
+    UDPHandler::MarkReceived
+    Marks a reliable packet as received, and updates the
+    ack bitfield to include it
+    @param  The sequence number of the packet
+==============================*/
+
+void UDPHandler::MarkReceived(uint16_t seqnum)
+{
+    uint16_t slot = seqnum % SEQWINDOW_RX;
+    int delta;
+    this->m_RXSeqNums[slot] = seqnum;
+    this->m_RXReceived[slot] = true;
+    if (!sequence_greaterthan(this->m_RemoteSeqNum, seqnum))
+        return;
+    delta = sequence_delta(this->m_RemoteSeqNum, seqnum);
+    if (delta <= 16)
+        this->m_AckBitfield |= 1 << (delta - 1);
+}
+
+
+/*==============================
+    UDPHandler::AdvanceRemoteSequence
+    Moves the remote sequence number forward, sliding the ack
+    bitfield along with it and forgetting RX slots which fell
+    out of the window
+    @param  The new remote sequence number
+==============================*/
+
+void UDPHandler::AdvanceRemoteSequence(uint16_t seqnum)
+{
+    int delta = sequence_delta(seqnum, this->m_RemoteSeqNum);
+    uint32_t bitfield = 0;
+
+    // Slide the bitfield, including the old remote sequence number if we received it
+    if (delta <= 16)
+    {
+        bitfield = ((uint32_t)this->m_AckBitfield) << delta;
+        if (this->IsReceived(this->m_RemoteSeqNum))
+            bitfield |= 1 << (delta - 1);
+    }
+    this->m_AckBitfield = (uint16_t)bitfield;
+
+    // Clear the slots that are being reused by the new part of the window
+    if (delta > SEQWINDOW_RX)
+        delta = SEQWINDOW_RX;
+    for (int i=1; i<=delta; i++)
+        this->m_RXReceived[(this->m_RemoteSeqNum + i) % SEQWINDOW_RX] = false;
+    this->m_RemoteSeqNum = seqnum;
+}
+
+
+/*==============================
+    UDPHandler::AcknowledgePackets
+    Removes all packets from the TX window which are acknowledged
+    by the given ack information
+    @param  The ack number
+    @param  The ack bitfield
+==============================*/
+
+void UDPHandler::AcknowledgePackets(uint16_t acknum, uint16_t ackbitfield)
+{
+    uint32_t acked = (((uint32_t)ackbitfield) << 1) | 1;
+    for (int i=0; acked != 0; i++, acked >>= 1)
+    {
+        uint16_t seqnum = (acknum - i) & MAX_SEQUENCENUM;
+        uint16_t slot = seqnum % SEQWINDOW_TX;
+        AbstractPacket* pkt2ack = this->m_TXPackets[slot].get();
+        if ((acked & 1) == 0 || pkt2ack == NULL || pkt2ack->GetSequenceNumber() != seqnum)
+            continue;
+
+        // Karn's rule, only packets that were sent once give an unambiguous RTT sample
+        if (pkt2ack->GetSendAttempts() == 1)
+            this->UpdateRTT(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pkt2ack->GetSendTimestamp()).count());
+        this->m_TXPackets[slot].reset();
+        this->m_TXCount--;
+    }
+
+    // Move the start of the TX window past any acked packets
+    while (this->m_TXOldest != this->m_LocalSeqNum && this->m_TXPackets[this->m_TXOldest % SEQWINDOW_TX].get() == NULL)
+        this->m_TXOldest = sequence_increment(this->m_TXOldest);
+    if (this->m_Stats != NULL)
+        this->m_Stats->SetOutstanding(this->m_TXCount);
 }
 
 
@@ -416,54 +1086,32 @@ void UDPHandler::SendPacket(AbstractPacket* pkt)
     @param  The packet to handle
     @param  The ack maker function for this packet type
     @return Whether this packet's sequence was handled correctly
-    @throws ClientTimeoutException If a packet fails to send after MAX_RESENDCOUNT attempts
+    @throws ClientTimeoutException If a packet went unacked for TIME_GIVEUP
 ==============================*/
 
 bool UDPHandler::HandlePacketSequence(AbstractPacket* pkt, AbstractPacket* (*ackmaker)())
 {
-    std::deque<AbstractPacket*>::iterator it;
-            
-    // If a packet with this sequence number already exists in our RX list, ignore this packet
-    for (AbstractPacket* rxpkt : this->m_AcksLeft_RX)
-    {
-        if (rxpkt->GetSequenceNumber() == pkt->GetSequenceNumber())
-        {
-            if ((pkt->GetFlags() & FLAG_EXPLICITACK) != 0)
-                this->SendPacket(ackmaker());
-            delete pkt;
-            return false;
-        }
-    }
-
-    // Go through transmitted packets and remove all which were acknowledged in the one we received
-    it = this->m_AcksLeft_TX.begin();
-    while (it != this->m_AcksLeft_TX.end())
+    // If we already received a reliable packet with this sequence number, ignore this packet
+    if (this->IsReceived(pkt->GetSequenceNumber()))
     {
-        AbstractPacket* pkt2ack = *it;
-        if (pkt->IsAcked(pkt2ack->GetSequenceNumber()))
-        {
-            delete pkt2ack;
-            it = this->m_AcksLeft_TX.erase(it);
-        }
-        else
-            ++it;
+        if (this->m_Stats != NULL)
+            this->m_Stats->CountDuplicate();
+        if ((pkt->GetFlags() & FLAG_EXPLICITACK) != 0)
+            this->SendPacket(ackmaker());
+        delete pkt;
+        return false;
     }
 
+    // Remove all transmitted packets which were acknowledged in the one we received
+    this->AcknowledgePackets(pkt->GetAck(), pkt->GetAckBitfield());
+
     // Increment the sequence number to the packet's highest value
     if (sequence_greaterthan(pkt->GetSequenceNumber(), this->m_RemoteSeqNum))
-        this->m_RemoteSeqNum = pkt->GetSequenceNumber();
+        this->AdvanceRemoteSequence(pkt->GetSequenceNumber());
         
     // Handle reliable packets
     if ((pkt->GetFlags() & FLAG_UNRELIABLE) == 0)
-    {
-        // Update our received packet list
-        if (this->m_AcksLeft_RX.size() > 17)
-        {
-            delete this->m_AcksLeft_RX.front();
-            this->m_AcksLeft_RX.pop_front();
-        }
-        this->m_AcksLeft_RX.push_back(pkt);
-    }
+        this->MarkReceived(pkt->GetSequenceNumber());
     
     // If the packet wants an explicit ack, send it
     if ((pkt->GetFlags() & FLAG_EXPLICITACK) != 0)
@@ -478,15 +1126,16 @@ bool UDPHandler::HandlePacketSequence(AbstractPacket* pkt, AbstractPacket* (*ack
     UDPHandler::ReadS64Packet
     Reads an S64 Packet from a collection of bytes 
     @param  The bytes with the packet information
-    @return The created packet, or NULL
+    @param  The number of valid bytes in the buffer
+    @return The created packet (which the caller must delete), or NULL
+    @throws BadPacketVersionException  If the packet is a higher version than supported
 ==============================*/
 
-S64Packet* UDPHandler::ReadS64Packet(uint8_t* data)
+S64Packet* UDPHandler::ReadS64Packet(uint8_t* data, size_t size)
 {
-    S64Packet* pkt;
-    if (!S64Packet::IsS64Packet(data))
-        return NULL;
-    pkt = S64Packet::FromBytes(data);
+    S64Packet* pkt = S64Packet::FromBytes(data, size);
+    if (pkt != NULL && this->m_Stats != NULL)
+        this->m_Stats->CountIn(size);
 
     // Handle sequence numbers
     if (pkt == NULL || !HandlePacketSequence(pkt, &MakeAck_S64Packet))
@@ -494,7 +1143,7 @@ S64Packet* UDPHandler::ReadS64Packet(uint8_t* data)
 
     // Debug prints for developers
     #if DEBUGPRINTS
-        if (pkt->GetType() != 0)
+        if (!pkt->IsAckBeat())
             printf("Received %s\n", static_cast<const char*>(pkt->AsString().c_str()));
     #endif
 
@@ -507,15 +1156,16 @@ S64Packet* UDPHandler::ReadS64Packet(uint8_t* data)
     UDPHandler::ReadNetLibPacket
     Reads an NetLib Packet from a collection of bytes 
     @param  The bytes with the packet information
-    @return The created packet, or NULL
+    @param  The number of valid bytes in the buffer
+    @return The created packet (which the caller must delete), or NULL
+    @throws BadPacketVersionException  If the packet is a higher version than supported
 ==============================*/
 
-NetLibPacket* UDPHandler::ReadNetLibPacket(uint8_t* data)
+NetLibPacket* UDPHandler::ReadNetLibPacket(uint8_t* data, size_t size)
 {
-    NetLibPacket* pkt;
-    if (!NetLibPacket::IsNetLibPacket(data))
-        return NULL;
-    pkt = NetLibPacket::FromBytes(data);
+    NetLibPacket* pkt = NetLibPacket::FromBytes(data, size);
+    if (pkt != NULL && this->m_Stats != NULL)
+        this->m_Stats->CountIn(size);
 
     // Handle sequence numbers
     if (pkt == NULL || !HandlePacketSequence(pkt, &MakeAck_NetLibPacket))
@@ -523,7 +1173,7 @@ NetLibPacket* UDPHandler::ReadNetLibPacket(uint8_t* data)
 
     // Debug prints for developers
     #if DEBUGPRINTS
-        if (pkt->GetType() != 0)
+        if (!pkt->IsAckBeat())
             printf("Received %s\n", static_cast<const char*>(pkt->AsString().c_str()));
     #endif
 
@@ -532,19 +1182,217 @@ NetLibPacket* UDPHandler::ReadNetLibPacket(uint8_t* data)
 }
 
 
+/*==============================
+    UDPHandler::UpdateRTT
+    Updates the round trip time estimates with a new sample,
+    and recalculates the retransmission timeout (RFC 6298)
+    @param The measured round trip time, in milliseconds
+==============================*/
+
+void UDPHandler::UpdateRTT(double sample)
+{
+    if (!this->m_HasRTTSample)
+    {
+        this->m_SRTT = sample;
+        this->m_RTTVar = sample/2;
+        this->m_HasRTTSample = true;
+    }
+    else
+    {
+        this->m_RTTVar = 0.75*this->m_RTTVar + 0.25*fabs(this->m_SRTT - sample);
+        this->m_SRTT = 0.875*this->m_SRTT + 0.125*sample;
+    }
+    this->m_RTO = this->m_SRTT + std::max((double)TIMERWHEEL_TICK, 4*this->m_RTTVar);
+    if (this->m_RTO < TIME_RTO_MIN)
+        this->m_RTO = TIME_RTO_MIN;
+    else if (this->m_RTO > TIME_RTO_MAX)
+        this->m_RTO = TIME_RTO_MAX;
+    if (this->m_Stats != NULL)
+    {
+        this->m_Stats->SetRTT(this->m_SRTT, this->m_RTTVar);
+        this->m_Stats->AddLatency(sample*1000);
+    }
+}
+
+
+/*==============================
+    UDPHandler::ScheduleResend
+    Places a packet in the retransmission timer wheel
+    @param The sequence number of the packet
+    @param When the packet should be resent
+==============================*/
+
+void UDPHandler::ScheduleResend(uint16_t seqnum, std::chrono::steady_clock::time_point deadline)
+{
+    int64_t ticks = 0;
+    if (deadline > this->m_ResendWheelTime)
+        ticks = (std::chrono::duration_cast<std::chrono::milliseconds>(deadline - this->m_ResendWheelTime).count() + TIMERWHEEL_TICK - 1)/TIMERWHEEL_TICK;
+    if (ticks > TIMERWHEEL_SLOTS - 1)
+        ticks = TIMERWHEEL_SLOTS - 1;
+    this->m_TXDeadlines[seqnum % SEQWINDOW_TX] = deadline;
+    this->m_ResendWheel[(this->m_ResendWheelSlot + ticks) % TIMERWHEEL_SLOTS].push_back(seqnum);
+    this->m_ResendWheelCount++;
+}
+
+
 /*==============================
     UDPHandler::ResendMissingPackets
-    Resends all packets which did not receive an ack after the resend time
-    @param  The bytes with the packet information
-    @return The created packet, or NULL
-    @throws ClientTimeoutException If a packet fails to send after MAX_RESENDCOUNT attempts
+    Resends all packets whose retransmission timer expired.
+    Only the timer wheel slots that elapsed since the last call
+    are visited. Each resend doubles the packet's timeout, up to
+    TIME_RTO_MAX, and requests an explicit ack so that a remote 
+    which has nothing else to send still acknowledges it.
+    @throws ClientTimeoutException If a packet went unacked for TIME_GIVEUP
 ==============================*/
 
 void UDPHandler::ResendMissingPackets()
 {
-    for (AbstractPacket* pkt2ack : this->m_AcksLeft_TX)
-        if (pkt2ack->GetSendTime() > TIME_RESEND)
-            this->SendPacket(pkt2ack);
+    bool startedbatch = false;
+    int slotsvisited = 0;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    while (this->m_ResendWheelTime <= now && slotsvisited < TIMERWHEEL_SLOTS)
+    {
+        // Take the packets out of the current slot, and move the wheel forward
+        this->m_ResendWheelDue.clear();
+        this->m_ResendWheelDue.swap(this->m_ResendWheel[this->m_ResendWheelSlot]);
+        this->m_ResendWheelSlot = (this->m_ResendWheelSlot + 1) % TIMERWHEEL_SLOTS;
+        this->m_ResendWheelTime += std::chrono::milliseconds(TIMERWHEEL_TICK);
+        slotsvisited++;
+
+        // Handle the packets in the slot
+        for (size_t i=0; i<this->m_ResendWheelDue.size(); i++)
+        {
+            uint16_t seqnum = this->m_ResendWheelDue[i];
+            AbstractPacket* pkt2ack = this->m_TXPackets[seqnum % SEQWINDOW_TX].get();
+            double timeout;
+            this->m_ResendWheelCount--;
+
+            // Skip packets which were acked already, and reschedule ones which were placed in the last slot but aren't due yet
+            if (pkt2ack == NULL || pkt2ack->GetSequenceNumber() != seqnum)
+                continue;
+            if (this->m_TXDeadlines[seqnum % SEQWINDOW_TX] > now)
+            {
+                this->ScheduleResend(seqnum, this->m_TXDeadlines[seqnum % SEQWINDOW_TX]);
+                continue;
+            }
+
+            // Resend the packet (batching the resends together), backing off exponentially
+            if (!this->m_Batching)
+            {
+                this->BeginBatch();
+                startedbatch = true;
+            }
+            pkt2ack->EnableFlags(FLAG_EXPLICITACK);
+            try
+            {
+                this->SendPacket(pkt2ack);
+            }
+            catch (ClientTimeoutException&)
+            {
+                // Put this packet and the ones we didn't get to back in the wheel, and send what was batched so far, so the handler stays usable
+                this->ScheduleResend(seqnum, now);
+                for (size_t j=i+1; j<this->m_ResendWheelDue.size(); j++)
+                {
+                    uint16_t pending = this->m_ResendWheelDue[j];
+                    AbstractPacket* pendingpkt = this->m_TXPackets[pending % SEQWINDOW_TX].get();
+                    this->m_ResendWheelCount--;
+                    if (pendingpkt != NULL && pendingpkt->GetSequenceNumber() == pending)
+                        this->ScheduleResend(pending, this->m_TXDeadlines[pending % SEQWINDOW_TX]);
+                }
+                this->m_ResendWheelDue.clear();
+                if (startedbatch)
+                    this->EndBatch();
+                throw;
+            }
+            timeout = std::min(this->m_RTO*(1 << std::min(pkt2ack->GetSendAttempts()-1, 16)), (double)TIME_RTO_MAX);
+            this->ScheduleResend(seqnum, now + std::chrono::microseconds((int64_t)(timeout*1000)));
+        }
+    }
+
+    // If we haven't been called in a long time, the whole wheel was visited, so catch up
+    if (this->m_ResendWheelTime <= now)
+        this->m_ResendWheelTime = now;
+
+    // Send the resent packets
+    if (startedbatch)
+        this->EndBatch();
+}
+
+
+/*==============================
+    UDPHandler::HasPendingResends
+    Checks if any packets are waiting in the retransmission 
+    timer wheel, useful for deciding how often to call
+    ResendMissingPackets
+    @return Whether there are packets waiting to be resent
+==============================*/
+
+bool UDPHandler::HasPendingResends()
+{
+    return this->m_ResendWheelCount > 0;
+}
+
+
+/*==============================
+    UDPHandler::GetSRTT
+    Retrieves the smoothed round trip time
+    @return The smoothed round trip time, in milliseconds
+==============================*/
+
+double UDPHandler::GetSRTT()
+{
+    return this->m_SRTT;
+}
+
+
+/*==============================
+    UDPHandler::GetRTTVar
+    Retrieves the round trip time variation
+    @return The round trip time variation, in milliseconds
+==============================*/
+
+double UDPHandler::GetRTTVar()
+{
+    return this->m_RTTVar;
+}
+
+
+/*==============================
+    UDPHandler::GetRTO
+    Retrieves the current retransmission timeout
+    @return The retransmission timeout, in milliseconds
+==============================*/
+
+double UDPHandler::GetRTO()
+{
+    return this->m_RTO;
+}
+
+
+/*==============================
+    UDPHandler::SetStats
+    Sets where the handler counts its traffic. The stats must
+    outlive the handler, or be unset before they are deleted.
+    @param The stats to update, or NULL to stop counting
+==============================*/
+
+void UDPHandler::SetStats(TransportStats* stats)
+{
+    this->m_Stats = stats;
+    if (stats != NULL)
+        stats->SetOutstanding(this->m_TXCount);
+}
+
+
+/*==============================
+    UDPHandler::GetStats
+    Retrieves where the handler counts its traffic
+    @return The stats the handler updates, or NULL
+==============================*/
+
+TransportStats* UDPHandler::GetStats()
+{
+    return this->m_Stats;
 }
 
 
@@ -571,7 +1419,7 @@ AbstractPacket::AbstractPacket(uint8_t version, uint16_t size, uint8_t* data, ui
     this->m_Size = size;
     if (size > 0)
     {
-        this->m_Data = (uint8_t*)malloc(size);
+        this->m_Data = (size <= MAX_PACKETSIZE) ? this->m_InlineData : (uint8_t*)malloc(size);
         memcpy(this->m_Data, data, size);
     }
     else
@@ -579,7 +1427,8 @@ AbstractPacket::AbstractPacket(uint8_t version, uint16_t size, uint8_t* data, ui
     this->m_SequenceNum = seqnum;
     this->m_Ack = acknum;
     this->m_AckBitField = ackbitfield;
-    this->m_SendTime = 0;
+    this->m_SendTime = std::chrono::steady_clock::time_point();
+    this->m_FirstSendTime = std::chrono::steady_clock::time_point();
     this->m_SendAttempts = 0;
 }
 
@@ -591,7 +1440,7 @@ AbstractPacket::AbstractPacket(uint8_t version, uint16_t size, uint8_t* data, ui
 
 AbstractPacket::~AbstractPacket()
 {
-    if (this->m_Size > 0)
+    if (this->m_Data != NULL && this->m_Data != this->m_InlineData)
         free(this->m_Data);
 }
 
@@ -656,6 +1505,31 @@ uint16_t AbstractPacket::GetSequenceNumber()
 }
 
 
+/*==============================
+    AbstractPacket::GetAck
+    Retrieves the sequence number of the last packet the 
+    sender of this packet received
+    @return The packet's ack number
+==============================*/
+
+uint16_t AbstractPacket::GetAck()
+{
+    return this->m_Ack;
+}
+
+
+/*==============================
+    AbstractPacket::GetAckBitfield
+    Retrieves the packet's ack bitfield
+    @return The packet's ack bitfield
+==============================*/
+
+uint16_t AbstractPacket::GetAckBitfield()
+{
+    return this->m_AckBitField;
+}
+
+
 /*==============================
     AbstractPacket::GetSendTime
     Retrieves the time elapsed (in milliseconds) since this 
@@ -663,9 +1537,33 @@ uint16_t AbstractPacket::GetSequenceNumber()
     @return The time since the packet was sent (in milliseconds)
 ==============================*/
 
-wxLongLong AbstractPacket::GetSendTime()
+int64_t AbstractPacket::GetSendTime()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - this->m_SendTime).count();
+}
+
+
+/*==============================
+    AbstractPacket::GetSendTimestamp
+    Retrieves the moment this packet was last sent
+    @return The time the packet was last sent
+==============================*/
+
+std::chrono::steady_clock::time_point AbstractPacket::GetSendTimestamp()
+{
+    return this->m_SendTime;
+}
+
+
+/*==============================
+    AbstractPacket::GetFirstSendTimestamp
+    Retrieves the moment this packet was first sent
+    @return The time the packet was first sent
+==============================*/
+
+std::chrono::steady_clock::time_point AbstractPacket::GetFirstSendTimestamp()
 {
-    return wxGetLocalTimeMillis() - this->m_SendTime;
+    return this->m_FirstSendTime;
 }
 
 
@@ -682,6 +1580,28 @@ uint8_t AbstractPacket::GetSendAttempts()
 }
 
 
+/*==============================
+    AbstractPacket::GetAsBytes
+    Converts the packet into a newly allocated set of raw bytes.
+    Prefer WriteAsBytes with a reusable buffer in hot paths.
+    @return The packet converted into raw bytes (free with free()), or NULL
+==============================*/
+
+uint8_t* AbstractPacket::GetAsBytes()
+{
+    uint16_t size = this->GetAsBytes_Size();
+    uint8_t* bytes = (uint8_t*)malloc(size);
+    if (bytes == NULL)
+        return NULL;
+    if (this->WriteAsBytes(bytes, size) == 0)
+    {
+        free(bytes);
+        return NULL;
+    }
+    return bytes;
+}
+
+
 /*==============================
     AbstractPacket::IsAcked
     Checks if this packet is acking a specific sequence number
@@ -691,9 +1611,13 @@ uint8_t AbstractPacket::GetSendAttempts()
 
 bool AbstractPacket::IsAcked(uint16_t number)
 {
+    int delta;
     if (this->m_Ack == number)
         return true;
-    return ((this->m_AckBitField & (1 << (sequence_delta(this->m_Ack, number) - 1))) != 0);
+    if (!sequence_greaterthan(this->m_Ack, number))
+        return false;
+    delta = sequence_delta(this->m_Ack, number);
+    return delta <= 16 && ((this->m_AckBitField & (1 << (delta - 1))) != 0);
 }
 
 
@@ -753,7 +1677,9 @@ void AbstractPacket::SetAckBitfield(uint16_t bitfield)
 void AbstractPacket::UpdateSendAttempt()
 {
     this->m_SendAttempts++;
-    this->m_SendTime = wxGetLocalTimeMillis();
+    this->m_SendTime = std::chrono::steady_clock::now();
+    if (this->m_SendAttempts == 1)
+        this->m_FirstSendTime = this->m_SendTime;
 }
 
 
@@ -774,9 +1700,22 @@ void AbstractPacket::UpdateSendAttempt()
     @param The ack bitfield of the last received packets
 ==============================*/
 
-S64Packet::S64Packet(uint8_t version, wxString type, uint16_t size, uint8_t* data, uint8_t flags, uint16_t seqnum, uint16_t acknum, uint16_t ackbitfield) : AbstractPacket(version, size, data, flags, seqnum, acknum, ackbitfield)
+S64Packet::S64Packet(uint8_t version, std::string type, uint16_t size, uint8_t* data, uint8_t flags, uint16_t seqnum, uint16_t acknum, uint16_t ackbitfield) : AbstractPacket(version, size, data, flags, seqnum, acknum, ackbitfield)
 {
-    this->m_Type = type;
+    this->SetType(type.data(), type.length());
+}
+
+
+/*==============================
+    S64Packet (Constructor)
+    Initializes the class from a parsed packet view.
+    The view's data is copied once, straight into the packet.
+    @param The view of the received packet
+==============================*/
+
+S64Packet::S64Packet(S64PacketView* view) : AbstractPacket(view->GetVersion(), view->GetSize(), (uint8_t*)view->GetData(), view->GetFlags(), view->GetSequenceNumber(), view->GetAck(), view->GetAckBitfield())
+{
+    this->SetType(view->GetTypeData(), view->GetTypeLength());
 }
 
 
@@ -804,134 +1743,81 @@ bool S64Packet::IsS64Packet(uint8_t* bytes)
 }
 
 
+/*==============================
+    S64Packet::SetType
+    Stores the packet type string inside the packet
+    @param The type string (does not need to be null terminated)
+    @param The length of the type string
+==============================*/
+
+void S64Packet::SetType(const char* type, size_t length)
+{
+    if (length > UINT8_MAX)
+        length = UINT8_MAX;
+    memcpy(this->m_Type, type, length);
+    this->m_Type[length] = '\0';
+    this->m_TypeLength = length;
+}
+
+
 /*==============================
     S64Packet::FromBytes
     Retrieves an S64Packet from the given bytes
     @param  The raw bytes
+    @param  The number of valid bytes
     @return The S64Packet contained in the bytes, or NULL
     @throws BadPacketVersionException  If the packet is a higher version than supported
 ==============================*/
 
-S64Packet* S64Packet::FromBytes(uint8_t* bytes)
+S64Packet* S64Packet::FromBytes(uint8_t* bytes, size_t size)
 {
-    uint8_t  version;
-    uint8_t  flags;
-    uint16_t seqnum;
-    uint16_t acknum;
-    uint16_t ackbitfield;
-    uint8_t  typestr_len;
-    char*    typestr;
-    uint16_t data_len;
-    uint8_t* data = NULL;
-    S64Packet* ret = NULL;
-    uint32_t readcount = 0;
-
-    // Read the header
-    if (!S64Packet::IsS64Packet(bytes))
+    S64PacketView view;
+    if (!view.Parse(bytes, size))
         return NULL;
-    readcount += strlen(S64PACKET_HEADER);
-    memcpy(&version, bytes+readcount, sizeof(version));
-    readcount += sizeof(version);
-    if (version > S64PACKET_VERSION)
-        throw BadPacketVersionException(version);
-    memcpy(&flags, bytes+readcount, sizeof(flags));
-    readcount += sizeof(flags);
-
-    // Read the sequence data
-    memcpy(&seqnum, bytes+readcount, sizeof(seqnum));
-    seqnum = swap_endian16(seqnum);
-    readcount += sizeof(seqnum);
-    memcpy(&acknum, bytes+readcount, sizeof(acknum));
-    acknum = swap_endian16(acknum);
-    readcount += sizeof(acknum);
-    memcpy(&ackbitfield, bytes+readcount, sizeof(ackbitfield));
-    ackbitfield = swap_endian16(ackbitfield);
-    readcount += sizeof(ackbitfield);
-
-    // Read the type string
-    memcpy(&typestr_len, bytes+readcount, sizeof(typestr_len));
-    readcount += sizeof(typestr_len);
-    typestr = (char*)malloc(typestr_len + 1);
-    memcpy(typestr, bytes+readcount, typestr_len);
-    typestr[typestr_len] = '\0';
-    readcount += typestr_len;
-
-    // Read the data
-    memcpy(&data_len, bytes+readcount, sizeof(data_len));
-    data_len = swap_endian16(data_len);
-    readcount += sizeof(data_len);
-    if (data_len > 0)
-    {
-        data = (uint8_t*)malloc(data_len);
-        memcpy(data, bytes+readcount, data_len);
-        readcount += data_len;
-    }
-
-    // Build the packet object and cleanup
-    ret = new S64Packet(version, wxString(typestr), data_len, data, flags, seqnum, acknum, ackbitfield);
-    free(typestr);
-    if (data_len > 0)
-        free(data);
-    return ret;
+    return new S64Packet(&view);
 }
 
 
 /*==============================
-    S64Packet::GetAsBytes
-    Converts the S64 packet into a set of raw bytes
-    @return The S64 packet converted into raw bytes, or NULL
+    S64Packet::WriteAsBytes
+    Serializes the S64 packet into a caller provided buffer
+    @param  The buffer to write into
+    @param  The size of the buffer
+    @return The number of bytes written, or 0 if the buffer is too small
 ==============================*/
 
-uint8_t* S64Packet::GetAsBytes()
+uint16_t S64Packet::WriteAsBytes(uint8_t* buff, size_t size)
 {
-    uint8_t  write8b;
-    uint16_t write16b;
-    uint8_t* bytes = NULL;
     uint32_t writecount = 0;
-
-    // Malloc the bytes
-    bytes = (uint8_t*)malloc(this->GetAsBytes_Size());
-    if (bytes == NULL)
-        return NULL;
+    if (size < this->GetAsBytes_Size())
+        return 0;
 
     // Write the header
-    memcpy(bytes+writecount, S64PACKET_HEADER, strlen(S64PACKET_HEADER));
-    writecount += strlen(S64PACKET_HEADER);
-    memcpy(bytes+writecount, &this->m_Version, sizeof(this->m_Version));
-    writecount += sizeof(this->m_Version);
-    memcpy(bytes+writecount, &this->m_Flags, sizeof(this->m_Flags));
-    writecount += sizeof(this->m_Flags);
+    memcpy(buff+writecount, S64PACKET_HEADER, sizeof(S64PACKET_HEADER)-1);
+    writecount += sizeof(S64PACKET_HEADER)-1;
+    buff[writecount++] = this->m_Version;
+    buff[writecount++] = this->m_Flags;
 
     // Write the sequence data
-    write16b = swap_endian16(this->m_SequenceNum);
-    memcpy(bytes+writecount, &write16b, sizeof(write16b));
-    writecount += sizeof(write16b);
-    write16b = swap_endian16(this->m_Ack);
-    memcpy(bytes+writecount, &write16b, sizeof(write16b));
-    writecount += sizeof(write16b);
-    write16b = swap_endian16(this->m_AckBitField);
-    memcpy(bytes+writecount, &write16b, sizeof(write16b));
-    writecount += sizeof(write16b);
+    writecount += write_u16(buff+writecount, this->m_SequenceNum);
+    writecount += write_u16(buff+writecount, this->m_Ack);
+    writecount += write_u16(buff+writecount, this->m_AckBitField);
 
     // Type string
-    write8b = this->m_Type.Length();
-    memcpy(bytes+writecount, &write8b, sizeof(write8b));
-    writecount += sizeof(write8b);
-    memcpy(bytes+writecount, this->m_Type.mb_str(), this->m_Type.Length());
-    writecount += this->m_Type.Length();
+    buff[writecount++] = this->m_TypeLength;
+    memcpy(buff+writecount, this->m_Type, this->m_TypeLength);
+    writecount += this->m_TypeLength;
 
     // Data
-    write16b = swap_endian16(this->m_Size);
-    memcpy(bytes+writecount, &write16b, sizeof(write16b));
-    writecount += sizeof(write16b);
+    writecount += write_u16(buff+writecount, this->m_Size);
     if (this->m_Size > 0)
     {
-        memcpy(bytes+writecount, this->m_Data, this->m_Size);
+        memcpy(buff+writecount, this->m_Data, this->m_Size);
         writecount += this->m_Size;
     }
 
     // Done
-    return bytes;
+    return writecount;
 }
 
 
@@ -945,7 +1831,7 @@ uint16_t S64Packet::GetAsBytes_Size()
 {
     return sizeof(S64PACKET_HEADER)-1 + sizeof(this->m_Version) + sizeof(this->m_Flags) + 
         sizeof(this->m_SequenceNum) + sizeof(this->m_Ack) + sizeof(this->m_AckBitField) +
-        1 + this->m_Type.Length() +
+        sizeof(this->m_TypeLength) + this->m_TypeLength +
         sizeof(this->m_Size) + this->m_Size;
 }
 
@@ -958,7 +1844,7 @@ uint16_t S64Packet::GetAsBytes_Size()
 
 bool S64Packet::IsAckBeat()
 {
-    return this->m_Type == "ACK";
+    return this->IsType("ACK");
 }
 
 
@@ -968,9 +1854,23 @@ bool S64Packet::IsAckBeat()
     @return The type of the packet
 ==============================*/
 
-wxString S64Packet::GetType()
+std::string S64Packet::GetType()
 {
-    return this->m_Type;
+    return std::string(this->m_Type, this->m_TypeLength);
+}
+
+
+/*==============================
+    S64Packet::IsType
+    Checks if this packet is of a given type, without
+    needing to build a string
+    @param  The type to compare against
+    @return Whether the packet is of the given type
+==============================*/
+
+bool S64Packet::IsType(const char* type)
+{
+    return strlen(type) == this->m_TypeLength && !memcmp(this->m_Type, type, this->m_TypeLength);
 }
 
 
@@ -980,27 +1880,25 @@ wxString S64Packet::GetType()
     @return The string representation of this packet
 ==============================*/
 
-wxString S64Packet::AsString()
+std::string S64Packet::AsString()
 {
-    wxString mystr = "S64Packet\n";
-    mystr += wxString("    Version: ") + wxString::Format("%d", this->m_Version) + wxString("\n");
-    mystr += wxString("    Type: ") + this->m_Type + wxString("\n");
-    mystr += wxString("    Sequence Number: ") + wxString::Format("%d", this->m_SequenceNum) + wxString("\n");
-    mystr += wxString("    Ack: ") + wxString::Format("%d", this->m_Ack) + wxString("\n");
-    mystr += wxString("    AckField: ") + getbits(2, &this->m_AckBitField) + wxString("\n");
-    mystr += wxString("    Data size: ") + wxString::Format("%d", this->m_Size) + wxString("\n");
+    std::string mystr = "S64Packet\n";
+    mystr += "    Version: " + std::to_string(this->m_Version) + "\n";
+    mystr += "    Type: " + this->GetType() + "\n";
+    mystr += "    Sequence Number: " + std::to_string(this->m_SequenceNum) + "\n";
+    mystr += "    Ack: " + std::to_string(this->m_Ack) + "\n";
+    mystr += "    AckField: " + getbits(2, &this->m_AckBitField) + "\n";
+    mystr += "    Data size: " + std::to_string(this->m_Size) + "\n";
     if (this->m_Size > 0)
     {
-        mystr += wxString("    Data: \n");
-        mystr += wxString("        ");
-        for (int i=0; i<this->m_Size; i++)
-            mystr += wxString::Format("%02x ", this->m_Data[i]);
+        mystr += "    Data: \n";
+        mystr += "        " + getbytes(this->m_Data, this->m_Size);
     }
     return mystr;
 }
 
 /*=============================================================
-
+                         NetLib Packet
 =============================================================*/
 
 /*==============================
@@ -1024,6 +1922,20 @@ NetLibPacket::NetLibPacket(uint8_t version, uint8_t type, uint16_t size, uint8_t
 }
 
 
+/*==============================
+    NetLibPacket (Constructor)
+    Initializes the class from a parsed packet view.
+    The view's data is copied once, straight into the packet.
+    @param The view of the received packet
+==============================*/
+
+NetLibPacket::NetLibPacket(NetLibPacketView* view) : AbstractPacket(view->GetVersion(), view->GetSize(), (uint8_t*)view->GetData(), view->GetFlags(), view->GetSequenceNumber(), view->GetAck(), view->GetAckBitfield())
+{
+    this->m_Type = view->GetType();
+    this->m_Recipients = view->GetRecipients();
+}
+
+
 /*==============================
     NetLibPacket (Destructor)
     Cleans up the class before deletion
@@ -1052,128 +1964,61 @@ bool NetLibPacket::IsNetLibPacket(uint8_t* bytes)
     NetLibPacket::FromBytes
     Retrieves an NetLibPacket from the given bytes
     @param  The raw bytes
+    @param  The number of valid bytes
     @return The NetLibPacket contained in the bytes, or NULL
     @throws BadPacketVersionException  If the packet is a higher version than supported
 ==============================*/
 
-NetLibPacket* NetLibPacket::FromBytes(uint8_t* bytes)
+NetLibPacket* NetLibPacket::FromBytes(uint8_t* bytes, size_t size)
 {
-    uint8_t  version, type, flags;
-    uint16_t seqnum, acknum, ackbitfield;
-    uint32_t recipients;
-    uint16_t data_len;
-    uint8_t* data = NULL;
-    NetLibPacket* ret = NULL;
-    uint32_t readcount = 0;
-
-    // Read the header
-    if (!NetLibPacket::IsNetLibPacket(bytes))
+    NetLibPacketView view;
+    if (!view.Parse(bytes, size))
         return NULL;
-    readcount += strlen(NETLIBPACKET_HEADER);
-    memcpy(&version, bytes+readcount, sizeof(version));
-    readcount += sizeof(version);
-    if (version > S64PACKET_VERSION)
-        throw BadPacketVersionException(version);
-
-    // Read the type and flags
-    memcpy(&type, bytes+readcount, sizeof(type));
-    readcount += sizeof(type);
-    memcpy(&flags, bytes+readcount, sizeof(flags));
-    readcount += sizeof(flags);
-
-    // Read the sequence data
-    memcpy(&seqnum, bytes+readcount, sizeof(seqnum));
-    seqnum = swap_endian16(seqnum);
-    readcount += sizeof(seqnum);
-    memcpy(&acknum, bytes+readcount, sizeof(acknum));
-    acknum = swap_endian16(acknum);
-    readcount += sizeof(acknum);
-    memcpy(&ackbitfield, bytes+readcount, sizeof(ackbitfield));
-    ackbitfield = swap_endian16(ackbitfield);
-    readcount += sizeof(ackbitfield);
-
-    // Read the recipients
-    memcpy(&recipients, bytes+readcount, sizeof(recipients));
-    recipients = swap_endian32(recipients);
-    readcount += sizeof(recipients);
-
-    // Read the data
-    memcpy(&data_len, bytes+readcount, sizeof(data_len));
-    data_len = swap_endian16(data_len);
-    readcount += sizeof(data_len);
-    if (data_len > 0)
-    {
-        data = (uint8_t*)malloc(data_len);
-        memcpy(data, bytes+readcount, data_len);
-        readcount += data_len;
-    }
-
-    // Build the packet object and cleanup
-    ret = new NetLibPacket(version, type, data_len, data, flags, recipients, seqnum, acknum, ackbitfield);
-    if (data_len > 0)
-        free(data);
-    return ret;
+    return new NetLibPacket(&view);
 }
 
 
 /*==============================
-    NetLibPacket::GetAsBytes
-    Converts the NetLib packet into a set of raw bytes
-    @return The NetLib packet converted into raw bytes, or NULL
+    NetLibPacket::WriteAsBytes
+    Serializes the NetLib packet into a caller provided buffer
+    @param  The buffer to write into
+    @param  The size of the buffer
+    @return The number of bytes written, or 0 if the buffer is too small
 ==============================*/
 
-uint8_t* NetLibPacket::GetAsBytes()
+uint16_t NetLibPacket::WriteAsBytes(uint8_t* buff, size_t size)
 {
-    uint16_t write16b;
-    uint32_t write32b;
-    uint8_t* bytes = NULL;
     uint32_t writecount = 0;
-
-    // Malloc the bytes
-    bytes = (uint8_t*)malloc(this->GetAsBytes_Size());
-    if (bytes == NULL)
-        return NULL;
+    if (size < this->GetAsBytes_Size())
+        return 0;
 
     // Write the header
-    memcpy(bytes+writecount, NETLIBPACKET_HEADER, strlen(NETLIBPACKET_HEADER));
-    writecount += strlen(NETLIBPACKET_HEADER);
-    memcpy(bytes+writecount, &this->m_Version, sizeof(this->m_Version));
-    writecount += sizeof(this->m_Version);
+    memcpy(buff+writecount, NETLIBPACKET_HEADER, sizeof(NETLIBPACKET_HEADER)-1);
+    writecount += sizeof(NETLIBPACKET_HEADER)-1;
+    buff[writecount++] = this->m_Version;
 
     // Write the type and the flags
-    memcpy(bytes+writecount, &this->m_Type, sizeof(this->m_Type));
-    writecount += sizeof(this->m_Type);
-    memcpy(bytes+writecount, &this->m_Flags, sizeof(this->m_Flags));
-    writecount += sizeof(this->m_Flags);
+    buff[writecount++] = this->m_Type;
+    buff[writecount++] = this->m_Flags;
 
     // Write the sequence data
-    write16b = swap_endian16(this->m_SequenceNum);
-    memcpy(bytes+writecount, &write16b, sizeof(write16b));
-    writecount += sizeof(write16b);
-    write16b = swap_endian16(this->m_Ack);
-    memcpy(bytes+writecount, &write16b, sizeof(write16b));
-    writecount += sizeof(write16b);
-    write16b = swap_endian16(this->m_AckBitField);
-    memcpy(bytes+writecount, &write16b, sizeof(write16b));
-    writecount += sizeof(write16b);
+    writecount += write_u16(buff+writecount, this->m_SequenceNum);
+    writecount += write_u16(buff+writecount, this->m_Ack);
+    writecount += write_u16(buff+writecount, this->m_AckBitField);
 
     // Write the recipients
-    write32b = swap_endian32(this->m_Recipients);
-    memcpy(bytes+writecount, &write32b, sizeof(write32b));
-    writecount += sizeof(write32b);
+    writecount += write_u32(buff+writecount, this->m_Recipients);
 
     // Data
-    write16b = swap_endian16(this->m_Size);
-    memcpy(bytes+writecount, &write16b, sizeof(write16b));
-    writecount += sizeof(write16b);
+    writecount += write_u16(buff+writecount, this->m_Size);
     if (this->m_Size > 0)
     {
-        memcpy(bytes+writecount, this->m_Data, this->m_Size);
+        memcpy(buff+writecount, this->m_Data, this->m_Size);
         writecount += this->m_Size;
     }
 
     // Done
-    return bytes;
+    return writecount;
 }
 
 
@@ -1194,7 +2039,7 @@ uint16_t NetLibPacket::GetAsBytes_Size()
 
 
 /*==============================
-    S64Packet::IsAckBeat
+    NetLibPacket::IsAckBeat
     Checks if this packet is an Ack/Heartbeat packet
     @return Whether this packet is an Ack/Heartbeat packet
 ==============================*/
@@ -1235,22 +2080,164 @@ uint32_t NetLibPacket::GetRecipients()
     @return The string representation of this packet
 ==============================*/
 
-wxString NetLibPacket::AsString()
+std::string NetLibPacket::AsString()
 {
-    wxString mystr = "NetLib Packet\n";
-    mystr += wxString("    Version: ") + wxString::Format("%d", this->m_Version) + wxString("\n");
-    mystr += wxString("    Type: ") + wxString::Format("%d", this->m_Type) + wxString("\n");
-    mystr += wxString("    Sequence Number: ") + wxString::Format("%d", this->m_SequenceNum) + wxString("\n");
-    mystr += wxString("    Ack: ") + wxString::Format("%d", this->m_Ack) + wxString("\n");
-    mystr += wxString("    AckField: ") + getbits(2, &this->m_AckBitField) + wxString("\n");
-    mystr += wxString("    Recipients: ") + getbits(4, &this->m_Recipients) + wxString("\n");
-    mystr += wxString("    Data size: ") + wxString::Format("%d", this->m_Size) + wxString("\n");
+    std::string mystr = "NetLib Packet\n";
+    mystr += "    Version: " + std::to_string(this->m_Version) + "\n";
+    mystr += "    Type: " + std::to_string(this->m_Type) + "\n";
+    mystr += "    Sequence Number: " + std::to_string(this->m_SequenceNum) + "\n";
+    mystr += "    Ack: " + std::to_string(this->m_Ack) + "\n";
+    mystr += "    AckField: " + getbits(2, &this->m_AckBitField) + "\n";
+    mystr += "    Recipients: " + getbits(4, &this->m_Recipients) + "\n";
+    mystr += "    Data size: " + std::to_string(this->m_Size) + "\n";
     if (this->m_Size > 0)
     {
-        mystr += wxString("    Data: \n");
-        mystr += wxString("        ");
-        for (int i=0; i<this->m_Size; i++)
-            mystr += wxString::Format("%02x ", this->m_Data[i]);
+        mystr += "    Data: \n";
+        mystr += "        " + getbytes(this->m_Data, this->m_Size);
     }
     return mystr;
+}
+
+
+/*=============================================================
+                         Packet Views
+=============================================================*/
+
+/*==============================
+    AbstractPacketView (Constructor)
+    Initializes the class
+==============================*/
+
+AbstractPacketView::AbstractPacketView()
+{
+    this->m_Bytes = NULL;
+    this->m_Length = 0;
+    this->m_Version = 0;
+    this->m_Flags = 0;
+    this->m_SequenceNum = 0;
+    this->m_Ack = 0;
+    this->m_AckBitField = 0;
+    this->m_Size = 0;
+    this->m_Data = NULL;
+}
+
+
+/*==============================
+    S64PacketView::Parse
+    Parses an S64 packet header in place. The view points into
+    the given buffer, so it must outlive the view.
+    @param  The raw bytes
+    @param  The number of valid bytes
+    @return Whether the bytes contain a complete S64 packet
+    @throws BadPacketVersionException  If the packet is a higher version than supported
+==============================*/
+
+bool S64PacketView::Parse(const uint8_t* bytes, size_t size)
+{
+    size_t readcount = 0;
+    const size_t fixedsize = sizeof(S64PACKET_HEADER)-1 + 1 + 1 + 2 + 2 + 2 + 1;
+
+    // Read the header
+    if (size < fixedsize || memcmp(bytes, S64PACKET_HEADER, sizeof(S64PACKET_HEADER)-1) != 0)
+        return false;
+    readcount += sizeof(S64PACKET_HEADER)-1;
+    this->m_Version = bytes[readcount++];
+    if (this->m_Version > S64PACKET_VERSION)
+        throw BadPacketVersionException(this->m_Version);
+    this->m_Flags = bytes[readcount++];
+
+    // Read the sequence data
+    this->m_SequenceNum = read_u16(bytes+readcount);
+    readcount += sizeof(this->m_SequenceNum);
+    this->m_Ack = read_u16(bytes+readcount);
+    readcount += sizeof(this->m_Ack);
+    this->m_AckBitField = read_u16(bytes+readcount);
+    readcount += sizeof(this->m_AckBitField);
+
+    // Read the type string
+    this->m_TypeLength = bytes[readcount++];
+    this->m_Type = (const char*)(bytes+readcount);
+    readcount += this->m_TypeLength;
+
+    // Read the data
+    if (size < readcount + sizeof(this->m_Size))
+        return false;
+    this->m_Size = read_u16(bytes+readcount);
+    readcount += sizeof(this->m_Size);
+    if (size < readcount + this->m_Size)
+        return false;
+    this->m_Data = (this->m_Size > 0) ? bytes+readcount : NULL;
+    readcount += this->m_Size;
+
+    // Done
+    this->m_Bytes = bytes;
+    this->m_Length = readcount;
+    return true;
+}
+
+
+/*==============================
+    S64PacketView::IsType
+    Checks if the viewed packet is of a given type
+    @param  The type to compare against
+    @return Whether the packet is of the given type
+==============================*/
+
+bool S64PacketView::IsType(const char* type)
+{
+    return strlen(type) == this->m_TypeLength && !memcmp(this->m_Type, type, this->m_TypeLength);
+}
+
+
+/*==============================
+    NetLibPacketView::Parse
+    Parses a NetLib packet header in place. The view points into
+    the given buffer, so it must outlive the view.
+    @param  The raw bytes
+    @param  The number of valid bytes
+    @return Whether the bytes contain a complete NetLib packet
+    @throws BadPacketVersionException  If the packet is a higher version than supported
+==============================*/
+
+bool NetLibPacketView::Parse(const uint8_t* bytes, size_t size)
+{
+    size_t readcount = 0;
+    const size_t fixedsize = sizeof(NETLIBPACKET_HEADER)-1 + 1 + 1 + 1 + 2 + 2 + 2 + 4 + 2;
+
+    // Read the header
+    if (size < fixedsize || memcmp(bytes, NETLIBPACKET_HEADER, sizeof(NETLIBPACKET_HEADER)-1) != 0)
+        return false;
+    readcount += sizeof(NETLIBPACKET_HEADER)-1;
+    this->m_Version = bytes[readcount++];
+    if (this->m_Version > NETLIBPACKET_VERSION)
+        throw BadPacketVersionException(this->m_Version);
+
+    // Read the type and flags
+    this->m_Type = bytes[readcount++];
+    this->m_Flags = bytes[readcount++];
+
+    // Read the sequence data
+    this->m_SequenceNum = read_u16(bytes+readcount);
+    readcount += sizeof(this->m_SequenceNum);
+    this->m_Ack = read_u16(bytes+readcount);
+    readcount += sizeof(this->m_Ack);
+    this->m_AckBitField = read_u16(bytes+readcount);
+    readcount += sizeof(this->m_AckBitField);
+
+    // Read the recipients
+    this->m_Recipients = read_u32(bytes+readcount);
+    readcount += sizeof(this->m_Recipients);
+
+    // Read the data
+    this->m_Size = read_u16(bytes+readcount);
+    readcount += sizeof(this->m_Size);
+    if (size < readcount + this->m_Size)
+        return false;
+    this->m_Data = (this->m_Size > 0) ? bytes+readcount : NULL;
+    readcount += this->m_Size;
+
+    // Done
+    this->m_Bytes = bytes;
+    this->m_Length = readcount;
+    return true;
 }
\ No newline at end of file
@@ -2,9 +2,15 @@
 
 #include <stdint.h>
 #include "Include/asio.hpp"
-#include <wx/string.h>
-#include <wx/msgqueue.h>
-#include <deque>
+#include <string>
+#include <future>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include <memory>
+#include "packetpool.h"
+#include "stats.h"
+#include "impairment.h"
 
 using asio::ip::udp;
 
@@ -19,6 +25,19 @@ using asio::ip::udp;
 #define NETLIBPACKET_HEADER "NLP"
 #define NETLIBPACKET_VERSION 1
 
+#define MAX_PACKETSIZE   4096
+
+// Sliding window sizes for sequence tracking, must be powers of two
+#define SEQWINDOW_RX  256
+#define SEQWINDOW_TX  1024
+
+// Retransmission timer wheel size, and the time (in milliseconds) each slot covers
+#define TIMERWHEEL_SLOTS  128
+#define TIMERWHEEL_TICK   10
+
+// The max number of datagrams to read or send with a single syscall
+#define MAX_BATCHCOUNT  32
+
 
 /******************************
              Types
@@ -46,27 +65,44 @@ class UDPHandler;
 class AbstractPacket;
 class S64Packet;
 class NetLibPacket;
+class AbstractPacketView;
+class S64PacketView;
+class NetLibPacketView;
 
 // Wrapper class for ASIO
 class ASIOSocket
 {
     private:
-        udp::resolver* m_Resolver;
         udp::socket* m_Socket;
         size_t m_LastReadCount;
-        wxString m_Address;
+        std::string m_Address;
         int m_Port;
+        udp::endpoint m_ReadEndpoint;
+        udp::endpoint m_LocalEndpoint;
+        bool m_Connected;
+        udp::endpoint m_ConnectedEndpoint;
+        Impairment* m_Impairment;
 
     protected:
 
     public:
         static void InitASIO();
+        static udp::endpoint Resolve(std::string address, int port);
 
-        ASIOSocket(wxString fulladdress);
-        ASIOSocket(wxString address, int port);
+        ASIOSocket(std::string fulladdress);
+        ASIOSocket(std::string address, int port);
         ~ASIOSocket();
         void Read(uint8_t* buff, size_t size);
-        void Send(wxString address, int port, uint8_t* buff, size_t size);
+        size_t ReadBatch(uint8_t* slab, size_t slotsize, size_t* sizes, size_t count, udp::endpoint* senders = NULL);
+        bool WaitRead(int timeout);
+        void AsyncWait(std::function<void(const asio::error_code&)> callback);
+        void Cancel();
+        void Send(std::string address, int port, uint8_t* buff, size_t size);
+        void Send(const udp::endpoint& endpoint, uint8_t* buff, size_t size);
+        void SendBatch(const udp::endpoint& endpoint, uint8_t* slab, size_t slotsize, size_t* sizes, size_t count);
+        void Connect(const udp::endpoint& endpoint);
+        bool IsConnected();
+        udp::endpoint GetLocalEndpoint();
         size_t LastReadCount();
 };
 
@@ -74,34 +110,78 @@ class ASIOSocket
 class UDPHandler
 {
     private:
-        wxString m_Address;
+        std::string m_Address;
         int      m_Port;
         ASIOSocket* m_Socket;
+        udp::endpoint m_Endpoint;
+        bool     m_HasEndpoint;
+        bool     m_ConnectSocket;
+        std::chrono::steady_clock::time_point m_EndpointTime;
+        std::future<udp::endpoint> m_EndpointResolve;
         uint16_t m_LocalSeqNum;
         uint16_t m_RemoteSeqNum;
         uint16_t m_AckBitfield;
-        std::deque<AbstractPacket*> m_AcksLeft_RX;
-        std::deque<AbstractPacket*> m_AcksLeft_TX;
-
+        uint16_t m_RXSeqNums[SEQWINDOW_RX];
+        bool     m_RXReceived[SEQWINDOW_RX];
+        std::unique_ptr<AbstractPacket> m_TXPackets[SEQWINDOW_TX];
+        std::chrono::steady_clock::time_point m_TXDeadlines[SEQWINDOW_TX];
+        uint16_t m_TXOldest;
+        uint32_t m_TXCount;
+        std::vector<uint16_t> m_ResendWheel[TIMERWHEEL_SLOTS];
+        std::vector<uint16_t> m_ResendWheelDue;
+        uint32_t m_ResendWheelSlot;
+        size_t   m_ResendWheelCount;
+        std::chrono::steady_clock::time_point m_ResendWheelTime;
+        double   m_SRTT;
+        double   m_RTTVar;
+        double   m_RTO;
+        bool     m_HasRTTSample;
+        uint8_t  m_SendBuffer[MAX_PACKETSIZE];
+        std::vector<uint8_t> m_BatchSlab;
+        size_t   m_BatchSizes[MAX_BATCHCOUNT];
+        size_t   m_BatchCount;
+        bool     m_Batching;
+        TransportStats* m_Stats;
+
+        void InitializeSequences();
+        bool IsReceived(uint16_t seqnum);
+        void MarkReceived(uint16_t seqnum);
+        void AdvanceRemoteSequence(uint16_t seqnum);
+        void AcknowledgePackets(uint16_t acknum, uint16_t ackbitfield);
+        void UpdateRTT(double sample);
+        void FlushBatch();
+        void ScheduleResend(uint16_t seqnum, std::chrono::steady_clock::time_point deadline);
         bool HandlePacketSequence(AbstractPacket* pkt, AbstractPacket* (*ackmaker)());
+        void UpdateEndpoint();
+        void SetEndpoint(const udp::endpoint& endpoint);
 
     protected:
 
     public:
-        UDPHandler(ASIOSocket* socket, wxString address, int port);
-        UDPHandler(ASIOSocket* socket, wxString fulladdress);
+        UDPHandler(ASIOSocket* socket, std::string address, int port);
+        UDPHandler(ASIOSocket* socket, std::string fulladdress);
         ~UDPHandler();
         ASIOSocket* GetSocket();
-        wxString GetAddress();
+        std::string GetAddress();
         int      GetPort();
+        void ConnectSocket();
         void SendPacket(AbstractPacket* pkt);
-        S64Packet* ReadS64Packet(uint8_t* data);
-        NetLibPacket* ReadNetLibPacket(uint8_t* data);
+        void BeginBatch();
+        void EndBatch();
+        S64Packet* ReadS64Packet(uint8_t* data, size_t size);
+        NetLibPacket* ReadNetLibPacket(uint8_t* data, size_t size);
         void ResendMissingPackets();
+        bool HasPendingResends();
+        double GetSRTT();
+        double GetRTTVar();
+        double GetRTO();
+        void SetStats(TransportStats* stats);
+        TransportStats* GetStats();
 };
 
 // An abstract packet class to reduce code repetition
 // Do not use directly
+// Packets are allocated from the PacketPool, with their data stored inline
 class AbstractPacket
 {
     private:
@@ -114,7 +194,9 @@ class AbstractPacket
         uint16_t m_AckBitField;
         uint16_t m_Size;
         uint8_t* m_Data;
-        wxLongLong m_SendTime;
+        uint8_t  m_InlineData[MAX_PACKETSIZE];
+        std::chrono::steady_clock::time_point m_SendTime;
+        std::chrono::steady_clock::time_point m_FirstSendTime;
         uint8_t    m_SendAttempts;
 
         AbstractPacket(uint8_t version, uint16_t size, uint8_t* data, uint8_t flags, uint16_t seqnum, uint16_t acknum, uint16_t ackbitfield);
@@ -123,16 +205,23 @@ class AbstractPacket
 
     public:
         virtual ~AbstractPacket();
+        static void* operator new(size_t size) {return PacketPool::Allocate(size);};
+        static void  operator delete(void* ptr, size_t size) {PacketPool::Free(ptr, size);};
 
         uint8_t    GetVersion();
         uint8_t    GetFlags();
         uint16_t   GetSize();
         uint8_t*   GetData();
         uint16_t   GetSequenceNumber();
+        uint16_t   GetAck();
+        uint16_t   GetAckBitfield();
         bool       IsAcked(uint16_t number);
-        wxLongLong GetSendTime();
+        int64_t    GetSendTime();
+        std::chrono::steady_clock::time_point GetSendTimestamp();
+        std::chrono::steady_clock::time_point GetFirstSendTimestamp();
         uint8_t    GetSendAttempts();
-        virtual uint8_t* GetAsBytes() {return NULL;};
+        uint8_t*   GetAsBytes();
+        virtual uint16_t WriteAsBytes(uint8_t*, size_t) {return 0;}
         virtual uint16_t GetAsBytes_Size() {return 0;};
 
         virtual bool IsAckBeat() {return false;};
@@ -141,32 +230,36 @@ class AbstractPacket
         void SetAck(uint16_t acknum);
         void SetAckBitfield(uint16_t bitfield);
         void UpdateSendAttempt();
-        virtual wxString AsString() {return "";};
+        virtual std::string AsString() {return "";};
 };
 
 // Server browser packet
 class S64Packet : public AbstractPacket
 {
     private:
-        wxString m_Type;
+        char    m_Type[UINT8_MAX+1];
+        uint8_t m_TypeLength;
 
-        S64Packet(uint8_t version, wxString type, uint16_t size, uint8_t* data, uint8_t flags, uint16_t seqnum, uint16_t acknum, uint16_t ackbitfield);
+        S64Packet(uint8_t version, std::string type, uint16_t size, uint8_t* data, uint8_t flags, uint16_t seqnum, uint16_t acknum, uint16_t ackbitfield);
+        S64Packet(S64PacketView* view);
+        void SetType(const char* type, size_t length);
 
     protected:
 
     public:
-        S64Packet(wxString type, uint16_t size, uint8_t* data, uint8_t flags) : S64Packet(S64PACKET_VERSION, type, size, data, flags, 0, 0, 0) {};
-        S64Packet(wxString type, uint16_t size, uint8_t* data) : S64Packet(S64PACKET_VERSION, type, size, data, 0, 0, 0, 0) {};
+        S64Packet(std::string type, uint16_t size, uint8_t* data, uint8_t flags) : S64Packet(S64PACKET_VERSION, type, size, data, flags, 0, 0, 0) {};
+        S64Packet(std::string type, uint16_t size, uint8_t* data) : S64Packet(S64PACKET_VERSION, type, size, data, 0, 0, 0, 0) {};
         ~S64Packet();
 
         static bool IsS64Packet(uint8_t* bytes);
-        static S64Packet* FromBytes(uint8_t* bytes);
-        uint8_t*   GetAsBytes();
+        static S64Packet* FromBytes(uint8_t* bytes, size_t size);
+        uint16_t   WriteAsBytes(uint8_t* buff, size_t size);
         uint16_t   GetAsBytes_Size();
 
         bool IsAckBeat();
-        wxString GetType();
-        wxString AsString();
+        bool IsType(const char* type);
+        std::string GetType();
+        std::string AsString();
 };
 
 // NetLib packet for N64 games
@@ -177,6 +270,7 @@ class NetLibPacket : public AbstractPacket
         uint32_t m_Recipients;
 
         NetLibPacket(uint8_t version, uint8_t type, uint16_t size, uint8_t* data, uint8_t flags, uint32_t recipients, uint16_t seqnum, uint16_t acknum, uint16_t ackbitfield);
+        NetLibPacket(NetLibPacketView* view);
 
     protected:
 
@@ -185,25 +279,94 @@ class NetLibPacket : public AbstractPacket
         ~NetLibPacket();
 
         static bool IsNetLibPacket(uint8_t* bytes);
-        static NetLibPacket* FromBytes(uint8_t* bytes);
-        uint8_t* GetAsBytes();
+        static NetLibPacket* FromBytes(uint8_t* bytes, size_t size);
+        uint16_t WriteAsBytes(uint8_t* buff, size_t size);
         uint16_t GetAsBytes_Size();
 
         bool IsAckBeat();
         uint8_t  GetType();
         uint32_t GetRecipients();
-        wxString AsString();
+        std::string AsString();
+};
+
+// Owning handles for packets
+typedef std::unique_ptr<S64Packet> S64PacketPtr;
+typedef std::unique_ptr<NetLibPacket> NetLibPacketPtr;
+
+// A non-owning view of a serialized packet, which parses the header in place
+// Do not use directly
+class AbstractPacketView
+{
+    private:
+
+    protected:
+        const uint8_t* m_Bytes;
+        size_t   m_Length;
+        uint8_t  m_Version;
+        uint8_t  m_Flags;
+        uint16_t m_SequenceNum;
+        uint16_t m_Ack;
+        uint16_t m_AckBitField;
+        uint16_t m_Size;
+        const uint8_t* m_Data;
+
+        AbstractPacketView();
+
+    public:
+        uint8_t  GetVersion() {return this->m_Version;};
+        uint8_t  GetFlags() {return this->m_Flags;};
+        uint16_t GetSequenceNumber() {return this->m_SequenceNum;};
+        uint16_t GetAck() {return this->m_Ack;};
+        uint16_t GetAckBitfield() {return this->m_AckBitField;};
+        uint16_t GetSize() {return this->m_Size;};
+        const uint8_t* GetData() {return this->m_Data;};
+        size_t   GetLength() {return this->m_Length;};
+};
+
+// View of a serialized S64 packet
+class S64PacketView : public AbstractPacketView
+{
+    private:
+        const char* m_Type;
+        uint8_t     m_TypeLength;
+
+    protected:
+
+    public:
+        S64PacketView() : AbstractPacketView() {this->m_Type = NULL; this->m_TypeLength = 0;};
+        bool Parse(const uint8_t* bytes, size_t size);
+
+        const char* GetTypeData() {return this->m_Type;};
+        uint8_t     GetTypeLength() {return this->m_TypeLength;};
+        bool        IsType(const char* type);
+};
+
+// View of a serialized NetLib packet
+class NetLibPacketView : public AbstractPacketView
+{
+    private:
+        uint8_t  m_Type;
+        uint32_t m_Recipients;
+
+    protected:
+
+    public:
+        NetLibPacketView() : AbstractPacketView() {this->m_Type = 0; this->m_Recipients = 0;};
+        bool Parse(const uint8_t* bytes, size_t size);
+
+        uint8_t  GetType() {return this->m_Type;};
+        uint32_t GetRecipients() {return this->m_Recipients;};
 };
 
 // Exception thrown by the UDPHandler when the client timesout
 class ClientTimeoutException : public std::exception
 {
     private:
-        wxString m_Address;
+        std::string m_Address;
 
     public:
-        ClientTimeoutException(wxString address) {this->m_Address = address;}
-        wxString what() {return this->m_Address;}
+        ClientTimeoutException(std::string address) {this->m_Address = address;}
+        std::string what() {return this->m_Address;}
 };
 
 // Exception thrown by the UDPHandler when the packet uses an unsupported version
@@ -215,4 +378,5 @@ class BadPacketVersionException : public std::exception
     public:
         BadPacketVersionException(int version) {this->m_Version = version;};
         int what() {return this->m_Version;}
+        int GetVersion() const {return this->m_Version;}
 };
\ No newline at end of file
@@ -0,0 +1,891 @@
+/***************************************************************
+                            relay.cpp
+
+A headless version of the client window, for relaying packets
+between an N64 and a server without needing wxWidgets. Useful
+for running on machines without a display, like a Raspberry Pi
+hooked up to the console.
+***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <signal.h>
+#include "relay.h"
+#include "helper.h"
+#include "capture.h"
+#include "Include/device.h"
+
+
+/******************************
+             Macros
+******************************/
+
+#define PROGRAM_NAME "netlib-relay"
+
+#define USBPROTOCOL_VERSION PROTOCOL_VERSION2
+#define HEARTBEAT_VERSION   1
+
+#define DATATYPE_NETPACKET        0x27
+#define DATATYPE_NETPACKETBUNDLE  0x28
+
+// The max size of a bundle of NetLib packets to send to the N64 in one USB transfer
+#define MAX_USBBUNDLESIZE  (64*1024)
+
+// The max number of USB transfers to read before flushing packets to the server
+#define MAX_USBREADS  MAX_BATCHCOUNT
+
+#define TIME_IDLECHECK  1000
+#define TIME_IDLESLEEP  1
+
+// How often (in milliseconds) the stats are logged, if requested
+#define TIME_STATSLOG   1000
+
+
+/******************************
+            Globals
+******************************/
+
+static volatile sig_atomic_t global_relay_interrupted = 0;
+
+
+/******************************
+           Functions
+******************************/
+
+/*==============================
+    relay_log
+    Prints a message to stdout
+    @param The format string
+    @param Variable arguments
+==============================*/
+
+static void relay_log(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    fflush(stdout);
+}
+
+
+/*==============================
+    relay_interrupt
+    Handles Ctrl+C, so the relay can shut down cleanly
+    @param The signal number
+==============================*/
+
+static void relay_interrupt(int sig)
+{
+    (void)sig;
+    global_relay_interrupted = 1;
+}
+
+
+/*==============================
+    relay_usage
+    Prints the command line usage
+==============================*/
+
+static void relay_usage()
+{
+    relay_log("Usage: %s -rom <File> -address <Address[:Port]> [-port <Port>] [-capture <File>] [-impair <Settings>] [-stats <File>]\n", PROGRAM_NAME);
+    relay_log("    -rom <File>\t\t\tROM to upload to the flashcart\n");
+    relay_log("    -address <Address[:Port]>\tServer to relay packets to\n");
+    relay_log("    -port <Port>\t\tServer port, if not given in the address\n");
+    relay_log("    -capture <File>\t\tRecord all UDP and USB traffic to a pcapng file\n");
+    relay_log("    -impair <Settings>\t\tSimulate a bad network, such as 'latency=50,jitter=10,loss=0.02'\n");
+    relay_log("    -stats <File>\t\tLog the connection stats as JSON lines once a second\n");
+}
+
+
+/*==============================
+    main
+    Program entrypoint
+    @param  The number of arguments
+    @param  The list of arguments
+    @return The exit code
+==============================*/
+
+int main(int argc, char* argv[])
+{
+    std::string rompath = "";
+    std::string address = "";
+    std::string capturepath = "";
+    std::string impairment = "";
+    std::string statspath = "";
+    int port = 0;
+    int ret;
+
+    // Parse the command line
+    for (int i=1; i<argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.length() > 1 && arg[0] == '-' && arg[1] == '-')
+            arg = arg.substr(1);
+        if ((arg == "-rom" || arg == "-r") && i+1 < argc)
+        {
+            rompath = argv[++i];
+        }
+        else if ((arg == "-address" || arg == "-a") && i+1 < argc)
+        {
+            address = argv[++i];
+        }
+        else if ((arg == "-port" || arg == "-p") && i+1 < argc)
+        {
+            port = atoi(argv[++i]);
+        }
+        else if ((arg == "-capture" || arg == "-c") && i+1 < argc)
+        {
+            capturepath = argv[++i];
+        }
+        else if ((arg == "-impair" || arg == "-i") && i+1 < argc)
+        {
+            impairment = argv[++i];
+        }
+        else if ((arg == "-stats" || arg == "-s") && i+1 < argc)
+        {
+            statspath = argv[++i];
+        }
+        else
+        {
+            relay_usage();
+            return (arg == "-help" || arg == "-h") ? 0 : 1;
+        }
+    }
+
+    // Allow the port to be part of the address
+    if (port == 0)
+        address_split(address, &address, &port);
+    if (rompath == "" || address == "" || port <= 0 || port > 65535)
+    {
+        relay_usage();
+        return 1;
+    }
+
+    // Run the relay until the device disconnects or we're interrupted
+    signal(SIGINT, relay_interrupt);
+    signal(SIGTERM, relay_interrupt);
+    ASIOSocket::InitASIO();
+    if (impairment != "" && !Impairment::Configure(impairment))
+    {
+        relay_log("Invalid impairment settings '%s'.\n", impairment.c_str());
+        return 1;
+    }
+    if (capturepath != "" && !PacketCapture::Start(capturepath))
+    {
+        relay_log("Unable to open capture file '%s'.\n", capturepath.c_str());
+        return 1;
+    }
+    Relay* relay = new Relay(rompath, address, port);
+    if (statspath != "" && !relay->OpenStatsLog(statspath))
+    {
+        relay_log("Unable to open stats file '%s'.\n", statspath.c_str());
+        delete relay;
+        PacketCapture::Stop();
+        return 1;
+    }
+    ret = relay->Run();
+    delete relay;
+    PacketCapture::Stop();
+    if (Impairment::IsEnabled())
+    {
+        ImpairmentStats stats = Impairment::GetStats();
+        relay_log("Impairment: %llu datagrams sent, %llu dropped, %llu duplicated, %llu reordered\n", (unsigned long long)stats.sent, (unsigned long long)stats.dropped, (unsigned long long)stats.duplicated, (unsigned long long)stats.reordered);
+    }
+    return ret;
+}
+
+
+/*=============================================================
+                            Relay
+=============================================================*/
+
+/*==============================
+    Relay (Constructor)
+    Initializes the class
+    @param The path to the ROM to upload
+    @param The server address
+    @param The server port
+==============================*/
+
+Relay::Relay(std::string rompath, std::string address, int port)
+{
+    this->m_ROMPath = rompath;
+    this->m_Address = address;
+    this->m_Port = port;
+    this->m_Socket = NULL;
+    this->m_Handler = NULL;
+    this->m_Timer = NULL;
+    this->m_RecvSlab = (uint8_t*)malloc(MAX_BATCHCOUNT*MAX_PACKETSIZE);
+    this->m_BundleSize = 0;
+    this->m_BundleBuffer = (uint8_t*)malloc(MAX_USBBUNDLESIZE);
+    this->m_Stopping = false;
+    this->m_TimerFast = false;
+    this->m_StatsLog = NULL;
+}
+
+
+/*==============================
+    Relay (Destructor)
+    Cleans up the class before deletion
+==============================*/
+
+Relay::~Relay()
+{
+    free(this->m_BundleBuffer);
+    free(this->m_RecvSlab);
+    if (this->m_StatsLog != NULL)
+        fclose(this->m_StatsLog);
+}
+
+
+/*==============================
+    Relay::OpenStatsLog
+    Starts logging the connection stats to a file, as one
+    JSON object per line
+    @param  The path of the file to append to
+    @return Whether the file was opened
+==============================*/
+
+bool Relay::OpenStatsLog(std::string path)
+{
+    this->m_StatsLog = fopen(path.c_str(), "ab");
+    return this->m_StatsLog != NULL;
+}
+
+
+/*==============================
+    Relay::Run
+    Uploads the ROM, then relays packets until the USB
+    disconnects, the server times out, or we are interrupted.
+    The flashcart is polled between runs of global_asiocontext,
+    which sleeps until the server sends something when the
+    N64 has nothing to say.
+    @return The exit code
+==============================*/
+
+int Relay::Run()
+{
+    asio::executor_work_guard<asio::io_context::executor_type> work = asio::make_work_guard(*global_asiocontext);
+    bool deviceopen;
+
+    // Get the flashcart ready
+    device_initialize();
+    if (!this->OpenDevice() || !this->UploadROM())
+    {
+        device_close();
+        return 1;
+    }
+
+    // Connect to the server
+    this->m_Socket = new ASIOSocket(this->m_Address, this->m_Port);
+    this->m_Handler = new UDPHandler(this->m_Socket, this->m_Address, this->m_Port);
+    this->m_Handler->SetStats(&this->m_Stats_Server);
+    this->m_Timer = new asio::steady_timer(*global_asiocontext);
+    this->m_StatsTime = std::chrono::steady_clock::now();
+    try
+    {
+        this->m_Handler->ConnectSocket();
+    }
+    catch (asio::system_error& e)
+    {
+        relay_log("Unable to resolve server address: %s\n", e.what());
+        this->m_Stopping = true;
+    }
+    if (!this->m_Stopping)
+    {
+        relay_log("Relaying packets to %s:%d\n", this->m_Address.c_str(), this->m_Port);
+        this->StartRead();
+        this->StartTimer();
+    }
+
+    // Handle I/O until something stops us
+    global_asiocontext->restart();
+    while (!this->m_Stopping && !global_relay_interrupted && device_isopen())
+    {
+        bool workdone = false;
+
+        // Read everything the N64 has for us, sending its packets to the server in one batch
+        this->m_Handler->BeginBatch();
+        for (int i=0; i<MAX_USBREADS && !this->m_Stopping && this->ReadDevice(); i++)
+            workdone = true;
+        if (!this->m_Stopping)
+            this->m_Handler->EndBatch();
+        if (!this->m_Stopping && !this->m_TimerFast && this->m_Handler->HasPendingResends())
+            this->StartTimer();
+
+        // No incoming USB data, that means we can send data to the N64 safely
+        if (!workdone)
+            workdone = this->UploadPackets();
+
+        // Service the socket. If there was nothing to do, rest until the server gives us something
+        if (workdone)
+            global_asiocontext->poll();
+        else
+            global_asiocontext->run_for(std::chrono::milliseconds(TIME_IDLESLEEP));
+
+        // Log the stats every so often
+        if (this->m_StatsLog != NULL && std::chrono::steady_clock::now() - this->m_StatsTime >= std::chrono::milliseconds(TIME_STATSLOG))
+            this->LogStats();
+    }
+    deviceopen = device_isopen();
+    if (global_relay_interrupted)
+        relay_log("\nInterrupted.\n");
+    else if (!deviceopen)
+        relay_log("\nUSB Disconnected.\n");
+
+    // Cancel all pending operations and let their handlers finish
+    this->m_Stopping = true;
+    this->m_Timer->cancel();
+    this->m_Socket->Cancel();
+    work.reset();
+    global_asiocontext->restart();
+    global_asiocontext->run();
+
+    // Cleanup
+    if (this->m_StatsLog != NULL)
+        this->LogStats();
+    this->PrintStats();
+    this->m_ToDevice.clear();
+    delete this->m_Timer;
+    delete this->m_Handler;
+    delete this->m_Socket;
+    this->m_Timer = NULL;
+    this->m_Handler = NULL;
+    this->m_Socket = NULL;
+    if (deviceopen)
+        device_close();
+    return global_relay_interrupted ? 0 : 1;
+}
+
+
+/*==============================
+    Relay::OpenDevice
+    Finds and opens the flashcart
+    @return Whether the flashcart is ready for debug communication
+==============================*/
+
+bool Relay::OpenDevice()
+{
+    DeviceError deverr;
+
+    // Search for a cart
+    relay_log("Searching for a valid flashcart\n");
+    deverr = device_find();
+    if (deverr != DEVICEERR_OK)
+    {
+        relay_log("Error finding flashcart. Returned error %d.\n", deverr);
+        return false;
+    }
+
+    // Return which cart was found
+    switch (device_getcart())
+    {
+        case CART_64DRIVE1: relay_log("Found 64Drive HW1\n"); break;
+        case CART_64DRIVE2: relay_log("Found 64Drive HW2\n"); break;
+        case CART_EVERDRIVE: relay_log("Found EverDrive\n"); break;
+        case CART_SC64: relay_log("Found SummerCart64\n"); break;
+        case CART_NONE:
+            relay_log("Found Unknown\nUSB Disconnected.\n");
+            return false;
+    }
+
+    // Open the cart
+    relay_log("Opening device\n");
+    deverr = device_open();
+    if (deverr != DEVICEERR_OK)
+    {
+        relay_log("Error opening flashcart. Returned error %d.\n", deverr);
+        return false;
+    }
+
+    // Test that debug mode is possible
+    if (device_testdebug() != DEVICEERR_OK)
+    {
+        switch (device_getcart())
+        {
+            case CART_64DRIVE1:
+            case CART_64DRIVE2:
+                relay_log("Please upgrade to firmware 2.05 or higher to access full USB functionality.\n");
+                break;
+            default:
+                relay_log("Unable to debug on this flashcart.\n");
+                break;
+        }
+        return false;
+    }
+    device_setprotocol(USBPROTOCOL_LATEST);
+    return true;
+}
+
+
+/*==============================
+    Relay::UploadROM
+    Uploads the ROM to the flashcart
+    @return Whether the upload succeeded
+==============================*/
+
+bool Relay::UploadROM()
+{
+    FILE* fp;
+    int filesize;
+    DeviceError deverr;
+
+    // Open the file
+    relay_log("Loading '%s' via USB\n", this->m_ROMPath.c_str());
+    device_setrom(this->m_ROMPath.c_str());
+    fp = fopen(this->m_ROMPath.c_str(), "rb");
+    if (fp == NULL)
+    {
+        relay_log("Unable to open ROM '%s'.\n", this->m_ROMPath.c_str());
+        return false;
+    }
+
+    // Set the CIC for the ROM to be bootable
+    device_explicitcic();
+
+    // Get the file size
+    fseek(fp, 0L, SEEK_END);
+    filesize = ftell(fp);
+    rewind(fp);
+
+    // Upload the ROM
+    this->m_BundleSize = 0; // The new ROM will tell us if it supports bundles
+    deverr = device_sendrom(fp, filesize);
+    fclose(fp);
+    if (deverr != DEVICEERR_OK)
+    {
+        relay_log("Error sending ROM. Returned error %d.\n", deverr);
+        return false;
+    }
+
+    // Finished uploading
+    relay_log("Finished uploading.\n");
+    if (device_getcart() != CART_EVERDRIVE)
+        relay_log("You may now boot the console.\n");
+    return true;
+}
+
+
+/*==============================
+    Relay::ReadDevice
+    Reads and handles a single USB transfer from the N64
+    @return Whether there was any data to read
+==============================*/
+
+bool Relay::ReadDevice()
+{
+    uint8_t* outbuff = NULL;
+    uint32_t dataheader = 0;
+    uint32_t size;
+    uint8_t command;
+
+    // Read from the N64's USB, and ensure there were no errors during the USB reading process
+    if (device_receivedata(&dataheader, &outbuff) != DEVICEERR_OK)
+    {
+        relay_log("\nError receiving data from the flashcart.\n");
+        free(outbuff);
+        return false;
+    }
+    if (dataheader == 0 || outbuff == NULL)
+        return false;
+
+    // Decide what to do with the data based off the command type
+    size = dataheader & 0xFFFFFF;
+    command = ((dataheader >> 24) & 0xFF);
+    this->m_Stats_USB.CountIn(size);
+    if (PacketCapture::IsActive())
+        PacketCapture::USB(CAPTURE_IN, command, outbuff, size);
+    switch (command)
+    {
+        case DATATYPE_TEXT:      this->ParseUSB_TextPacket(outbuff, size); break;
+        case DATATYPE_NETPACKET: this->ParseUSB_NetLibPacket(outbuff, size); break;
+        case DATATYPE_NETPACKETBUNDLE: this->ParseUSB_NetLibBundlePacket(outbuff, size); break;
+        case DATATYPE_HEARTBEAT: this->ParseUSB_HeartbeatPacket(outbuff, size); break;
+        default:
+            relay_log("\nError: Received unknown datatype '%02X' from the flashcart.\n", command);
+            break;
+    }
+
+    // Cleanup
+    free(outbuff);
+    return true;
+}
+
+
+/*==============================
+    Relay::UploadPackets
+    Uploads everything the server has sent so far to the N64.
+    If the ROM supports it, packets are bundled so that many
+    of them go in a single USB transfer, otherwise only one
+    packet is sent per call.
+    @return Whether any packets were uploaded
+==============================*/
+
+bool Relay::UploadPackets()
+{
+    uint32_t bundleused = 0;
+    int bundlecount = 0;
+    if (this->m_ToDevice.empty())
+        return false;
+
+    // If the ROM can't handle bundles, send a single packet and let the loop poll the N64 again before the next one
+    if (this->m_BundleSize == 0)
+    {
+        while (!this->m_ToDevice.empty())
+        {
+            uint16_t pktsize = this->m_ToDevice.front()->WriteAsBytes(this->m_BundleBuffer, MAX_PACKETSIZE);
+            this->m_ToDevice.pop_front();
+            if (pktsize == 0)
+            {
+                this->m_Stats_USB.CountDrop();
+                relay_log("\nPacket from the server is too large for the N64, dropped it.\n");
+                continue;
+            }
+            this->SendData(DATATYPE_NETPACKET, this->m_BundleBuffer, pktsize);
+            break;
+        }
+        return true;
+    }
+
+    // Pack as many packets as will fit into each transfer
+    for (NetLibPacketPtr& pkt : this->m_ToDevice)
+    {
+        uint16_t pktsize = pkt->WriteAsBytes(this->m_BundleBuffer + bundleused, this->m_BundleSize - bundleused);
+        if (pktsize == 0 && bundlecount > 0)
+        {
+            this->SendBundle(bundleused, bundlecount);
+            bundleused = 0;
+            bundlecount = 0;
+            pktsize = pkt->WriteAsBytes(this->m_BundleBuffer, this->m_BundleSize);
+        }
+        if (pktsize > 0)
+        {
+            bundleused += pktsize;
+            bundlecount++;
+        }
+        else
+        {
+            this->m_Stats_USB.CountDrop();
+            relay_log("\nPacket from the server is too large for the N64, dropped it.\n");
+        }
+    }
+    if (bundlecount > 0)
+        this->SendBundle(bundleused, bundlecount);
+    this->m_ToDevice.clear();
+    return true;
+}
+
+
+/*==============================
+    Relay::SendBundle
+    Sends the packets in the bundle buffer to the N64
+    @param The number of bytes in the bundle buffer
+    @param The number of packets in the bundle buffer
+==============================*/
+
+void Relay::SendBundle(uint32_t size, int count)
+{
+    this->SendData((count > 1) ? DATATYPE_NETPACKETBUNDLE : DATATYPE_NETPACKET, this->m_BundleBuffer, size);
+}
+
+
+/*==============================
+    Relay::SendData
+    Sends a USB transfer to the N64, timing how long it takes
+    @param The USB datatype of the transfer
+    @param The data to send
+    @param The size of the data
+==============================*/
+
+void Relay::SendData(uint8_t type, uint8_t* data, uint32_t size)
+{
+    std::chrono::steady_clock::time_point start;
+    if (PacketCapture::IsActive())
+        PacketCapture::USB(CAPTURE_OUT, type, data, size);
+    start = std::chrono::steady_clock::now();
+    device_senddata((USBDataType)type, (byte*)data, size);
+    this->m_Stats_USB.CountOut(size);
+    this->m_Stats_USB.AddLatency(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+}
+
+
+/*==============================
+    Relay::ParseUSB_TextPacket
+    Parses a USB text packet, and prints it
+    @param The raw buffer with text data
+    @param The size of the data
+==============================*/
+
+void Relay::ParseUSB_TextPacket(uint8_t* buff, uint32_t size)
+{
+    fwrite(buff, 1, size, stdout);
+    fflush(stdout);
+}
+
+
+/*==============================
+    Relay::ParseUSB_NetLibPacket
+    Parses a NetLib packet and sends it to the server
+    @param The raw buffer with NetLib packet data
+    @param The size of the data
+==============================*/
+
+void Relay::ParseUSB_NetLibPacket(uint8_t* buff, uint32_t size)
+{
+    NetLibPacket* pkt = NULL;
+    try
+    {
+        pkt = NetLibPacket::FromBytes(buff, size);
+    }
+    catch (BadPacketVersionException& e)
+    {
+        (void)e;
+    }
+
+    // Ensure we had a valid packet
+    if (pkt == NULL)
+    {
+        relay_log("\nGot a bad NetLib Packet\n");
+        return;
+    }
+
+    // Send the packet to the server
+    if (this->m_Stopping)
+    {
+        delete pkt;
+        return;
+    }
+    try
+    {
+        this->m_Handler->SendPacket(pkt);
+    }
+    catch (ClientTimeoutException& e)
+    {
+        (void)e;
+        this->Disconnect("\nServer timed out. Disconnected.\n");
+    }
+}
+
+
+/*==============================
+    Relay::ParseUSB_NetLibBundlePacket
+    Parses the N64 telling us that it can receive bundles
+    of NetLib packets in a single USB transfer
+    @param The raw buffer with the bundle announcement
+    @param The size of the data
+==============================*/
+
+void Relay::ParseUSB_NetLibBundlePacket(uint8_t* buff, uint32_t size)
+{
+    uint32_t maxsize;
+    if (size < 4)
+    {
+        relay_log("\nError: Malformed bundle announcement received.\n");
+        return;
+    }
+
+    // Bundles must be able to fit at least the largest packet
+    maxsize = (buff[0] << 24) | (buff[1] << 16) | (buff[2] << 8) | buff[3];
+    if (maxsize < MAX_PACKETSIZE)
+        this->m_BundleSize = 0;
+    else
+        this->m_BundleSize = (maxsize < MAX_USBBUNDLESIZE) ? maxsize : MAX_USBBUNDLESIZE;
+}
+
+
+/*==============================
+    Relay::ParseUSB_HeartbeatPacket
+    Parses a UNFLoader heartbeat packet
+    @param The raw buffer with heartbeat data
+    @param The size of the data
+==============================*/
+
+void Relay::ParseUSB_HeartbeatPacket(uint8_t* buff, uint32_t size)
+{
+    uint32_t header;
+    uint16_t heartbeat_version;
+    uint16_t protocol_version;
+
+    // Heartbeat packet must have at least 4 bytes
+    if (size < 4)
+    {
+        relay_log("\nError: Malformed heartbeat received.\n");
+        return;
+    }
+
+    // Read the heartbeat header
+    header = (buff[3] << 24) | (buff[2] << 16) | (buff[1] << 8) | (buff[0]);
+    header = swap_endian(header);
+    heartbeat_version = (uint16_t)(header&0x0000FFFF);
+    protocol_version = (header&0xFFFF0000)>>16;
+
+    // Ensure we support this protocol version
+    if (protocol_version > USBPROTOCOL_VERSION)
+    {
+        relay_log("\nError: USB protocol %d unsupported. Your NetLib Relay is probably out of date.\n", protocol_version);
+        return;
+    }
+    device_setprotocol((ProtocolVer)protocol_version);
+
+    // Handle the heartbeat by reading more stuff based on the version
+    // Currently, nothing here.
+    if (heartbeat_version != HEARTBEAT_VERSION)
+    {
+        relay_log("\nError: Heartbeat version %d unsupported. Your NetLib Relay is probably out of date.\n", heartbeat_version);
+        return;
+    }
+}
+
+
+/*==============================
+    Relay::StartRead
+    Waits asynchronously for packets from the server
+==============================*/
+
+void Relay::StartRead()
+{
+    this->m_Socket->AsyncWait([this](const asio::error_code& error) {
+        this->OnRead(error);
+    });
+}
+
+
+/*==============================
+    Relay::OnRead
+    Drains all the packets the server sent us, in batches,
+    and queues them up for the N64
+    @param The error code of the wait operation
+==============================*/
+
+void Relay::OnRead(const asio::error_code& error)
+{
+    size_t count = MAX_BATCHCOUNT;
+    if (error == asio::error::operation_aborted || this->m_Stopping)
+        return;
+
+    // Parse the packets, batching any acks we need to send back
+    this->m_Handler->BeginBatch();
+    while (!error && count == MAX_BATCHCOUNT)
+    {
+        count = this->m_Socket->ReadBatch(this->m_RecvSlab, MAX_PACKETSIZE, this->m_RecvSizes, MAX_BATCHCOUNT);
+        for (size_t i=0; i<count; i++)
+        {
+            try
+            {
+                NetLibPacket* pkt = this->m_Handler->ReadNetLibPacket(this->m_RecvSlab + i*MAX_PACKETSIZE, this->m_RecvSizes[i]);
+                if (pkt != NULL)
+                    this->m_ToDevice.push_back(NetLibPacketPtr(pkt));
+            }
+            catch (BadPacketVersionException& e)
+            {
+                relay_log("\nGot unsupported packet version %d from the server.\n", e.GetVersion());
+            }
+            catch (ClientTimeoutException& e)
+            {
+                (void)e;
+                this->Disconnect("\nServer timed out. Disconnected.\n");
+                return;
+            }
+        }
+    }
+    this->m_Handler->EndBatch();
+
+    // Wait for more
+    this->StartRead();
+}
+
+
+/*==============================
+    Relay::StartTimer
+    Schedules the next retransmission check. The timer ticks
+    with the handler's timer wheel while packets are waiting
+    for an ack, and rarely otherwise.
+==============================*/
+
+void Relay::StartTimer()
+{
+    this->m_TimerFast = this->m_Handler->HasPendingResends();
+    this->m_Timer->expires_after(std::chrono::milliseconds(this->m_TimerFast ? TIMERWHEEL_TICK : TIME_IDLECHECK));
+    this->m_Timer->async_wait([this](const asio::error_code& error) {
+        this->OnTimer(error);
+    });
+}
+
+
+/*==============================
+    Relay::OnTimer
+    Resends reliable packets that were not acknowledged in time
+    @param The error code of the timer
+==============================*/
+
+void Relay::OnTimer(const asio::error_code& error)
+{
+    if (error == asio::error::operation_aborted || this->m_Stopping)
+        return;
+    try
+    {
+        this->m_Handler->ResendMissingPackets();
+    }
+    catch (ClientTimeoutException& e)
+    {
+        (void)e;
+        this->Disconnect("\nServer timed out. Disconnected.\n");
+        return;
+    }
+    this->StartTimer();
+}
+
+
+/*==============================
+    Relay::Disconnect
+    Stops the connection to the server
+    @param The reason to print
+==============================*/
+
+void Relay::Disconnect(std::string reason)
+{
+    relay_log("%s", reason.c_str());
+    this->m_Stopping = true;
+}
+
+
+/*==============================
+    Relay::LogStats
+    Writes the connection stats to the stats log as a JSON line
+==============================*/
+
+void Relay::LogStats()
+{
+    TransportStatsSnapshot server = this->m_Stats_Server.Snapshot();
+    TransportStatsSnapshot usb = this->m_Stats_USB.Snapshot();
+    fprintf(this->m_StatsLog, "{\"time_ms\":%lld,\"server\":%s,\"usb\":%s,\"to_device\":%lu}\n",
+        (long long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count(),
+        TransportStats::ToJSON(&server).c_str(), TransportStats::ToJSON(&usb).c_str(), (unsigned long)this->m_ToDevice.size()
+    );
+    fflush(this->m_StatsLog);
+    this->m_StatsTime = std::chrono::steady_clock::now();
+}
+
+
+/*==============================
+    Relay::PrintStats
+    Prints a summary of the connection stats
+==============================*/
+
+void Relay::PrintStats()
+{
+    TransportStatsSnapshot server = this->m_Stats_Server.Snapshot();
+    TransportStatsSnapshot usb = this->m_Stats_USB.Snapshot();
+    relay_log("Server: %llu packets sent, %llu received, %llu resent, %llu duplicates, RTT %.1f ms (%.1f jitter)\n",
+        (unsigned long long)server.packets_out, (unsigned long long)server.packets_in, (unsigned long long)server.resends,
+        (unsigned long long)server.duplicates, server.srtt, server.rttvar
+    );
+    relay_log("USB: %llu transfers sent (%llu bytes), %llu received (%llu bytes), %llu packets dropped, p99 send time %.0f us\n",
+        (unsigned long long)usb.packets_out, (unsigned long long)usb.bytes_out, (unsigned long long)usb.packets_in,
+        (unsigned long long)usb.bytes_in, (unsigned long long)usb.dropped, TransportStats::Percentile(&usb, 99)
+    );
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <chrono>
+#include "packets.h"
+#include "stats.h"
+
+
+/*********************************
+             Classes
+*********************************/
+
+// Headless N64 <-> Server relay.
+// The flashcart is polled and the server socket is serviced from a single
+// event loop, so no threads or wxWidgets are needed.
+class Relay
+{
+    private:
+        std::string m_ROMPath;
+        std::string m_Address;
+        int m_Port;
+        ASIOSocket* m_Socket;
+        UDPHandler* m_Handler;
+        asio::steady_timer* m_Timer;
+        uint8_t* m_RecvSlab;
+        size_t m_RecvSizes[MAX_BATCHCOUNT];
+        std::deque<NetLibPacketPtr> m_ToDevice;
+        uint32_t m_BundleSize;
+        uint8_t* m_BundleBuffer;
+        bool m_Stopping;
+        bool m_TimerFast;
+        TransportStats m_Stats_Server;
+        TransportStats m_Stats_USB;
+        FILE* m_StatsLog;
+        std::chrono::steady_clock::time_point m_StatsTime;
+
+        bool OpenDevice();
+        bool UploadROM();
+        bool ReadDevice();
+        bool UploadPackets();
+        void SendBundle(uint32_t size, int count);
+        void SendData(uint8_t type, uint8_t* data, uint32_t size);
+        void ParseUSB_TextPacket(uint8_t* buff, uint32_t size);
+        void ParseUSB_NetLibPacket(uint8_t* buff, uint32_t size);
+        void ParseUSB_NetLibBundlePacket(uint8_t* buff, uint32_t size);
+        void ParseUSB_HeartbeatPacket(uint8_t* buff, uint32_t size);
+        void StartRead();
+        void StartTimer();
+        void OnRead(const asio::error_code& error);
+        void OnTimer(const asio::error_code& error);
+        void Disconnect(std::string reason);
+        void LogStats();
+        void PrintStats();
+
+    protected:
+
+    public:
+        Relay(std::string rompath, std::string address, int port);
+        ~Relay();
+        bool OpenStatsLog(std::string path);
+        int Run();
+};
@@ -0,0 +1,344 @@
+/***************************************************************
+                           replay.cpp
+
+Plays a traffic capture (made with the relay's -capture option
+or the browser's CaptureFile setting) back through the UDP
+handler, and reports how quickly the packets were parsed and
+their acks processed. This gives a reproducible workload for
+catching performance regressions, without needing an N64 or a
+server.
+***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+#include "packets.h"
+#include "capture.h"
+
+
+/******************************
+             Macros
+******************************/
+
+#define PROGRAM_NAME "netlib-replay"
+
+
+/******************************
+             Types
+******************************/
+
+typedef enum {
+    REPLAYPACKET_NONE,
+    REPLAYPACKET_S64,
+    REPLAYPACKET_NETLIB,
+} ReplayPacketType;
+
+typedef struct {
+    uint64_t packets;   // Packets given to the parser
+    uint64_t bytes;     // Bytes in those packets
+    uint64_t accepted;  // Packets that were parsed (and weren't duplicates)
+    uint64_t rejected;  // Malformed or duplicate packets
+    uint64_t errors;    // Packets that caused an exception
+    double   seconds;   // Time spent parsing
+} ReplayStats;
+
+
+/******************************
+           Functions
+******************************/
+
+/*==============================
+    replay_usage
+    Prints the command line usage
+==============================*/
+
+static void replay_usage()
+{
+    printf("Usage: %s -trace <File> [-speed <max|recorded>] [-loops <Count>]\n", PROGRAM_NAME);
+    printf("    -trace <File>\t\tCapture file to replay\n");
+    printf("    -speed <max|recorded>\tReplay as fast as possible (default), or with the recorded timing\n");
+    printf("    -loops <Count>\t\tHow many times to replay the capture\n");
+}
+
+
+/*==============================
+    replay_packettype
+    Checks what kind of packet a datagram holds
+    @param  The datagram
+    @return The type of packet
+==============================*/
+
+static ReplayPacketType replay_packettype(std::vector<uint8_t>& data)
+{
+    if (data.size() < 3)
+        return REPLAYPACKET_NONE;
+    if (S64Packet::IsS64Packet(data.data()))
+        return REPLAYPACKET_S64;
+    if (NetLibPacket::IsNetLibPacket(data.data()))
+        return REPLAYPACKET_NETLIB;
+    return REPLAYPACKET_NONE;
+}
+
+
+/*==============================
+    replay_report
+    Prints the results of a replay
+    @param The name of the replay
+    @param The replay's stats
+==============================*/
+
+static void replay_report(const char* name, ReplayStats* stats)
+{
+    double seconds = (stats->seconds > 0) ? stats->seconds : 1e-9;
+    printf("%-14s %llu packets in %.3f ms, %.0f packets/s, %.2f MB/s (%llu accepted, %llu rejected, %llu errors)\n", name,
+        (unsigned long long)stats->packets, stats->seconds*1000.0, stats->packets/seconds, stats->bytes/seconds/(1024.0*1024.0),
+        (unsigned long long)stats->accepted, (unsigned long long)stats->rejected, (unsigned long long)stats->errors
+    );
+}
+
+
+/*==============================
+    replay_parse
+    Parses every received datagram with the packet views,
+    which measures the cost of parsing on its own
+    @param The records to replay
+    @param The stats to add to
+==============================*/
+
+static void replay_parse(std::vector<CaptureRecord>& records, ReplayStats* stats)
+{
+    S64PacketView s64view;
+    NetLibPacketView netlibview;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (CaptureRecord& record : records)
+    {
+        bool parsed = false;
+        if (record.source != CAPTURE_UDP || record.direction != CAPTURE_IN)
+            continue;
+        try
+        {
+            switch (replay_packettype(record.data))
+            {
+                case REPLAYPACKET_S64:    parsed = s64view.Parse(record.data.data(), record.data.size()); break;
+                case REPLAYPACKET_NETLIB: parsed = netlibview.Parse(record.data.data(), record.data.size()); break;
+                default: break;
+            }
+            if (parsed)
+                stats->accepted++;
+            else
+                stats->rejected++;
+        }
+        catch (BadPacketVersionException& e)
+        {
+            (void)e;
+            stats->errors++;
+        }
+        stats->packets++;
+        stats->bytes += record.data.size();
+    }
+    stats->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+/*==============================
+    replay_send
+    Sends a packet that we sent in the capture through the
+    handler again, so that the acks in the packets that we
+    received find it in the handler's TX window. Only reliable
+    packets are sent, as unreliable ones (like the acks the
+    handler makes itself) don't change its state.
+    @param The handler to send the packet with
+    @param The record of the packet
+==============================*/
+
+static void replay_send(UDPHandler* handler, CaptureRecord& record)
+{
+    AbstractPacket* pkt = NULL;
+    switch (replay_packettype(record.data))
+    {
+        case REPLAYPACKET_S64:    pkt = S64Packet::FromBytes(record.data.data(), record.data.size()); break;
+        case REPLAYPACKET_NETLIB: pkt = NetLibPacket::FromBytes(record.data.data(), record.data.size()); break;
+        default: break;
+    }
+    if (pkt == NULL)
+        return;
+    if ((pkt->GetFlags() & FLAG_UNRELIABLE) != 0)
+    {
+        delete pkt;
+        return;
+    }
+    handler->SendPacket(pkt);
+}
+
+
+/*==============================
+    replay_handle
+    Replays the capture through a set of UDP handlers, one per
+    remote endpoint. Only the time spent inside the handler's
+    read functions is counted, which covers parsing as well as
+    the sequence and ack processing.
+    @param The records to replay
+    @param Whether to wait between records like in the capture
+    @param The stats to add to
+==============================*/
+
+static void replay_handle(std::vector<CaptureRecord>& records, bool realtime, ReplayStats* stats)
+{
+    ASIOSocket* socket = new ASIOSocket("127.0.0.1", 0);
+    int selfport = socket->GetLocalEndpoint().port();
+    std::unordered_map<udp::endpoint, UDPHandler*> handlers;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t firsttime = records.empty() ? 0 : records[0].timestamp;
+
+    for (CaptureRecord& record : records)
+    {
+        UDPHandler* handler;
+        std::chrono::steady_clock::time_point readstart;
+        std::unordered_map<udp::endpoint, UDPHandler*>::iterator it;
+        AbstractPacket* pkt = NULL;
+        if (record.source != CAPTURE_UDP)
+            continue;
+        if (realtime)
+            std::this_thread::sleep_until(start + std::chrono::microseconds(record.timestamp - firsttime));
+
+        // Any acks the handlers send go back to our own socket, where they are ignored
+        it = handlers.find(record.remote);
+        if (it == handlers.end())
+            it = handlers.emplace(record.remote, new UDPHandler(socket, "127.0.0.1", selfport)).first;
+        handler = it->second;
+
+        // Replay the packet
+        try
+        {
+            if (record.direction == CAPTURE_OUT)
+            {
+                replay_send(handler, record);
+                continue;
+            }
+            readstart = std::chrono::steady_clock::now();
+            switch (replay_packettype(record.data))
+            {
+                case REPLAYPACKET_S64:    pkt = handler->ReadS64Packet(record.data.data(), record.data.size()); break;
+                case REPLAYPACKET_NETLIB: pkt = handler->ReadNetLibPacket(record.data.data(), record.data.size()); break;
+                default: break;
+            }
+            stats->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - readstart).count();
+            if (pkt != NULL)
+                stats->accepted++;
+            else
+                stats->rejected++;
+            delete pkt;
+        }
+        catch (ClientTimeoutException& e)
+        {
+            (void)e;
+            stats->errors++;
+        }
+        catch (BadPacketVersionException& e)
+        {
+            (void)e;
+            stats->errors++;
+        }
+        if (record.direction == CAPTURE_IN)
+        {
+            stats->packets++;
+            stats->bytes += record.data.size();
+        }
+    }
+
+    // Cleanup
+    for (std::pair<const udp::endpoint, UDPHandler*>& it : handlers)
+        delete it.second;
+    delete socket;
+}
+
+
+/*==============================
+    main
+    Program entrypoint
+    @param  The number of arguments
+    @param  The list of arguments
+    @return The exit code
+==============================*/
+
+int main(int argc, char* argv[])
+{
+    std::string tracepath = "";
+    bool realtime = false;
+    int loops = 1;
+    CaptureReader reader;
+    CaptureRecord record;
+    std::vector<CaptureRecord> records;
+    uint64_t counts[2][2] = {{0, 0}, {0, 0}};
+    ReplayStats parsestats, handlestats;
+
+    // Parse the command line
+    for (int i=1; i<argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.length() > 1 && arg[0] == '-' && arg[1] == '-')
+            arg = arg.substr(1);
+        if ((arg == "-trace" || arg == "-t") && i+1 < argc)
+        {
+            tracepath = argv[++i];
+        }
+        else if ((arg == "-speed" || arg == "-s") && i+1 < argc && (!strcmp(argv[i+1], "max") || !strcmp(argv[i+1], "recorded")))
+        {
+            realtime = !strcmp(argv[++i], "recorded");
+        }
+        else if ((arg == "-loops" || arg == "-l") && i+1 < argc)
+        {
+            loops = atoi(argv[++i]);
+        }
+        else
+        {
+            replay_usage();
+            return (arg == "-help" || arg == "-h") ? 0 : 1;
+        }
+    }
+    if (tracepath == "" || loops <= 0)
+    {
+        replay_usage();
+        return 1;
+    }
+
+    // Load the whole capture first, so that reading it doesn't count towards the results
+    if (!reader.Open(tracepath))
+    {
+        printf("Unable to open capture file '%s'.\n", tracepath.c_str());
+        return 1;
+    }
+    while (reader.Next(&record))
+    {
+        counts[record.source][record.direction == CAPTURE_OUT]++;
+        records.push_back(record);
+    }
+    reader.Close();
+    if (records.empty())
+    {
+        printf("The capture file has no records.\n");
+        return 1;
+    }
+    printf("Loaded %llu records spanning %.3f s (UDP: %llu in, %llu out. USB: %llu in, %llu out)\n",
+        (unsigned long long)records.size(), (records.back().timestamp - records.front().timestamp)/1000000.0,
+        (unsigned long long)counts[CAPTURE_UDP][0], (unsigned long long)counts[CAPTURE_UDP][1],
+        (unsigned long long)counts[CAPTURE_USB][0], (unsigned long long)counts[CAPTURE_USB][1]
+    );
+
+    // Replay it
+    ASIOSocket::InitASIO();
+    memset(&parsestats, 0, sizeof(ReplayStats));
+    memset(&handlestats, 0, sizeof(ReplayStats));
+    for (int i=0; i<loops; i++)
+    {
+        replay_parse(records, &parsestats);
+        replay_handle(records, realtime, &handlestats);
+    }
+    replay_report("Parse:", &parsestats);
+    replay_report("Parse + acks:", &handlestats);
+    return 0;
+}
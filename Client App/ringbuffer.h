@@ -0,0 +1,295 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <utility>
+
+
+/******************************
+             Macros
+******************************/
+
+// Assumed cache line size, used to keep the producer and consumer indices apart
+#define RING_CACHELINE  64
+
+
+/*********************************
+             Classes
+*********************************/
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// Items are moved in and out, so ownership of the item travels with it.
+template <typename T, size_t N>
+class SPSCRing
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SPSCRing size must be a power of two");
+
+    private:
+        T m_Items[N];
+
+        // Written by the consumer
+        std::atomic<size_t> m_Head;
+        size_t m_TailCache;
+        char m_PadHead[RING_CACHELINE];
+
+        // Written by the producer
+        std::atomic<size_t> m_Tail;
+        size_t m_HeadCache;
+        std::atomic<size_t> m_HighWater;
+        char m_PadTail[RING_CACHELINE];
+
+        // Consumer wakeup, only touched when the consumer has gone idle
+        std::atomic<bool> m_Awake;
+        std::mutex m_WaitMutex;
+        std::condition_variable m_WaitCond;
+
+    public:
+        SPSCRing() : m_Head(0), m_TailCache(0), m_Tail(0), m_HeadCache(0), m_HighWater(0), m_Awake(false) {}
+
+        /*==============================
+            SPSCRing::Push
+            Moves an item into the ring. Producer only.
+            @param  The item to move in. Left untouched if the ring is full
+            @return Whether the item was added
+        ==============================*/
+
+        bool Push(T&& item)
+        {
+            size_t tail = this->m_Tail.load(std::memory_order_relaxed);
+            size_t depth;
+            if (tail - this->m_HeadCache == N)
+            {
+                this->m_HeadCache = this->m_Head.load(std::memory_order_acquire);
+                if (tail - this->m_HeadCache == N)
+                    return false;
+            }
+            this->m_Items[tail & (N - 1)] = std::move(item);
+            this->m_Tail.store(tail + 1, std::memory_order_release);
+
+            // Track the deepest the ring has been
+            depth = tail + 1 - this->m_HeadCache;
+            if (depth > this->m_HighWater.load(std::memory_order_relaxed))
+                this->m_HighWater.store(depth, std::memory_order_relaxed);
+            return true;
+        }
+
+        /*==============================
+            SPSCRing::Pop
+            Moves the oldest item out of the ring. Consumer only.
+            @param  The item to move into
+            @return Whether there was an item to take
+        ==============================*/
+
+        bool Pop(T& item)
+        {
+            size_t head = this->m_Head.load(std::memory_order_relaxed);
+            if (head == this->m_TailCache)
+            {
+                this->m_TailCache = this->m_Tail.load(std::memory_order_acquire);
+                if (head == this->m_TailCache)
+                    return false;
+            }
+            item = std::move(this->m_Items[head & (N - 1)]);
+            this->m_Head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        /*==============================
+            SPSCRing::WakeConsumer
+            Lets the consumer know there are items to take.
+            Called by the producer after pushing. Only does any
+            work if the consumer said it was going idle, in which
+            case sleepers in WaitFor are signaled.
+            @return Whether the consumer was idle, meaning the caller
+                    needs to wake it if it does not sleep in WaitFor
+        ==============================*/
+
+        bool WakeConsumer()
+        {
+            if (this->m_Awake.exchange(true, std::memory_order_acq_rel))
+                return false;
+            {
+                std::lock_guard<std::mutex> lock(this->m_WaitMutex);
+            }
+            this->m_WaitCond.notify_one();
+            return true;
+        }
+
+        /*==============================
+            SPSCRing::Idle
+            Marks the consumer as idle, so that the next push wakes
+            it up. Must be called before draining the ring, so that
+            items pushed during the drain are not missed. Consumer only.
+        ==============================*/
+
+        void Idle()
+        {
+            this->m_Awake.exchange(false, std::memory_order_acq_rel);
+        }
+
+        /*==============================
+            SPSCRing::WaitFor
+            Sleeps the consumer until an item is pushed or the
+            timeout passes. Consumer only.
+            @param The max time to wait, in milliseconds
+        ==============================*/
+
+        void WaitFor(int ms)
+        {
+            this->Idle();
+            if (this->Depth() == 0)
+            {
+                std::unique_lock<std::mutex> lock(this->m_WaitMutex);
+                this->m_WaitCond.wait_for(lock, std::chrono::milliseconds(ms), [this]() {
+                    return this->m_Awake.load(std::memory_order_acquire);
+                });
+            }
+            this->m_Awake.store(true, std::memory_order_relaxed);
+        }
+
+        /*==============================
+            SPSCRing::Depth
+            Gets the number of items in the ring. Only exact
+            when called from the producer or consumer.
+            @return The number of items in the ring
+        ==============================*/
+
+        size_t Depth() const
+        {
+            size_t head = this->m_Head.load(std::memory_order_acquire);
+            return this->m_Tail.load(std::memory_order_acquire) - head;
+        }
+
+        /*==============================
+            SPSCRing::HighWater
+            Gets the most items the ring has held at once
+            @return The high-water mark
+        ==============================*/
+
+        size_t HighWater() const
+        {
+            return this->m_HighWater.load(std::memory_order_relaxed);
+        }
+
+        /*==============================
+            SPSCRing::Capacity
+            Gets the max number of items the ring can hold
+            @return The ring's capacity
+        ==============================*/
+
+        size_t Capacity() const
+        {
+            return N;
+        }
+};
+
+
+// Bounded lock-free byte queue for exactly one producer thread and one consumer thread.
+// Writes are all or nothing, so a write that doesn't fit is dropped and counted instead.
+template <size_t N>
+class SPSCByteRing
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SPSCByteRing size must be a power of two");
+
+    private:
+        uint8_t m_Bytes[N];
+
+        // Written by the consumer
+        std::atomic<size_t> m_Head;
+        char m_PadHead[RING_CACHELINE];
+
+        // Written by the producer
+        std::atomic<size_t> m_Tail;
+        std::atomic<size_t> m_Dropped;
+        char m_PadTail[RING_CACHELINE];
+
+    public:
+        SPSCByteRing() : m_Head(0), m_Tail(0), m_Dropped(0) {}
+
+        /*==============================
+            SPSCByteRing::Write
+            Copies bytes into the ring. Producer only.
+            @param  The bytes to copy in
+            @param  The number of bytes
+            @return Whether the bytes fit. If not, nothing is
+                    written and the bytes are counted as dropped
+        ==============================*/
+
+        bool Write(const uint8_t* data, size_t size)
+        {
+            size_t tail = this->m_Tail.load(std::memory_order_relaxed);
+            size_t start = tail & (N - 1);
+            size_t first = std::min(size, N - start);
+            if (N - (tail - this->m_Head.load(std::memory_order_acquire)) < size)
+            {
+                this->m_Dropped.fetch_add(size, std::memory_order_relaxed);
+                return false;
+            }
+            memcpy(this->m_Bytes + start, data, first);
+            memcpy(this->m_Bytes, data + first, size - first);
+            this->m_Tail.store(tail + size, std::memory_order_release);
+            return true;
+        }
+
+        /*==============================
+            SPSCByteRing::Read
+            Copies bytes out of the ring. Consumer only.
+            @param  The buffer to copy into
+            @param  The max number of bytes to copy
+            @return The number of bytes copied
+        ==============================*/
+
+        size_t Read(uint8_t* buff, size_t size)
+        {
+            size_t head = this->m_Head.load(std::memory_order_relaxed);
+            size_t start = head & (N - 1);
+            size_t first;
+            size = std::min(size, this->m_Tail.load(std::memory_order_acquire) - head);
+            first = std::min(size, N - start);
+            memcpy(buff, this->m_Bytes + start, first);
+            memcpy(buff + first, this->m_Bytes, size - first);
+            this->m_Head.store(head + size, std::memory_order_release);
+            return size;
+        }
+
+        /*==============================
+            SPSCByteRing::Depth
+            Gets the number of bytes in the ring. Only exact
+            when called from the producer or consumer.
+            @return The number of bytes in the ring
+        ==============================*/
+
+        size_t Depth() const
+        {
+            size_t head = this->m_Head.load(std::memory_order_acquire);
+            return this->m_Tail.load(std::memory_order_acquire) - head;
+        }
+
+        /*==============================
+            SPSCByteRing::Dropped
+            Gets the number of bytes that didn't fit in the ring
+            @return The number of dropped bytes
+        ==============================*/
+
+        size_t Dropped() const
+        {
+            return this->m_Dropped.load(std::memory_order_relaxed);
+        }
+
+        /*==============================
+            SPSCByteRing::Capacity
+            Gets the max number of bytes the ring can hold
+            @return The ring's capacity
+        ==============================*/
+
+        size_t Capacity() const
+        {
+            return N;
+        }
+};
@@ -0,0 +1,294 @@
+/***************************************************************
+                          romcache.cpp
+
+Remembers the SHA-256 of ROMs between runs, so the server
+browser doesn't need to read entire ROMs to check if they match
+what a server wants.
+***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <unordered_map>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+#endif
+#include "romcache.h"
+#include "helper.h"
+#include "sha256.h"
+
+
+/******************************
+            Globals
+******************************/
+
+static std::mutex global_romcache_mutex;
+static std::string global_romcache_path = "";
+static std::unordered_map<std::string, ROMCacheEntry> global_romcache;
+
+
+/*=============================================================
+                       Helper Functions
+=============================================================*/
+
+/*==============================
+    romcache_stat
+    Gets the file attributes that a cache entry is keyed by
+    @param  The path to the file
+    @param  The entry to fill in
+    @return Whether the file exists
+==============================*/
+
+static bool romcache_stat(const std::string& path, ROMCacheEntry* entry)
+{
+    #ifdef _WIN32
+        struct _stat64 st;
+        if (_stat64(path.c_str(), &st) != 0)
+            return false;
+    #else
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            return false;
+    #endif
+    entry->size = (uint64_t)st.st_size;
+    entry->mtime = (int64_t)st.st_mtime;
+    entry->inode = (uint64_t)st.st_ino;
+    return true;
+}
+
+
+/*==============================
+    romcache_hashstream
+    Hashes a file by reading it in chunks
+    @param  The file to hash
+    @param  The hash context to update
+    @return Whether the whole file was read
+==============================*/
+
+static bool romcache_hashstream(FILE* fp, SHA256_CTX* ctx)
+{
+    size_t readcount;
+    uint8_t* chunk = (uint8_t*)malloc(ROMCACHE_CHUNKSIZE);
+    if (chunk == NULL)
+        return false;
+    while ((readcount = fread(chunk, 1, ROMCACHE_CHUNKSIZE, fp)) > 0)
+        sha256_update(ctx, chunk, readcount);
+    free(chunk);
+    return ferror(fp) == 0;
+}
+
+
+/*=============================================================
+                          ROM Cache
+=============================================================*/
+
+/*==============================
+    ROMCache::Load
+    Loads the hash index from disk. Each line holds the hash,
+    size, modification time, inode, and path of a ROM.
+    @param The path of the index file, which is also where
+           it gets saved to
+==============================*/
+
+void ROMCache::Load(std::string indexpath)
+{
+    char line[4096];
+    FILE* fp;
+    std::lock_guard<std::mutex> lock(global_romcache_mutex);
+    global_romcache_path = indexpath;
+    global_romcache.clear();
+
+    // Nothing to load if this is the first run
+    fp = fopen(indexpath.c_str(), "r");
+    if (fp == NULL)
+        return;
+
+    // Parse each entry
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        ROMCacheEntry entry;
+        char hash[65];
+        unsigned long long size, inode;
+        long long mtime;
+        int pathstart = 0;
+        size_t len = strlen(line);
+        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+            line[--len] = '\0';
+        if (sscanf(line, "%64s %llu %lld %llu %n", hash, &size, &mtime, &inode, &pathstart) < 4 || pathstart == 0 || line[pathstart] == '\0')
+            continue;
+        entry.hash = hash;
+        entry.size = size;
+        entry.mtime = mtime;
+        entry.inode = inode;
+        global_romcache[std::string(line + pathstart)] = entry;
+    }
+    fclose(fp);
+}
+
+
+/*==============================
+    ROMCache::Save
+    Writes the hash index to disk
+    @return Whether the index was saved
+==============================*/
+
+bool ROMCache::Save()
+{
+    FILE* fp;
+    std::string temppath;
+    std::lock_guard<std::mutex> lock(global_romcache_mutex);
+    if (global_romcache_path == "")
+        return false;
+
+    // Write to a temporary file first, so that a crash doesn't leave a half written index behind
+    temppath = global_romcache_path + ".tmp";
+    fp = fopen(temppath.c_str(), "w");
+    if (fp == NULL)
+        return false;
+    for (const std::pair<const std::string, ROMCacheEntry>& it : global_romcache)
+        fprintf(fp, "%s %llu %lld %llu %s\n", it.second.hash.c_str(), (unsigned long long)it.second.size, (long long)it.second.mtime, (unsigned long long)it.second.inode, it.first.c_str());
+    if (fclose(fp) != 0)
+    {
+        remove(temppath.c_str());
+        return false;
+    }
+
+    // Replace the old index
+    remove(global_romcache_path.c_str());
+    return rename(temppath.c_str(), global_romcache_path.c_str()) == 0;
+}
+
+
+/*==============================
+    ROMCache::Lookup
+    Finds the hash of a ROM in the index. Entries for ROMs
+    that changed since they were hashed are thrown out.
+    @param  The path to the ROM
+    @param  The string to store the hash in
+    @return Whether an up to date hash was found
+==============================*/
+
+bool ROMCache::Lookup(std::string rompath, std::string* hash)
+{
+    ROMCacheEntry current;
+    std::lock_guard<std::mutex> lock(global_romcache_mutex);
+    std::unordered_map<std::string, ROMCacheEntry>::iterator it = global_romcache.find(rompath);
+    if (it == global_romcache.end())
+        return false;
+
+    // Make sure the file is still the one we hashed
+    if (!romcache_stat(rompath, &current) || current.size != it->second.size || current.mtime != it->second.mtime || current.inode != it->second.inode)
+    {
+        global_romcache.erase(it);
+        return false;
+    }
+    *hash = it->second.hash;
+    return true;
+}
+
+
+/*==============================
+    ROMCache::Store
+    Adds a ROM's hash to the index, and saves it to disk
+    @param The path to the ROM
+    @param The hash of the ROM
+==============================*/
+
+void ROMCache::Store(std::string rompath, std::string hash)
+{
+    ROMCacheEntry entry;
+    if (!romcache_stat(rompath, &entry))
+        return;
+    entry.hash = hash;
+    {
+        std::lock_guard<std::mutex> lock(global_romcache_mutex);
+        global_romcache[rompath] = entry;
+    }
+    ROMCache::Save();
+}
+
+
+/*==============================
+    ROMCache::GetHash
+    Gets the hash of a ROM, from the index if possible,
+    otherwise by hashing the file and remembering the result
+    @param  The path to the ROM
+    @param  The string to store the hash in
+    @return Whether the hash could be calculated
+==============================*/
+
+bool ROMCache::GetHash(std::string rompath, std::string* hash)
+{
+    if (ROMCache::Lookup(rompath, hash))
+        return true;
+    if (!ROMCache::HashFile(rompath, hash))
+        return false;
+    ROMCache::Store(rompath, *hash);
+    return true;
+}
+
+
+/*==============================
+    ROMCache::HashFile
+    Calculates the SHA-256 of a file without loading all of
+    it into memory. The file is memory mapped if possible,
+    otherwise it is read in chunks.
+    @param  The path to the file
+    @param  The string to store the hash in
+    @return Whether the hash could be calculated
+==============================*/
+
+bool ROMCache::HashFile(std::string rompath, std::string* hash)
+{
+    uint8_t digest[SHA256_BLOCK_SIZE];
+    SHA256_CTX ctx;
+    FILE* fp;
+    bool success;
+    sha256_init(&ctx);
+
+    // Try memory mapping the file, so that the data doesn't need to be copied
+    #ifndef _WIN32
+        struct stat st;
+        int fd = open(rompath.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED)
+            {
+                #ifdef MADV_SEQUENTIAL
+                    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+                #endif
+                for (size_t offset = 0; offset < (size_t)st.st_size; offset += ROMCACHE_CHUNKSIZE)
+                {
+                    size_t left = (size_t)st.st_size - offset;
+                    sha256_update(&ctx, (uint8_t*)map + offset, (left < ROMCACHE_CHUNKSIZE) ? left : ROMCACHE_CHUNKSIZE);
+                }
+                munmap(map, (size_t)st.st_size);
+                close(fd);
+                sha256_final(&ctx, digest);
+                *hash = stringhash_frombytes(digest, SHA256_BLOCK_SIZE);
+                return true;
+            }
+        }
+        close(fd);
+    #endif
+
+    // Otherwise, stream it in
+    fp = fopen(rompath.c_str(), "rb");
+    if (fp == NULL)
+        return false;
+    success = romcache_hashstream(fp, &ctx);
+    fclose(fp);
+    if (!success)
+        return false;
+    sha256_final(&ctx, digest);
+    *hash = stringhash_frombytes(digest, SHA256_BLOCK_SIZE);
+    return true;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+
+/******************************
+             Macros
+******************************/
+
+// How many bytes of a ROM to hash at a time
+#define ROMCACHE_CHUNKSIZE  (1024*1024)
+
+
+/******************************
+             Types
+******************************/
+
+typedef struct {
+    uint64_t size;
+    int64_t  mtime;
+    uint64_t inode;
+    std::string hash;
+} ROMCacheEntry;
+
+
+/*********************************
+             Classes
+*********************************/
+
+// Index of ROM hashes, so that ROMs only need to be hashed again when they change.
+// Entries are keyed by path, and are only valid while the file's size, modification
+// time, and inode match what they were when it was hashed.
+// Safe to use from multiple threads.
+class ROMCache
+{
+    public:
+        static void Load(std::string indexpath);
+        static bool Save();
+        static bool Lookup(std::string rompath, std::string* hash);
+        static void Store(std::string rompath, std::string hash);
+        static bool GetHash(std::string rompath, std::string* hash);
+        static bool HashFile(std::string rompath, std::string* hash);
+};
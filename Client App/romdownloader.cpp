@@ -106,6 +106,13 @@ void ROMDownloadWindow::ThreadEvent(wxThreadEvent& event)
         case TEVENT_SETPROGRESS:
         {
             int prog = event.GetPayload<int>();
+            if (!this->IsModal())
+                break;
+            if (prog < 0) // The download failed
+            {
+                this->EndModal(0);
+                break;
+            }
             this->m_Gauge_Download->SetValue(prog);
             this->Layout();
             if (prog == 100)
@@ -119,7 +126,7 @@ void ROMDownloadWindow::ThreadEvent(wxThreadEvent& event)
 /*==============================
     ROMDownloadWindow::UpdateDownloadProgress
     Sends a upload progress event to the main thread for drawing the gauge
-    @param The upload progress (from 0 to 100) 
+    @param The upload progress (from 0 to 100), or -1 if the download failed
 ==============================*/
 
 void ROMDownloadWindow::UpdateDownloadProgress(int progress)
@@ -8,11 +8,17 @@ The server browser window
 #include "clientwindow.h"
 #include "packets.h"
 #include "helper.h"
+#include "romcache.h"
 #include "sha256.h"
 #include <stdint.h>
+#include <math.h>
+#include <algorithm>
 #include <wx/config.h>
 #include <wx/dir.h>
+#include <wx/filefn.h>
+#include <wx/filename.h>
 #include <wx/msgdlg.h>
+#include <wx/msgqueue.h>
 #include <wx/tokenzr.h>
 #include <wx/app.h>
 #include "Resources/resources.h"
@@ -23,7 +29,9 @@ The server browser window
 ******************************/
 
 typedef enum {
-    TEVENT_ADDSERVER,
+    TEVENT_ADDSERVERS,
+    TEVENT_UPDATEPINGS,
+    TEVENT_ROMHASHED,
 
     // User Input events
     TEVENT_DOLIST,
@@ -32,27 +40,23 @@ typedef enum {
     TEVENT_FILENAME,
 } ThreadEventType;
 
-typedef enum {
-    COLUMN_PING = 0,
-    COLUMN_PLAYERCOUNT = 1,
-    COLUMN_ADDRESS = 2,
-    COLUMN_ROM = 3,
-    COLUMN_SERVERNAME = 4,
-    COLUMN_ROMHASH = 5,
-    COLUMN_ROMONMASTER = 6
-} ServerListColumn;
-
 typedef struct {
     ThreadEventType type;
     char* data;
 } InputMessage;
 
+typedef struct {
+    wxString romname;
+    wxString romhash;
+} HashedROM;
+
 
 /******************************
             Globals
 ******************************/
 
 static wxMessageQueue<InputMessage*> global_msgqueue_serverthread_input;
+static wxMessageQueue<wxString> global_msgqueue_hashthread_input;
 
 
 /*=============================================================
@@ -76,25 +80,6 @@ void address_fromstr(wxString str, wxString* addr, int* port)
 }
 
 
-/*==============================
-    get_sanitizedromname
-    Cleans up markup text from a ROM name
-    @param  The ROM name to cleanup
-    @return The sanitised ROM name
-==============================*/
-
-wxString get_sanitizedromname(wxString romname)
-{
-    if (romname.Right(wxString("</span>").Length()) == "</span>")
-    {
-        romname.Replace("</span>", "");
-        return romname.AfterFirst('>');
-    }
-    else
-        return romname;
-}
-
-
 /*==============================
     get_rompath
     Appends the ROM folder path to a given ROM name
@@ -113,7 +98,8 @@ wxString get_rompath(wxString romname)
 
 /*==============================
     is_samerom
-    Checks if a given ROM matches a given hash string
+    Checks if a given ROM matches a given hash string.
+    The ROM is only hashed if it changed since it was last checked.
     @param  The ROM name to fetch from the ROMs folder
     @param  The hash string to compare it to
     @return Whether the given ROM matches the hash
@@ -121,46 +107,13 @@ wxString get_rompath(wxString romname)
 
 bool is_samerom(wxString romname, wxString romhash)
 {
-    uint8_t hash[32];
-    uint8_t *filedata;
-    uint32_t filesize;
+    std::string hashstr;
     wxString rompath = get_rompath(romname);
-    wxString hashstr = "";
-    SHA256_CTX ctx;
-    FILE* fp;
     if (!wxFileExists(rompath))
         return false;
-
-    fp = fopen(rompath, "rb");
-    if (fp == NULL)
-        return false;
-
-    // Get the file size and malloc space for the file data
-    fseek(fp, 0L, SEEK_END);
-    filesize = ftell(fp);
-    filedata = (uint8_t*)malloc(filesize);
-    if (filedata == NULL)
-    {
-        fclose(fp);
+    if (!ROMCache::GetHash(rompath.ToStdString(), &hashstr))
         return false;
-    }
-
-    // Read the file data, and then calculate the hash
-    fseek(fp, 0L, SEEK_SET);
-    fread(filedata, 1, filesize, fp);
-    sha256_init(&ctx);
-    sha256_update(&ctx, filedata, filesize);
-    sha256_final(&ctx, hash);
-
-    // Convert it to a string
-    hashstr = "";
-    for (uint32_t i=0; i<(sizeof(hash)/sizeof(hash[0])); i++)
-        hashstr += wxString::Format("%02X", hash[i]);
-
-    // Cleanup
-    fclose(fp);
-    free(filedata);
-    return hashstr == romhash;
+    return wxString(hashstr) == romhash;
 }
 
 
@@ -183,11 +136,13 @@ ServerBrowser::ServerBrowser(wxWindow* parent, wxWindowID id, const wxString& ti
 {
     wxString maddr;
     this->m_FinderThread = NULL;
+    this->m_HasherThread = NULL;
     this->m_DownloadWindow = NULL;
 
-    // Initialize the master address from the config file
+    // Initialize the master address and discovery rate from the config file
     maddr = wxConfigBase::Get()->Read("MasterAddress", wxString::Format("%s:%d", DEFAULT_MASTERSERVER_ADDRESS, DEFAULT_MASTERSERVER_PORT));
     address_fromstr(maddr, &this->m_MasterAddress, &this->m_MasterPort);
+    this->m_DiscoveryRate = wxConfigBase::Get()->ReadLong("DiscoveryRate", DISCOVERY_DEFAULTRATE);
 
     // Begin the window
     this->SetSizeHints(wxDefaultSize, wxDefaultSize);
@@ -230,15 +185,16 @@ ServerBrowser::ServerBrowser(wxWindow* parent, wxWindowID id, const wxString& ti
     m_Sizer_Main->SetFlexibleDirection(wxBOTH);
     m_Sizer_Main->SetNonFlexibleGrowMode(wxFLEX_GROWMODE_SPECIFIED);
 
-    // Create the server list
+    // Create the server list. Sorting is done by us when a column header is clicked, rather than by the control
     this->m_DataViewListCtrl_Servers = new CustomDataView(this, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxDV_ROW_LINES);
-    this->m_DataViewListColumn_Ping = this->m_DataViewListCtrl_Servers->AppendTextColumn(wxT("Ping"), wxDATAVIEW_CELL_INERT, -1, static_cast<wxAlignment>(wxALIGN_LEFT), wxDATAVIEW_COL_RESIZABLE|wxDATAVIEW_COL_SORTABLE);
-    this->m_DataViewListColumn_Players = this->m_DataViewListCtrl_Servers->AppendTextColumn(wxT("Players"), wxDATAVIEW_CELL_INERT, -1, static_cast<wxAlignment>(wxALIGN_LEFT), wxDATAVIEW_COL_RESIZABLE|wxDATAVIEW_COL_SORTABLE);
-    this->m_DataViewListColumn_Address = this->m_DataViewListCtrl_Servers->AppendTextColumn(wxT("Address"), wxDATAVIEW_CELL_INERT, -1, static_cast<wxAlignment>(wxALIGN_LEFT), wxDATAVIEW_COL_RESIZABLE|wxDATAVIEW_COL_SORTABLE);
-    this->m_DataViewListColumn_ROM = this->m_DataViewListCtrl_Servers->AppendCustomTextColumn(wxT("ROM"), wxDATAVIEW_CELL_INERT, -1, static_cast<wxAlignment>(wxALIGN_LEFT), wxDATAVIEW_COL_RESIZABLE|wxDATAVIEW_COL_SORTABLE);
-    this->m_DataViewListColumn_ServerName = this->m_DataViewListCtrl_Servers->AppendTextColumn(wxT("Server Name"), wxDATAVIEW_CELL_INERT, -1, static_cast<wxAlignment>(wxALIGN_LEFT), wxDATAVIEW_COL_RESIZABLE|wxDATAVIEW_COL_SORTABLE);
-    this->m_DataViewListColumn_Hash = this->m_DataViewListCtrl_Servers->AppendTextColumn(wxT("Hash"), wxDATAVIEW_CELL_INERT, -1, static_cast<wxAlignment>(wxALIGN_LEFT), wxDATAVIEW_COL_HIDDEN);
-    this->m_DataViewListColumn_FileExistsOnMaster = this->m_DataViewListCtrl_Servers->AppendTextColumn(wxT("File Exists on Master"), wxDATAVIEW_CELL_INERT, -1, static_cast<wxAlignment>(wxALIGN_LEFT), wxDATAVIEW_COL_HIDDEN);
+    this->m_ServerListModel = new ServerListModel();
+    this->m_DataViewListCtrl_Servers->AssociateModel(this->m_ServerListModel);
+    this->m_ServerListModel->DecRef();
+    this->m_DataViewListColumn_Ping = this->m_DataViewListCtrl_Servers->AppendTextColumn(wxT("Ping"), SERVERCOLUMN_PING, wxDATAVIEW_CELL_INERT, -1, static_cast<wxAlignment>(wxALIGN_LEFT), wxDATAVIEW_COL_RESIZABLE);
+    this->m_DataViewListColumn_Players = this->m_DataViewListCtrl_Servers->AppendTextColumn(wxT("Players"), SERVERCOLUMN_PLAYERS, wxDATAVIEW_CELL_INERT, -1, static_cast<wxAlignment>(wxALIGN_LEFT), wxDATAVIEW_COL_RESIZABLE);
+    this->m_DataViewListColumn_Address = this->m_DataViewListCtrl_Servers->AppendTextColumn(wxT("Address"), SERVERCOLUMN_ADDRESS, wxDATAVIEW_CELL_INERT, -1, static_cast<wxAlignment>(wxALIGN_LEFT), wxDATAVIEW_COL_RESIZABLE);
+    this->m_DataViewListColumn_ROM = this->m_DataViewListCtrl_Servers->AppendCustomTextColumn(wxT("ROM"), SERVERCOLUMN_ROM, wxDATAVIEW_CELL_INERT, -1, static_cast<wxAlignment>(wxALIGN_LEFT), wxDATAVIEW_COL_RESIZABLE);
+    this->m_DataViewListColumn_ServerName = this->m_DataViewListCtrl_Servers->AppendTextColumn(wxT("Server Name"), SERVERCOLUMN_NAME, wxDATAVIEW_CELL_INERT, -1, static_cast<wxAlignment>(wxALIGN_LEFT), wxDATAVIEW_COL_RESIZABLE);
     m_Sizer_Main->Add(this->m_DataViewListCtrl_Servers, wxGBPosition(0, 0), wxGBSpan(1, 1), wxALL|wxEXPAND, 5);
 
     // Finalize the layout
@@ -256,9 +212,11 @@ ServerBrowser::ServerBrowser(wxWindow* parent, wxWindowID id, const wxString& ti
     this->Connect(this->m_Tool_Refresh->GetId(), wxEVT_COMMAND_TOOL_CLICKED, wxCommandEventHandler(ServerBrowser::m_Tool_Refresh_OnToolClicked));
     this->m_TextCtrl_MasterServerAddress->Connect(wxEVT_COMMAND_TEXT_UPDATED, wxCommandEventHandler(ServerBrowser::m_TextCtrl_MasterServerAddress_OnText), NULL, this);
     this->m_DataViewListCtrl_Servers->Connect(wxEVT_COMMAND_DATAVIEW_ITEM_ACTIVATED, wxDataViewEventHandler(ServerBrowser::m_DataViewListCtrl_Servers_OnDataViewListCtrlItemActivated), NULL, this);
+    this->m_DataViewListCtrl_Servers->Connect(wxEVT_COMMAND_DATAVIEW_COLUMN_HEADER_CLICK, wxDataViewEventHandler(ServerBrowser::m_DataViewListCtrl_Servers_OnColumnHeaderClick), NULL, this);
     this->m_DataViewListCtrl_Servers->Connect(wxEVT_MOTION, wxMouseEventHandler(ServerBrowser::m_DataViewListCtrl_Servers_OnMotion), NULL, this);
 
-    // Connect to the master server
+    // Start the ROM hasher, then connect to the master server
+    this->StartThread_Hasher();
     this->ConnectMaster();
 }
 
@@ -270,14 +228,16 @@ ServerBrowser::ServerBrowser(wxWindow* parent, wxWindowID id, const wxString& ti
 
 ServerBrowser::~ServerBrowser()
 {
-    // Kill the server finder thread
+    // Kill the server finder and ROM hasher threads
     this->StopThread_Finder();
+    this->StopThread_Hasher();
 
     // Disconnect events
     this->Disconnect(wxEVT_CLOSE_WINDOW, wxCloseEventHandler(ServerBrowser::m_Event_OnClose));
     this->Disconnect(wxID_ANY, wxEVT_THREAD, wxThreadEventHandler(ServerBrowser::ThreadEvent));
     this->Disconnect(this->m_Tool_Refresh->GetId(), wxEVT_COMMAND_TOOL_CLICKED, wxCommandEventHandler(ServerBrowser::m_Tool_Refresh_OnToolClicked));
     this->m_DataViewListCtrl_Servers->Disconnect(wxEVT_COMMAND_DATAVIEW_ITEM_ACTIVATED, wxDataViewEventHandler(ServerBrowser::m_DataViewListCtrl_Servers_OnDataViewListCtrlItemActivated), NULL, this);
+    this->m_DataViewListCtrl_Servers->Disconnect(wxEVT_COMMAND_DATAVIEW_COLUMN_HEADER_CLICK, wxDataViewEventHandler(ServerBrowser::m_DataViewListCtrl_Servers_OnColumnHeaderClick), NULL, this);
 }
 
 
@@ -316,6 +276,43 @@ void ServerBrowser::StopThread_Finder()
 }
 
 
+/*==============================
+    ServerBrowser::StartThread_Hasher
+    Starts the ROM hasher thread
+==============================*/
+
+void ServerBrowser::StartThread_Hasher()
+{
+    if (this->m_HasherThread == NULL)
+    {
+        this->m_HasherThread = new ROMHasherThread(this);
+        if (this->m_HasherThread->Run() != wxTHREAD_NO_ERROR)
+        {
+            delete this->m_HasherThread;
+            this->m_HasherThread = NULL;
+        }
+    }
+}
+
+
+/*==============================
+    ServerBrowser::StopThread_Hasher
+    Stops the ROM hasher thread
+==============================*/
+
+void ServerBrowser::StopThread_Hasher()
+{
+    if (this->m_HasherThread != NULL)
+    {
+        this->m_HasherThread->Delete();
+        delete this->m_HasherThread;
+        this->m_HasherThread = NULL;
+    }
+    global_msgqueue_hashthread_input.Clear();
+    this->m_PendingHashes.clear();
+}
+
+
 /*==============================
     ServerBrowser::m_Event_OnClose
     Event handler for window closing
@@ -349,11 +346,14 @@ void ServerBrowser::m_Tool_Refresh_OnToolClicked(wxCommandEvent& event)
 
 void ServerBrowser::m_DataViewListCtrl_Servers_OnDataViewListCtrlItemActivated(wxDataViewEvent& event)
 {
-    wxString serveraddr = this->m_DataViewListCtrl_Servers->GetTextValue(this->m_DataViewListCtrl_Servers->GetSelectedRow(), COLUMN_ADDRESS);
-    wxString romname = get_sanitizedromname(this->m_DataViewListCtrl_Servers->GetTextValue(this->m_DataViewListCtrl_Servers->GetSelectedRow(), COLUMN_ROM));
-    wxString romhash = this->m_DataViewListCtrl_Servers->GetTextValue(this->m_DataViewListCtrl_Servers->GetSelectedRow(), COLUMN_ROMHASH);
+    ServerListEntry* server = this->m_ServerListModel->GetServer(this->m_DataViewListCtrl_Servers->GetSelection());
+    if (server == NULL)
+        return;
+    wxString serveraddr = wxString::FromUTF8(server->fulladdress.c_str());
+    wxString romname = wxString::FromUTF8(server->romname.c_str());
+    wxString romhash = wxString(server->romhash);
     wxString rompath = get_rompath(romname);
-    bool romavailable = this->m_DataViewListCtrl_Servers->GetTextValue(this->m_DataViewListCtrl_Servers->GetSelectedRow(), COLUMN_ROMONMASTER) == "1";
+    bool romavailable = server->romdownloadable;
 
     // Check the ROM exists in our ROMs folder
     if (wxFileExists(rompath))
@@ -419,51 +419,89 @@ void ServerBrowser::m_TextCtrl_MasterServerAddress_OnText(wxCommandEvent& event)
 
 void ServerBrowser::m_DataViewListCtrl_Servers_OnMotion(wxMouseEvent& event)
 {
-    int row;
+    int row = -1;
     wxDataViewItem item;
     wxDataViewColumn* col;
+    ServerListEntry* server;
     static int lastrow = -1;
 
     // Check where the mouse is colliding
     this->m_DataViewListCtrl_Servers->HitTest(this->m_DataViewListCtrl_Servers->ScreenToClient(wxGetMousePosition()), item, col);
-    row = this->m_DataViewListCtrl_Servers->ItemToRow(item);
+    server = this->m_ServerListModel->GetServer(item);
+    if (server != NULL)
+        row = this->m_ServerListModel->GetRow(item);
 
-    // If we hit a valid item in the third column (the ROMs column)
-    if (item != NULL && col->GetModelColumn() == COLUMN_ROM)
+    // If we hit a valid item in the ROMs column
+    if (server != NULL && col != NULL && col->GetModelColumn() == SERVERCOLUMN_ROM)
     {
         if (lastrow != row) // Only do this when the mouse changes row
         {
-            wxString romname = get_sanitizedromname(this->m_DataViewListCtrl_Servers->GetTextValue(row, COLUMN_ROM));
-            wxString romhash = this->m_DataViewListCtrl_Servers->GetTextValue(row, COLUMN_ROMHASH);
-            wxString rompath = get_rompath(romname);
-            bool romavailable = this->m_DataViewListCtrl_Servers->GetTextValue(row, COLUMN_ROMONMASTER) == "1";
+            wxString romhash = wxString(server->romhash);
 
             // Set the tooltip based on the state of the ROM
-            if (wxFileExists(rompath))
+            switch (server->romstatus)
             {
-                if (is_samerom(romname, romhash))
-                    this->m_DataViewListCtrl_Servers->SetToolTip("You have this ROM!\n"+romhash);
-                else
+                case ROMSTATUS_MATCHES:
+                    this->m_DataViewListCtrl_Servers->SetToolTip("You have this ROM!\n" + romhash);
+                    break;
+                case ROMSTATUS_DIFFERS:
                     this->m_DataViewListCtrl_Servers->SetToolTip("Your ROM differs from the server.\n" + romhash);
+                    break;
+                case ROMSTATUS_UNCHECKED:
+                    this->m_DataViewListCtrl_Servers->SetToolTip("Checking if your ROM matches the server.\n" + romhash);
+                    break;
+                case ROMSTATUS_UNAVAILABLE:
+                    this->m_DataViewListCtrl_Servers->SetToolTip("This ROM is not available for download.\n" + romhash);
+                    break;
+                default:
+                    this->m_DataViewListCtrl_Servers->SetToolTip("This ROM is available for download from the master server.\n" + romhash);
+                    break;
             }
-            else if (!romavailable)
-                this->m_DataViewListCtrl_Servers->SetToolTip("This ROM is not available for download.\n" + romhash);
-            else
-                this->m_DataViewListCtrl_Servers->SetToolTip("This ROM is available for download from the master server.\n" + romhash);
-            
         }
     }
     else if (lastrow != row)
         this->m_DataViewListCtrl_Servers->SetToolTip("");
 
     // Update the lastrow for next time this function is called
-    lastrow = this->m_DataViewListCtrl_Servers->ItemToRow(item);
+    lastrow = row;
 
     // Unused parameter
     (void)event;
 }
 
 
+/*==============================
+    ServerBrowser::m_DataViewListCtrl_Servers_OnColumnHeaderClick
+    Event handler for clicking on a column header, which sorts
+    the server list by that column. Clicking the same column
+    again flips the sort order.
+    @param The dataview event
+==============================*/
+
+void ServerBrowser::m_DataViewListCtrl_Servers_OnColumnHeaderClick(wxDataViewEvent& event)
+{
+    wxDataViewColumn* col = event.GetDataViewColumn();
+    ServerList* list = this->m_ServerListModel->GetList();
+    bool ascending = true;
+    int column;
+    if (col == NULL)
+        return;
+
+    // Figure out the new sort order
+    column = (int)col->GetModelColumn();
+    if (list->GetSortColumn() == column)
+        ascending = !list->IsSortAscending();
+    for (unsigned int i=0; i<this->m_DataViewListCtrl_Servers->GetColumnCount(); i++)
+        this->m_DataViewListCtrl_Servers->GetColumn(i)->UnsetAsSortKey();
+    col->SetSortOrder(ascending);
+
+    // Sort the list, keeping the selected server selected
+    this->UpdateServerList([this, column, ascending]() {
+        this->m_ServerListModel->SortServers(column, ascending);
+    });
+}
+
+
 /*==============================
     ServerBrowser::m_MenuItem_File_Connect_OnMenuSelection
     Event handler for Manual Connect menu item selection
@@ -593,7 +631,34 @@ void ServerBrowser::RequestDownload(wxString hash, wxString filepath)
 
 void ServerBrowser::ClearServers()
 {
-    this->m_DataViewListCtrl_Servers->DeleteAllItems();
+    this->m_ServerListModel->ClearServers();
+}
+
+
+/*==============================
+    ServerBrowser::UpdateServerList
+    Changes the order or size of the server list, and reselects
+    whichever server was selected beforehand
+    @param The function that changes the list
+==============================*/
+
+void ServerBrowser::UpdateServerList(std::function<void()> change)
+{
+    std::string selected = "";
+    ServerListEntry* server = this->m_ServerListModel->GetServer(this->m_DataViewListCtrl_Servers->GetSelection());
+    int row;
+    if (server != NULL)
+        selected = server->fulladdress;
+
+    // Apply the change
+    change();
+
+    // Restore the selection
+    if (selected == "")
+        return;
+    row = this->m_ServerListModel->GetList()->Find(selected);
+    if (row >= 0)
+        this->m_DataViewListCtrl_Servers->Select(this->m_ServerListModel->GetItem(row));
 }
 
 
@@ -607,31 +672,66 @@ void ServerBrowser::ThreadEvent(wxThreadEvent& event)
 {
     switch ((ThreadEventType)event.GetInt())
     {
-        case TEVENT_ADDSERVER:
+        case TEVENT_ADDSERVERS:
         {
-            wxString rompath;
-            FoundServer* server = event.GetPayload<FoundServer*>();
-            wxVector<wxVariant> data;
-            rompath = get_rompath(server->romname);
-            data.push_back(wxVariant(wxString::Format("%ld", server->ping)));
-            data.push_back(wxVariant(wxString::Format("%d/%d", server->playercount, server->maxplayers)));
-            data.push_back(wxVariant(server->fulladdress));
-            if (wxFileExists(rompath))
+            std::vector<FoundServer>* found = event.GetPayload<std::vector<FoundServer>*>();
+            std::vector<ServerListEntry> batch;
+            batch.reserve(found->size());
+            for (FoundServer& server : *found)
             {
-                if (is_samerom(server->romname, server->romhash))
-                    data.push_back(wxVariant(wxString::Format("<span color=\"#008000\">%s</span>", server->romname)));
+                ServerListEntry entry;
+                wxString rompath = get_rompath(server.romname);
+                entry.fulladdress = std::string(server.fulladdress.utf8_str());
+                entry.name = std::string(server.name.utf8_str());
+                entry.playercount = server.playercount;
+                entry.maxplayers = server.maxplayers;
+                entry.ping = server.ping.GetValue();
+                entry.romname = std::string(server.romname.utf8_str());
+                entry.romhash = server.romhash.ToStdString();
+                entry.romdownloadable = server.romdownloadable;
+
+                // Figure out how the ROM should be shown. If we don't know the hash of our copy of the ROM yet, the hasher thread will tell us
+                if (wxFileExists(rompath))
+                {
+                    std::string localhash;
+                    if (ROMCache::Lookup(rompath.ToStdString(), &localhash))
+                        entry.romstatus = (localhash == entry.romhash) ? ROMSTATUS_MATCHES : ROMSTATUS_DIFFERS;
+                    else
+                    {
+                        entry.romstatus = ROMSTATUS_UNCHECKED;
+                        this->RequestROMHash(server.romname);
+                    }
+                }
+                else if (!server.romdownloadable)
+                    entry.romstatus = ROMSTATUS_UNAVAILABLE;
                 else
-                    data.push_back(wxVariant(wxString::Format("<span color=\"#FF8000\">%s</span>", server->romname)));
+                    entry.romstatus = ROMSTATUS_DOWNLOADABLE;
+                batch.push_back(entry);
             }
-            else if (!server->romdownloadable)
-                data.push_back(wxVariant(wxString::Format("<span color=\"#800000\">%s</span>", server->romname)));
-            else
-                data.push_back(wxVariant(server->romname));
-            data.push_back(wxVariant(server->name));
-            data.push_back(wxVariant(server->romhash));
-            data.push_back(wxVariant(wxString::Format("%d", server->romdownloadable)));
-            this->m_DataViewListCtrl_Servers->AppendItem(data);
-            free(server);
+            delete found;
+
+            // Add the whole batch at once
+            this->UpdateServerList([this, &batch]() {
+                this->m_ServerListModel->AppendServers(batch);
+            });
+            break;
+        }
+        case TEVENT_UPDATEPINGS:
+        {
+            std::unordered_map<std::string, int64_t>* pings = event.GetPayload<std::unordered_map<std::string, int64_t>*>();
+            this->UpdateServerList([this, pings]() {
+                this->m_ServerListModel->UpdatePings(*pings);
+            });
+            delete pings;
+            break;
+        }
+        case TEVENT_ROMHASHED:
+        {
+            HashedROM* result = event.GetPayload<HashedROM*>();
+            this->m_PendingHashes.erase(result->romname);
+            if (result->romhash != "")
+                this->UpdateROMLabels(result->romname, result->romhash);
+            delete result;
             break;
         }
         default:
@@ -640,6 +740,46 @@ void ServerBrowser::ThreadEvent(wxThreadEvent& event)
 }
 
 
+/*==============================
+    ServerBrowser::RequestROMHash
+    Asks the hasher thread to hash a ROM in our ROMs folder,
+    unless it's already doing so
+    @param The ROM name
+==============================*/
+
+void ServerBrowser::RequestROMHash(wxString romname)
+{
+    if (this->m_HasherThread == NULL || this->m_PendingHashes.find(romname) != this->m_PendingHashes.end())
+        return;
+    this->m_PendingHashes.insert(romname);
+    global_msgqueue_hashthread_input.Post(romname);
+}
+
+
+/*==============================
+    ServerBrowser::UpdateROMLabels
+    Colors the ROM name of every server that uses a given ROM,
+    based on whether our copy of it matches theirs
+    @param The ROM name
+    @param The hash of our copy of the ROM
+==============================*/
+
+void ServerBrowser::UpdateROMLabels(wxString romname, wxString romhash)
+{
+    ServerList* list = this->m_ServerListModel->GetList();
+    std::string name = std::string(romname.utf8_str());
+    std::string hash = romhash.ToStdString();
+    for (size_t row=0; row<list->Count(); row++)
+    {
+        ServerListEntry* server = list->Get(row);
+        if (server->romname != name)
+            continue;
+        server->romstatus = (server->romhash == hash) ? ROMSTATUS_MATCHES : ROMSTATUS_DIFFERS;
+        this->m_ServerListModel->RowChanged(row);
+    }
+}
+
+
 /*==============================
     ServerBrowser::GetAddress
     Retreives the server address to connect to
@@ -664,6 +804,80 @@ int ServerBrowser::GetPort()
 }
 
 
+/*==============================
+    ServerBrowser::GetDiscoveryRate
+    Gets the max number of discovery probes to send per second
+    @return The discovery rate
+==============================*/
+
+int ServerBrowser::GetDiscoveryRate()
+{
+    return this->m_DiscoveryRate;
+}
+
+
+/*=============================================================
+                       ROM Hasher Thread
+=============================================================*/
+
+/*==============================
+    ROMHasherThread (Constructor)
+    Initializes the class
+    @param The parent window
+==============================*/
+
+ROMHasherThread::ROMHasherThread(ServerBrowser* win) : wxThread(wxTHREAD_JOINABLE)
+{
+    this->m_Window = win;
+}
+
+
+/*==============================
+    ROMHasherThread (Destructor)
+    Cleans up the class before deletion
+==============================*/
+
+ROMHasherThread::~ROMHasherThread()
+{
+    // Nothing here
+}
+
+
+/*==============================
+    ROMHasherThread::Entry
+    The entry function for the thread.
+    Hashes the ROMs the main thread asks for, so that big ROMs
+    don't freeze the server list.
+    @return The exit code
+==============================*/
+
+void* ROMHasherThread::Entry()
+{
+    wxString romname;
+    while (!TestDestroy())
+    {
+        std::string hash;
+        HashedROM* result;
+        wxThreadEvent evt = wxThreadEvent(wxEVT_THREAD, wxID_ANY);
+        if (global_msgqueue_hashthread_input.ReceiveTimeout(100, romname) != wxMSGQUEUE_NO_ERROR)
+            continue;
+
+        // Hash the ROM, remembering the result for next time
+        result = new HashedROM();
+        result->romname = romname;
+        result->romhash = "";
+        if (ROMCache::GetHash(get_rompath(romname).ToStdString(), &hash))
+            result->romhash = wxString(hash);
+
+        // Send the result to the main thread
+        evt.SetInt(TEVENT_ROMHASHED);
+        evt.SetPayload<HashedROM*>(result);
+        wxQueueEvent(this->m_Window, evt.Clone());
+    }
+    return NULL;
+}
+
+
 /*=============================================================
                      Server Finder Thread
 =============================================================*/
@@ -677,6 +891,12 @@ int ServerBrowser::GetPort()
 ServerFinderThread::ServerFinderThread(ServerBrowser* win) : wxThread(wxTHREAD_JOINABLE)
 {
     this->m_Window = win;
+    this->m_Discovery = NULL;
+    this->m_Batch = NULL;
+    this->m_PingBatch = NULL;
+    this->m_DownloadOffset = 0;
+    memset(this->m_DownloadHash, 0, sizeof(this->m_DownloadHash));
+    this->m_LastBatchTime = 0;
 }
 
 
@@ -687,7 +907,8 @@ ServerFinderThread::ServerFinderThread(ServerBrowser* win) : wxThread(wxTHREAD_J
 
 ServerFinderThread::~ServerFinderThread()
 {
-    // Nothing here
+    delete this->m_Batch;
+    delete this->m_PingBatch;
 }
 
 
@@ -699,87 +920,88 @@ ServerFinderThread::~ServerFinderThread()
 
 void* ServerFinderThread::Entry()
 {
-    std::unordered_map<wxString, std::pair<FoundServer, wxLongLong>> serversleft;
-    ASIOSocket* sock = new ASIOSocket(this->m_Window->GetAddress(), this->m_Window->GetPort());
-    UDPHandler* handler = new UDPHandler(sock, this->m_Window->GetAddress(), this->m_Window->GetPort());
-    uint8_t* buff = (uint8_t*)malloc(4096);
+    ASIOSocket* sock = new ASIOSocket(this->m_Window->GetAddress().ToStdString(), this->m_Window->GetPort());
+    UDPHandler* handler = new UDPHandler(sock, this->m_Window->GetAddress().ToStdString(), this->m_Window->GetPort());
+    uint8_t* slab = (uint8_t*)malloc(MAX_BATCHCOUNT*MAX_PACKETSIZE);
+    size_t sizes[MAX_BATCHCOUNT];
+    udp::endpoint senders[MAX_BATCHCOUNT];
     wxString filedl_path = "";
+    this->m_Discovery = new ServerDiscovery(sock, this->m_Window->GetDiscoveryRate());
 
     // Run in a loop until the main thread wants to kill us
     while (!TestDestroy() && this->m_Window != NULL)
     {
         try 
         {
-            S64Packet* pkt = NULL;
+            S64PacketPtr pkt;
+            size_t count, i = 0;
 
             // Check for packets from the master server / servers we pinged
-            sock->Read(buff, 4096);
-            while (sock->LastReadCount() > 0)
+            count = sock->ReadBatch(slab, MAX_PACKETSIZE, sizes, MAX_BATCHCOUNT, senders);
+            while (i < count)
             {
-                pkt = handler->ReadS64Packet(buff);
+                // Replies to discovery probes are handled separately from the master server's packets
+                if (!this->m_Discovery->HandleDatagram(senders[i], slab + i*MAX_PACKETSIZE, sizes[i]))
+                    pkt.reset(handler->ReadS64Packet(slab + i*MAX_PACKETSIZE, sizes[i]));
 
-                // Handle various packets that we received from a server
-                if (pkt != NULL)
+                // Handle various packets that we received from the master server
+                if (pkt.get() != NULL)
                 {
                     try
                     {
-                        if (!strncmp(pkt->GetType(), "SERVER", 6))
-                        {
-                            FoundServer server = this->ParsePacket_Server(handler->GetSocket(), pkt);
-                            serversleft[server.fulladdress] = std::make_pair(server, wxGetLocalTimeMillis());
-                        }
-                        else if (!strncmp(pkt->GetType(), "DONELISTING", 11))
+                        if (pkt->IsType("SERVER"))
+                            this->ParsePacket_Server(pkt.get());
+                        else if (pkt->IsType("DONELISTING"))
                             printf("Master server finished sending server list\n");
-                        else if (!strncmp(pkt->GetType(), "DOWNLOAD", 8))
-                            this->FileDownload(pkt, filedl_path);
-                        else if (!strncmp(pkt->GetType(), "DISCOVER", 8))
-                            this->DiscoveredServer(&serversleft, pkt);
+                        else if (pkt->IsType("DOWNLOAD"))
+                            this->FileDownload(pkt.get(), filedl_path);
                         else
                             printf("Unexpected packet type received '%s'\n", static_cast<const char*>(pkt->GetType().c_str()));
                     }
                     catch (BadPacketVersionException& e)
                     {
-                        printf("Got unsupported packet version %d\n", e.what());
+                        printf("Got unsupported packet version %d\n", e.GetVersion());
                         break;
                     }
+                    pkt.reset();
                 }
 
                 // Check for more packets
-                sock->Read(buff, 4096);
+                if (++i == count && count == MAX_BATCHCOUNT)
+                {
+                    count = sock->ReadBatch(slab, MAX_PACKETSIZE, sizes, MAX_BATCHCOUNT, senders);
+                    i = 0;
+                }
             }
             handler->ResendMissingPackets();
 
-            // Rest for a second
-            wxMilliSleep(10);
+            // Send more probes, and handle the results of the ones that were answered (or weren't)
+            this->m_Discovery->Update();
+            this->HandleDiscoveryEvents();
+
+            // Send any servers we discovered to the main thread
+            if (wxGetLocalTimeMillis() - this->m_LastBatchTime >= SERVERLIST_BATCHTIME)
+                this->SendServers();
+
+            // Wait for more packets, or until it's time to send the next probe
+            sock->WaitRead(this->m_Discovery->GetWaitTime(10));
 
             // Check for messages from the main thread
             this->HandleMainInput(handler, &filedl_path);
         }
         catch (ClientTimeoutException& e)
         {
-            wxString fulladdr = wxString::Format("%s:%d", handler->GetAddress(), handler->GetPort());
-
-            // Log error messages based on what server timed out
-            if (e.what() != fulladdr)
-            {
-                if (serversleft.find(fulladdr) != serversleft.end())
-                {
-                    std::pair<FoundServer, wxLongLong> found = serversleft[fulladdr];
-                    printf("Server %s timed out\n", static_cast<const char*>(fulladdr.c_str()));
-                    delete found.first.handler;
-                    serversleft.erase(fulladdr);
-                }
-            }
-            else
-                printf("Master server timed out\n");
+            (void)e;
+            printf("Master server timed out\n");
         }
     }
 
     // Cleanup
-    for (std::pair<wxString, std::pair<FoundServer, wxLongLong>> it : serversleft)
-        delete it.second.first.handler;
+    this->SendServers();
+    delete this->m_Discovery;
+    this->m_Discovery = NULL;
     delete handler;
-    free(buff);
+    free(slab);
     delete sock;
     return NULL;
 }
@@ -800,12 +1022,28 @@ void ServerFinderThread::HandleMainInput(UDPHandler* handler, wxString* filedl_p
         switch (usrinput->type)
         {
             case TEVENT_DOLIST:
+                this->m_Discovery->Clear();
+                this->m_Listed.clear();
                 if (handler != NULL)
                     handler->SendPacket(new S64Packet("LIST", 0, NULL, FLAG_UNRELIABLE));
                 break;
             case TEVENT_DODL:
                 if (handler != NULL)
-                    handler->SendPacket(new S64Packet("DOWNLOAD", 32, (uint8_t*)usrinput->data, FLAG_UNRELIABLE));
+                {
+                    uint8_t request[DOWNLOAD_HASHSIZE + sizeof(uint32_t)];
+                    uint32_t offset;
+                    wxString partpath = *filedl_path + DOWNLOAD_PARTEXT;
+
+                    // If a previous download of this ROM was interrupted, ask to resume it
+                    this->m_DownloadOffset = 0;
+                    if (*filedl_path != "" && wxFileExists(partpath))
+                        this->m_DownloadOffset = (uint32_t)wxFileName::GetSize(partpath).GetValue();
+                    memcpy(this->m_DownloadHash, usrinput->data, DOWNLOAD_HASHSIZE);
+                    memcpy(request, usrinput->data, DOWNLOAD_HASHSIZE);
+                    offset = swap_endian32(this->m_DownloadOffset);
+                    memcpy(request + DOWNLOAD_HASHSIZE, &offset, sizeof(uint32_t));
+                    handler->SendPacket(new S64Packet("DOWNLOAD", sizeof(request), request, FLAG_UNRELIABLE));
+                }
                 break;
             case TEVENT_CANCELDL:
                 *filedl_path = "";
@@ -824,19 +1062,19 @@ void ServerFinderThread::HandleMainInput(UDPHandler* handler, wxString* filedl_p
 
 /*==============================
     ServerFinderThread::ParsePacket_Server
-    Parse a server info packet from the master server
-    @param The socket to write the ping to
+    Parse a server info packet from the master server, and
+    queue the server to be probed
     @param The packet with the server info
 ==============================*/
 
-FoundServer ServerFinderThread::ParsePacket_Server(ASIOSocket* socket, S64Packet* pkt)
+void ServerFinderThread::ParsePacket_Server(S64Packet* pkt)
 {
     uint8_t hash[32];
     uint32_t read32;
     uint8_t* buf = pkt->GetData();
     uint32_t buffoffset = 0;
     FoundServer server;
-    wxCharBuffer serveraddr;
+    std::string fulladdress;
 
     // Read the full server address
     memcpy(&read32, buf + buffoffset, sizeof(uint32_t));
@@ -869,84 +1107,152 @@ FoundServer ServerFinderThread::ParsePacket_Server(ASIOSocket* socket, S64Packet
     buffoffset += sizeof(char);
     server.romdownloadable = hash[0];
 
-    // Create the UDP handler and send the ping packet
-    server.handler = new UDPHandler(socket, server.fulladdress);
-    serveraddr = server.fulladdress.ToUTF8();
-    server.handler->SendPacket(new S64Packet("DISCOVER", serveraddr.length(), (uint8_t*)serveraddr.data(), FLAG_UNRELIABLE));
-    
-    // Done
-    return server;
+    // Remember the server, and ask the discovery engine to ping it
+    fulladdress = std::string(server.fulladdress.utf8_str());
+    this->m_Listed[fulladdress] = server;
+    this->m_Discovery->Add(fulladdress);
+}
+
+
+/*==============================
+    ServerFinderThread::HandleDiscoveryEvents
+    Handles the results of the servers we probed
+==============================*/
+
+void ServerFinderThread::HandleDiscoveryEvents()
+{
+    std::vector<DiscoveryEvent>* events = this->m_Discovery->GetEvents();
+    for (DiscoveryEvent& evt : *events)
+    {
+        std::unordered_map<std::string, FoundServer>::iterator it = this->m_Listed.find(evt.fulladdress);
+        if (it == this->m_Listed.end())
+            continue;
+        switch (evt.type)
+        {
+            case DISCOVERYEVENT_FOUND:
+                this->DiscoveredServer(&it->second, &evt);
+                break;
+            case DISCOVERYEVENT_PINGED:
+                this->PingedServer(&it->second, &evt);
+                break;
+            case DISCOVERYEVENT_TIMEOUT:
+                printf("Server %s timed out\n", evt.fulladdress.c_str());
+                this->m_Listed.erase(it);
+                break;
+        }
+    }
+    events->clear();
 }
 
 
 /*==============================
     ServerFinderThread::DiscoveredServer
     Parse a response packet from a server we pinged
-    @param The map to place the known server in
-    @param The packet with the server info
+    @param The server that replied
+    @param The discovery event with the server's reply
 ==============================*/
 
-void ServerFinderThread::DiscoveredServer(std::unordered_map<wxString, std::pair<FoundServer, wxLongLong>>* serverlist, S64Packet* pkt)
+void ServerFinderThread::DiscoveredServer(FoundServer* server, DiscoveryEvent* evt)
 {
     uint32_t read32;
-    wxString fulladdress;
     uint32_t buffoffset = 0;
-    uint8_t* buf = pkt->GetData();
+    uint8_t* buf = evt->data.data();
+    size_t size = evt->data.size();
 
-    // Read the full server address
+    // Skip the full server address, which the server sends back to us
+    if (size < buffoffset + sizeof(uint32_t))
+        return;
+    memcpy(&read32, buf + buffoffset, sizeof(uint32_t));
+    read32 = swap_endian32(read32);
+    buffoffset += sizeof(uint32_t) + read32;
+
+    // Read the server name
+    if (size < buffoffset + sizeof(uint32_t))
+        return;
     memcpy(&read32, buf + buffoffset, sizeof(uint32_t));
     read32 = swap_endian32(read32);
     buffoffset += sizeof(uint32_t);
-    fulladdress = wxString(buf + buffoffset, (size_t)read32);
+    if (size < buffoffset + read32 + 2*sizeof(uint32_t))
+        return;
+    server->name = wxString(buf + buffoffset, (size_t)read32);
     buffoffset += read32;
 
-    // Ensure the server that pinged us back is actually in the server list
-    if (serverlist->find(fulladdress) != serverlist->end())
+    // Read if the player count and max player count
+    memcpy(&read32, buf + buffoffset, sizeof(uint32_t));
+    read32 = swap_endian32(read32);
+    buffoffset += sizeof(uint32_t);
+    server->playercount = read32;
+    memcpy(&read32, buf + buffoffset, sizeof(uint32_t));
+    read32 = swap_endian32(read32);
+    buffoffset += sizeof(uint32_t);
+    server->maxplayers = read32;
+
+    // Store the ping
+    server->ping = wxLongLong((int64_t)llround(evt->ping));
+    printf("Discovered %s in %.2fms\n", evt->fulladdress.c_str(), evt->ping);
+
+    // Add the server to the batch that gets sent to the main thread
+    if (this->m_Batch == NULL)
+        this->m_Batch = new std::vector<FoundServer>();
+    this->m_Batch->push_back(*server);
+}
+
+
+/*==============================
+    ServerFinderThread::PingedServer
+    Updates a server's ping once all its samples were taken
+    @param The server that was pinged
+    @param The discovery event with the median ping
+==============================*/
+
+void ServerFinderThread::PingedServer(FoundServer* server, DiscoveryEvent* evt)
+{
+    server->ping = wxLongLong((int64_t)llround(evt->ping));
+
+    // If the main thread doesn't know about the server yet, fix the ping in the batch instead
+    if (this->m_Batch != NULL)
+    {
+        for (FoundServer& batched : *this->m_Batch)
+        {
+            if (batched.fulladdress == server->fulladdress)
+            {
+                batched.ping = server->ping;
+                return;
+            }
+        }
+    }
+    if (this->m_PingBatch == NULL)
+        this->m_PingBatch = new std::unordered_map<std::string, int64_t>();
+    (*this->m_PingBatch)[evt->fulladdress] = server->ping.GetValue();
+}
+
+
+/*==============================
+    ServerFinderThread::SendServers
+    Sends the batch of discovered servers to the main thread.
+    Servers are sent in batches so that the server list only
+    needs to be updated a few times a second, no matter how
+    many servers reply.
+==============================*/
+
+void ServerFinderThread::SendServers()
+{
+    this->m_LastBatchTime = wxGetLocalTimeMillis();
+    if (this->m_Batch != NULL)
+    {
+        wxThreadEvent evt = wxThreadEvent(wxEVT_THREAD, wxID_ANY);
+        evt.SetInt(TEVENT_ADDSERVERS);
+        evt.SetPayload<std::vector<FoundServer>*>(this->m_Batch);
+        wxQueueEvent(this->m_Window, evt.Clone());
+        this->m_Batch = NULL;
+    }
+    if (this->m_PingBatch != NULL)
     {
-        std::pair<FoundServer, wxLongLong> found = (*serverlist)[fulladdress];
-        FoundServer* server_copy = new FoundServer();
         wxThreadEvent evt = wxThreadEvent(wxEVT_THREAD, wxID_ANY);
-        FoundServer* server = &found.first;
-
-        // Read the server name
-        memcpy(&read32, buf + buffoffset, sizeof(uint32_t));
-        read32 = swap_endian32(read32);
-        buffoffset += sizeof(uint32_t);
-        server->name = wxString(buf + buffoffset, (size_t)read32);
-        buffoffset += read32;
-
-        // Read if the player count and max player count
-        memcpy(&read32, buf + buffoffset, sizeof(uint32_t));
-        read32 = swap_endian32(read32);
-        buffoffset += sizeof(uint32_t);
-        server->playercount = read32;
-        memcpy(&read32, buf + buffoffset, sizeof(uint32_t));
-        read32 = swap_endian32(read32);
-        buffoffset += sizeof(uint32_t);
-        server->maxplayers = read32;
-
-        // Calculate the ping
-        server->ping = wxGetLocalTimeMillis() - found.second;
-        printf("Discovered %s in %lldms\n", static_cast<const char*>(fulladdress.c_str()), server->ping.GetValue());
-
-        // Copy the server data
-        server_copy->fulladdress = server->fulladdress;
-        server_copy->name = server->name;
-        server_copy->playercount = server->playercount;
-        server_copy->maxplayers = server->maxplayers;
-        server_copy->ping = server->ping;
-        server_copy->romname = server->romname;
-        server_copy->romhash = server->romhash;
-        server_copy->romdownloadable = server->romdownloadable;
-
-        // Cleanup
-        delete server->handler;
-        serverlist->erase(fulladdress);
-
-        // Send the event to the main thread
-        evt.SetInt(TEVENT_ADDSERVER);
-        evt.SetPayload<FoundServer*>(server_copy);
+        evt.SetInt(TEVENT_UPDATEPINGS);
+        evt.SetPayload<std::unordered_map<std::string, int64_t>*>(this->m_PingBatch);
         wxQueueEvent(this->m_Window, evt.Clone());
+        this->m_PingBatch = NULL;
     }
 }
 
@@ -960,24 +1266,68 @@ void ServerFinderThread::DiscoveredServer(std::unordered_map<wxString, std::pair
 
 void ServerFinderThread::FileDownload(S64Packet* pkt, wxString filepath)
 {
-    uint8_t* filedata;
-    uint32_t chunksize, filesize, fileleft, fileread;
+    uint8_t* buffer;
+    uint8_t digest[SHA256_BLOCK_SIZE];
+    uint32_t filesize, offset = 0, fileread;
+    int lastprogress = -1;
+    SHA256_CTX ctx;
+    wxString partpath = filepath + DOWNLOAD_PARTEXT;
     wxSocketClient* tcpsock;
     wxIPV4address addr;
-    if (filepath == "" || pkt->GetSize() == 0)
+    FILE* fp;
+    bool success = false;
+    if (filepath == "")
+        return;
+
+    // An empty packet means the master server can't give us the ROM
+    if (pkt->GetSize() < 2*sizeof(uint32_t))
+    {
+        printf("    Master server does not have this ROM\n");
+        this->m_Window->m_DownloadWindow->UpdateDownloadProgress(-1);
         return;
+    }
 
-    // Assign file info
+    // Assign file info. Master servers that support resuming also tell us where they're resuming from
     memcpy(&filesize, &pkt->GetData()[0], sizeof(uint32_t));
     filesize = swap_endian32(filesize);
-    fileleft = filesize;
-    filedata = (uint8_t*)malloc(filesize);
-    if (filedata == NULL)
+    if (pkt->GetSize() >= 3*sizeof(uint32_t))
+    {
+        memcpy(&offset, &pkt->GetData()[8], sizeof(uint32_t));
+        offset = swap_endian32(offset);
+    }
+    if (offset > this->m_DownloadOffset)
+        offset = 0;
+    buffer = (uint8_t*)malloc(DOWNLOAD_BUFFERSIZE);
+    if (buffer == NULL)
         return;
 
-    // Get chunk size
-    memcpy(&chunksize, &pkt->GetData()[4], sizeof(uint32_t));
-    chunksize = swap_endian32(chunksize);
+    // Open the partial file, and hash what we already have of it
+    sha256_init(&ctx);
+    fp = fopen(partpath.c_str(), (offset > 0) ? "r+b" : "wb");
+    if (fp == NULL)
+    {
+        free(buffer);
+        this->m_Window->m_DownloadWindow->UpdateDownloadProgress(-1);
+        return;
+    }
+    for (fileread = 0; fileread < offset;)
+    {
+        size_t readcount = fread(buffer, 1, std::min(offset - fileread, (uint32_t)DOWNLOAD_BUFFERSIZE), fp);
+        if (readcount == 0)
+            break;
+        sha256_update(&ctx, buffer, readcount);
+        fileread += readcount;
+    }
+    fseek(fp, fileread, SEEK_SET);
+    if (fileread != offset)
+    {
+        printf("    Partial download is shorter than expected\n");
+        fclose(fp);
+        free(buffer);
+        remove(partpath.c_str());
+        this->m_Window->m_DownloadWindow->UpdateDownloadProgress(-1);
+        return;
+    }
 
     // Connect to the TCP socket
     tcpsock = new wxSocketClient(wxSOCKET_BLOCK);
@@ -985,23 +1335,30 @@ void ServerFinderThread::FileDownload(S64Packet* pkt, wxString filepath)
     addr.Service(this->m_Window->GetPort());
     tcpsock->Connect(addr);
     printf("    Filesize %d\n", filesize);
+    if (offset > 0)
+        printf("    Resuming from byte %d\n", offset);
 
-    // Download the file chunks
-    fileread = 0;
-    while (fileread < filesize)
+    // Stream the file straight to disk
+    while (fileread < filesize && tcpsock->IsConnected())
     {
-        if (tcpsock->IsData())
+        // Wait for data to arrive, giving up every now and then to check for cancellation
+        if (tcpsock->WaitForRead(0, DOWNLOAD_CANCELCHECK))
         {
             uint32_t readcount;
-            uint32_t readsize = chunksize;
-            if (fileread + readsize < filesize)
-                readsize = filesize - fileread;
-            tcpsock->Read(filedata+fileread, readsize);
+            tcpsock->Read(buffer, std::min(filesize - fileread, (uint32_t)DOWNLOAD_BUFFERSIZE));
             readcount = tcpsock->LastReadCount();
-            if (tcpsock->LastReadCount() != 0)
+            if (readcount == 0)
+                break;
+            sha256_update(&ctx, buffer, readcount);
+            if (fwrite(buffer, 1, readcount, fp) != readcount)
+                break;
+            fileread += readcount;
+
+            // Progress only reaches 100 once the file is in place
+            if ((int)((((float)fileread)/filesize)*99) != lastprogress)
             {
-                fileread += readcount;
-                this->m_Window->m_DownloadWindow->UpdateDownloadProgress((((float)fileread)/filesize)*100);
+                lastprogress = (int)((((float)fileread)/filesize)*99);
+                this->m_Window->m_DownloadWindow->UpdateDownloadProgress(lastprogress);
             }
         }
 
@@ -1012,25 +1369,36 @@ void ServerFinderThread::FileDownload(S64Packet* pkt, wxString filepath)
             printf("    Download cancelled\n");
             break;
         }
-
-        // Rest a bit
-        wxMilliSleep(10);
     }
     tcpsock->Close();
+    tcpsock->Destroy();
+    free(buffer);
+    if (fclose(fp) != 0)
+        fileread = 0;
 
-    // Dump the ROM to a file if it finished
+    // Make sure we got what we asked for before putting the file in place
     if (fileread == filesize)
     {
-        FILE* fp = fopen(filepath.c_str(), "wb+");
-        fwrite(filedata, 1, filesize, fp);
-        fclose(fp);
-        printf("    File saved\n");
+        sha256_final(&ctx, digest);
+        if (memcmp(digest, this->m_DownloadHash, DOWNLOAD_HASHSIZE) != 0)
+        {
+            printf("    Downloaded file does not match the requested hash\n");
+            remove(partpath.c_str());
+        }
+        else if (wxRenameFile(partpath, filepath, true))
+        {
+            printf("    File saved\n");
+            ROMCache::Store(filepath.ToStdString(), stringhash_frombytes(digest, SHA256_BLOCK_SIZE));
+            success = true;
+        }
     }
+    else if (filepath != "")
+        printf("    Download interrupted, kept %d bytes to resume from\n", fileread);
 
     // Done
     printf("Download finished\n");
-    free(filedata);
-    return;
+    if (filepath != "")
+        this->m_Window->m_DownloadWindow->UpdateDownloadProgress(success ? 100 : -1);
 }
 
 
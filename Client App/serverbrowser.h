@@ -24,9 +24,13 @@ typedef struct IUnknown IUnknown;
 #include <wx/sizer.h>
 #include <wx/dialog.h>
 #include <wx/socket.h>
+#include <functional>
 #include <unordered_map>
 #include <list>
+#include <set>
+#include <vector>
 #include "customview.h"
+#include "discovery.h"
 #include "packets.h"
 #include "romdownloader.h"
 
@@ -38,6 +42,15 @@ typedef struct IUnknown IUnknown;
 #define DEFAULT_MASTERSERVER_ADDRESS "master.n64brew.dev"
 #define DEFAULT_MASTERSERVER_PORT    6464
 
+// How often (in milliseconds) discovered servers are sent to the server list
+#define SERVERLIST_BATCHTIME  100
+
+// ROM download settings
+#define DOWNLOAD_HASHSIZE    32
+#define DOWNLOAD_BUFFERSIZE  (256*1024)
+#define DOWNLOAD_CANCELCHECK 100 // How often (in milliseconds) to check if the download was cancelled
+#define DOWNLOAD_PARTEXT     ".part"
+
 
 /******************************
              Types
@@ -45,7 +58,6 @@ typedef struct IUnknown IUnknown;
 
 typedef struct
 {
-    UDPHandler* handler;
     wxString fulladdress;
     wxString name;
     int playercount;
@@ -63,6 +75,7 @@ typedef struct
 
 // Prototypes
 class ServerFinderThread;
+class ROMHasherThread;
 
 // Server browser window
 class ServerBrowser : public wxFrame
@@ -70,20 +83,22 @@ class ServerBrowser : public wxFrame
     private:
         wxString    m_MasterAddress;
         int         m_MasterPort;
+        int         m_DiscoveryRate;
         ServerFinderThread* m_FinderThread;
+        ROMHasherThread* m_HasherThread;
+        std::set<wxString> m_PendingHashes;
         wxMenuBar* m_MenuBar;
         wxMenu* m_Menu_File;
         wxToolBar* m_ToolBar;
         wxToolBarToolBase* m_Tool_Refresh;
         wxTextCtrl* m_TextCtrl_MasterServerAddress;
         CustomDataView* m_DataViewListCtrl_Servers;
+        ServerListModel* m_ServerListModel;
         wxDataViewColumn* m_DataViewListColumn_Ping;
         wxDataViewColumn* m_DataViewListColumn_Players;
         wxDataViewColumn* m_DataViewListColumn_ServerName;
         wxDataViewColumn* m_DataViewListColumn_Address;
         wxDataViewColumn* m_DataViewListColumn_ROM;
-        wxDataViewColumn* m_DataViewListColumn_Hash;
-        wxDataViewColumn* m_DataViewListColumn_FileExistsOnMaster;
 
         void m_Event_OnClose( wxCloseEvent& event );
         void m_MenuItem_File_Connect_OnMenuSelection(wxCommandEvent& event);
@@ -91,13 +106,19 @@ class ServerBrowser : public wxFrame
         void m_Tool_Refresh_OnToolClicked(wxCommandEvent& event);
         void m_TextCtrl_MasterServerAddress_OnText(wxCommandEvent& event);
         void m_DataViewListCtrl_Servers_OnDataViewListCtrlItemActivated(wxDataViewEvent& event);
+        void m_DataViewListCtrl_Servers_OnColumnHeaderClick(wxDataViewEvent& event);
         void m_DataViewListCtrl_Servers_OnMotion(wxMouseEvent& event);
 
         void StartThread_Finder();
         void StopThread_Finder();
+        void StartThread_Hasher();
+        void StopThread_Hasher();
         void ClearServers();
+        void UpdateServerList(std::function<void()> change);
         void ThreadEvent(wxThreadEvent& event);
         void RequestDownload(wxString hash, wxString filepath);
+        void RequestROMHash(wxString romname);
+        void UpdateROMLabels(wxString romname, wxString romhash);
         void ConnectMaster();
 
     protected:
@@ -109,6 +130,7 @@ class ServerBrowser : public wxFrame
         void CreateClient(wxString rom, wxString addressport);
         wxString          GetAddress();
         int               GetPort();
+        int               GetDiscoveryRate();
 };
 
 // Thread for discovering servers
@@ -116,10 +138,20 @@ class ServerFinderThread : public wxThread
 {
     private:
         ServerBrowser* m_Window;
+        ServerDiscovery* m_Discovery;
+        std::unordered_map<std::string, FoundServer> m_Listed;
+        std::vector<FoundServer>* m_Batch;
+        std::unordered_map<std::string, int64_t>* m_PingBatch;
+        wxLongLong   m_LastBatchTime;
+        uint8_t      m_DownloadHash[DOWNLOAD_HASHSIZE];
+        uint32_t     m_DownloadOffset;
         
         void         HandleMainInput(UDPHandler* handler, wxString* filedl_path);
-        FoundServer  ParsePacket_Server(ASIOSocket* socket, S64Packet* pkt);
-        void         DiscoveredServer(std::unordered_map<wxString, std::pair<FoundServer, wxLongLong>>* serverlist, S64Packet* pkt);
+        void         ParsePacket_Server(S64Packet* pkt);
+        void         HandleDiscoveryEvents();
+        void         DiscoveredServer(FoundServer* server, DiscoveryEvent* evt);
+        void         PingedServer(FoundServer* server, DiscoveryEvent* evt);
+        void         SendServers();
         void         FileDownload(S64Packet* pkt, wxString filepath);
 
     protected:
@@ -131,6 +163,21 @@ class ServerFinderThread : public wxThread
         virtual void* Entry() wxOVERRIDE;
 };
 
+// Thread for hashing ROMs in the background
+class ROMHasherThread : public wxThread
+{
+    private:
+        ServerBrowser* m_Window;
+
+    protected:
+
+    public:
+        ROMHasherThread(ServerBrowser* win);
+        ~ROMHasherThread();
+
+        virtual void* Entry() wxOVERRIDE;
+};
+
 // Window for manual server connections
 class ManualConnectWindow : public wxDialog
 {
@@ -0,0 +1,219 @@
+/***************************************************************
+                          serverlist.cpp
+
+The list of servers backing the server browser. Kept free of
+wxWidgets so the browser's view only needs to read from it.
+***************************************************************/
+
+#include <algorithm>
+#include <iterator>
+#include "serverlist.h"
+
+
+/*==============================
+    ServerList (Constructor)
+    Initializes the class
+==============================*/
+
+ServerList::ServerList()
+{
+    this->m_SortColumn = -1;
+    this->m_SortAscending = true;
+}
+
+
+/*==============================
+    ServerList (Destructor)
+    Cleans up the class before deletion
+==============================*/
+
+ServerList::~ServerList()
+{
+    // Nothing here
+}
+
+
+/*==============================
+    ServerList::Compare
+    Checks if a server goes before another using the current
+    sort column. Ties are broken by address, so that the order
+    stays the same between sorts.
+    @param  The first server
+    @param  The second server
+    @return Whether the first server goes before the second
+==============================*/
+
+bool ServerList::Compare(const ServerListEntry& a, const ServerListEntry& b) const
+{
+    int result = 0;
+    switch (this->m_SortColumn)
+    {
+        case SERVERCOLUMN_PING:
+            result = (a.ping < b.ping) ? -1 : (a.ping > b.ping);
+            break;
+        case SERVERCOLUMN_PLAYERS:
+            result = (a.playercount < b.playercount) ? -1 : (a.playercount > b.playercount);
+            if (result == 0)
+                result = (a.maxplayers < b.maxplayers) ? -1 : (a.maxplayers > b.maxplayers);
+            break;
+        case SERVERCOLUMN_ROM:
+            result = a.romname.compare(b.romname);
+            break;
+        case SERVERCOLUMN_NAME:
+            result = a.name.compare(b.name);
+            break;
+        default:
+            break;
+    }
+    if (result == 0)
+        result = a.fulladdress.compare(b.fulladdress);
+    return this->m_SortAscending ? (result < 0) : (result > 0);
+}
+
+
+/*==============================
+    ServerList::Count
+    Gets the number of servers in the list
+    @return The number of servers
+==============================*/
+
+size_t ServerList::Count() const
+{
+    return this->m_Servers.size();
+}
+
+
+/*==============================
+    ServerList::Get
+    Gets the server at a given row
+    @param  The row of the server
+    @return The server, or NULL if the row is out of range
+==============================*/
+
+ServerListEntry* ServerList::Get(size_t row)
+{
+    if (row >= this->m_Servers.size())
+        return NULL;
+    return &this->m_Servers[row];
+}
+
+
+/*==============================
+    ServerList::Find
+    Finds the row of a server
+    @param  The server's address:port
+    @return The row of the server, or -1 if it's not in the list
+==============================*/
+
+int ServerList::Find(const std::string& fulladdress) const
+{
+    for (size_t i=0; i<this->m_Servers.size(); i++)
+        if (this->m_Servers[i].fulladdress == fulladdress)
+            return (int)i;
+    return -1;
+}
+
+
+/*==============================
+    ServerList::Append
+    Adds a batch of servers to the list. If the list is sorted,
+    the batch is sorted and merged in, instead of sorting the
+    whole list again.
+    @param The servers to add, which are moved out of the vector
+==============================*/
+
+void ServerList::Append(std::vector<ServerListEntry>& batch)
+{
+    size_t oldcount = this->m_Servers.size();
+    this->m_Servers.reserve(oldcount + batch.size());
+    std::move(batch.begin(), batch.end(), std::back_inserter(this->m_Servers));
+    batch.clear();
+    if (this->m_SortColumn < 0)
+        return;
+
+    // Merge the new servers into place
+    auto compare = [this](const ServerListEntry& a, const ServerListEntry& b) {
+        return this->Compare(a, b);
+    };
+    std::stable_sort(this->m_Servers.begin() + oldcount, this->m_Servers.end(), compare);
+    std::inplace_merge(this->m_Servers.begin(), this->m_Servers.begin() + oldcount, this->m_Servers.end(), compare);
+}
+
+
+/*==============================
+    ServerList::UpdatePings
+    Changes the ping of a batch of servers. If the list is
+    sorted by ping, it is sorted again afterwards.
+    @param  The new pings, keyed by server address:port
+    @return Whether any server's ping changed
+==============================*/
+
+bool ServerList::UpdatePings(const std::unordered_map<std::string, int64_t>& pings)
+{
+    bool changed = false;
+    for (ServerListEntry& server : this->m_Servers)
+    {
+        std::unordered_map<std::string, int64_t>::const_iterator it = pings.find(server.fulladdress);
+        if (it == pings.end() || it->second == server.ping)
+            continue;
+        server.ping = it->second;
+        changed = true;
+    }
+    if (changed && this->m_SortColumn == SERVERCOLUMN_PING)
+        this->Sort(this->m_SortColumn, this->m_SortAscending);
+    return changed;
+}
+
+
+/*==============================
+    ServerList::Clear
+    Removes all the servers from the list
+==============================*/
+
+void ServerList::Clear()
+{
+    this->m_Servers.clear();
+}
+
+
+/*==============================
+    ServerList::Sort
+    Sorts the list in place
+    @param The column to sort by, or -1 to stop sorting
+    @param Whether to sort in ascending order
+==============================*/
+
+void ServerList::Sort(int column, bool ascending)
+{
+    this->m_SortColumn = column;
+    this->m_SortAscending = ascending;
+    if (column < 0)
+        return;
+    std::stable_sort(this->m_Servers.begin(), this->m_Servers.end(), [this](const ServerListEntry& a, const ServerListEntry& b) {
+        return this->Compare(a, b);
+    });
+}
+
+
+/*==============================
+    ServerList::GetSortColumn
+    Gets the column the list is sorted by
+    @return The sort column, or -1 if the list isn't sorted
+==============================*/
+
+int ServerList::GetSortColumn() const
+{
+    return this->m_SortColumn;
+}
+
+
+/*==============================
+    ServerList::IsSortAscending
+    Checks the direction the list is sorted in
+    @return Whether the list is sorted in ascending order
+==============================*/
+
+bool ServerList::IsSortAscending() const
+{
+    return this->m_SortAscending;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+
+/******************************
+             Types
+******************************/
+
+typedef enum {
+    SERVERCOLUMN_PING = 0,
+    SERVERCOLUMN_PLAYERS = 1,
+    SERVERCOLUMN_ADDRESS = 2,
+    SERVERCOLUMN_ROM = 3,
+    SERVERCOLUMN_NAME = 4,
+    SERVERCOLUMN_COUNT
+} ServerListColumn;
+
+typedef enum {
+    ROMSTATUS_UNCHECKED,     // We have the ROM, but haven't hashed it yet
+    ROMSTATUS_MATCHES,       // We have the ROM, and it matches the server's
+    ROMSTATUS_DIFFERS,       // We have the ROM, but it differs from the server's
+    ROMSTATUS_DOWNLOADABLE,  // We don't have the ROM, but the master server does
+    ROMSTATUS_UNAVAILABLE,   // Nobody has the ROM
+} ROMStatus;
+
+typedef struct {
+    std::string fulladdress;
+    std::string name;
+    int playercount;
+    int maxplayers;
+    int64_t ping;
+    std::string romname;
+    std::string romhash;
+    bool romdownloadable;
+    ROMStatus romstatus;
+} ServerListEntry;
+
+
+/*********************************
+             Classes
+*********************************/
+
+// Flat list of servers shown in the server browser.
+// New servers are added in batches, and are merged into place if the list is sorted.
+class ServerList
+{
+    private:
+        std::vector<ServerListEntry> m_Servers;
+        int  m_SortColumn;
+        bool m_SortAscending;
+
+        bool Compare(const ServerListEntry& a, const ServerListEntry& b) const;
+
+    protected:
+
+    public:
+        ServerList();
+        ~ServerList();
+        size_t Count() const;
+        ServerListEntry* Get(size_t row);
+        int  Find(const std::string& fulladdress) const;
+        void Append(std::vector<ServerListEntry>& batch);
+        bool UpdatePings(const std::unordered_map<std::string, int64_t>& pings);
+        void Clear();
+        void Sort(int column, bool ascending);
+        int  GetSortColumn() const;
+        bool IsSortAscending() const;
+};
@@ -10,6 +10,9 @@
               Algorithm specification can be found here:
                * http://csrc.nist.gov/publications/fips/fips180-2/fips180-2withchangenotice.pdf
               This implementation uses little endian byte order.
+              The block function uses the CPU's SHA instructions (x86
+              SHA-NI or ARMv8 SHA2) when they are available, which is
+              decided at runtime.
 *********************************************************************/
 
 /*************************** HEADER FILES ***************************/
@@ -17,6 +20,27 @@
 #include <memory.h>
 #include "sha256.h"
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+	#define SHA256_HAVE_SHANI 1
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#define SHA256_TARGET_SHANI
+	#else
+		#include <cpuid.h>
+		#define SHA256_TARGET_SHANI __attribute__((target("sha,sse4.1")))
+	#endif
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO))
+	#define SHA256_HAVE_ARMV8 1
+	#include <arm_neon.h>
+	#if defined(__linux__)
+		#include <sys/auxv.h>
+		#include <asm/hwcap.h>
+	#endif
+#endif
+
 /****************************** MACROS ******************************/
 #define ROTLEFT(a,b) (((a) << (b)) | ((a) >> (32-(b))))
 #define ROTRIGHT(a,b) (((a) >> (b)) | ((a) << (32-(b))))
@@ -40,8 +64,10 @@ static const uint32_t k[64] = {
 	0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
 };
 
+typedef void (*sha256_blocks_func)(uint32_t state[], const uint8_t data[], size_t blocks);
+
 /*********************** FUNCTION DEFINITIONS ***********************/
-void sha256_transform(SHA256_CTX *ctx, const uint8_t data[])
+static void sha256_transform(uint32_t state[], const uint8_t data[])
 {
 	uint32_t a, b, c, d, e, f, g, h, i, j, t1, t2, m[64];
 
@@ -50,14 +76,14 @@ void sha256_transform(SHA256_CTX *ctx, const uint8_t data[])
 	for ( ; i < 64; ++i)
 		m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
 
-	a = ctx->state[0];
-	b = ctx->state[1];
-	c = ctx->state[2];
-	d = ctx->state[3];
-	e = ctx->state[4];
-	f = ctx->state[5];
-	g = ctx->state[6];
-	h = ctx->state[7];
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+	f = state[5];
+	g = state[6];
+	h = state[7];
 
 	for (i = 0; i < 64; ++i) {
 		t1 = h + EP1(e) + CH(e,f,g) + k[i] + m[i];
@@ -72,14 +98,187 @@ void sha256_transform(SHA256_CTX *ctx, const uint8_t data[])
 		a = t1 + t2;
 	}
 
-	ctx->state[0] += a;
-	ctx->state[1] += b;
-	ctx->state[2] += c;
-	ctx->state[3] += d;
-	ctx->state[4] += e;
-	ctx->state[5] += f;
-	ctx->state[6] += g;
-	ctx->state[7] += h;
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+static void sha256_blocks_generic(uint32_t state[], const uint8_t data[], size_t blocks)
+{
+	for ( ; blocks > 0; --blocks, data += 64)
+		sha256_transform(state, data);
+}
+
+#ifdef SHA256_HAVE_SHANI
+// Four rounds at a time with the SHA-NI instructions. The message schedule for the
+// rounds 16 ahead is computed in place, so msg[] always holds the next 16 words.
+SHA256_TARGET_SHANI static void sha256_blocks_shani(uint32_t state[], const uint8_t data[], size_t blocks)
+{
+	const __m128i shuf = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i state0, state1, abef, cdgh, tmp, wk, msg[4];
+	int i;
+
+	// Rearrange the state into the ABEF/CDGH layout the instructions use
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+	for ( ; blocks > 0; --blocks, data += 64) {
+		abef = state0;
+		cdgh = state1;
+		for (i = 0; i < 4; ++i)
+			msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + i * 16)), shuf);
+
+		for (i = 0; i < 16; ++i) {
+			wk = _mm_add_epi32(msg[i & 3], _mm_loadu_si128((const __m128i *)&k[i * 4]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+			if (i < 12) {
+				tmp = _mm_add_epi32(_mm_sha256msg1_epu32(msg[i & 3], msg[(i + 1) & 3]), _mm_alignr_epi8(msg[(i + 3) & 3], msg[(i + 2) & 3], 4));
+				msg[i & 3] = _mm_sha256msg2_epu32(tmp, msg[(i + 3) & 3]);
+			}
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(wk, 0x0E));
+		}
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+	}
+
+	// Put the state back in order
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	_mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+	_mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+static int sha256_supported_shani(void)
+{
+	unsigned int regs[4] = {0, 0, 0, 0};
+	int sse41, sha;
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return 0;
+	__cpuid(info, 1);
+	regs[2] = (unsigned int)info[2];
+	sse41 = (regs[2] >> 19) & 1;
+	__cpuidex(info, 7, 0);
+	regs[1] = (unsigned int)info[1];
+	sha = (regs[1] >> 29) & 1;
+#else
+	if (__get_cpuid_max(0, NULL) < 7)
+		return 0;
+	__cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+	sse41 = (regs[2] >> 19) & 1;
+	__cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+	sha = (regs[1] >> 29) & 1;
+#endif
+	return sse41 && sha;
+}
+#endif
+
+#ifdef SHA256_HAVE_ARMV8
+// Four rounds at a time with the ARMv8 SHA2 instructions
+static void sha256_blocks_armv8(uint32_t state[], const uint8_t data[], size_t blocks)
+{
+	uint32x4_t state0, state1, abcd, efgh, tmp, wk, msg[4];
+	int i;
+
+	state0 = vld1q_u32(&state[0]);
+	state1 = vld1q_u32(&state[4]);
+
+	for ( ; blocks > 0; --blocks, data += 64) {
+		abcd = state0;
+		efgh = state1;
+		for (i = 0; i < 4; ++i)
+			msg[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+
+		for (i = 0; i < 16; ++i) {
+			wk = vaddq_u32(msg[i & 3], vld1q_u32(&k[i * 4]));
+			if (i < 12)
+				msg[i & 3] = vsha256su1q_u32(vsha256su0q_u32(msg[i & 3], msg[(i + 1) & 3]), msg[(i + 2) & 3], msg[(i + 3) & 3]);
+			tmp = state0;
+			state0 = vsha256hq_u32(state0, state1, wk);
+			state1 = vsha256h2q_u32(state1, tmp, wk);
+		}
+
+		state0 = vaddq_u32(state0, abcd);
+		state1 = vaddq_u32(state1, efgh);
+	}
+
+	vst1q_u32(&state[0], state0);
+	vst1q_u32(&state[4], state1);
+}
+
+static int sha256_supported_armv8(void)
+{
+#if defined(__linux__)
+	return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#else
+	return 1; // The compiler was told the CPU has them
+#endif
+}
+#endif
+
+static sha256_blocks_func sha256_select(SHA256Kernel kernel)
+{
+	switch (kernel) {
+#ifdef SHA256_HAVE_SHANI
+		case SHA256_KERNEL_SHANI:
+			return sha256_supported_shani() ? sha256_blocks_shani : NULL;
+#endif
+#ifdef SHA256_HAVE_ARMV8
+		case SHA256_KERNEL_ARMV8:
+			return sha256_supported_armv8() ? sha256_blocks_armv8 : NULL;
+#endif
+		case SHA256_KERNEL_GENERIC:
+			return sha256_blocks_generic;
+		default:
+			return NULL;
+	}
+}
+
+static SHA256Kernel sha256_best(void)
+{
+	if (sha256_select(SHA256_KERNEL_SHANI) != NULL)
+		return SHA256_KERNEL_SHANI;
+	if (sha256_select(SHA256_KERNEL_ARMV8) != NULL)
+		return SHA256_KERNEL_ARMV8;
+	return SHA256_KERNEL_GENERIC;
+}
+
+static SHA256Kernel sha256_kernel = sha256_best();
+static sha256_blocks_func sha256_blocks = sha256_select(sha256_kernel);
+
+SHA256Kernel sha256_getkernel(void)
+{
+	return sha256_kernel;
+}
+
+int sha256_setkernel(SHA256Kernel kernel)
+{
+	sha256_blocks_func func = sha256_select(kernel);
+	if (func == NULL)
+		return 0;
+	sha256_kernel = kernel;
+	sha256_blocks = func;
+	return 1;
+}
+
+const char *sha256_kernelname(SHA256Kernel kernel)
+{
+	switch (kernel) {
+		case SHA256_KERNEL_GENERIC: return "generic";
+		case SHA256_KERNEL_SHANI:   return "sha-ni";
+		case SHA256_KERNEL_ARMV8:   return "armv8";
+		default:                    return "unknown";
+	}
 }
 
 void sha256_init(SHA256_CTX *ctx)
@@ -98,17 +297,36 @@ void sha256_init(SHA256_CTX *ctx)
 
 void sha256_update(SHA256_CTX *ctx, const uint8_t data[], size_t len)
 {
-	uint32_t i;
+	size_t fill, blocks;
 
-	for (i = 0; i < len; ++i) {
-		ctx->data[ctx->datalen] = data[i];
-		ctx->datalen++;
-		if (ctx->datalen == 64) {
-			sha256_transform(ctx, ctx->data);
-			ctx->bitlen += 512;
-			ctx->datalen = 0;
-		}
+	// Top up a partially filled block first
+	if (ctx->datalen > 0) {
+		fill = 64 - ctx->datalen;
+		if (fill > len)
+			fill = len;
+		memcpy(ctx->data + ctx->datalen, data, fill);
+		ctx->datalen += (uint32_t)fill;
+		data += fill;
+		len -= fill;
+		if (ctx->datalen < 64)
+			return;
+		sha256_blocks(ctx->state, ctx->data, 1);
+		ctx->bitlen += 512;
+		ctx->datalen = 0;
 	}
+
+	// Hash whole blocks straight from the input
+	blocks = len / 64;
+	if (blocks > 0) {
+		sha256_blocks(ctx->state, data, blocks);
+		ctx->bitlen += (unsigned long long)blocks * 512;
+		data += blocks * 64;
+		len -= blocks * 64;
+	}
+
+	// Keep the rest for later
+	memcpy(ctx->data, data, len);
+	ctx->datalen = (uint32_t)len;
 }
 
 void sha256_final(SHA256_CTX *ctx, uint8_t hash[])
@@ -127,7 +345,7 @@ void sha256_final(SHA256_CTX *ctx, uint8_t hash[])
 		ctx->data[i++] = 0x80;
 		while (i < 64)
 			ctx->data[i++] = 0x00;
-		sha256_transform(ctx, ctx->data);
+		sha256_blocks(ctx->state, ctx->data, 1);
 		memset(ctx->data, 0, 56);
 	}
 
@@ -141,7 +359,7 @@ void sha256_final(SHA256_CTX *ctx, uint8_t hash[])
 	ctx->data[58] = (uint8_t)(ctx->bitlen >> 40);
 	ctx->data[57] = (uint8_t)(ctx->bitlen >> 48);
 	ctx->data[56] = (uint8_t)(ctx->bitlen >> 56);
-	sha256_transform(ctx, ctx->data);
+	sha256_blocks(ctx->state, ctx->data, 1);
 
 	// Since this implementation uses little endian byte ordering and SHA uses big endian,
 	// reverse all the bytes when copying the final state to the output hash.
@@ -17,6 +17,12 @@
 #define SHA256_BLOCK_SIZE 32            // SHA256 outputs a 32 byte digest
 
 /**************************** DATA TYPES ****************************/
+typedef enum {
+	SHA256_KERNEL_GENERIC = 0,  // Portable C
+	SHA256_KERNEL_SHANI   = 1,  // x86 SHA extensions
+	SHA256_KERNEL_ARMV8   = 2,  // ARMv8 SHA2 instructions
+} SHA256Kernel;
+
 //typedef unsigned char BYTE;             // 8-bit byte
 //typedef unsigned int  WORD;             // 32-bit word, change to "long" for 16-bit machines
 
@@ -32,4 +38,9 @@ void sha256_init(SHA256_CTX *ctx);
 void sha256_update(SHA256_CTX *ctx, const uint8_t data[], size_t len);
 void sha256_final(SHA256_CTX *ctx, uint8_t hash[]);
 
+// The fastest kernel the CPU supports is picked at startup
+SHA256Kernel sha256_getkernel(void);
+int sha256_setkernel(SHA256Kernel kernel);
+const char *sha256_kernelname(SHA256Kernel kernel);
+
 #endif   // SHA256_H
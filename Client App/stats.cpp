@@ -0,0 +1,149 @@
+/***************************************************************
+                            stats.cpp
+
+Per-connection traffic counters, cheap enough to leave enabled
+all the time, which can be shown to the user or logged as JSON
+to help track down lag.
+***************************************************************/
+
+#include <stdio.h>
+#include "stats.h"
+
+
+/*=============================================================
+                       Transport Stats
+=============================================================*/
+
+/*==============================
+    TransportStats (Constructor)
+    Initializes the class
+==============================*/
+
+TransportStats::TransportStats()
+{
+    this->Reset();
+}
+
+
+/*==============================
+    TransportStats::Reset
+    Sets all the counters back to zero. Must be called by the
+    thread that updates the stats.
+==============================*/
+
+void TransportStats::Reset()
+{
+    this->m_PacketsOut.store(0, std::memory_order_relaxed);
+    this->m_BytesOut.store(0, std::memory_order_relaxed);
+    this->m_PacketsIn.store(0, std::memory_order_relaxed);
+    this->m_BytesIn.store(0, std::memory_order_relaxed);
+    this->m_Resends.store(0, std::memory_order_relaxed);
+    this->m_Duplicates.store(0, std::memory_order_relaxed);
+    this->m_Dropped.store(0, std::memory_order_relaxed);
+    this->m_Outstanding.store(0, std::memory_order_relaxed);
+    this->m_SRTT.store(0, std::memory_order_relaxed);
+    this->m_RTTVar.store(0, std::memory_order_relaxed);
+    this->m_Samples.store(0, std::memory_order_relaxed);
+    for (int i=0; i<STATS_BUCKETS; i++)
+        this->m_Latency[i].store(0, std::memory_order_relaxed);
+}
+
+
+/*==============================
+    TransportStats::AddLatency
+    Adds a sample to the latency histogram
+    @param The latency, in microseconds
+==============================*/
+
+void TransportStats::AddLatency(double microseconds)
+{
+    uint64_t value = (microseconds > 1) ? (uint64_t)microseconds : 1;
+    int bucket = 0;
+    while (value > 1 && bucket < STATS_BUCKETS-1)
+    {
+        value >>= 1;
+        bucket++;
+    }
+    Bump(this->m_Latency[bucket], 1);
+    Bump(this->m_Samples, 1);
+}
+
+
+/*==============================
+    TransportStats::Snapshot
+    Copies the current value of all the counters
+    @return The copy of the counters
+==============================*/
+
+TransportStatsSnapshot TransportStats::Snapshot() const
+{
+    TransportStatsSnapshot snapshot;
+    snapshot.packets_out = this->m_PacketsOut.load(std::memory_order_relaxed);
+    snapshot.bytes_out = this->m_BytesOut.load(std::memory_order_relaxed);
+    snapshot.packets_in = this->m_PacketsIn.load(std::memory_order_relaxed);
+    snapshot.bytes_in = this->m_BytesIn.load(std::memory_order_relaxed);
+    snapshot.resends = this->m_Resends.load(std::memory_order_relaxed);
+    snapshot.duplicates = this->m_Duplicates.load(std::memory_order_relaxed);
+    snapshot.dropped = this->m_Dropped.load(std::memory_order_relaxed);
+    snapshot.outstanding = this->m_Outstanding.load(std::memory_order_relaxed);
+    snapshot.srtt = this->m_SRTT.load(std::memory_order_relaxed);
+    snapshot.rttvar = this->m_RTTVar.load(std::memory_order_relaxed);
+    snapshot.samples = this->m_Samples.load(std::memory_order_relaxed);
+    for (int i=0; i<STATS_BUCKETS; i++)
+        snapshot.latency[i] = this->m_Latency[i].load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+
+/*==============================
+    TransportStats::Percentile
+    Estimates a percentile of the latency from the histogram
+    @param  The snapshot of the stats
+    @param  The percentile to get, from 0 to 100
+    @return The upper bound of the bucket the percentile falls
+            in, in microseconds, or 0 if there are no samples
+==============================*/
+
+double TransportStats::Percentile(const TransportStatsSnapshot* snapshot, double percentile)
+{
+    uint64_t total = 0, target;
+    if (snapshot->samples == 0)
+        return 0;
+    target = (uint64_t)(snapshot->samples*percentile/100.0);
+    for (int i=0; i<STATS_BUCKETS; i++)
+    {
+        total += snapshot->latency[i];
+        if (total > target || total == snapshot->samples)
+            return (double)(2ULL << i);
+    }
+    return (double)(2ULL << (STATS_BUCKETS-1));
+}
+
+
+/*==============================
+    TransportStats::ToJSON
+    Converts a snapshot of the stats into a JSON object
+    @param  The snapshot of the stats
+    @return The JSON object, on a single line
+==============================*/
+
+std::string TransportStats::ToJSON(const TransportStatsSnapshot* snapshot)
+{
+    char buff[512];
+    std::string json;
+    snprintf(buff, sizeof(buff), "{\"packets_out\":%llu,\"bytes_out\":%llu,\"packets_in\":%llu,\"bytes_in\":%llu,\"resends\":%llu,\"duplicates\":%llu,\"dropped\":%llu,\"outstanding\":%llu,\"srtt_ms\":%.3f,\"rttvar_ms\":%.3f,\"latency_p50_us\":%.0f,\"latency_p99_us\":%.0f,\"latency_hist\":[",
+        (unsigned long long)snapshot->packets_out, (unsigned long long)snapshot->bytes_out,
+        (unsigned long long)snapshot->packets_in, (unsigned long long)snapshot->bytes_in,
+        (unsigned long long)snapshot->resends, (unsigned long long)snapshot->duplicates,
+        (unsigned long long)snapshot->dropped, (unsigned long long)snapshot->outstanding,
+        snapshot->srtt, snapshot->rttvar,
+        TransportStats::Percentile(snapshot, 50), TransportStats::Percentile(snapshot, 99)
+    );
+    json = buff;
+    for (int i=0; i<STATS_BUCKETS; i++)
+    {
+        snprintf(buff, sizeof(buff), "%s%llu", (i > 0) ? "," : "", (unsigned long long)snapshot->latency[i]);
+        json += buff;
+    }
+    return json + "]}";
+}
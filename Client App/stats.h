@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+
+
+/******************************
+             Macros
+******************************/
+
+// How many buckets the latency histogram has. Bucket i counts samples from 2^i up to 2^(i+1) microseconds
+#define STATS_BUCKETS  24
+
+
+/******************************
+             Types
+******************************/
+
+typedef struct {
+    uint64_t packets_out;  // Packets (or USB transfers) sent
+    uint64_t bytes_out;    // Bytes sent
+    uint64_t packets_in;   // Packets (or USB transfers) received
+    uint64_t bytes_in;     // Bytes received
+    uint64_t resends;      // Reliable packets that had to be sent again
+    uint64_t duplicates;   // Received packets that were thrown away as duplicates
+    uint64_t dropped;      // Packets thrown away because a queue on the way was full
+    uint64_t outstanding;  // Reliable packets waiting for an ack
+    double   srtt;         // Smoothed round trip time, in milliseconds
+    double   rttvar;       // Round trip time variation (jitter), in milliseconds
+    uint64_t samples;      // Number of latency samples in the histogram
+    uint64_t latency[STATS_BUCKETS];
+} TransportStatsSnapshot;
+
+
+/*********************************
+             Classes
+*********************************/
+
+// Traffic counters for a connection.
+// Only one thread may update an instance, which lets the counters be bumped with
+// relaxed loads and stores instead of locked instructions. Any thread can take a
+// snapshot, although the fields in it might not all be from the exact same moment.
+class TransportStats
+{
+    private:
+        std::atomic<uint64_t> m_PacketsOut;
+        std::atomic<uint64_t> m_BytesOut;
+        std::atomic<uint64_t> m_PacketsIn;
+        std::atomic<uint64_t> m_BytesIn;
+        std::atomic<uint64_t> m_Resends;
+        std::atomic<uint64_t> m_Duplicates;
+        std::atomic<uint64_t> m_Dropped;
+        std::atomic<uint64_t> m_Outstanding;
+        std::atomic<double>   m_SRTT;
+        std::atomic<double>   m_RTTVar;
+        std::atomic<uint64_t> m_Samples;
+        std::atomic<uint64_t> m_Latency[STATS_BUCKETS];
+
+        static inline void Bump(std::atomic<uint64_t>& counter, uint64_t amount)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+
+    protected:
+
+    public:
+        TransportStats();
+        void Reset();
+        void AddLatency(double microseconds);
+        TransportStatsSnapshot Snapshot() const;
+        static double Percentile(const TransportStatsSnapshot* snapshot, double percentile);
+        static std::string ToJSON(const TransportStatsSnapshot* snapshot);
+
+        void CountOut(size_t bytes) {Bump(this->m_PacketsOut, 1); Bump(this->m_BytesOut, bytes);};
+        void CountIn(size_t bytes) {Bump(this->m_PacketsIn, 1); Bump(this->m_BytesIn, bytes);};
+        void CountResend() {Bump(this->m_Resends, 1);};
+        void CountDuplicate() {Bump(this->m_Duplicates, 1);};
+        void CountDrop() {Bump(this->m_Dropped, 1);};
+        void SetOutstanding(uint64_t count) {this->m_Outstanding.store(count, std::memory_order_relaxed);};
+        void SetRTT(double srtt, double rttvar) {this->m_SRTT.store(srtt, std::memory_order_relaxed); this->m_RTTVar.store(rttvar, std::memory_order_relaxed);};
+};
@@ -21,6 +21,7 @@ The main room where all the players and NPCs interact
 
 #define INPUTRATE        15.0f
 #define MAXPACKETSTOACK  100
+#define MAXINPUTSTOSEND  255 // The input count is sent as a byte. This many also fit in a single packet
 
 
 /*********************************
@@ -121,6 +122,14 @@ void stage_game_update(float dt)
     in->contdata = global_contdata;
     in->dt = dt;
     list_append(&global_inputstosend, in);
+    
+    // If the inputs haven't been sent in a while, forget the oldest ones so that the rest still fit in a packet
+    while (global_inputstosend.size > MAXINPUTSTOSEND)
+    {
+        InputToAck* inclean = global_inputstosend.head->data;
+        free(list_remove(&global_inputstosend, inclean));
+        free(inclean);
+    }
 
     // Predict the player's movement before the server updates our position
     if (global_prediction)
@@ -153,20 +162,28 @@ void stage_game_update(float dt)
     if (global_nextsend < curtime)
     {
         listNode* node = global_inputstosend.head;
+        size_t size = sizeof(u8) + global_inputstosend.size*(sizeof(u64) + sizeof(f32) + 2*sizeof(u8));
+        byte* out;
         
-        // Dump the input data that we buffered over previous frames
+        // Dump the input data that we buffered over previous frames. If it doesn't fit, don't send an empty packet
         netlib_start(PACKETID_CLIENTINPUT);
-            netlib_writebyte((u8)global_inputstosend.size);
-            while (node != NULL)
+            out = netlib_reserve(size);
+            if (out != NULL)
             {
-                InputToAck* insend = (InputToAck*)node->data;
-                netlib_writeqword((u64)insend->time);
-                netlib_writefloat((f32)insend->dt);
-                netlib_writebyte((u8)insend->contdata.stick_x);
-                netlib_writebyte((u8)insend->contdata.stick_y);
-                node = node->next;
+                out = netlib_storebyte(out, (u8)global_inputstosend.size);
+                while (node != NULL)
+                {
+                    InputToAck* insend = (InputToAck*)node->data;
+                    out = netlib_storeqword(out, (u64)insend->time);
+                    out = netlib_storefloat(out, (f32)insend->dt);
+                    out = netlib_storebyte(out, (u8)insend->contdata.stick_x);
+                    out = netlib_storebyte(out, (u8)insend->contdata.stick_y);
+                    node = node->next;
+                }
+                netlib_commit(size);
             }
-        netlib_sendtoserver();
+        if (out != NULL)
+            netlib_sendtoserver();
         global_nextsend = curtime + OS_USEC_TO_CYCLES((u64)(1000000.0f*(1.0f/INPUTRATE)));
         
         // If we want to reconcile, add the buffered inputs to the reconcile list
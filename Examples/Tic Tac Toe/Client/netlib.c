@@ -13,8 +13,20 @@
 // The size of the NetLib packet header (AKA the minimum size of a packet)
 #define PACKET_HEADERSIZE   18
 
-// The datatype to use for UNFLoader
-#define DATATYPE_NETPACKET  0x27
+// The datatypes to use for UNFLoader
+#define DATATYPE_NETPACKET        0x27
+#define DATATYPE_NETPACKETBUNDLE  0x28
+
+
+/*********************************
+              Structs
+*********************************/
+
+// A packet waiting in the outgoing queue
+typedef struct {
+    u32 offset;
+    u32 size;
+} OutgoingPacket;
     
     
 /*********************************
@@ -27,14 +39,33 @@ static u32 global_timeouttime;
 // Write buffers
 static size_t global_writecursize;
 static byte   global_writebuffer[MAX_PACKETSIZE];
+static size_t global_writereserved;
+static byte   global_blockbuffer[MAX_PACKETSIZE]; // Keeps the packet being sent safe while OVERFLOW_BLOCK polls
+
+// Read buffer. Each received packet's data is copied here in one go, so that reading
+// it doesn't need a trip through the USB library for every value
+static byte global_readbuffer[MAX_PACKETSIZE] __attribute__((aligned(8)));
+byte* netlib_readcursor = global_readbuffer;
+byte* netlib_readend = global_readbuffer;
+
+// Outgoing packet queue. Packets are stored back to back in the buffer, wrapping
+// around to the start when the next one doesn't fit at the end, so that each one
+// can be handed to the USB library in a single write
+static byte global_outbuffer[OUTGOING_BUFFERSIZE] __attribute__((aligned(8)));
+static OutgoingPacket global_outpackets[MAX_OUTGOINGPACKETS];
+static u32 global_outfirst;
+static u32 global_outcount;
+static u32 global_outbytes;
+static u32 global_outdropped;
+static OverflowPolicy global_outpolicy;
 
 // Client info
 static ClientNumber global_clnumber;
 
 // Library state
 static u64 global_lastpkt;
-static u8  global_sendafterpoll;
 static u8  global_disconnected;
+static u8  global_polling; // Whether packet callbacks are being called, so that polls made from inside them do nothing
 
 // Callback functions
 static void (*global_funcptr_disconnect)();
@@ -50,12 +81,14 @@ static void (*global_funcptrs[MAX_UNIQUEPACKETS])(size_t) = {0};
 /*==============================
     netlib_initialize
     Initializes the NetLib library.
-    Also initializes the USB library internally
+    Also initializes the USB library internally, and lets
+    the client app know we can receive packet bundles
 ==============================*/
 
 void netlib_initialize()
 {
     int i;
+    byte bundlesize[4];
     usb_initialize();
     global_writebuffer[0] = 'N';
     global_writebuffer[1] = 'L';
@@ -65,12 +98,21 @@ void netlib_initialize()
         global_writebuffer[i] = 0;
     memset(global_funcptrs, sizeof(global_funcptrs), 1);
     global_clnumber = 0;
-    global_sendafterpoll = FALSE;
     global_disconnected = FALSE;
+    global_polling = FALSE;
+    global_outfirst = 0;
+    global_outcount = 0;
+    global_outbytes = 0;
+    global_outdropped = 0;
+    global_outpolicy = OUTGOING_OVERFLOW;
     global_funcptr_disconnect = NULL;
     global_funcptr_reconnect = NULL;
     global_lastpkt = 0;
     global_timeouttime = 0;
+    
+    // Tell the client app the largest bundle of packets it can send us in one go
+    netlib_storedword(bundlesize, DEBUG_ADDRESS_SIZE);
+    usb_write(DATATYPE_NETPACKETBUNDLE, bundlesize, sizeof(bundlesize));
 }
 
 
@@ -123,6 +165,18 @@ void netlib_callback_reconnect(void (*callback)())
 {
     global_funcptr_reconnect = callback;
 }
+
+/*==============================
+    netlib_setoverflow
+    Sets what happens to packets that are sent while the
+    outgoing queue is full
+    @param The overflow policy to use
+==============================*/
+
+void netlib_setoverflow(OverflowPolicy policy)
+{
+    global_outpolicy = policy;
+}
     
     
 /*********************************
@@ -133,6 +187,7 @@ void netlib_callback_reconnect(void (*callback)())
     netlib_start
     Begins a new net packet. If another net packet is already
     started and hasn't been sent yet, it will be discarded.
+    Packets which were already sent stay in the outgoing queue.
     @param The type of the packet
 ==============================*/
 
@@ -141,6 +196,7 @@ void netlib_start(NetPacket type)
     global_writebuffer[4] = (byte)type;
     global_writebuffer[5] = (byte)0; // Flags
     global_writecursize = PACKET_HEADERSIZE;
+    global_writereserved = 0;
 }
 
 
@@ -255,8 +311,8 @@ void netlib_writefloat(float data)
         }
     #endif
     
-    // N64 is also big endian, so data already respects Network Byte Order :D
-    memcpy(&global_writebuffer[global_writecursize], &data, sizeof(float));
+    // Stored a byte at a time so that host builds on little endian PCs also respect Network Byte Order
+    netlib_storefloat(&global_writebuffer[global_writecursize], data);
     global_writecursize += sizeof(float);
 }
 
@@ -277,8 +333,8 @@ void netlib_writedouble(double data)
         }
     #endif
     
-    // N64 is also big endian, so data already respects Network Byte Order :D
-    memcpy(&global_writebuffer[global_writecursize], &data, sizeof(double));
+    // Stored a byte at a time so that host builds on little endian PCs also respect Network Byte Order
+    netlib_storedouble(&global_writebuffer[global_writecursize], data);
     global_writecursize += sizeof(double);
 }
 
@@ -306,6 +362,54 @@ void netlib_writebytes(byte* data, size_t size)
 }
 
 
+/*==============================
+    netlib_reserve
+    Reserves space at the end of the current net packet,
+    so that it can be filled in directly with the
+    netlib_store functions. Nothing is added to the packet
+    until netlib_commit is called
+    @param  The number of bytes to reserve
+    @return A pointer to the reserved space, or NULL if
+            the packet doesn't have enough room left
+==============================*/
+
+byte* netlib_reserve(size_t size)
+{
+    if (global_writecursize + size > MAX_PACKETSIZE)
+    {
+        #if SAFETYCHECKS
+            usb_write(DATATYPE_TEXT, "Warning: Reserving more data than max packet size. Discarded!\n", 63);
+        #endif
+        global_writereserved = 0;
+        return NULL;
+    }
+    global_writereserved = size;
+    return &global_writebuffer[global_writecursize];
+}
+
+
+/*==============================
+    netlib_commit
+    Adds data that was written to the reserved space to
+    the current net packet
+    @param The number of bytes that were written, which
+           can't be more than what was reserved
+==============================*/
+
+void netlib_commit(size_t size)
+{
+    #if SAFETYCHECKS
+        if (size > global_writereserved)
+        {
+            usb_write(DATATYPE_TEXT, "Warning: Committing more data than was reserved. Discarded!\n", 61);
+            return;
+        }
+    #endif
+    global_writecursize += size;
+    global_writereserved = 0;
+}
+
+
 /*==============================
     netlib_setflags
     Set the flag(s) of this packet
@@ -318,25 +422,137 @@ void netlib_setflags(PacketFlag flags)
 }
 
 /*==============================
-    netlib_broadcast
-    Sends the current net packet to all connected players
+    netlib_queuefind
+    Finds where in the outgoing buffer a packet would fit
+    @param  The size of the packet
+    @return The offset in the outgoing buffer, or -1 if 
+            there isn't enough space
 ==============================*/
 
-void netlib_broadcast()
+static int netlib_queuefind(u32 size)
+{
+    OutgoingPacket* oldest;
+    OutgoingPacket* newest;
+    u32 end;
+    if (global_outcount == 0)
+        return (size <= OUTGOING_BUFFERSIZE) ? 0 : -1;
+    if (global_outcount == MAX_OUTGOINGPACKETS)
+        return -1;
+    oldest = &global_outpackets[global_outfirst];
+    newest = &global_outpackets[(global_outfirst + global_outcount - 1) % MAX_OUTGOINGPACKETS];
+    end = newest->offset + newest->size;
+    
+    // If the queue hasn't wrapped around yet, the packet can go after the newest one or at the start of the buffer
+    if (newest->offset >= oldest->offset)
+    {
+        if (end + size <= OUTGOING_BUFFERSIZE)
+            return end;
+        return (size <= oldest->offset) ? 0 : -1;
+    }
+    
+    // Otherwise it has to fit between the newest and the oldest
+    return (end + size <= oldest->offset) ? (int)end : -1;
+}
+
+
+/*==============================
+    netlib_queuepop
+    Removes the oldest packet from the outgoing queue
+==============================*/
+
+static void netlib_queuepop()
+{
+    global_outbytes -= global_outpackets[global_outfirst].size;
+    global_outfirst = (global_outfirst + 1) % MAX_OUTGOINGPACKETS;
+    global_outcount--;
+}
+
+
+/*==============================
+    netlib_queuepush
+    Finishes the current net packet and adds it to the
+    outgoing queue, making room for it according to the
+    overflow policy, then tries to send it
+    @param The recipients of the packet
+==============================*/
+
+static void netlib_queuepush(u32 mask)
 {
-    u32 mask = 0xFFFFFFFF  & ~(1 << (global_clnumber-1));
     u16 datasize = global_writecursize - PACKET_HEADERSIZE;
+    OutgoingPacket* pkt;
+    int offset;
     
     // Write the client list and data size
-    memcpy(&global_writebuffer[12], &mask, 4);
-    memcpy(&global_writebuffer[16], &datasize, 2);
+    netlib_storedword(&global_writebuffer[12], mask);
+    netlib_storeword(&global_writebuffer[16], datasize);
+    
+    // Find space for the packet
+    offset = netlib_queuefind(global_writecursize);
+    while (offset < 0)
+    {
+        if (global_outpolicy == OVERFLOW_DROPOLDEST && global_outcount > 0)
+        {
+            netlib_queuepop();
+            global_outdropped++;
+        }
+        else if (global_outpolicy == OVERFLOW_BLOCK && global_outcount > 0 && !global_polling && usb_getcart() != CART_NONE)
+        {
+            // Packet callbacks can start packets of their own while we poll, so put ours back afterwards
+            size_t cursize = global_writecursize;
+            memcpy(global_blockbuffer, global_writebuffer, cursize);
+            netlib_poll();
+            memcpy(global_writebuffer, global_blockbuffer, cursize);
+            global_writecursize = cursize;
+        }
+        else
+        {
+            global_outdropped++;
+            return;
+        }
+        offset = netlib_queuefind(global_writecursize);
+    }
+    
+    // Copy it into the queue
+    pkt = &global_outpackets[(global_outfirst + global_outcount) % MAX_OUTGOINGPACKETS];
+    pkt->offset = offset;
+    pkt->size = global_writecursize;
+    memcpy(&global_outbuffer[offset], global_writebuffer, global_writecursize);
+    global_outcount++;
+    global_outbytes += global_writecursize;
     
     // Send the packet over the wire once it's safe to do so
-    global_sendafterpoll = TRUE;
     netlib_poll();
 }
 
 
+/*==============================
+    netlib_queueflush
+    Sends as many queued packets as the USB will take
+==============================*/
+
+static void netlib_queueflush()
+{
+    while (global_outcount > 0)
+    {
+        OutgoingPacket* pkt = &global_outpackets[global_outfirst];
+        if (usb_write(DATATYPE_NETPACKET, (void*)&global_outbuffer[pkt->offset], pkt->size) == 0)
+            break;
+        netlib_queuepop();
+    }
+}
+
+
+/*==============================
+    netlib_broadcast
+    Sends the current net packet to all connected players
+==============================*/
+
+void netlib_broadcast()
+{
+    netlib_queuepush(0xFFFFFFFF & ~(1 << (global_clnumber-1)));
+}
+
+
 /*==============================
     netlib_send
     Sends the current net packet to a single player
@@ -345,16 +561,7 @@ void netlib_broadcast()
 
 void netlib_send(ClientNumber client)
 {
-    u32 mask = 1 << client;
-    u16 datasize = global_writecursize - PACKET_HEADERSIZE;
-    
-    // Write the client list and data size
-    memcpy(&global_writebuffer[12], &mask, 4);
-    memcpy(&global_writebuffer[16], &datasize, 2);
-    
-    // Send the packet over the wire once it's safe to do so
-    global_sendafterpoll = TRUE;
-    netlib_poll();
+    netlib_queuepush(1 << client);
 }
 
 
@@ -365,16 +572,44 @@ void netlib_send(ClientNumber client)
 
 void netlib_sendtoserver()
 {
-    u32 mask = 0; // Zero is a server send
-    u16 datasize = global_writecursize - PACKET_HEADERSIZE;
-    
-    // Write the client list and data size
-    memcpy(&global_writebuffer[12], &mask, 4);
-    memcpy(&global_writebuffer[16], &datasize, 2);
-    
-    // Send the packet over the wire once it's safe to do so
-    global_sendafterpoll = TRUE;
-    netlib_poll();
+    netlib_queuepush(0); // Zero is a server send
+}
+
+
+/*==============================
+    netlib_outgoing_count
+    Gets the number of packets waiting to be sent over USB
+    @return The number of queued packets
+==============================*/
+
+uint32_t netlib_outgoing_count()
+{
+    return global_outcount;
+}
+
+
+/*==============================
+    netlib_outgoing_bytes
+    Gets the number of bytes waiting to be sent over USB
+    @return The size of all the queued packets
+==============================*/
+
+uint32_t netlib_outgoing_bytes()
+{
+    return global_outbytes;
+}
+
+
+/*==============================
+    netlib_outgoing_dropped
+    Gets the number of packets that were thrown away
+    because the outgoing queue was full
+    @return The number of dropped packets
+==============================*/
+
+uint32_t netlib_outgoing_dropped()
+{
+    return global_outdropped;
 }
    
     
@@ -404,191 +639,279 @@ void netlib_register(NetPacket type, void (*callback)(size_t))
 
 
 /*==============================
-    netlib_poll
-    Polls the USB for NetLib packets.
+    netlib_handlepacket
+    Reads a NetLib packet from USB, and calls the function
+    registered to handle it
+    @param  The current time
+    @return Whether the packet was handled
 ==============================*/
 
-void netlib_poll()
+static int netlib_handlepacket(u64 curtime)
 {
-    unsigned int header;
-    u64 curtime;
-    #ifndef LIBDRAGON
-        curtime = osGetTime();
-    #else
-        curtime = timer_ticks();
-    #endif
+    byte header[PACKET_HEADERSIZE];
+    NetPacket type;
+    uint16_t size;
     
-    // Check the USB did not time out from being disconnected
-    // If it did (or reconnected), then execute the callback functions
-    if (!global_disconnected && ((global_lastpkt+global_timeouttime) < curtime || usb_timedout() || usb_getcart == CART_NONE))
-    {
-        global_disconnected = TRUE;
-        if (global_funcptr_disconnect != NULL)
-            global_funcptr_disconnect();
-    }
-    else if (global_disconnected && (global_lastpkt+global_timeouttime) > curtime && usb_getcart != CART_NONE)
-    {
-        global_disconnected = FALSE;
-        if (global_funcptr_reconnect != NULL)
-            global_funcptr_reconnect();
-    }
+    // Read the header, and get the packet type and data size. The flags, sequence data, and recipients list aren't important
+    usb_read(header, PACKET_HEADERSIZE);
+    type = header[4];
+    size = ((uint16_t)header[16] << 8) | header[17];
     
-    // Read all incoming net packets first
-    header = USBHEADER_GETTYPE(usb_poll());
-    while (header != 0)
-    {
-        if (header == DATATYPE_NETPACKET)
+    // Skip packets we can't handle. The header layout doesn't change between versions, so the rest of a bundle is still readable
+    // The USB can't be written to until the transfer is fully read, so the warning is only sent if this was the last packet in it
+    #if SAFETYCHECKS
+        if (header[3] > NETLIB_VERSION)
         {
-            uint8_t version, flags;
-            NetPacket type;
-            uint32_t recipients;
-            uint16_t size;
-            
-            // Read the version packet
-            #if SAFETYCHECKS
-                usb_skip(3);
-                usb_read(&version, 1);
-                if (version > NETLIB_VERSION)
-                {
-                    usb_purge();
-                    usb_write(DATATYPE_TEXT, "Warning: Unsupported packet version. Discarding!\n", 50);
-                    return;
-                }
-            #else
-                usb_skip(4);
-            #endif
-            
-            // Get the packet type and flags
-            usb_read(&type, 1);
-            usb_read(&flags, 1);
-            
-            // Skip the sequence data as it's not important
-            usb_skip(6);
-            
-            // Get the recipients list and the data size
-            usb_read(&recipients, 4);
-            usb_read(&size, 2);
-                    
-            // Call the relevant packet handling function
-            #if SAFETYCHECKS
-                if (global_funcptrs[type] == NULL)
-                {
-                    usb_purge();
-                    usb_write(DATATYPE_TEXT, "Warning: Tried calling unregistered function!\n", 47);
-                    return;
-                }
-            #endif
-            global_funcptrs[type](size);
-            
-            // Refresh the packet time
-            global_lastpkt = curtime;
+            usb_skip(size);
+            if (usb_getdataleft() == 0)
+                usb_write(DATATYPE_TEXT, "Warning: Unsupported packet version. Discarding!\n", 50);
+            return FALSE;
         }
-        
-        // Poll again
-        usb_purge();
-        header = USBHEADER_GETTYPE(usb_poll());
-    }
+        if (global_funcptrs[type] == NULL)
+        {
+            usb_skip(size);
+            if (usb_getdataleft() == 0)
+                usb_write(DATATYPE_TEXT, "Warning: Tried calling unregistered function!\n", 47);
+            return FALSE;
+        }
+    #endif
     
-    // If we queued up a message during polling, send it now
-    if (global_sendafterpoll)
+    // The size comes from the wire, so make sure the data fits in the read buffer, skipping it if it doesn't
+    if (size > MAX_PACKETSIZE)
     {
-        if (usb_write(DATATYPE_NETPACKET, (void*)global_writebuffer, global_writecursize) != 0)
-            global_sendafterpoll = FALSE;
+        usb_skip(size);
+        return FALSE;
     }
+    
+    // Copy the data to RAM and call the relevant packet handling function
+    usb_read(global_readbuffer, size);
+    netlib_readcursor = global_readbuffer;
+    netlib_readend = global_readbuffer + size;
+    global_funcptrs[type](size);
+    
+    // Refresh the packet time
+    global_lastpkt = curtime;
+    return TRUE;
 }
 
 
 /*==============================
-    netlib_readbyte
-    Reads a byte from the received net packet
-    @param A pointer to the byte to read into
+    netlib_gettime
+    Gets the current time, in CPU cycles (Libultra) or
+    timer ticks (Libdragon)
+    @return The current time
 ==============================*/
 
-void netlib_readbyte(uint8_t* output)
+static u64 netlib_gettime()
 {
-    usb_read(output, sizeof(uint8_t));
+    #ifndef LIBDRAGON
+        return osGetTime();
+    #else
+        return timer_ticks();
+    #endif
 }
 
 
 /*==============================
-    netlib_readword
-    Reads a word from the received net packet
-    @param A pointer to the word to read into
+    netlib_outofbudget
+    Checks whether a netlib_poll_budget call used up its
+    budget
+    @param  The number of packets handled so far
+    @param  The max number of packets, or zero for no limit
+    @param  The time the poll started
+    @param  The max time to spend, or zero for no limit
+    @return Whether the budget was used up
 ==============================*/
 
-void netlib_readword(uint16_t* output)
+static int netlib_outofbudget(u32 handled, u32 max_packets, u64 starttime, u64 max_cycles)
 {
-    usb_read(output, sizeof(uint16_t));
+    if (max_packets != 0 && handled >= max_packets)
+        return TRUE;
+    return (max_cycles != 0 && netlib_gettime() - starttime >= max_cycles);
 }
 
 
 /*==============================
-    netlib_readdword
-    Reads a double word from the received net packet
-    @param A pointer to the double word to read into
+    netlib_countpending
+    Counts the packets left in the USB transfer we're
+    currently reading, without consuming them
+    @param  The number of bytes left in the transfer
+    @return The number of packets left
 ==============================*/
 
-void netlib_readdword(uint32_t* output)
+static u32 netlib_countpending(int left)
 {
-    usb_read(output, sizeof(uint32_t));
+    byte header[PACKET_HEADERSIZE];
+    u32 count = 0;
+    int walked = 0;
+    while (left - walked >= PACKET_HEADERSIZE)
+    {
+        int size;
+        usb_read(header, PACKET_HEADERSIZE);
+        size = ((int)header[16] << 8) | header[17];
+        walked += PACKET_HEADERSIZE;
+        count++;
+        if (left - walked < size)
+            break;
+        usb_skip(size);
+        walked += size;
+    }
+    usb_rewind(walked);
+    return count;
 }
 
 
 /*==============================
-    netlib_readqword
-    Reads a quad word from the received net packet
-    @param A pointer to the quad word to read into
+    netlib_poll
+    Polls the USB for NetLib packets, then sends as many
+    queued packets as the USB will take
 ==============================*/
 
-void netlib_readqword(uint64_t* output)
+void netlib_poll()
 {
-    usb_read(output, sizeof(uint64_t));
+    netlib_poll_budget(0, 0);
 }
 
+
 /*==============================
-    netlib_readfloat
-    Reads a float from the received net packet
-    @param A pointer to the float to read into
+    netlib_poll_budget
+    Polls the USB for NetLib packets, like netlib_poll, but
+    stops once a budget is used up. The packets that weren't
+    handled are left in the USB buffer for the next poll.
+    Queued packets are sent before reading, and after each
+    USB transfer is read, since the USB can't be written
+    to in the middle of a read
+    @param  The max number of packets to handle, or zero for
+            no limit
+    @param  The max amount of time to spend handling packets,
+            in CPU cycles (Libultra) or timer ticks 
+            (Libdragon), or zero for no limit. This is only
+            checked between packets
+    @return The number of packets left in the USB transfer
+            being read, or zero if everything was handled
 ==============================*/
 
-void netlib_readfloat(float* output)
+uint32_t netlib_poll_budget(uint32_t max_packets, uint64_t max_cycles)
 {
-    usb_read(output, sizeof(float));
-}
+    unsigned int header;
+    u32 handled = 0;
+    u32 pending = 0;
+    u64 curtime, starttime;
     
+    // A packet callback is sending a packet, which polls. The packet stays in the outgoing queue, to be sent by the poll that called the callback
+    if (global_polling)
+        return 0;
+    curtime = netlib_gettime();
+    starttime = curtime;
     
-/*==============================
-    netlib_readdouble
-    Reads a double from the received net packet
-    @param A pointer to the double to read into
-==============================*/
-
-void netlib_readdouble(double* output)
-{
-    usb_read(output, sizeof(double));
+    // Check the USB did not time out from being disconnected
+    // If it did (or reconnected), then execute the callback functions
+    if (!global_disconnected && ((global_lastpkt+global_timeouttime) < curtime || usb_timedout() || usb_getcart() == CART_NONE))
+    {
+        global_disconnected = TRUE;
+        if (global_funcptr_disconnect != NULL)
+            global_funcptr_disconnect();
+    }
+    else if (global_disconnected && (global_lastpkt+global_timeouttime) > curtime && usb_getcart() != CART_NONE)
+    {
+        global_disconnected = FALSE;
+        if (global_funcptr_reconnect != NULL)
+            global_funcptr_reconnect();
+    }
+    
+    // Send what we can before reading, since the USB can't be written to while a read is unfinished
+    netlib_queueflush();
+    
+    // Read the incoming net packets
+    // If we stopped halfway through a bundle last time, the USB library gives us back what's left of it
+    global_polling = TRUE;
+    header = usb_poll();
+    while (USBHEADER_GETTYPE(header) != 0)
+    {
+        if (USBHEADER_GETTYPE(header) == DATATYPE_NETPACKET)
+        {
+            if (netlib_handlepacket(curtime))
+                handled++;
+        }
+        else if (USBHEADER_GETTYPE(header) == DATATYPE_NETPACKETBUNDLE)
+        {
+            // Handle every packet in the bundle. Since each packet is read from USB whole, we're always at the start of the next one
+            while (usb_getdataleft() >= PACKET_HEADERSIZE)
+            {
+                if (netlib_handlepacket(curtime))
+                    handled++;
+                
+                // Stop here if we're out of budget, leaving the rest of the bundle for next time
+                if (usb_getdataleft() >= PACKET_HEADERSIZE && netlib_outofbudget(handled, max_packets, starttime, max_cycles))
+                {
+                    pending = netlib_countpending(usb_getdataleft());
+                    break;
+                }
+            }
+            if (pending > 0)
+                break;
+        }
+        
+        // Now that the transfer was read, send what the callbacks queued up, then poll again unless we're out of budget
+        // The peek keeps the USB in the middle of a read, which is why the queue is sent first
+        usb_purge();
+        netlib_queueflush();
+        if (netlib_outofbudget(handled, max_packets, starttime, max_cycles))
+        {
+            header = usb_poll();
+            if (USBHEADER_GETTYPE(header) == DATATYPE_NETPACKET)
+                pending = 1;
+            else if (USBHEADER_GETTYPE(header) == DATATYPE_NETPACKETBUNDLE)
+                pending = netlib_countpending(USBHEADER_GETSIZE(header));
+            break;
+        }
+        header = usb_poll();
+    }
+    global_polling = FALSE;
+    return pending;
 }
 
 
 /*==============================
-    netlib_readbytes
-    Reads a set of bytes from the received net packet
-    @param A pointer to the buffer to read into
-    @param The number of bytes to read into this buffer
+    netlib_readstruct
+    Reads a set of values from the received net packet
+    into a struct, in one go
+    @param A pointer to the struct to read into
+    @param The struct's layout, one character per member:
+           'b' byte, 'w' word, 'd' double word, 'q' quad
+           word, 'f' float, and 'D' double. Members are
+           expected at their natural alignment
 ==============================*/
 
-void netlib_readbytes(byte* output, size_t size)
+void netlib_readstruct(void* output, const char* layout)
 {
-    usb_read(output, size);
+    byte* out = (byte*)output;
+    size_t offset = 0;
+    while (*layout != '\0')
+    {
+        switch (*layout++)
+        {
+            case 'b':
+                netlib_readbyte((uint8_t*)(out + offset));
+                offset += sizeof(uint8_t);
+                break;
+            case 'w':
+                offset = (offset + sizeof(uint16_t) - 1) & ~(sizeof(uint16_t) - 1);
+                netlib_readword((uint16_t*)(out + offset));
+                offset += sizeof(uint16_t);
+                break;
+            case 'd':
+            case 'f': // Floats have the same byte order as double words, so they can be read the same way
+                offset = (offset + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+                netlib_readdword((uint32_t*)(out + offset));
+                offset += sizeof(uint32_t);
+                break;
+            case 'q':
+            case 'D':
+                offset = (offset + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+                netlib_readqword((uint64_t*)(out + offset));
+                offset += sizeof(uint64_t);
+                break;
+        }
+    }
 }
-    
-    
-/*==============================
-    netlib_skipbytes
-    Skips a number of bytes from the received net packet
-    @param The number of bytes to skip
-==============================*/
-
-void netlib_skipbytes(size_t count)
-{
-    usb_skip(count);
-}
\ No newline at end of file
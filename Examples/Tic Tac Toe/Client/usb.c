@@ -13,6 +13,13 @@ https://github.com/buu342/N64-UNFLoader
     #include <libdragon.h>
 #endif
 #include <string.h>
+#ifdef USB_HOST
+    #include <stdlib.h>
+    #include <unistd.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+#endif
 
 
 /*********************************
@@ -65,7 +72,7 @@ https://github.com/buu342/N64-UNFLoader
     #define IO_READ(addr)       (*(vu32 *)PHYS_TO_K1(addr))
     
     // Data alignment
-    #define OS_DCACHE_ROUNDUP_ADDR(x) (void *)(((((u32)(x)+0xf)/0x10)*0x10))
+    #define OS_DCACHE_ROUNDUP_ADDR(x) (void *)(((((uintptr_t)(x)+0xf)/0x10)*0x10))
     #define OS_DCACHE_ROUNDUP_SIZE(x) (u32)(((((u32)(x)+0xf)/0x10)*0x10))
 #endif
 
@@ -224,7 +231,9 @@ static u32  usb_getaddr();
 static s8   usb_64drive_write(int datatype, const void* data, int size);
 static u32  usb_64drive_poll(void);
 static void usb_64drive_read(void);
-static void usb_64drive_set_extendedaddress(u8 enable);
+#ifndef USB_HOST
+    static void usb_64drive_set_extendedaddress(u8 enable);
+#endif
 static u32  usb_64drive_get_baseaddr();
 
 static s8   usb_everdrive_write(int datatype, const void* data, int size);
@@ -235,6 +244,12 @@ static s8   usb_sc64_write(int datatype, const void* data, int size);
 static u32  usb_sc64_poll(void);
 static void usb_sc64_read(void);
 
+#ifdef USB_HOST
+    static s8   usb_simulated_write(int datatype, const void* data, int size);
+    static u32  usb_simulated_poll(void);
+    static void usb_simulated_read(void);
+#endif
+
 
 /*********************************
              Globals
@@ -258,6 +273,10 @@ static int usb_readblock = -1;
 // Cart specific globals
 static vu8 d64_wasarmed = FALSE;
 static u8 d64_extendedaddr = FALSE;
+#ifdef USB_HOST
+    static int sim_socket = -1;
+    static u8* sim_debugarea = NULL;
+#endif
 
 #ifndef LIBDRAGON
     // Message globals
@@ -472,6 +491,13 @@ char usb_initialize(void)
             funcPointer_poll  = usb_sc64_poll;
             funcPointer_read  = usb_sc64_read;
             break;
+        #ifdef USB_HOST
+            case CART_SIMULATED:
+                funcPointer_write = usb_simulated_write;
+                funcPointer_poll  = usb_simulated_poll;
+                funcPointer_read  = usb_simulated_read;
+                break;
+        #endif
         default:
             return 0;
     }
@@ -491,6 +517,26 @@ static void usb_findcart(void)
 {
     u32 buff;
     
+    // On a PC, there's no cartridge to probe, so connect to the simulated one instead
+    #ifdef USB_HOST
+        const char* path = getenv("NETLIB_USBSOCKET");
+        struct sockaddr_un addr;
+        (void)buff;
+        if (path == NULL || strlen(path) >= sizeof(addr.sun_path))
+            return;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path);
+        if (sim_socket < 0)
+            sim_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sim_debugarea == NULL)
+            sim_debugarea = (u8*)malloc(DEBUG_ADDRESS_SIZE);
+        if (sim_socket < 0 || sim_debugarea == NULL || connect(sim_socket, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+            return;
+        usb_cart = CART_SIMULATED;
+        return;
+    #endif
+    
     // Before we do anything, check that we are using an emulator
     #if CHECK_EMULATOR
         // Check the RDP clock register.
@@ -685,7 +731,7 @@ void usb_read(void* buffer, int nbytes)
         }
         
         // Copy from the USB buffer to the supplied buffer
-        memcpy((void*)(((u32)buffer)+read), usb_buffer+copystart, block);
+        memcpy((u8*)buffer+read, usb_buffer+copystart, block);
         
         // Increment/decrement all our counters
         read += block;
@@ -756,6 +802,19 @@ void usb_purge(void)
 }
 
 
+/*==============================
+    usb_getdataleft
+    Returns how many bytes of the data being received
+    are left to read, without polling for new data
+    @return The number of bytes left to read
+==============================*/
+
+int usb_getdataleft(void)
+{
+    return usb_dataleft;
+}
+
+
 /*==============================
     usb_timedout
     Checks if the USB timed out recently
@@ -862,6 +921,7 @@ static u32 usb_64drive_get_baseaddr()
 }
 
 
+#ifndef USB_HOST // Nothing calls this yet, so keep it out of the host build, which is built with warnings on
 /*==============================
     usb_64drive_set_extendedaddress
     Enables or disables 64Drive's extended address mode
@@ -880,6 +940,7 @@ static void usb_64drive_set_extendedaddress(u8 enable)
     // Wait until operation is finished
     usb_64drive_wait();
 }
+#endif
 
 
 /*==============================
@@ -1075,7 +1136,7 @@ static s8 usb_64drive_write(int datatype, const void* data, int size)
         usb_dma_write(usb_buffer, pi_address, ALIGN(block, 2));
 
         // Update pointers and variables
-        data = (void*)(((u32)data) + block);
+        data = (const u8*)data + block;
         left -= block;
         pi_address += block;
     }
@@ -1493,7 +1554,7 @@ static s8 usb_sc64_write(int datatype, const void* data, int size)
         usb_dma_write(usb_buffer, pi_address, ALIGN(block, 2));
 
         // Update pointers and variables
-        data = (void*)(((u32)data) + block);
+        data = (const u8*)data + block;
         left -= block;
         pi_address += block;
     }
@@ -1585,3 +1646,123 @@ static void usb_sc64_read(void)
     // Set up DMA transfer between RDRAM and the PI
     usb_dma_read(usb_buffer, SC64_BASE + usb_getaddr() + usb_readblock, BUFFER_SIZE);
 }
+
+
+/*********************************
+  Simulated flashcart functions
+*********************************/
+
+#ifdef USB_HOST
+
+    /*==============================
+        usb_simulated_transfer
+        Sends or receives an exact number of bytes through
+        the simulated flashcart's socket
+        @param  The buffer to send from or receive into
+        @param  The number of bytes
+        @param  TRUE to send, FALSE to receive
+        @return TRUE on success, FALSE if the socket closed
+    ==============================*/
+    
+    static char usb_simulated_transfer(void* buffer, int size, char sending)
+    {
+        u8* cursor = (u8*)buffer;
+        while (size > 0)
+        {
+            ssize_t done = sending ? write(sim_socket, cursor, size) : read(sim_socket, cursor, size);
+            if (done <= 0)
+                return FALSE;
+            cursor += done;
+            size -= (int)done;
+        }
+        return TRUE;
+    }
+    
+    
+    /*==============================
+        usb_simulated_write
+        Sends data through the simulated flashcart's socket.
+        Each transfer is a big endian USB header followed by
+        the data
+        @param  The DATATYPE that is being sent
+        @param  A buffer with the data to send
+        @param  The size of the data being sent
+        @return 1 on success, 0 on fail, -1 on timeout
+    ==============================*/
+    
+    static s8 usb_simulated_write(int datatype, const void* data, int size)
+    {
+        u32 header = USBHEADER_CREATE(datatype, size);
+        u8 headerbytes[4];
+        headerbytes[0] = (header >> 24) & 0xFF;
+        headerbytes[1] = (header >> 16) & 0xFF;
+        headerbytes[2] = (header >> 8) & 0xFF;
+        headerbytes[3] = header & 0xFF;
+        if (!usb_simulated_transfer(headerbytes, 4, TRUE) || !usb_simulated_transfer((void*)data, size, TRUE))
+        {
+            usb_didtimeout = TRUE;
+            return -1;
+        }
+        usb_didtimeout = FALSE;
+        return 1;
+    }
+    
+    
+    /*==============================
+        usb_simulated_poll
+        Returns the header of data being received through the
+        simulated flashcart's socket, and copies the data into
+        the simulated debug area
+        @return The data header, or 0
+    ==============================*/
+    
+    static u32 usb_simulated_poll(void)
+    {
+        struct pollfd pfd;
+        u8 headerbytes[4];
+        u32 size;
+        
+        // Return 0 if there's no data
+        pfd.fd = sim_socket;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 0) <= 0)
+            return 0;
+        
+        // Read the transfer into the debug area, the same way the flashcart would
+        if (!usb_simulated_transfer(headerbytes, 4, FALSE))
+        {
+            usb_didtimeout = TRUE;
+            return 0;
+        }
+        size = ((headerbytes[1] << 16) | (headerbytes[2] << 8) | headerbytes[3]) & 0xFFFFFF;
+        if (size > DEBUG_ADDRESS_SIZE || !usb_simulated_transfer(sim_debugarea, size, FALSE))
+        {
+            usb_didtimeout = TRUE;
+            return 0;
+        }
+        if (size == 0)
+            return 0;
+        
+        // Fill USB read data variables
+        usb_datatype = headerbytes[0];
+        usb_dataleft = size;
+        usb_datasize = usb_dataleft;
+        usb_readblock = -1;
+        return USBHEADER_CREATE(usb_datatype, size);
+    }
+    
+    
+    /*==============================
+        usb_simulated_read
+        Reads bytes from the simulated debug area into the
+        global buffer with the block offset
+    ==============================*/
+    
+    static void usb_simulated_read(void)
+    {
+        int size = usb_datasize - usb_readblock;
+        memcpy(usb_buffer, sim_debugarea + usb_readblock, (size < BUFFER_SIZE) ? size : BUFFER_SIZE);
+    }
+
+#endif
@@ -18,6 +18,7 @@
     #define CART_64DRIVE   1
     #define CART_EVERDRIVE 2
     #define CART_SC64      3
+    #define CART_SIMULATED 4 // Only when compiled for a PC with USB_HOST defined
     
     // Data types defintions
     #define DATATYPE_TEXT        0x01
@@ -79,7 +80,11 @@
         @return The data header, or 0
     ==============================*/
     
-    extern unsigned long usb_poll(void);
+    #ifndef USB_HOST
+        extern unsigned long usb_poll(void);
+    #else
+        extern uint32_t usb_poll(void); // Long is 64 bits on most PCs
+    #endif
     
     
     /*==============================
@@ -118,6 +123,16 @@
     extern void usb_purge(void);
 
 
+    /*==============================
+        usb_getdataleft
+        Returns how many bytes of the data being received
+        are left to read, without polling for new data
+        @return The number of bytes left to read
+    ==============================*/
+
+    extern int usb_getdataleft(void);
+
+
     /*==============================
         usb_timedout
         Checks if the USB timed out recently
@@ -22,7 +22,8 @@ import java.util.concurrent.ConcurrentLinkedQueue;
 public class ClientConnectionThread extends Thread {
     
 	// Constants
-    private static final int FILECHUNKSIZE = 2048;
+    private static final int FILECHUNKSIZE = 65536;
+    private static final int ROMHASHSIZE = 32;
 
     // Connection handler
     private UDPHandler handler;
@@ -183,6 +184,7 @@ public class ClientConnectionThread extends Thread {
     /**
      * Handle a S64Packet with the type "DOWNLOAD"
      * This packet is sent by clients when they wish to download a ROM
+     * It contains the ROM hash, optionally followed by the byte offset to resume a partial download from
      * @throws ClientTimeoutException  Shouldn't happen as we are sending unreliable flags
      * @throws IOException             If an I/O error occurs
      * @throws InvalidROMException     If a file is found which is not a valid N64 ROM
@@ -190,6 +192,7 @@ public class ClientConnectionThread extends Thread {
      */
     private void DownloadROM(byte[] data) throws IOException, ClientTimeoutException, InvalidROMException, InterruptedException {
         long chunks;
+        long offset = 0;
         byte[] hash;
         N64ROM rom;
         String romhashstr;
@@ -203,10 +206,14 @@ public class ClientConnectionThread extends Thread {
         System.out.println("Client " + addrport + " wants to download ROM");
         
         // Store the hash
-        hash = new byte[data.length];
-        for (int i=0; i<data.length; i++)
+        hash = new byte[Math.min(data.length, ROMHASHSIZE)];
+        for (int i=0; i<hash.length; i++)
             hash[i] = bb.get();
         
+        // Newer clients can ask to resume a partial download
+        if (bb.remaining() >= Integer.BYTES)
+            offset = Integer.toUnsignedLong(bb.getInt());
+        
         // Find the hash in our ROM list
         romhashstr = N64ROM.BytesToHash(hash);
         rom = this.roms.get(romhashstr);
@@ -235,11 +242,16 @@ public class ClientConnectionThread extends Thread {
             return;
         }
         
-        // Send the download packet
-        bb = ByteBuffer.allocate(8);
+        // If the offset is past the end of the ROM, the client has something else, so send the whole ROM again
+        if (offset > rom.GetSize())
+            offset = 0;
+        
+        // Send the download packet, which tells the client where we're resuming from
+        bb = ByteBuffer.allocate(12);
         bb.putInt(rom.GetSize());
         bb.putInt(FILECHUNKSIZE);
-        chunks = (long)Math.ceil(((float)rom.GetSize()) / FILECHUNKSIZE);
+        bb.putInt((int)offset);
+        chunks = (long)Math.ceil(((double)(rom.GetSize() - offset)) / FILECHUNKSIZE);
         this.handler.SendPacket(new S64Packet("DOWNLOAD", bb.array(), PacketFlag.FLAG_UNRELIABLE.GetInt()));
         System.out.println("    Sent download packet");
         
@@ -247,13 +259,21 @@ public class ClientConnectionThread extends Thread {
         ss = new ServerSocket(6464);
         fis = new FileInputStream(romfile);
         try {
+            long skipped = 0;
+            while (skipped < offset) {
+                long count = fis.skip(offset - skipped);
+                if (count <= 0)
+                    break;
+                skipped += count;
+            }
             sock = ss.accept();
             out = sock.getOutputStream();
             System.out.println("    Opened TCP Socket");
+            if (offset > 0)
+                System.out.println("    Resuming from byte " + offset);
             for (long i = 0; i < chunks; i++) {
                 byte[] sendbuf = fis.readNBytes(FILECHUNKSIZE);
                 out.write(sendbuf);
-                Thread.sleep(10);
             }
             
             // Finished
@@ -0,0 +1,725 @@
+/***************************************************************
+                           hosttest.c
+
+Self checks and benchmarks for netlib.c, built for a PC with a
+simulated flashcart. The program plays the part of the client
+app on the other end of the simulated flashcart's socket, so
+that the same code that runs on the N64 can be tested without
+any hardware. Results are printed as JSON, and the exit code is
+non-zero if any of the checks failed.
+***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "netlib.h"
+#include "usb.h"
+
+
+/*********************************
+              Macros
+*********************************/
+
+#define PROGRAM_NAME  "netlib-host"
+#define HOST_VERSION  1
+
+#define DATATYPE_NETPACKET        0x27
+#define DATATYPE_NETPACKETBUNDLE  0x28
+
+#define PACKET_HEADERSIZE  18
+#define MAX_CHECKS         64
+
+// Packet types used by the checks
+#define PACKETID_VALUES      1
+#define PACKETID_SEQUENCE    2
+#define PACKETID_PLAYERS     3
+#define PACKETID_FROMN64     4
+#define PACKETID_ECHO        5
+#define PACKETID_UNKNOWN     6
+
+// The size of the player update used by the decode benchmark, like the Realtime example's
+#define BENCH_PLAYERS     30
+#define BENCH_PLAYERSIZE  (1 + 4 + 5*4 + 3)
+
+
+/*********************************
+              Structs
+*********************************/
+
+typedef struct {
+    u32 id;
+    float x, y;
+    float dirx, diry;
+    float speed;
+    u8 r, g, b;
+} HostPlayer;
+
+typedef struct {
+    const char* name;
+    int passed;
+} HostCheck;
+
+
+/*********************************
+             Globals
+*********************************/
+
+static int global_desktop = -1;
+static int global_quick = FALSE;
+
+static HostCheck global_checks[MAX_CHECKS];
+static int global_checkcount = 0;
+
+static char global_results[4096];
+static size_t global_resultslen = 0;
+
+// Filled in by the packet callbacks
+static u8  global_values_byte;
+static u16 global_values_word;
+static u32 global_values_dword;
+static u64 global_values_qword;
+static float  global_values_float;
+static double global_values_double;
+static u8  global_values_bytes[5];
+static u8  global_values_pastend;
+static u32 global_sequence[16];
+static int global_sequencecount;
+static HostPlayer global_players[BENCH_PLAYERS];
+static int global_echocount;
+
+
+/*********************************
+         Helper Functions
+*********************************/
+
+/*==============================
+    host_check
+    Records the result of a check
+    @param The name of the check
+    @param Whether the check passed
+==============================*/
+
+static void host_check(const char* name, int passed)
+{
+    if (global_checkcount < MAX_CHECKS)
+    {
+        global_checks[global_checkcount].name = name;
+        global_checks[global_checkcount].passed = passed;
+        global_checkcount++;
+    }
+}
+
+
+/*==============================
+    host_result
+    Records the result of a benchmark
+    @param The name of the benchmark
+    @param The number of iterations
+    @param The nanoseconds per iteration
+==============================*/
+
+static void host_result(const char* name, int iterations, double ns)
+{
+    global_resultslen += snprintf(global_results + global_resultslen, sizeof(global_results) - global_resultslen,
+        "%s\n    {\"name\": \"%s\", \"iterations\": %d, \"ns_per_op\": %.1f}",
+        (global_resultslen > 0) ? "," : "", name, iterations, ns
+    );
+}
+
+
+/*==============================
+    host_now
+    Gets the current time
+    @return The time, in nanoseconds
+==============================*/
+
+static double host_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec*1000000000.0 + now.tv_nsec;
+}
+
+
+/*==============================
+    host_put
+    Writes a big endian value into a buffer
+    @param  The buffer to write into
+    @param  The value to write
+    @param  The size of the value, in bytes
+    @return The address right after the written value
+==============================*/
+
+static u8* host_put(u8* dest, u64 value, int size)
+{
+    int i;
+    for (i=0; i<size; i++)
+        dest[i] = (value >> (8*(size - 1 - i))) & 0xFF;
+    return dest + size;
+}
+
+
+/*==============================
+    host_putfloat
+    Writes a big endian float into a buffer
+    @param  The buffer to write into
+    @param  The value to write
+    @return The address right after the written value
+==============================*/
+
+static u8* host_putfloat(u8* dest, float value)
+{
+    u32 bits;
+    memcpy(&bits, &value, sizeof(float));
+    return host_put(dest, bits, 4);
+}
+
+
+/*==============================
+    host_putheader
+    Writes a NetLib packet header into a buffer
+    @param  The buffer to write into
+    @param  The packet type
+    @param  The size of the packet's data
+    @return The address of the packet's data
+==============================*/
+
+static u8* host_putheader(u8* dest, NetPacket type, u16 size)
+{
+    memset(dest, 0, PACKET_HEADERSIZE);
+    dest[0] = 'N';
+    dest[1] = 'L';
+    dest[2] = 'P';
+    dest[3] = 1;
+    dest[4] = type;
+    host_put(&dest[16], size, 2);
+    return dest + PACKET_HEADERSIZE;
+}
+
+
+/*==============================
+    host_transfer
+    Sends or receives an exact number of bytes through
+    the desktop's end of the simulated flashcart's socket
+    @param  The buffer to send from or receive into
+    @param  The number of bytes
+    @param  TRUE to send, FALSE to receive
+    @return TRUE on success
+==============================*/
+
+static int host_transfer(void* buffer, size_t size, int sending)
+{
+    u8* cursor = (u8*)buffer;
+    while (size > 0)
+    {
+        ssize_t done = sending ? write(global_desktop, cursor, size) : read(global_desktop, cursor, size);
+        if (done <= 0)
+            return FALSE;
+        cursor += done;
+        size -= done;
+    }
+    return TRUE;
+}
+
+
+/*==============================
+    host_send
+    Sends a USB transfer to the simulated N64
+    @param The data type
+    @param The data to send
+    @param The size of the data
+==============================*/
+
+static void host_send(int type, const u8* data, u32 size)
+{
+    u8 header[4];
+    host_put(header, ((u32)type << 24) | (size & 0xFFFFFF), 4);
+    host_transfer(header, 4, TRUE);
+    host_transfer((void*)data, size, TRUE);
+}
+
+
+/*==============================
+    host_receive
+    Receives a USB transfer from the simulated N64
+    @param  The buffer to put the data in
+    @param  The size of the buffer
+    @param  A pointer to store the size of the data in
+    @return The data type, or -1 on failure
+==============================*/
+
+static int host_receive(u8* buffer, u32 buffsize, u32* size)
+{
+    u8 header[4];
+    if (!host_transfer(header, 4, FALSE))
+        return -1;
+    *size = (header[1] << 16) | (header[2] << 8) | header[3];
+    if (*size > buffsize || !host_transfer(buffer, *size, FALSE))
+        return -1;
+    return header[0];
+}
+
+
+/*********************************
+         Packet Callbacks
+*********************************/
+
+static void host_callback_values(size_t size)
+{
+    (void)size;
+    netlib_readbyte(&global_values_byte);
+    netlib_readword(&global_values_word);
+    netlib_readdword(&global_values_dword);
+    netlib_readqword(&global_values_qword);
+    netlib_readfloat(&global_values_float);
+    netlib_readdouble(&global_values_double);
+    netlib_readbytes(global_values_bytes, sizeof(global_values_bytes));
+    netlib_readbyte(&global_values_pastend);
+}
+
+static void host_callback_sequence(size_t size)
+{
+    // Only read part of the packet, to check that the next one is still found
+    (void)size;
+    if (global_sequencecount < 16)
+        netlib_readdword(&global_sequence[global_sequencecount++]);
+}
+
+static void host_callback_echo(size_t size)
+{
+    // Send a packet back from inside the callback, like the examples' heartbeats do
+    u32 value;
+    (void)size;
+    netlib_readdword(&value);
+    global_echocount++;
+    netlib_start(PACKETID_FROMN64);
+    netlib_writedword(value);
+    netlib_sendtoserver();
+}
+
+static void host_callback_players(size_t size)
+{
+    u8 count;
+    (void)size;
+    netlib_readbyte(&count);
+    while (count > 0)
+    {
+        u8 index;
+        netlib_readbyte(&index);
+        netlib_readstruct(&global_players[index % BENCH_PLAYERS], "dfffffbbb");
+        count--;
+    }
+}
+
+
+/*********************************
+             Checks
+*********************************/
+
+/*==============================
+    host_check_decode
+    Checks that every value type is decoded correctly
+==============================*/
+
+static void host_check_decode()
+{
+    u8 buff[PACKET_HEADERSIZE + 64];
+    u8* data = host_putheader(buff, PACKETID_VALUES, 1+2+4+8+4+8+5);
+    double dbl = -1234.5;
+    u64 dblbits;
+    memcpy(&dblbits, &dbl, sizeof(double));
+    data = host_put(data, 0xA5, 1);
+    data = host_put(data, 0xBEEF, 2);
+    data = host_put(data, 0xDEADBEEF, 4);
+    data = host_put(data, 0x0123456789ABCDEFULL, 8);
+    data = host_putfloat(data, 3.5f);
+    data = host_put(data, dblbits, 8);
+    memcpy(data, "hello", 5);
+    data += 5;
+    host_send(DATATYPE_NETPACKET, buff, data - buff);
+    global_values_pastend = 0xFF;
+    netlib_poll();
+    host_check("decode_byte", global_values_byte == 0xA5);
+    host_check("decode_word", global_values_word == 0xBEEF);
+    host_check("decode_dword", global_values_dword == 0xDEADBEEF);
+    host_check("decode_qword", global_values_qword == 0x0123456789ABCDEFULL);
+    host_check("decode_float", global_values_float == 3.5f);
+    host_check("decode_double", global_values_double == -1234.5);
+    host_check("decode_bytes", memcmp(global_values_bytes, "hello", 5) == 0);
+    host_check("decode_pastend", global_values_pastend == 0);
+}
+
+
+/*==============================
+    host_check_bundles
+    Checks that bundled packets are all handled, even when
+    the callbacks don't read everything, and that the poll
+    budget stops and resumes in the right places
+==============================*/
+
+static void host_check_bundles()
+{
+    u8 buff[16*(PACKET_HEADERSIZE + 16)];
+    u8* cursor = buff;
+    u32 pending[4];
+    int i, inorder = TRUE;
+    for (i=0; i<10; i++)
+    {
+        cursor = host_putheader(cursor, PACKETID_SEQUENCE, 4 + i);
+        cursor = host_put(cursor, i, 4);
+        memset(cursor, 0xEE, i);
+        cursor += i;
+    }
+
+    // All in one go
+    global_sequencecount = 0;
+    host_send(DATATYPE_NETPACKETBUNDLE, buff, cursor - buff);
+    netlib_poll();
+    for (i=0; i<10; i++)
+        inorder = inorder && global_sequence[i] == (u32)i;
+    host_check("bundle_all", global_sequencecount == 10 && inorder);
+
+    // Three at a time
+    global_sequencecount = 0;
+    inorder = TRUE;
+    host_send(DATATYPE_NETPACKETBUNDLE, buff, cursor - buff);
+    for (i=0; i<4; i++)
+        pending[i] = netlib_poll_budget(3, 0);
+    for (i=0; i<10; i++)
+        inorder = inorder && global_sequence[i] == (u32)i;
+    host_check("budget_pending", pending[0] == 7 && pending[1] == 4 && pending[2] == 1 && pending[3] == 0);
+    host_check("budget_resumes", global_sequencecount == 10 && inorder);
+}
+
+
+/*==============================
+    host_check_reentrant
+    Checks that packets sent from inside a callback don't
+    disturb the bundle being handled, and are sent once the
+    poll is done reading. Also checks that packets which are
+    larger than MAX_PACKETSIZE, unregistered, or from a newer
+    version are skipped without losing the rest of the bundle
+==============================*/
+
+static void host_check_reentrant()
+{
+    u8 buff[6*(PACKET_HEADERSIZE + 4) + PACKET_HEADERSIZE + MAX_PACKETSIZE + 4];
+    u8* cursor = buff;
+    u32 size;
+    int i, echoed = 0;
+    for (i=0; i<6; i++)
+    {
+        cursor = host_putheader(cursor, PACKETID_ECHO, 4);
+        cursor = host_put(cursor, 100 + i, 4);
+    }
+    global_echocount = 0;
+    host_send(DATATYPE_NETPACKETBUNDLE, buff, cursor - buff);
+    netlib_poll();
+    for (i=0; i<6; i++)
+        if (host_receive(buff, sizeof(buff), &size) == DATATYPE_NETPACKET && size == PACKET_HEADERSIZE + 4 && buff[PACKET_HEADERSIZE + 3] == 100 + i)
+            echoed++;
+    host_check("reentrant_bundle", global_echocount == 6 && echoed == 6 && netlib_outgoing_count() == 0);
+
+    // An oversized packet between two good ones
+    cursor = buff;
+    cursor = host_putheader(cursor, PACKETID_SEQUENCE, 4);
+    cursor = host_put(cursor, 0, 4);
+    cursor = host_putheader(cursor, PACKETID_SEQUENCE, MAX_PACKETSIZE + 4);
+    memset(cursor, 0xEE, MAX_PACKETSIZE + 4);
+    cursor += MAX_PACKETSIZE + 4;
+    cursor = host_putheader(cursor, PACKETID_SEQUENCE, 4);
+    cursor = host_put(cursor, 1, 4);
+    global_sequencecount = 0;
+    host_send(DATATYPE_NETPACKETBUNDLE, buff, cursor - buff);
+    netlib_poll();
+    host_check("oversized_skipped", global_sequencecount == 2 && global_sequence[0] == 0 && global_sequence[1] == 1);
+
+    // Unregistered and unsupported packets between good ones. Only the last one can warn, since the rest are in the middle of the transfer
+    cursor = buff;
+    cursor = host_putheader(cursor, PACKETID_SEQUENCE, 4);
+    cursor = host_put(cursor, 0, 4);
+    cursor = host_putheader(cursor, PACKETID_UNKNOWN, 4);
+    cursor = host_put(cursor, 0, 4);
+    cursor = host_putheader(cursor, PACKETID_SEQUENCE, 4);
+    cursor[3 - PACKET_HEADERSIZE] = 0xFF;
+    cursor = host_put(cursor, 0xEE, 4);
+    cursor = host_putheader(cursor, PACKETID_SEQUENCE, 4);
+    cursor = host_put(cursor, 1, 4);
+    cursor = host_putheader(cursor, PACKETID_UNKNOWN, 4);
+    cursor = host_put(cursor, 0, 4);
+    global_sequencecount = 0;
+    host_send(DATATYPE_NETPACKETBUNDLE, buff, cursor - buff);
+    netlib_poll();
+    host_check("unhandled_skipped", global_sequencecount == 2 && global_sequence[0] == 0 && global_sequence[1] == 1 && host_receive(buff, sizeof(buff), &size) == DATATYPE_TEXT);
+
+    // More packets sent from callbacks than the queue can hold. Blocking isn't possible in the middle of a bundle, so the extra ones are dropped
+    cursor = buff;
+    for (i=0; i<MAX_OUTGOINGPACKETS + 4; i++)
+    {
+        cursor = host_putheader(cursor, PACKETID_ECHO, 4);
+        cursor = host_put(cursor, i, 4);
+    }
+    echoed = 0;
+    global_echocount = 0;
+    netlib_setoverflow(OVERFLOW_BLOCK);
+    host_send(DATATYPE_NETPACKETBUNDLE, buff, cursor - buff);
+    netlib_poll();
+    netlib_setoverflow(OUTGOING_OVERFLOW);
+    for (i=0; i<MAX_OUTGOINGPACKETS; i++)
+        if (host_receive(buff, sizeof(buff), &size) == DATATYPE_NETPACKET && buff[PACKET_HEADERSIZE + 3] == i)
+            echoed++;
+    host_check("block_in_callback", global_echocount == MAX_OUTGOINGPACKETS + 4 && echoed == MAX_OUTGOINGPACKETS && netlib_outgoing_dropped() == 4);
+}
+
+
+/*==============================
+    host_check_budgetsends
+    Checks that packets sent from callbacks still go out
+    when every budgeted poll stops with more data waiting
+==============================*/
+
+static void host_check_budgetsends()
+{
+    u8 buff[PACKET_HEADERSIZE + 4];
+    u32 size;
+    int i, echoed = 0;
+    global_echocount = 0;
+    for (i=0; i<8; i++)
+    {
+        u8* cursor = host_putheader(buff, PACKETID_ECHO, 4);
+        host_put(cursor, i, 4);
+        host_send(DATATYPE_NETPACKET, buff, sizeof(buff));
+        if (i == 0)
+            host_send(DATATYPE_NETPACKET, buff, sizeof(buff));
+        netlib_poll_budget(1, 0);
+        if (host_receive(buff, sizeof(buff), &size) == DATATYPE_NETPACKET && size == sizeof(buff))
+            echoed++;
+    }
+    netlib_poll();
+    if (host_receive(buff, sizeof(buff), &size) == DATATYPE_NETPACKET)
+        echoed++;
+    host_check("budget_sends", global_echocount == 9 && echoed == 9);
+}
+
+
+/*==============================
+    host_check_send
+    Checks that packets built on the N64 reach the client
+    app in Network Byte Order
+==============================*/
+
+static void host_check_send()
+{
+    u8 buff[PACKET_HEADERSIZE + 64];
+    u8 expected[4+4+8+2] = {0xCA, 0xFE, 0xBA, 0xBE, 0x40, 0x60, 0x00, 0x00, 0, 0, 0, 0, 0, 0, 0, 7, 0x12, 0x34};
+    u32 size;
+    int type;
+    byte* out;
+
+    netlib_start(PACKETID_FROMN64);
+    netlib_writedword(0xCAFEBABE);
+    netlib_writefloat(3.5f);
+    out = netlib_reserve(10);
+    if (out != NULL)
+    {
+        out = netlib_storeqword(out, 7);
+        netlib_storeword(out, 0x1234);
+        netlib_commit(10);
+    }
+    netlib_sendtoserver();
+    type = host_receive(buff, sizeof(buff), &size);
+    host_check("send_type", type == DATATYPE_NETPACKET && size == PACKET_HEADERSIZE + sizeof(expected));
+    host_check("send_header", buff[4] == PACKETID_FROMN64 && buff[16] == 0 && buff[17] == sizeof(expected));
+    host_check("send_data", memcmp(&buff[PACKET_HEADERSIZE], expected, sizeof(expected)) == 0);
+    host_check("send_queue", netlib_outgoing_count() == 0 && netlib_outgoing_bytes() == 0 && netlib_outgoing_dropped() == 0);
+}
+
+
+/*********************************
+            Benchmarks
+*********************************/
+
+/*==============================
+    host_bench_decode
+    Times polling and decoding a player update for 30
+    players, including the trip through the socket
+==============================*/
+
+static void host_bench_decode()
+{
+    u8 buff[PACKET_HEADERSIZE + 1 + BENCH_PLAYERS*BENCH_PLAYERSIZE];
+    u8* cursor = host_putheader(buff, PACKETID_PLAYERS, 1 + BENCH_PLAYERS*BENCH_PLAYERSIZE);
+    int i, iterations = global_quick ? 2000 : 50000;
+    double start;
+    cursor = host_put(cursor, BENCH_PLAYERS, 1);
+    for (i=0; i<BENCH_PLAYERS; i++)
+    {
+        cursor = host_put(cursor, i, 1);
+        cursor = host_put(cursor, 1000 + i, 4);
+        cursor = host_putfloat(cursor, i*1.5f);
+        cursor = host_putfloat(cursor, i*2.5f);
+        cursor = host_putfloat(cursor, 0.0f);
+        cursor = host_putfloat(cursor, 1.0f);
+        cursor = host_putfloat(cursor, 4.0f);
+        cursor = host_put(cursor, 0x102030, 3);
+    }
+    start = host_now();
+    for (i=0; i<iterations; i++)
+    {
+        host_send(DATATYPE_NETPACKET, buff, cursor - buff);
+        netlib_poll();
+    }
+    host_result("poll_playerupdate", iterations, (host_now() - start)/iterations);
+    host_check("decode_players", global_players[7].id == 1007 && global_players[7].y == 7*2.5f && global_players[7].b == 0x30);
+}
+
+
+/*==============================
+    host_bench_encode
+    Times building a batch of 100 inputs, like the Realtime
+    example's client input packet, with the write functions
+    and with a reservation
+==============================*/
+
+static void host_bench_encode()
+{
+    int i, j, iterations = global_quick ? 20000 : 500000;
+    size_t size = 1 + 100*(8 + 4 + 2);
+    double start;
+
+    start = host_now();
+    for (i=0; i<iterations; i++)
+    {
+        netlib_start(PACKETID_FROMN64);
+        netlib_writebyte(100);
+        for (j=0; j<100; j++)
+        {
+            netlib_writeqword((u64)j*1000);
+            netlib_writefloat(0.016f);
+            netlib_writebyte(j);
+            netlib_writebyte(-j);
+        }
+    }
+    host_result("encode_inputs_write", iterations, (host_now() - start)/iterations);
+
+    start = host_now();
+    for (i=0; i<iterations; i++)
+    {
+        byte* out;
+        netlib_start(PACKETID_FROMN64);
+        out = netlib_reserve(size);
+        if (out == NULL)
+            continue;
+        out = netlib_storebyte(out, 100);
+        for (j=0; j<100; j++)
+        {
+            out = netlib_storeqword(out, (u64)j*1000);
+            out = netlib_storefloat(out, 0.016f);
+            out = netlib_storebyte(out, j);
+            out = netlib_storebyte(out, -j);
+        }
+        netlib_commit(size);
+    }
+    host_result("encode_inputs_reserve", iterations, (host_now() - start)/iterations);
+}
+
+
+/*********************************
+              Main
+*********************************/
+
+int main(int argc, char* argv[])
+{
+    char path[108];
+    struct sockaddr_un addr;
+    int listener, i, passed = TRUE;
+    u8 buff[64];
+    u32 size;
+    const char* outpath = NULL;
+    FILE* fp = stdout;
+
+    // Parse the command line
+    for (i=1; i<argc; i++)
+    {
+        if (strcmp(argv[i], "-quick") == 0)
+            global_quick = TRUE;
+        else if (strcmp(argv[i], "-output") == 0 && i+1 < argc)
+            outpath = argv[++i];
+        else
+        {
+            printf("Usage: %s [-quick] [-output <File>]\n", PROGRAM_NAME);
+            return 1;
+        }
+    }
+
+    // Listen on a socket for the simulated flashcart, like the client app would
+    snprintf(path, sizeof(path), "/tmp/%s-%d.sock", PROGRAM_NAME, (int)getpid());
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0)
+    {
+        printf("Unable to listen on '%s'.\n", path);
+        return 1;
+    }
+    setenv("NETLIB_USBSOCKET", path, 1);
+
+    // Boot the simulated N64. The flashcart connects while initializing, so we can accept it right after
+    netlib_initialize();
+    global_desktop = accept(listener, NULL, NULL);
+    close(listener);
+    unlink(path);
+    if (global_desktop >= 0)
+    {
+        // Waiting on a packet that never comes fails the check instead of hanging
+        struct timeval timeout = {2, 0};
+        setsockopt(global_desktop, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+    host_check("cart_simulated", usb_getcart() == CART_SIMULATED && global_desktop >= 0);
+    if (global_desktop < 0)
+        return 1;
+    host_check("boot_heartbeat", host_receive(buff, sizeof(buff), &size) == DATATYPE_HEARTBEAT && size == 4);
+    host_check("boot_bundlesize", host_receive(buff, sizeof(buff), &size) == DATATYPE_NETPACKETBUNDLE && size == 4 && ((buff[0] << 24) | (buff[1] << 16) | (buff[2] << 8) | buff[3]) == DEBUG_ADDRESS_SIZE);
+    netlib_register(PACKETID_VALUES, host_callback_values);
+    netlib_register(PACKETID_SEQUENCE, host_callback_sequence);
+    netlib_register(PACKETID_PLAYERS, host_callback_players);
+    netlib_register(PACKETID_ECHO, host_callback_echo);
+
+    // Run everything
+    host_check_decode();
+    host_check_bundles();
+    host_check_send();
+    host_check_reentrant();
+    host_check_budgetsends();
+    host_bench_decode();
+    host_bench_encode();
+    close(global_desktop);
+
+    // Print the results
+    if (outpath != NULL)
+    {
+        fp = fopen(outpath, "w");
+        if (fp == NULL)
+        {
+            printf("Unable to open '%s' for writing.\n", outpath);
+            return 1;
+        }
+    }
+    fprintf(fp, "{\n  \"program\": \"%s\",\n  \"version\": %d,\n  \"quick\": %s,\n", PROGRAM_NAME, HOST_VERSION, global_quick ? "true" : "false");
+    fprintf(fp, "  \"results\": [%s\n  ],\n  \"checks\": [", global_results);
+    for (i=0; i<global_checkcount; i++)
+    {
+        fprintf(fp, "%s\n    {\"name\": \"%s\", \"passed\": %s}", (i > 0) ? "," : "", global_checks[i].name, global_checks[i].passed ? "true" : "false");
+        passed = passed && global_checks[i].passed;
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    if (fp != stdout)
+        fclose(fp);
+    return passed ? 0 : 1;
+}
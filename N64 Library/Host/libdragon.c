@@ -0,0 +1,89 @@
+/***************************************************************
+                           libdragon.c
+
+The Libdragon functions that netlib.c and usb.c need on a PC.
+The timer counts N64 timer ticks since the program started, and
+the PI and cache functions stop the program, since no hardware
+flashcart exists to talk to.
+***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "libdragon.h"
+
+
+/*********************************
+            Functions
+*********************************/
+
+/*==============================
+    host_nohardware
+    Stops the program when the hardware is accessed
+    @param The name of the function that was called
+==============================*/
+
+static void host_nohardware(const char* function)
+{
+    fprintf(stderr, "%s called in a host build, which has no PI\n", function);
+    abort();
+}
+
+
+/*==============================
+    timer_ticks
+    Gets the time since the program started
+    @return The time, in N64 timer ticks
+==============================*/
+
+long long timer_ticks(void)
+{
+    static struct timespec start;
+    struct timespec now;
+    if (start.tv_sec == 0 && start.tv_nsec == 0)
+        clock_gettime(CLOCK_MONOTONIC, &start);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)(now.tv_sec - start.tv_sec)*TICKS_PER_SECOND + (long long)(now.tv_nsec - start.tv_nsec)*TICKS_PER_SECOND/1000000000LL;
+}
+
+uint32_t io_read(uint32_t pi_address)
+{
+    (void)pi_address;
+    host_nohardware("io_read");
+    return 0;
+}
+
+void io_write(uint32_t pi_address, uint32_t value)
+{
+    (void)pi_address;
+    (void)value;
+    host_nohardware("io_write");
+}
+
+void dma_read(void* ram_address, unsigned long pi_address, unsigned long size)
+{
+    (void)ram_address;
+    (void)pi_address;
+    (void)size;
+    host_nohardware("dma_read");
+}
+
+void dma_write(const void* ram_address, unsigned long pi_address, unsigned long size)
+{
+    (void)ram_address;
+    (void)pi_address;
+    (void)size;
+    host_nohardware("dma_write");
+}
+
+void data_cache_hit_writeback(volatile const void* addr, unsigned long size)
+{
+    (void)addr;
+    (void)size;
+}
+
+void data_cache_hit_writeback_invalidate(volatile void* addr, unsigned long size)
+{
+    (void)addr;
+    (void)size;
+}
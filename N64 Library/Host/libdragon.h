@@ -0,0 +1,73 @@
+/***************************************************************
+                           libdragon.h
+
+A stand-in for Libdragon's header, for compiling netlib.c and
+usb.c on a PC (see the Makefile). It only provides what those
+two files use. The PI and cache functions should never be
+called, since usb.c talks to a simulated flashcart instead.
+***************************************************************/
+
+#ifndef _N64_HOST_LIBDRAGON_H
+#define _N64_HOST_LIBDRAGON_H
+
+    /*********************************
+                 Includes
+    *********************************/
+    
+    #include <stdint.h>
+    #include <stddef.h>
+    
+    
+    /*********************************
+                  Macros
+    *********************************/
+    
+    #ifndef TRUE
+        #define TRUE 1
+    #endif
+    #ifndef FALSE
+        #define FALSE 0
+    #endif
+    
+    // The N64's timer runs at half the CPU clock (46.875MHz)
+    #define TICKS_PER_SECOND   46875000
+    #define TIMER_TICKS(us)    ((long long)(us)*46875/1000)
+    #define TICKS_FROM_MS(ms)  ((long long)(ms)*46875)
+    #define TICKS_READ()       ((uint32_t)timer_ticks())
+    
+    
+    /*********************************
+                  Types
+    *********************************/
+    
+    typedef uint8_t  u8;
+    typedef uint16_t u16;
+    typedef uint32_t u32;
+    typedef uint64_t u64;
+    
+    typedef int8_t  s8;
+    typedef int16_t s16;
+    typedef int32_t s32;
+    typedef int64_t s64;
+    
+    typedef volatile uint8_t  vu8;
+    typedef volatile uint32_t vu32;
+    
+    typedef float  f32;
+    typedef double f64;
+    
+    
+    /*********************************
+           Function Prototypes
+    *********************************/
+    
+    long long timer_ticks(void);
+    
+    uint32_t io_read(uint32_t pi_address);
+    void io_write(uint32_t pi_address, uint32_t value);
+    void dma_read(void* ram_address, unsigned long pi_address, unsigned long size);
+    void dma_write(const void* ram_address, unsigned long pi_address, unsigned long size);
+    void data_cache_hit_writeback(volatile const void* addr, unsigned long size);
+    void data_cache_hit_writeback_invalidate(volatile void* addr, unsigned long size);
+
+#endif
@@ -18,12 +18,23 @@
     // Whether to check if the packet write will go past the buffer
     #define SAFETYCHECKS  1
     
+    // The max number of packets waiting to be sent over USB
+    #define MAX_OUTGOINGPACKETS  16
+    
+    // The size of the buffer for packets waiting to be sent over USB
+    // Must be able to fit at least one packet of MAX_PACKETSIZE
+    #define OUTGOING_BUFFERSIZE  16*1024
+    
+    // What to do with a new packet when the outgoing queue is full (see OverflowPolicy)
+    #define OUTGOING_OVERFLOW  OVERFLOW_DROPOLDEST
+    
     
     /*********************************
                  Includes
     *********************************/
 
     #include <stdlib.h>
+    #include <string.h>
     #ifndef LIBDRAGON
         #include <ultra64.h>
     #else
@@ -59,6 +70,23 @@
         FLAG_EXPLICITACK = 0x02,
     } PacketFlag;
     
+    // What to do when a packet is sent while the outgoing queue is full
+    typedef enum {
+        OVERFLOW_DROPOLDEST = 0, // Throw away the oldest queued packets to make room
+        OVERFLOW_DROPNEWEST = 1, // Throw away the packet being sent
+        OVERFLOW_BLOCK      = 2, // Keep polling until the USB has taken enough packets to make room (packets sent from callbacks are dropped instead)
+    } OverflowPolicy;
+    
+    
+    /*********************************
+                 Globals
+    *********************************/
+    
+    // The received packet's data, and how far into it we have read.
+    // These are only exposed so that the read functions below can be inlined, don't modify them yourself
+    extern byte* netlib_readcursor;
+    extern byte* netlib_readend;
+    
     
     /*********************************
             Initialization and
@@ -68,7 +96,8 @@
     /*==============================
         netlib_initialize
         Initializes the NetLib library.
-        Also initializes the USB library internally
+        Also initializes the USB library internally, and lets
+        the client app know we can receive packet bundles
     ==============================*/
     
     extern void netlib_initialize();
@@ -111,6 +140,16 @@
     extern void netlib_callback_reconnect(void (*callback)());
     
     
+    /*==============================
+        netlib_setoverflow
+        Sets what happens to packets that are sent while the
+        outgoing queue is full
+        @param The overflow policy to use
+    ==============================*/
+    
+    extern void netlib_setoverflow(OverflowPolicy policy);
+    
+    
     /*********************************
          N64 -> Network Functions
     *********************************/
@@ -119,6 +158,7 @@
         netlib_start
         Begins a new net packet. If another net packet is already
         started and hasn't been sent yet, it will be discarded.
+        Packets which were already sent stay in the outgoing queue.
         @param The type of the packet
     ==============================*/
     
@@ -189,6 +229,133 @@
     extern void netlib_writebytes(byte* data, size_t size);
     
     
+    /*==============================
+        netlib_reserve
+        Reserves space at the end of the current net packet,
+        so that it can be filled in directly with the
+        netlib_store functions. Nothing is added to the packet
+        until netlib_commit is called
+        @param  The number of bytes to reserve
+        @return A pointer to the reserved space, or NULL if
+                the packet doesn't have enough room left
+    ==============================*/
+    
+    extern byte* netlib_reserve(size_t size);
+    
+    
+    /*==============================
+        netlib_commit
+        Adds data that was written to the reserved space to
+        the current net packet
+        @param The number of bytes that were written, which
+               can't be more than what was reserved
+    ==============================*/
+    
+    extern void netlib_commit(size_t size);
+    
+    
+    /*==============================
+        netlib_storebyte
+        Stores a byte at the given address in network
+        byte order
+        @param  The address to store the byte at
+        @param  The byte to store
+        @return The address right after the stored byte
+    ==============================*/
+    
+    static inline byte* netlib_storebyte(byte* dest, uint8_t data)
+    {
+        dest[0] = data;
+        return dest + sizeof(uint8_t);
+    }
+    
+    
+    /*==============================
+        netlib_storeword
+        Stores a word at the given address in network
+        byte order
+        @param  The address to store the word at
+        @param  The word to store
+        @return The address right after the stored word
+    ==============================*/
+    
+    static inline byte* netlib_storeword(byte* dest, uint16_t data)
+    {
+        dest[0] = (data >> 8) & 0xFF;
+        dest[1] = data & 0xFF;
+        return dest + sizeof(uint16_t);
+    }
+    
+    
+    /*==============================
+        netlib_storedword
+        Stores a double word at the given address in network
+        byte order
+        @param  The address to store the double word at
+        @param  The double word to store
+        @return The address right after the stored double word
+    ==============================*/
+    
+    static inline byte* netlib_storedword(byte* dest, uint32_t data)
+    {
+        dest[0] = (data >> 24) & 0xFF;
+        dest[1] = (data >> 16) & 0xFF;
+        dest[2] = (data >> 8) & 0xFF;
+        dest[3] = data & 0xFF;
+        return dest + sizeof(uint32_t);
+    }
+    
+    
+    /*==============================
+        netlib_storeqword
+        Stores a quad word at the given address in network
+        byte order
+        @param  The address to store the quad word at
+        @param  The quad word to store
+        @return The address right after the stored quad word
+    ==============================*/
+    
+    static inline byte* netlib_storeqword(byte* dest, uint64_t data)
+    {
+        dest = netlib_storedword(dest, (uint32_t)(data >> 32));
+        return netlib_storedword(dest, (uint32_t)data);
+    }
+    
+    
+    /*==============================
+        netlib_storefloat
+        Stores a float at the given address in network
+        byte order
+        @param  The address to store the float at
+        @param  The float to store
+        @return The address right after the stored float
+    ==============================*/
+    
+    static inline byte* netlib_storefloat(byte* dest, float data)
+    {
+        uint32_t bits;
+        memcpy(&bits, &data, sizeof(float));
+        return netlib_storedword(dest, bits);
+    }
+    
+    
+    /*==============================
+        netlib_storedouble
+        Stores a double at the given address in network
+        byte order
+        @param  The address to store the double at
+        @param  The double to store
+        @return The address right after the stored double
+    ==============================*/
+    
+    static inline byte* netlib_storedouble(byte* dest, double data)
+    {
+        uint64_t bits;
+        memcpy(&bits, &data, sizeof(double));
+        return netlib_storeqword(dest, bits);
+    }
+    
+    
     /*==============================
         netlib_setflags
         Set the flag(s) of this packet
@@ -221,6 +388,34 @@
     ==============================*/
     
     extern void netlib_sendtoserver();
+    
+    
+    /*==============================
+        netlib_outgoing_count
+        Gets the number of packets waiting to be sent over USB
+        @return The number of queued packets
+    ==============================*/
+    
+    extern uint32_t netlib_outgoing_count();
+    
+    
+    /*==============================
+        netlib_outgoing_bytes
+        Gets the number of bytes waiting to be sent over USB
+        @return The size of all the queued packets
+    ==============================*/
+    
+    extern uint32_t netlib_outgoing_bytes();
+    
+    
+    /*==============================
+        netlib_outgoing_dropped
+        Gets the number of packets that were thrown away
+        because the outgoing queue was full
+        @return The number of dropped packets
+    ==============================*/
+    
+    extern uint32_t netlib_outgoing_dropped();
    
     
     /*********************************
@@ -240,19 +435,72 @@
     
     /*==============================
         netlib_poll
-        Polls the USB for NetLib packets.
+        Polls the USB for NetLib packets. Packets that the client
+        app bundled into a single USB transfer are handled one
+        after the other. Each packet's data is copied to RAM
+        before its callback is called, so reading it is cheap.
+        Callbacks must not read past the size they were given.
+        Packets sent from a callback wait in the outgoing queue,
+        and polling from a callback does nothing. Afterwards,
+        sends as many queued packets as the USB will take.
     ==============================*/
     
     extern void netlib_poll();
     
     
+    /*==============================
+        netlib_poll_budget
+        Polls the USB for NetLib packets, like netlib_poll, but
+        stops once a budget is used up. The packets that weren't
+        handled are left in the USB buffer for the next poll.
+        Queued packets are sent before reading, and after each
+        USB transfer is read, since the USB can't be written
+        to in the middle of a read
+        @param  The max number of packets to handle, or zero for
+                no limit
+        @param  The max amount of time to spend handling packets,
+                in CPU cycles (Libultra) or timer ticks 
+                (Libdragon), or zero for no limit. This is only
+                checked between packets
+        @return The number of packets left in the USB transfer
+                being read, or zero if everything was handled
+    ==============================*/
+    
+    extern uint32_t netlib_poll_budget(uint32_t max_packets, uint64_t max_cycles);
+    
+    
+    /*==============================
+        netlib_readstruct
+        Reads a set of values from the received net packet
+        into a struct, in one go
+        @param A pointer to the struct to read into
+        @param The struct's layout, one character per member:
+               'b' byte, 'w' word, 'd' double word, 'q' quad
+               word, 'f' float, and 'D' double. Members are
+               expected at their natural alignment
+    ==============================*/
+    
+    extern void netlib_readstruct(void* output, const char* layout);
+    
+    
     /*==============================
         netlib_readbyte
         Reads a byte from the received net packet
         @param A pointer to the byte to read into
     ==============================*/
     
-    extern void netlib_readbyte(uint8_t* output);
+    static inline void netlib_readbyte(uint8_t* output)
+    {
+        #if SAFETYCHECKS
+            if (netlib_readcursor + sizeof(uint8_t) > netlib_readend)
+            {
+                *output = 0;
+                return;
+            }
+        #endif
+        *output = netlib_readcursor[0];
+        netlib_readcursor += sizeof(uint8_t);
+    }
     
     
     /*==============================
@@ -261,7 +509,18 @@
         @param A pointer to the word to read into
     ==============================*/
     
-    extern void netlib_readword(uint16_t* output);
+    static inline void netlib_readword(uint16_t* output)
+    {
+        #if SAFETYCHECKS
+            if (netlib_readcursor + sizeof(uint16_t) > netlib_readend)
+            {
+                *output = 0;
+                return;
+            }
+        #endif
+        *output = ((uint16_t)netlib_readcursor[0] << 8) | netlib_readcursor[1];
+        netlib_readcursor += sizeof(uint16_t);
+    }
     
     
     /*==============================
@@ -270,16 +529,33 @@
         @param A pointer to the double word to read into
     ==============================*/
     
-    extern void netlib_readdword(uint32_t* output);
+    static inline void netlib_readdword(uint32_t* output)
+    {
+        #if SAFETYCHECKS
+            if (netlib_readcursor + sizeof(uint32_t) > netlib_readend)
+            {
+                *output = 0;
+                return;
+            }
+        #endif
+        *output = ((uint32_t)netlib_readcursor[0] << 24) | ((uint32_t)netlib_readcursor[1] << 16) | ((uint32_t)netlib_readcursor[2] << 8) | netlib_readcursor[3];
+        netlib_readcursor += sizeof(uint32_t);
+    }
     
     
     /*==============================
-        netlib_readdword
+        netlib_readqword
         Reads a quad word from the received net packet
         @param A pointer to the quad word to read into
     ==============================*/
     
-    extern void netlib_readqword(uint64_t* output);
+    static inline void netlib_readqword(uint64_t* output)
+    {
+        uint32_t hi, lo;
+        netlib_readdword(&hi);
+        netlib_readdword(&lo);
+        *output = ((uint64_t)hi << 32) | lo;
+    }
     
     
     /*==============================
@@ -288,7 +564,12 @@
         @param A pointer to the float to read into
     ==============================*/
     
-    extern void netlib_readfloat(float* output);
+    static inline void netlib_readfloat(float* output)
+    {
+        uint32_t bits;
+        netlib_readdword(&bits);
+        memcpy(output, &bits, sizeof(float));
+    }
     
     
     /*==============================
@@ -297,7 +578,12 @@
         @param A pointer to the double to read into
     ==============================*/
     
-    extern void netlib_readdouble(double* output);
+    static inline void netlib_readdouble(double* output)
+    {
+        uint64_t bits;
+        netlib_readqword(&bits);
+        memcpy(output, &bits, sizeof(double));
+    }
     
     
     /*==============================
@@ -307,7 +593,15 @@
         @param The number of bytes to read into this buffer
     ==============================*/
     
-    extern void netlib_readbytes(byte* output, size_t size);
+    static inline void netlib_readbytes(byte* output, size_t size)
+    {
+        #if SAFETYCHECKS
+            if (netlib_readcursor + size > netlib_readend)
+                size = netlib_readend - netlib_readcursor;
+        #endif
+        memcpy(output, netlib_readcursor, size);
+        netlib_readcursor += size;
+    }
     
     
     /*==============================
@@ -316,6 +610,13 @@
         @param The number of bytes to skip
     ==============================*/
     
-    extern void netlib_skipbytes(size_t count);
+    static inline void netlib_skipbytes(size_t count)
+    {
+        #if SAFETYCHECKS
+            if (netlib_readcursor + count > netlib_readend)
+                count = netlib_readend - netlib_readcursor;
+        #endif
+        netlib_readcursor += count;
+    }
     
 #endif
\ No newline at end of file